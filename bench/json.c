@@ -0,0 +1,461 @@
+/*
+ * JSON throughput benchmark.
+ *
+ * Parses, dumps and frees every corpus given on the command line (plus a few
+ * synthetic ones) over and over for a while and prints one JSON object per
+ * corpus and operation:
+ *
+ *     {"corpus":"twitter.json","op":"parse","bytes":631515,"runs":412,
+ *      "mb_per_s":104.2,"allocs_per_doc":35811,"peak_heap":4263616,
+ *      "max_rss_kb":22036}
+ *
+ * allocs_per_doc and peak_heap (the most heap in use at once, above what was
+ * in use before) come from counting malloc() and friends, which this program
+ * replaces for the library as well. max_rss_kb is the peak resident set size
+ * of the whole process so far, so it only ever grows.
+ *
+ * Usage: json [-t seconds per operation] [file...]
+ */
+
+#define _GNU_SOURCE
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <dlfcn.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define BENCH_NESTED_DEPTH 512
+#define BENCH_NESTED_COUNT 256
+#define BENCH_STRINGS_COUNT 20000
+
+enum bench_op
+{
+    BENCH_PARSE,
+    BENCH_DUMP,
+    BENCH_FREE,
+
+    BENCH_OP_MAX
+};
+
+static const char *bench_op_str[] = { "parse", "dump", "free" };
+
+struct bench_result
+{
+    size_t runs;
+    double seconds;  /* spent in the operation itself */
+
+    size_t allocs;
+    size_t peak_heap;
+};
+
+/* Allocation statistics, kept by the malloc() replacements below */
+static size_t bench_allocs;
+static size_t bench_heap;
+static size_t bench_heap_peak;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* dlsym() may allocate itself before the real calloc() is known */
+static char bench_early[4096];
+static size_t bench_early_used;
+
+static void bench_init_alloc(void);
+static void bench_account(void *ptr);
+
+static double bench_now(void);
+static char *bench_read_file(const char *path, size_t *n);
+static char *bench_nested(size_t *n);
+static char *bench_strings(size_t *n);
+
+static int bench_corpus(const char *name,
+                        const char *input,
+                        size_t n,
+                        double duration,
+                        struct json_writer *out);
+
+static void bench_report(struct json_writer *out,
+                         const char *name,
+                         enum bench_op op,
+                         size_t n,
+                         const struct bench_result *res);
+
+
+int main(int argc, char **argv)
+{
+    struct json_writer out;
+    double duration = 1.0;
+    char *input;
+    size_t n;
+    int err = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+        case 't':
+            duration = strtod(optarg, NULL);
+            break;
+
+        default:
+            fprintf(stderr, "usage: %s [-t seconds] [file...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    json_writer_init_fd(&out, STDOUT_FILENO);
+
+    for (; optind < argc; ++optind) {
+        const char *name = strrchr(argv[optind], '/');
+
+        if ((input = bench_read_file(argv[optind], &n)) == NULL) {
+            perror(argv[optind]);
+            err = 1;
+            continue;
+        }
+
+        err |= bench_corpus(name ? name + 1 : argv[optind],
+                            input,
+                            n,
+                            duration,
+                            &out);
+        free(input);
+    }
+
+    input = bench_nested(&n);
+    err |= bench_corpus("synthetic-nested", input, n, duration, &out);
+    free(input);
+
+    input = bench_strings(&n);
+    err |= bench_corpus("synthetic-strings", input, n, duration, &out);
+    free(input);
+
+    json_writer_flush(&out);
+    json_writer_free(&out);
+
+    return err;
+}
+
+void *malloc(size_t size)
+{
+    void *ptr;
+
+    if (real_malloc == NULL)
+        bench_init_alloc();
+
+    if ((ptr = real_malloc(size)) != NULL)
+        bench_account(ptr);
+
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (real_calloc == NULL) {
+        /* Called from within dlsym(), the arena is zeroed to begin with */
+        size_t len = (nmemb * size + 15) & ~(size_t)15;
+
+        if (bench_early_used + len > sizeof(bench_early))
+            return NULL;
+
+        ptr = bench_early + bench_early_used;
+        bench_early_used += len;
+
+        return ptr;
+    }
+
+    if ((ptr = real_calloc(nmemb, size)) != NULL)
+        bench_account(ptr);
+
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old = (ptr != NULL) ? malloc_usable_size(ptr) : 0;
+    void *res;
+
+    if (real_realloc == NULL)
+        bench_init_alloc();
+
+    if ((res = real_realloc(ptr, size)) != NULL) {
+        bench_heap -= old;
+        bench_account(res);
+    }
+
+    return res;
+}
+
+void free(void *ptr)
+{
+    if ((ptr == NULL)
+            || (((char *)ptr >= bench_early)
+                && ((char *)ptr < bench_early + sizeof(bench_early))))
+        return;
+
+    if (real_free == NULL)
+        bench_init_alloc();
+
+    bench_heap -= malloc_usable_size(ptr);
+    real_free(ptr);
+}
+
+static void bench_init_alloc(void)
+{
+    /* calloc() last, dlsym() uses it and gets the early arena until then */
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+}
+
+static void bench_account(void *ptr)
+{
+    bench_allocs++;
+    bench_heap += malloc_usable_size(ptr);
+
+    if (bench_heap > bench_heap_peak)
+        bench_heap_peak = bench_heap;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *bench_read_file(const char *path, size_t *n)
+{
+    FILE *f;
+    char *buf = NULL;
+    long len;
+
+    if ((f = fopen(path, "rb")) == NULL)
+        return NULL;
+
+    if ((fseek(f, 0, SEEK_END) == 0) && ((len = ftell(f)) >= 0)) {
+        rewind(f);
+
+        buf = malloc(len + 1);
+
+        if (fread(buf, 1, len, f) == (size_t)len) {
+            buf[len] = '\0';
+            *n = len;
+        } else {
+            free(buf);
+            buf = NULL;
+        }
+    }
+
+    fclose(f);
+    return buf;
+}
+
+/* Many deeply nested objects and arrays with hardly any data in them */
+static char *bench_nested(size_t *n)
+{
+    struct json_writer w;
+    char *buf;
+    size_t i;
+    size_t j;
+
+    json_writer_init_buffer(&w);
+    json_writer_begin_array(&w);
+
+    for (i = 0; i < BENCH_NESTED_COUNT; ++i) {
+        for (j = 0; j < BENCH_NESTED_DEPTH; ++j) {
+            if (j % 2) {
+                json_writer_begin_array(&w);
+            } else {
+                json_writer_begin_object(&w);
+                json_writer_key(&w, "a");
+            }
+        }
+
+        json_writer_number(&w, i);
+
+        for (j = BENCH_NESTED_DEPTH; j > 0; --j) {
+            if ((j - 1) % 2)
+                json_writer_end_array(&w);
+            else
+                json_writer_end_object(&w);
+        }
+    }
+
+    json_writer_end_array(&w);
+
+    buf = json_writer_detach(&w, n);
+    json_writer_free(&w);
+
+    return buf;
+}
+
+/* Lots of long strings, with escapes and non-ASCII text mixed in */
+static char *bench_strings(size_t *n)
+{
+    static const char *pieces[] = {
+        "The quick brown fox jumps over the lazy dog. ",
+        "\"quoted\"\tand\\escaped\n",
+        "Gr\xc3\xbc\xc3\x9f" "e aus K\xc3\xb6ln, ",
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e \xf0\x9f\x98\x80 ",
+        "plain ascii text without anything special in it "
+    };
+
+    struct json_writer w;
+    char str[1024];
+    char *buf;
+    size_t i;
+
+    json_writer_init_buffer(&w);
+    json_writer_begin_array(&w);
+
+    for (i = 0; i < BENCH_STRINGS_COUNT; ++i) {
+        size_t len = 0;
+        size_t k;
+
+        for (k = 0; k < 1 + i % 8; ++k) {
+            const char *p = pieces[(i + k) % 5];
+            size_t plen = strlen(p);
+
+            memcpy(str + len, p, plen);
+            len += plen;
+        }
+
+        json_writer_string(&w, str, len);
+    }
+
+    json_writer_end_array(&w);
+
+    buf = json_writer_detach(&w, n);
+    json_writer_free(&w);
+
+    return buf;
+}
+
+static int bench_corpus(const char *name,
+                        const char *input,
+                        size_t n,
+                        double duration,
+                        struct json_writer *out)
+{
+    struct bench_result res[BENCH_OP_MAX];
+    struct json_value *val;
+    size_t outlen;
+    char *outbuf;
+    double start;
+    int op;
+
+    memset(res, 0, sizeof(res));
+
+    /* Once up front, to size the dump buffer and to reject bad input */
+    if ((val = json_parse_n(input, n)) == NULL) {
+        fprintf(stderr, "%s: parse error\n", name);
+        return 1;
+    }
+
+    outlen = json_dump(NULL, 0, val) + 1;
+    outbuf = malloc(outlen);
+
+    json_free(val);
+
+    start = bench_now();
+
+    do {
+        size_t allocs;
+        size_t heap;
+        double t;
+
+        /* parse */
+        allocs = bench_allocs;
+        heap = bench_heap;
+        bench_heap_peak = heap;
+
+        t = bench_now();
+        val = json_parse_n(input, n);
+        res[BENCH_PARSE].seconds += bench_now() - t;
+
+        res[BENCH_PARSE].allocs += bench_allocs - allocs;
+        if (bench_heap_peak - heap > res[BENCH_PARSE].peak_heap)
+            res[BENCH_PARSE].peak_heap = bench_heap_peak - heap;
+
+        /* dump */
+        allocs = bench_allocs;
+        heap = bench_heap;
+        bench_heap_peak = heap;
+
+        t = bench_now();
+        json_dump(outbuf, outlen, val);
+        res[BENCH_DUMP].seconds += bench_now() - t;
+
+        res[BENCH_DUMP].allocs += bench_allocs - allocs;
+        if (bench_heap_peak - heap > res[BENCH_DUMP].peak_heap)
+            res[BENCH_DUMP].peak_heap = bench_heap_peak - heap;
+
+        /* free */
+        allocs = bench_allocs;
+
+        t = bench_now();
+        json_free(val);
+        res[BENCH_FREE].seconds += bench_now() - t;
+
+        res[BENCH_FREE].allocs += bench_allocs - allocs;
+
+        for (op = 0; op < BENCH_OP_MAX; ++op)
+            res[op].runs++;
+    } while ((bench_now() - start) < duration * BENCH_OP_MAX);
+
+    free(outbuf);
+
+    for (op = 0; op < BENCH_OP_MAX; ++op)
+        bench_report(out, name, op, n, &res[op]);
+
+    return 0;
+}
+
+static void bench_report(struct json_writer *out,
+                         const char *name,
+                         enum bench_op op,
+                         size_t n,
+                         const struct bench_result *res)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    json_writer_begin_object(out);
+
+    json_writer_key(out, "corpus");
+    json_writer_string(out, name, strlen(name));
+    json_writer_key(out, "op");
+    json_writer_string(out, bench_op_str[op], strlen(bench_op_str[op]));
+    json_writer_key(out, "bytes");
+    json_writer_number(out, n);
+    json_writer_key(out, "runs");
+    json_writer_number(out, res->runs);
+    json_writer_key(out, "mb_per_s");
+    json_writer_number(out, n * res->runs / res->seconds / 1e6);
+    json_writer_key(out, "allocs_per_doc");
+    json_writer_number(out, (double)res->allocs / res->runs);
+    json_writer_key(out, "peak_heap");
+    json_writer_number(out, res->peak_heap);
+    json_writer_key(out, "max_rss_kb");
+    json_writer_number(out, ru.ru_maxrss);
+
+    json_writer_end_object(out);
+
+    /* One object per line */
+    json_writer_write(out, "\n", 1);
+    json_writer_flush(out);
+}
@@ -0,0 +1,50 @@
+#ifndef JSON_CBOR_H
+#define JSON_CBOR_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdlib.h>
+
+/*
+ * Conversion between JSON values and CBOR (RFC 8949).
+ *
+ * Strings and containers are length prefixed, so decoding never has to scan
+ * for the end of anything, and numbers are kept binary: integral values
+ * become CBOR integers, everything else a single or double precision float
+ * (whichever holds the exact value). Nothing is formatted or parsed as text.
+ *
+ * Decoding accepts everything that has a JSON equivalent: byte strings turn
+ * into strings (as they are), tags are ignored, undefined becomes null and
+ * all numbers end up as doubles. Map keys must be text strings. Text strings
+ * that aren't valid UTF-8 are errors.
+ *
+ * Example usage:
+ *
+ *     size_t n;
+ *     char *buf = json_cbor_encode(val, &n);
+ *
+ *     send(sock, buf, n, 0);
+ *     [...]
+ *     val = json_cbor_decode(buf, n, NULL);
+ */
+
+#define JSON_CBOR_MAX_DEPTH 1024 /* maximum nesting depth when decoding */
+
+/*
+ * Writes val as CBOR to any json_writer sink, returns 0 on success and 1 on
+ * error, see json_writer_write().
+ */
+int json_cbor_write(struct json_writer *w, const struct json_value *val);
+
+/* Returns the encoded value (to be freed by the caller), its length in n */
+char *json_cbor_encode(const struct json_value *val, size_t *n);
+
+/*
+ * Decodes the CBOR data item at buf, reading at most n bytes. Stores the
+ * number of bytes it took up in used unless that's NULL, so concatenated
+ * items can be decoded one after the other. Returns NULL on malformed input.
+ */
+struct json_value *json_cbor_decode(const char *buf, size_t n, size_t *used);
+
+#endif /* defined JSON_CBOR_H */
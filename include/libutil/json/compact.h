@@ -0,0 +1,97 @@
+#ifndef JSON_COMPACT_H
+#define JSON_COMPACT_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A compact, read-only form of a document, for large documents that are
+ * mostly looked at. Every value is a single 64 bit word ("box") stored right
+ * in its container, so scalars take no allocations of their own and arrays
+ * are plain vectors of boxes:
+ *
+ *     struct json_compact doc;
+ *     json_box usd;
+ *     double rate;
+ *
+ *     if (json_compact_parse(&doc, input, n))
+ *         return 1;
+ *
+ *     if (!json_compact_lookup(doc.root, "USD", &usd)
+ *             && !json_compact_get_number(usd, &rate))
+ *         printf("%f\n", rate);
+ *
+ *     json_compact_free(&doc);
+ *
+ * Numbers are stored as doubles, which leaves the 2^51 NaN bit patterns no
+ * number parsed from JSON ever has for everything else: null, booleans,
+ * integers that fit 32 bits and pointers to strings, arrays and objects
+ * (tagged in bits 48 to 50 of a NaN with the sign bit set). Object keys are
+ * stored once per document, however many objects have them.
+ *
+ * Boxes are only valid for as long as the document they came from.
+ */
+
+typedef uint64_t json_box;
+
+struct json_compact
+{
+    json_box root;
+
+    /* Keys of all objects (struct json_compact_string), by their text */
+    struct hashtable *keys;
+};
+
+/*
+ * Parses the n bytes at input into doc, which is left empty on error. Returns
+ * 0 on success and 1 on parse error or if out of memory.
+ */
+int json_compact_parse(struct json_compact *doc, const char *input, size_t n);
+
+/* Same from a regular tree, NaNs and infinities turn into null */
+int json_compact_from_value(struct json_compact *doc,
+                            const struct json_value *val);
+
+void json_compact_free(struct json_compact *doc);
+
+/* Copies box into a regular tree */
+struct json_value *json_compact_value(json_box box);
+
+/* Writes box like json_writer_value() does, returns 0 on success */
+int json_compact_write(struct json_writer *w, json_box box);
+
+/*
+ * Accessors mirroring json_get_*(). Strings are zero terminated, their length
+ * (U+0000 and all) is also stored in n unless that's NULL, and NULL is
+ * returned on type error.
+ * Numbers and booleans are stored in out, returning 0 on success and 1 on
+ * type error.
+ */
+enum json_value_type json_compact_type(json_box box);
+bool json_compact_is_null(json_box box);
+
+const char *json_compact_get_string(json_box box, size_t *n);
+int json_compact_get_number(json_box box, double *out);
+int json_compact_get_bool(json_box box, bool *out);
+
+/* Number of elements or members of an array or object, 0 for anything else */
+size_t json_compact_length(json_box box);
+
+/*
+ * Store element i of an array, the value of key in an object (found by a
+ * linear search) or key and value of member i of an object, in input order
+ * (key and n may be NULL). Return 0 on success and 1 if there is no such
+ * element.
+ */
+int json_compact_index(json_box arr, size_t i, json_box *out);
+int json_compact_lookup(json_box obj, const char *key, json_box *out);
+int json_compact_member(json_box obj,
+                        size_t i,
+                        const char **key,
+                        size_t *n,
+                        json_box *val);
+
+#endif /* defined JSON_COMPACT_H */
@@ -0,0 +1,130 @@
+#ifndef JSON_CURSOR_H
+#define JSON_CURSOR_H
+
+#include <libutil/json.h>
+
+#include <stdlib.h>
+
+/*
+ * On-demand access to a JSON document without parsing it into a tree first.
+ *
+ * A cursor simply points at a value somewhere inside the document text. Moving
+ * a cursor to an object member or array element only lexes as much as needed
+ * to get there, and subtrees that are passed over are skipped without being
+ * tokenized. Nothing is converted or allocated until a scalar is actually read,
+ * so sparse reads out of large documents cost a fraction of a json_parse().
+ *
+ * The document text is not copied and has to outlive all cursors into it.
+ * Cursors don't validate more than they need to see, so malformed input
+ * in a part of the document that is never visited goes unnoticed.
+ *
+ * Example usage:
+ *
+ *     struct json_cursor doc, usd, last;
+ *     double n;
+ *
+ *     if (!json_cursor_init(&doc, input, len)
+ *             && !json_cursor_lookup(&doc, "USD", &usd)
+ *             && !json_cursor_lookup(&usd, "15m", &last)
+ *             && !json_cursor_get_number(&last, &n))
+ *         printf("%.2f\n", n);
+ */
+
+struct json_cursor
+{
+    const char *input; /* the whole document */
+    size_t len;
+    size_t pos;        /* where the value starts within input */
+};
+
+struct json_cursor_iterator
+{
+    struct json_lexer_state lex;
+
+    enum json_value_type type; /* JSON_ARRAY or JSON_OBJECT */
+    bool first;
+    bool error;                /* set if iteration stopped on bad input */
+    bool done;                 /* set once the end has been reached */
+
+    /* Where the value last returned starts, if it's yet to be skipped */
+    size_t pending;
+    bool has_pending;
+};
+
+/*
+ * Points cur at the top level value of the n bytes at input. Returns 0 on
+ * success and 1 if there's no value to be found.
+ */
+int json_cursor_init(struct json_cursor *cur, const char *input, size_t n);
+
+/* The type of the value at cur, as far as can be told by its first byte */
+enum json_value_type json_cursor_type(const struct json_cursor *cur);
+
+/*
+ * Point out at the value of member key of the object at obj, or at the nth
+ * element of the array at arr. Returns 0 on success and 1 if there is no
+ * such member or element, or if the container is malformed. Unlike
+ * json_parse(), which keeps the last one, lookups find the first of
+ * duplicate keys.
+ */
+int json_cursor_lookup(const struct json_cursor *obj,
+                       const char *key,
+                       struct json_cursor *out);
+
+int json_cursor_index(const struct json_cursor *arr,
+                      size_t n,
+                      struct json_cursor *out);
+
+/*
+ * Iterates the elements of an array or the members of an object. key is only
+ * set for objects (where it points at the key string) and may be NULL.
+ *
+ * A value is only skipped over once the next one is asked for, so stopping
+ * at a value costs nothing beyond getting there, and a malformed value only
+ * ends the iteration after it has been returned.
+ */
+bool json_cursor_iterator_init(struct json_cursor_iterator *iter,
+                               const struct json_cursor *cur);
+
+bool json_cursor_iterator_next(struct json_cursor_iterator *iter,
+                               struct json_cursor *key,
+                               struct json_cursor *val);
+
+/*
+ * Tells iter that the value last returned has already been gone through up
+ * to end (the offset just past it), so it isn't skipped over once more.
+ */
+void json_cursor_iterator_consumed(struct json_cursor_iterator *iter,
+                                   size_t end);
+
+/*
+ * Skips over whatever is left of the container and returns the offset just
+ * past its end, or 0 if it's malformed
+ */
+size_t json_cursor_iterator_end(struct json_cursor_iterator *iter);
+
+/*
+ * Accessors for scalars. Like their json_get_* counterparts, they fail on a
+ * type mismatch, json_cursor_get_number() and json_cursor_get_bool() by
+ * returning 1 (0 on success), json_cursor_get_string() by returning NULL.
+ * The string is decoded into a newly allocated buffer the caller has to
+ * free.
+ */
+char *json_cursor_get_string(const struct json_cursor *cur);
+int json_cursor_get_number(const struct json_cursor *cur, double *out);
+int json_cursor_get_bool(const struct json_cursor *cur, bool *out);
+bool json_cursor_is_null(const struct json_cursor *cur);
+
+/* Compares the string at cur to str without decoding it to the heap */
+bool json_cursor_string_equal(const struct json_cursor *cur, const char *str);
+
+/*
+ * Stores the raw text of the value at cur (e.g. for passing it on as is)
+ * in raw and returns its length, or 0 if the value is malformed.
+ */
+size_t json_cursor_raw(const struct json_cursor *cur, const char **raw);
+
+/* Parses the value at cur into a regular tree, NULL on parse error */
+struct json_value *json_cursor_value(const struct json_cursor *cur);
+
+#endif /* defined JSON_CURSOR_H */
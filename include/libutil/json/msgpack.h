@@ -0,0 +1,51 @@
+#ifndef JSON_MSGPACK_H
+#define JSON_MSGPACK_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdlib.h>
+
+/*
+ * Conversion between JSON values and MessagePack.
+ *
+ * Like CBOR (see json/cbor.h), strings and containers are length prefixed and
+ * numbers are kept binary: integral values become the smallest fitting
+ * integer type, everything else a float 32 or float 64.
+ *
+ * Decoding accepts everything that has a JSON equivalent: bin turns into
+ * strings (as it is) and all numbers end up as doubles. Map keys must be
+ * strings, ext types are rejected, and so are str that aren't valid UTF-8.
+ *
+ * Example usage:
+ *
+ *     size_t n;
+ *     char *buf = json_msgpack_encode(val, &n);
+ *
+ *     send(sock, buf, n, 0);
+ *     [...]
+ *     val = json_msgpack_decode(buf, n, NULL);
+ */
+
+#define JSON_MSGPACK_MAX_DEPTH 1024 /* maximum nesting depth when decoding */
+
+/*
+ * Writes val as MessagePack to any json_writer sink, returns 0 on success and
+ * 1 on error, see json_writer_write().
+ */
+int json_msgpack_write(struct json_writer *w, const struct json_value *val);
+
+/* Returns the encoded value (to be freed by the caller), its length in n */
+char *json_msgpack_encode(const struct json_value *val, size_t *n);
+
+/*
+ * Decodes the MessagePack object at buf, reading at most n bytes. Stores the
+ * number of bytes it took up in used unless that's NULL, so concatenated
+ * objects can be decoded one after the other. Returns NULL on malformed
+ * input.
+ */
+struct json_value *json_msgpack_decode(const char *buf,
+                                       size_t n,
+                                       size_t *used);
+
+#endif /* defined JSON_MSGPACK_H */
@@ -0,0 +1,94 @@
+#ifndef JSON_PARALLEL_H
+#define JSON_PARALLEL_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdlib.h>
+
+/*
+ * Minimal fork/join helper for the multithreaded parts of the JSON code. This
+ * isn't much of a thread pool: threads are started for every call and joined
+ * before it returns, which is cheap next to the amount of work that's worth
+ * spreading across cores in the first place.
+ *
+ * Example usage:
+ *
+ *     static void parse_one(size_t i, void *ud)
+ *     {
+ *         struct job *jobs = ud;
+ *
+ *         jobs[i].val = json_parse_n(jobs[i].input, jobs[i].n);
+ *     }
+ *
+ *     json_parallel_for(njobs, 0, parse_one, jobs);
+ */
+
+typedef void (*json_parallel_func)(size_t i, void *ud);
+
+/* Returns the number of online processors, but at least 1 */
+unsigned json_parallel_ncpu(void);
+
+/*
+ * Calls fn(i, ud) for every i in [0, n), using up to nthreads threads (the
+ * calling thread being one of them). 0 threads means json_parallel_ncpu().
+ * Items are handed out one at a time in ascending order, so they should be
+ * reasonably coarse. If threads can't be started, the ones that could do the
+ * remaining work.
+ */
+void json_parallel_for(size_t n,
+                       unsigned nthreads,
+                       json_parallel_func fn,
+                       void *ud);
+
+/* Slices of the input smaller than this are grouped into one unit of work */
+#define JSON_PARALLEL_BLOCKSIZ 65536
+
+/*
+ * Parses a single large document on multiple threads. The containers in the
+ * top depth levels are scanned sequentially, skipping over the values below
+ * them without parsing them, which are then parsed in parallel and put into
+ * place. A depth of 1 splits up the elements (or members) of the top-level
+ * array (or object), a depth of 2 those of the containers in there, e.g.
+ *
+ *     {"rows": [{...}, {...}, ...]}
+ *
+ * and so on. Returns the same as json_parse_n() would.
+ */
+struct json_value *json_parallel_parse(const char *input,
+                                       size_t n,
+                                       size_t depth,
+                                       unsigned nthreads);
+
+/* Blocks of output to be written per thread, see json_parallel_write() */
+#define JSON_PARALLEL_WRITE_BLOCKS 8
+
+/*
+ * Writes val to w like json_writer_value() does, on multiple threads. This is
+ * json_parallel_parse() the other way around: the containers in the top
+ * depth levels are written sequentially (their brackets, keys and commas,
+ * that is), the values below them in parallel, each thread into buffers of
+ * its own that are then written to w in order. Those are split up into
+ * JSON_PARALLEL_WRITE_BLOCKS per thread, so a few values that take much
+ * longer than the rest don't hold up everything.
+ *
+ * All of the output is held in memory until it's written. val must not be
+ * modified by anyone meanwhile. Returns 0 on success and 1 on error.
+ */
+int json_parallel_write(struct json_writer *w,
+                        const struct json_value *val,
+                        size_t depth,
+                        unsigned nthreads);
+
+/*
+ * Same straight to fd, with writev() instead of copying the buffers once
+ * more, with the given JSON_WRITER_* flags and numbers in their shortest
+ * form
+ */
+int json_parallel_write_fd(int fd,
+                           const struct json_value *val,
+                           size_t depth,
+                           unsigned nthreads,
+                           unsigned flags);
+
+#endif /* defined JSON_PARALLEL_H */
@@ -0,0 +1,164 @@
+#ifndef JSON_SCHEMA_H
+#define JSON_SCHEMA_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+
+/*
+ * Decoding JSON straight into C structs (and encoding them again) without
+ * building a tree in between. The layout of a struct is declared once as a
+ * table of fields, each naming a member, its offset and its type:
+ *
+ *     struct point { double x, y; };
+ *     struct shape
+ *     {
+ *         char *name;
+ *         bool closed;
+ *         struct json_schema_array points;
+ *     };
+ *
+ *     static struct json_field point_fields[] = {
+ *         JSON_FIELD(struct point, x, JSON_FIELD_DOUBLE),
+ *         JSON_FIELD(struct point, y, JSON_FIELD_DOUBLE),
+ *         JSON_FIELD_END
+ *     };
+ *
+ *     static struct json_schema point_schema =
+ *         JSON_SCHEMA(struct point, point_fields);
+ *
+ *     static struct json_field shape_fields[] = {
+ *         JSON_FIELD(struct shape, name, JSON_FIELD_STRING),
+ *         JSON_FIELD(struct shape, closed, JSON_FIELD_BOOL),
+ *         JSON_FIELD_ARRAY(struct shape, points, JSON_FIELD_OBJECT,
+ *                          &point_schema),
+ *         JSON_FIELD_END
+ *     };
+ *
+ *     static struct json_schema shape_schema =
+ *         JSON_SCHEMA(struct shape, shape_fields);
+ *
+ *     struct shape s = { 0 };
+ *
+ *     json_schema_init(&shape_schema);
+ *
+ *     if (!json_schema_decode(&shape_schema, input, len, &s)) {
+ *         [...]
+ *         json_schema_free(&shape_schema, &s);
+ *     }
+ *
+ * Members not mentioned in the input keep their values, so the struct should
+ * be initialized beforehand. Strings and arrays are allocated and owned by
+ * the struct, they must be NULL or allocated the same way before decoding
+ * (and are replaced by duplicate keys). Unknown keys are skipped without
+ * being parsed, null leaves a member untouched (strings become NULL).
+ */
+
+enum json_field_type
+{
+    JSON_FIELD_STRING,  /* char *, zero terminated   */
+    JSON_FIELD_DOUBLE,
+    JSON_FIELD_FLOAT,
+    JSON_FIELD_INT,
+    JSON_FIELD_LONG,
+    JSON_FIELD_BOOL,
+    JSON_FIELD_OBJECT,  /* nested struct, see schema */
+    JSON_FIELD_ARRAY    /* struct json_schema_array  */
+};
+
+/* Storage of JSON_FIELD_ARRAY members */
+struct json_schema_array
+{
+    void *items;
+    size_t count;
+};
+
+struct json_schema;
+
+struct json_field
+{
+    const char *name;
+    size_t offset;
+    enum json_field_type type;
+
+    /* The element type of arrays, which can't be arrays themselves */
+    enum json_field_type elem;
+
+    /* The struct of objects, or of the elements of arrays of objects */
+    const struct json_schema *schema;
+
+    /* Filled in by json_schema_init() */
+    size_t hash;
+    size_t len;
+};
+
+struct json_schema
+{
+    size_t size;
+    struct json_field *fields;
+    size_t nfields;
+
+    bool ready;
+};
+
+#define JSON_FIELD_NAMED(T, member, key, t) \
+    { .name = (key), .offset = offsetof(T, member), .type = (t) }
+
+#define JSON_FIELD(T, member, t) JSON_FIELD_NAMED(T, member, #member, t)
+
+#define JSON_FIELD_OBJECT(T, member, s)                                  \
+    { .name = #member, .offset = offsetof(T, member),                    \
+      .type = JSON_FIELD_OBJECT, .schema = (s) }
+
+#define JSON_FIELD_ARRAY(T, member, e, s)                                \
+    { .name = #member, .offset = offsetof(T, member),                    \
+      .type = JSON_FIELD_ARRAY, .elem = (e), .schema = (s) }
+
+#define JSON_FIELD_END { .name = NULL }
+
+#define JSON_SCHEMA(T, f) { .size = sizeof(T), .fields = (f) }
+
+/*
+ * Precomputes the key hashes of schema and of all schemas nested in it.
+ * Must be called once before schema is used (and not concurrently with
+ * using it). Returns 0 on success and 1 if schema is malformed.
+ */
+int json_schema_init(struct json_schema *schema);
+
+/*
+ * Decode the object in the n bytes at input (or the next value from lex)
+ * into the struct at out. Returns 0 on success and 1 on a syntax error, if
+ * the input doesn't match the schema or if anything but whitespace follows
+ * the object in input (json_schema_decode_lexer() leaves the rest of lex
+ * alone), in which case all strings and arrays in out are freed and set to
+ * NULL. Numbers for int and long fields must be whole and within range,
+ * and nesting no deeper than lex->max_depth (JSON_PARSE_MAX_DEPTH).
+ */
+int json_schema_decode(const struct json_schema *schema,
+                       const char *input,
+                       size_t n,
+                       void *out);
+
+int json_schema_decode_lexer(const struct json_schema *schema,
+                             struct json_lexer_state *lex,
+                             void *out);
+
+/* Frees the strings and arrays in the struct at obj, and sets them to NULL */
+void json_schema_free(const struct json_schema *schema, void *obj);
+
+/*
+ * Encode the struct at obj as an object with all of its fields, NULL
+ * strings becoming null. Returns 0 on success and 1 on error, or the
+ * encoding in a new buffer of length n (NULL on error).
+ */
+int json_schema_write(struct json_writer *w,
+                      const struct json_schema *schema,
+                      const void *obj);
+
+char *json_schema_encode(const struct json_schema *schema,
+                         const void *obj,
+                         size_t *n);
+
+#endif /* defined JSON_SCHEMA_H */
@@ -0,0 +1,116 @@
+#ifndef JSON_TAPE_H
+#define JSON_TAPE_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A position independent binary snapshot ("tape") of a parsed document, meant
+ * to be written once and then mapped into memory and used as is, by any
+ * number of processes sharing the same pages:
+ *
+ *     json_tape_save("reference.tape", doc);
+ *     [...]
+ *
+ *     struct json_tape tape;
+ *     struct json_tape_node root;
+ *     struct json_tape_node usd;
+ *
+ *     json_tape_open(&tape, "reference.tape");
+ *     root = json_tape_root(&tape);
+ *
+ *     if (!json_tape_lookup(&root, "USD", &usd))
+ *         printf("%f\n", *json_tape_get_number(&usd));
+ *
+ *     json_tape_close(&tape);
+ *
+ * Every value is a record of 8 byte words, referring to others by offset from
+ * the start of the tape: strings carry their length and are zero terminated,
+ * arrays hold the offsets of their elements for constant time indexing and
+ * objects hold (key, value) offset pairs sorted by key for binary search.
+ * Identical keys are stored only once. The tape is in native byte order and
+ * can only be read on machines using the same.
+ */
+
+#define JSON_TAPE_VERSION 1
+
+struct json_tape
+{
+    const char *base;
+    size_t len;
+
+    size_t root;  /* offset of the root record */
+    bool mapped;  /* whether base is a mapping of our own */
+};
+
+/* Refers to a value on a tape, valid for as long as the tape is open */
+struct json_tape_node
+{
+    const struct json_tape *tape;
+    size_t pos;
+};
+
+/*
+ * Writes val as a tape to any json_writer sink, which must not have been
+ * written to before. Returns 0 on success and 1 on error.
+ */
+int json_tape_write(struct json_writer *w, const struct json_value *val);
+
+/* Same into a new buffer (to be freed by the caller) of length n */
+char *json_tape_encode(const struct json_value *val, size_t *n);
+
+/* Same into the file at path */
+int json_tape_save(const char *path, const struct json_value *val);
+
+/*
+ * Open the tape in the file at path by mapping it, or use the n bytes at buf
+ * (which must be 8 byte aligned and stay around). Return 0 on success and 1
+ * if the file can't be mapped or isn't a valid tape.
+ */
+int json_tape_open(struct json_tape *tape, const char *path);
+int json_tape_init(struct json_tape *tape, const char *buf, size_t n);
+void json_tape_close(struct json_tape *tape);
+
+struct json_tape_node json_tape_root(const struct json_tape *tape);
+
+/*
+ * Accessors mirroring json_get_*(), returning NULL on type errors. Strings
+ * are zero terminated, their length is also stored in n unless that's NULL.
+ */
+enum json_value_type json_tape_type(const struct json_tape_node *node);
+bool json_tape_is_null(const struct json_tape_node *node);
+
+const char   *json_tape_get_string(const struct json_tape_node *node,
+                                   size_t *n);
+const double *json_tape_get_number(const struct json_tape_node *node);
+const bool   *json_tape_get_bool  (const struct json_tape_node *node);
+
+/* Number of elements or members of an array or object, 0 for anything else */
+size_t json_tape_length(const struct json_tape_node *node);
+
+/*
+ * Point out at element i of an array, the value of key in an object (in
+ * logarithmic time) or at member i of an object (key and value, in order of
+ * their keys; either may be NULL). Return 0 on success and 1 if there is no
+ * such element, or it isn't before its parent on the tape as it should be.
+ */
+int json_tape_index(const struct json_tape_node *arr,
+                    size_t i,
+                    struct json_tape_node *out);
+
+int json_tape_lookup(const struct json_tape_node *obj,
+                     const char *key,
+                     struct json_tape_node *out);
+
+int json_tape_member(const struct json_tape_node *obj,
+                     size_t i,
+                     struct json_tape_node *key,
+                     struct json_tape_node *val);
+
+/* Copies the value at node into a regular tree, NULL if the tape is broken */
+struct json_value *json_tape_value(const struct json_tape_node *node);
+
+#endif /* defined JSON_TAPE_H */
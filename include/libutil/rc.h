@@ -27,6 +27,10 @@
  * unlike C++ classes like std::vector and std::list do)
  *
  * Reference cycles may also be problematic. Try to avoid them.
+ *
+ * With C11 atomics, reference counts are atomic, so references to the same
+ * object may be taken and dropped on different threads. Anything else about
+ * the object is up to its users.
  */
 
 /*
@@ -42,6 +46,13 @@
 
 #endif
 
+#if __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+    #include <stdatomic.h>
+    #define RC_ATOMIC _Atomic
+#else
+    #define RC_ATOMIC
+#endif
+
 #define RC_GETOBJ(ptr) ((struct rc_object *) \
     ((unsigned char*)(ptr) - offsetof(struct rc_object, data) ))
 
@@ -50,8 +61,6 @@
         struct rc_object *_hdr = RC_GETOBJ(ref);    \
                                                     \
         if (!--(_hdr->refcount)) {                  \
-            void *_tmp = (ref);                     \
-                                                    \
             (ref) = NULL;                           \
                                                     \
             if (_hdr->destructor != NULL) {         \
@@ -88,7 +97,8 @@ struct rc_object
     rc_destructor_fun destructor;
     void *udata;
 
-    unsigned refcount;
+    /* As wide as the pointers above, so data is aligned for doubles too */
+    RC_ATOMIC size_t refcount;
     unsigned char data[RC_FLEXIBLE];
 };
 
@@ -189,6 +189,8 @@ static void _hashtable_clear_internal(struct hashtable *table,
         list_free_all(table->buckets[i], deleter, table);
         table->buckets[i] = NULL;
     }
+
+    table->entries = 0;
 }
 
 void hashtable_clear(struct hashtable *table)
@@ -211,14 +213,22 @@ static int _hashtable_find(const void *listdata, const void *key, void *ud)
 
 void *hashtable_lookup(const struct hashtable *table, const void *key)
 {
-    size_t hash;
+    assert(table != NULL);
+    assert(key != NULL);
+
+    return hashtable_lookup_hashed(table, key, table->key_hash(key));
+}
+
+void *hashtable_lookup_hashed(const struct hashtable *table,
+                              const void *key,
+                              size_t hash)
+{
     size_t idx;
     struct list *n;
 
     assert(table != NULL);
     assert(key != NULL);
 
-    hash = table->key_hash(key);
     idx = hash % table->bucket_count;
 
     if (table->buckets[idx] == NULL)
@@ -283,6 +293,7 @@ void hashtable_rehash(struct hashtable *table)
     /* Move over the new buckets and size */
     table->buckets      = tmp->buckets;
     table->bucket_count = tmp->bucket_count;
+    table->entries      = tmp->entries;
 
     /* Free the old container. */
     free(tmp);
@@ -81,6 +81,15 @@ void hashtable_clear(struct hashtable *table);
 void hashtable_clear_shallow(struct hashtable *table);
 
 void *hashtable_lookup(const struct hashtable *table, const void *key);
+
+/*
+ * Like hashtable_lookup(), but uses a hash calculated beforehand. hash must be
+ * what the table's hash function returns for key, for example when looking up
+ * the same key in many tables.
+ */
+void *hashtable_lookup_hashed(const struct hashtable *table,
+                              const void *key,
+                              size_t hash);
 bool hashtable_contains(const struct hashtable *table, const void *key);
 size_t hashtable_size(const struct hashtable *table);
 
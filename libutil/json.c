@@ -1,10 +1,163 @@
 #include "json.h"
+#include "rc.h"
 #include "utf8.h"
 
+#include "json/cache.h"
+#include "json/stream.h"
+#include "json/writer.h"
+
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+    #define JSON_LEXER_SSE2
+    #include <emmintrin.h>
+#endif
+
+/* Numbers shorter than this are converted without touching the heap */
+#define JSON_NUMBER_BUFSIZ 64
+
+/*
+ * Shapes form a tree rooted in the empty shape, every shape having one more
+ * key than its parent. They are counted references, held by the objects
+ * using them (or being parsed into them) and by their children.
+ */
+struct json_shape
+{
+    struct json_shape *parent;
+    RC_ATOMIC size_t refs; /* atomic like those of clones, see rc.h */
+
+    size_t count;
+    char **keys; /* the first count - 1 belong to the parents */
+    size_t *lens;
+
+    struct json_shape **next;
+    size_t nnext;
+};
+
+/* Guards the next of shapes whose children are released, see below */
+static pthread_mutex_t _json_shape_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Nesting levels json_parse_value() handles without allocating its stack */
+#define JSON_PARSE_STACK 16
+
+enum json_frame_type
+{
+    JSON_FRAME_ARRAY,
+    JSON_FRAME_OBJECT,  /* keys owned by the hashtable */
+    JSON_FRAME_VIEW,    /* JSON_VALUE_VIEW keys */
+    JSON_FRAME_INSITU,  /* JSON_VALUE_BORROWED keys */
+    JSON_FRAME_SHAPED,  /* values collected for a JSON_VALUE_SHAPED object */
+    JSON_FRAME_PACKED   /* array of numbers only so far, JSON_VALUE_PACKED */
+};
+
+/* A container json_parse_value() is in */
+struct json_parse_frame
+{
+    enum json_frame_type type;
+
+    struct json_value *container; /* all but shaped objects */
+    struct list *tail;            /* last element of arrays */
+
+    /* The key of the member being parsed, decoded into tmp if need be */
+    char *key;
+    size_t keylen;
+    char *tmp;
+
+    struct json_shape *shape;
+    struct json_shaped *shaped;
+    size_t cap;
+};
+
+/* Decodes a view key a byte at a time, see _json_view_key_getc() */
+struct json_view_key_reader
+{
+    const char *key;
+    size_t len;
+    size_t i;
+
+    char buf[4]; /* the decoded escape sequence last read */
+    size_t j;
+    size_t n;
+};
+
+static int _json_is_number_char(char c);
+static bool _json_is_number(const char *str, size_t n);
+static int _json_lexer_scan_string(struct json_lexer_state *lex);
+
+static int _json_hex4(const char *in, unsigned *out);
+
+static size_t _json_validate_ws(const char *s, size_t n, size_t i);
+static const char *_json_validate_string(const char *s, size_t n, size_t *i);
+static const char *_json_validate_key(const char *s, size_t n, size_t *i);
+static size_t _json_validate_number(const char *s, size_t n, size_t i);
+static size_t _json_validate_digits(const char *s, size_t n, size_t i);
+
+static size_t _json_minify_scan(const char *s, size_t n, size_t i);
+static size_t _json_minify_string(const char *s, size_t n, size_t i);
+static size_t _json_minify_space(const char *s, size_t n, size_t i);
+static bool _json_is_space(char c);
+static void _json_reformat_newline(struct json_writer *w, size_t indent);
+
+static size_t _json_unescape(const char *in, size_t n, char *out);
+static size_t _json_unescape_one(const char *in, size_t n, char *out,
+                                 size_t *used);
+static char *_json_parse_string_insitu(struct json_lexer_state *lex,
+                                       struct json_token *tok);
+
+static size_t _json_view_key_len(const char *key, bool *escaped);
+static void _json_view_key_reader_init(struct json_view_key_reader *r,
+                                       const char *key);
+static int _json_view_key_getc(struct json_view_key_reader *r);
+static size_t _json_view_key_hash(const void *key);
+static int _json_view_key_equal(const void *a, const void *b);
+static int _json_view_key_equal_plain(const char *view, const char *key);
+static struct json_value *_json_view_lookup(const struct hashtable *table,
+                                            const char *key);
+
+static int _json_share(struct json_value *val);
+static int _json_unshare(struct json_value *val);
+static void _json_shared_free(void *data, void *udata);
+
+static struct json_shape *_json_shape_new(struct json_shape *parent,
+                                          const char *key,
+                                          size_t n);
+static struct json_shape *_json_shape_transition(struct json_shape *shape,
+                                                 const char *key,
+                                                 size_t n);
+static size_t _json_shape_find(const struct json_shape *shape,
+                               const char *key,
+                               size_t n);
+static void _json_shape_release(struct json_shape *shape);
+
+static struct json_value *_json_shaped_unshape(struct json_shaped *shaped);
+
+static int _json_packed_push(struct json_value *arr, double d);
+static struct list *_json_packed_list(const struct json_packed *packed,
+                                      struct list **tail);
+
+static struct json_value *_json_parse_scalar(struct json_lexer_state *lex,
+                                             struct json_token *tok);
+
+static void _json_frame_open(struct json_lexer_state *lex,
+                             struct json_parse_frame *frame,
+                             bool object);
+static int _json_frame_next(struct json_lexer_state *lex,
+                            struct json_parse_frame *frame);
+static void _json_frame_attach(struct json_parse_frame *frame,
+                               struct json_value *val);
+static void _json_frame_attach_shaped(struct json_parse_frame *frame,
+                                      struct json_value *val);
+static struct json_value *_json_frame_close(struct json_parse_frame *frame);
+static void _json_frame_free(struct json_parse_frame *frame);
 
 const char *json_token_str[] = {
     "{", "}", ":", "[", "]", ",", "string", "number", "true", "false", "null"
@@ -67,6 +220,35 @@ struct json_value *json_object_new()
     return v;
 }
 
+struct json_value *json_clone(struct json_value *val)
+{
+    struct json_value *copy;
+
+    if (_json_share(val) || ((copy = malloc(sizeof(*copy))) == NULL))
+        return NULL;
+
+    *copy = *val;
+    copy->flags &= ~JSON_VALUE_CACHED;
+
+    if (copy->flags & JSON_VALUE_SHARED) {
+        RC_INCREF(copy->value.jshared);
+    } else if ((copy->flags & JSON_VALUE_RAW)
+            && !(copy->flags & (JSON_VALUE_VIEW | JSON_VALUE_BORROWED))) {
+        /* Number text isn't worth sharing */
+        if ((copy->value.jraw = strdup(val->value.jraw)) == NULL) {
+            free(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+int json_unshare(struct json_value *val)
+{
+    return (val->flags & JSON_VALUE_SHARED) ? _json_unshare(val) : 0;
+}
+
 bool json_is_null(struct json_value *val)
 {
     return val->type == JSON_NULL;
@@ -79,21 +261,144 @@ enum json_value_type json_get_value_type(struct json_value *val)
 
 const char *json_get_string(struct json_value *val)
 {
-    return (val->type == JSON_STRING) ? val->value.jstring : NULL;
+    if (val->type != JSON_STRING)
+        return NULL;
+
+    if (val->flags & JSON_VALUE_SHARED)
+        return json_get_string(val->value.jshared);
+
+    if (val->flags & JSON_VALUE_VIEW) {
+        /* Views aren't terminated, so it's time for a copy after all */
+        size_t n;
+        const char *str = json_get_string_n(val, &n);
+
+        val->value.jstring = strndup(str, n);
+        val->flags &= ~JSON_VALUE_VIEW;
+    }
+
+    return val->value.jstring;
+}
+
+const char *json_get_string_n(const struct json_value *val, size_t *n)
+{
+    if (val->type != JSON_STRING)
+        return NULL;
+
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    /* Views never contain escapes, so the first quote ends them */
+    *n = (val->flags & JSON_VALUE_VIEW)
+        ? (size_t)(strchr(val->value.jstring, '"') - val->value.jstring)
+        : strlen(val->value.jstring);
+
+    return val->value.jstring;
 }
 
 void json_set_string(struct json_value *val, const char *newstring)
 {
     /* whatever the old value was, free it and turn this value into a string */
+    json_cache_modified(val);
     json_free_contents(val);
 
     val->type = JSON_STRING;
+    val->flags = 0;
     val->value.jstring = strdup(newstring);
 }
 
 double *json_get_number(struct json_value *val)
 {
-    return (val->type == JSON_NUMBER) ? &val->value.jnumber : NULL;
+    if (val->type != JSON_NUMBER)
+        return NULL;
+
+    if (val->flags & JSON_VALUE_RAW) {
+        /* The caller may modify it, so it's time to convert after all */
+        double d = json_get_number_value(val);
+
+        if (!(val->flags & (JSON_VALUE_VIEW | JSON_VALUE_BORROWED)))
+            free(val->value.jraw);
+
+        val->flags &= ~(JSON_VALUE_RAW | JSON_VALUE_VIEW | JSON_VALUE_BORROWED);
+        val->value.jnumber = d;
+    }
+
+    return &val->value.jnumber;
+}
+
+double json_get_number_value(const struct json_value *val)
+{
+    const char *text;
+    double d;
+    size_t n;
+
+    if (val->type != JSON_NUMBER)
+        return 0;
+
+    if ((text = json_get_number_text(val, &n)) == NULL)
+        return val->value.jnumber;
+
+    /* Checked by the parser already */
+    json_parse_number(text, n, &d);
+    return d;
+}
+
+int json_get_int64(const struct json_value *val, int64_t *out)
+{
+    const char *text;
+    uint64_t u = 0;
+    size_t n;
+    size_t i;
+    bool neg;
+
+    if (val->type != JSON_NUMBER)
+        return 1;
+
+    /* Views aren't terminated, so only look at the number itself */
+    if ((text = json_get_number_text(val, &n)) != NULL)
+        for (i = 0; (i < n) && !strchr(".eE", text[i]); ++i);
+
+    if ((text == NULL) || (i < n)) {
+        double d = json_get_number_value(val);
+
+        /* 2^63, the first double that doesn't fit */
+        if (!(d >= -9223372036854775808.0) || !(d < 9223372036854775808.0)
+                || (d != (double)(int64_t)d))
+            return 1;
+
+        *out = (int64_t)d;
+        return 0;
+    }
+
+    /* Digits only, but maybe more of them than fit */
+    neg = (text[0] == '-');
+
+    for (i = neg; i < n; ++i) {
+        unsigned digit = text[i] - '0';
+
+        if (u > (UINT64_MAX - digit) / 10)
+            return 1;
+
+        u = u * 10 + digit;
+    }
+
+    if (u > (uint64_t)INT64_MAX + neg)
+        return 1;
+
+    *out = (neg && (u > 0)) ? -(int64_t)(u - 1) - 1 : (int64_t)u;
+    return 0;
+}
+
+const char *json_get_number_text(const struct json_value *val, size_t *n)
+{
+    if ((val->type != JSON_NUMBER) || !(val->flags & JSON_VALUE_RAW))
+        return NULL;
+
+    /* Views are always followed by something else in the input */
+    *n = 0;
+    while (_json_is_number_char(val->value.jraw[*n]))
+        (*n)++;
+
+    return val->value.jraw;
 }
 
 bool *json_get_bool(struct json_value *val)
@@ -103,13 +408,18 @@ bool *json_get_bool(struct json_value *val)
 
 bool json_get_logical_bool(struct json_value *val)
 {
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
     switch (val->type) {
-        case JSON_STRING:  return strlen(val->value.jstring) > 0;
-        case JSON_NUMBER:  return val->value.jnumber > 0;
+        case JSON_STRING:  return val->value.jstring[0] != '\0'
+                               && ((val->flags & JSON_VALUE_VIEW) == 0
+                                   || val->value.jstring[0] != '"');
+        case JSON_NUMBER:  return json_get_number_value(val) > 0;
         case JSON_NULL:    return false;
         case JSON_BOOLEAN: return val->value.jbool;
         case JSON_ARRAY:   return val->value.jarray != NULL; /* NULL = empty */
-        case JSON_OBJECT:  return hashtable_size(val->value.jobject) > 0;
+        case JSON_OBJECT:  return json_object_size(val) > 0;
     }
 
     return false;
@@ -117,517 +427,2610 @@ bool json_get_logical_bool(struct json_value *val)
 
 struct list *json_get_array(struct json_value *val)
 {
-    return (val->type == JSON_ARRAY) ? val->value.jarray : NULL;
-}
+    if (val->type != JSON_ARRAY)
+        return NULL;
 
-struct hashtable *json_get_object(struct json_value *val)
-{
-    return (val->type == JSON_OBJECT) ? val->value.jobject : NULL;
-}
+    json_cache_modified(val);
 
+    /* The caller may modify it, so it has to be ours alone */
+    if ((val->flags & JSON_VALUE_SHARED) && _json_unshare(val))
+        return NULL;
 
-void json_free_wrapper_hash(void *val)
-{
-    json_free(val);
+    if (json_array_unpack(val))
+        return NULL;
+
+    return val->value.jarray;
 }
 
-void json_free_wrapper(void *val, void *ud)
+double *json_get_packed(struct json_value *arr, size_t *n)
 {
-    (void)ud;
+    if (arr->type != JSON_ARRAY)
+        return NULL;
 
-    json_free(val);
-}
+    json_cache_modified(arr);
 
-void json_free(struct json_value *v)
-{
-    json_free_contents(v);
-    free(v);
+    if ((arr->flags & JSON_VALUE_SHARED) && _json_unshare(arr))
+        return NULL;
+
+    if (!(arr->flags & JSON_VALUE_PACKED))
+        return NULL;
+
+    *n = arr->value.jpacked->len;
+    return arr->value.jpacked->values;
 }
 
-void json_free_contents(struct json_value *v)
+int json_array_append(struct json_value *arr, struct json_value *val)
 {
-    switch (v->type) {
-    case JSON_STRING:
-        free(v->value.jstring);
-        break;
+    if (arr->type != JSON_ARRAY)
+        return 1;
 
-    case JSON_ARRAY:
-        list_free_all(v->value.jarray, json_free_wrapper, NULL);
-        break;
+    json_cache_modified(arr);
 
-    case JSON_OBJECT:
-        hashtable_free(v->value.jobject);
-        break;
+    if ((arr->flags & JSON_VALUE_SHARED) && _json_unshare(arr))
+        return 1;
 
-    default:
-        break;
+    if (arr->flags & JSON_VALUE_PACKED) {
+        if (val->type == JSON_NUMBER) {
+            if (_json_packed_push(arr, *json_get_number(val)))
+                return 1;
+
+            json_free(val);
+            return 0;
+        }
+
+        if (json_array_unpack(arr))
+            return 1;
     }
+
+    arr->value.jarray = list_append(arr->value.jarray, val);
+    return 0;
 }
 
-struct json_value *json_parse(const char *input)
+int json_array_unpack(struct json_value *arr)
 {
-    struct json_lexer_state state;
+    struct json_packed *packed;
+    struct list *list;
 
-    state.pos = 0;
-    state.input = input;
+    if (arr->type != JSON_ARRAY)
+        return 0;
 
-    return json_parse_value(&state);
-}
+    json_cache_modified(arr);
 
-struct json_value *json_parse_value(struct json_lexer_state *lex)
-{
-    /* Read first token to determine how to proceed */
-    struct json_token tok;
-    struct json_token next;
-
-    if (!json_lexer_next_token(lex, &tok)) {
-        switch (tok.type) {
-        case TOK_BRACE_OPEN: {
-            /* Read string:value pairs until TOK_BRACE_CLOSE */
-            struct json_value *obj = json_object_new();
-
-            while (!json_lexer_next_token(lex, &next)) {
-                if (next.type == TOK_STRING) {
-                    char *key;
-                    struct json_value *kval;
-
-                    key = json_parse_string(lex, &next);
-                    if (!key)
-                        goto exit_err_obj;
-
-                    if ((json_lexer_next_token(lex, &next) != 0)
-                            || (next.type != TOK_COLON)) {
-                        free(key);
-                        goto exit_err_obj;
-                    }
-
-                    kval = json_parse_value(lex);
-                    if (!kval) {
-                        free(key);
-                        goto exit_err_obj;
-                    }
-
-                    hashtable_insert(obj->value.jobject, key, kval);
-
-                    if (json_lexer_next_token(lex, &next) != 0)
-                        goto exit_err_obj;
-
-                    if (next.type == TOK_COMMA) {
-                        continue;
-                    } else if (next.type == TOK_BRACE_CLOSE) {
-                        return obj;
-                    } else {
-                        /*
-                        fprintf(stderr, "expected `%s' or `%s', got `%s'\n",
-                            json_token_str[TOK_COMMA],
-                            json_token_str[TOK_BRACE_CLOSE],
-                            json_token_str[next.type]);
-                        */
-
-                        goto exit_err_obj;
-                    }
-                } else if (next.type == TOK_BRACE_CLOSE) {
-                    /* In case it's an empty object */
-                    return obj;
-                } else {
-                    /*
-                     fprintf(stderr, "expected `%s' or `%s', got `%s'\n",
-                        json_token_str[TOK_COLON],
-                        json_token_str[TOK_BRACE_CLOSE],
-                        json_token_str[next.type]);
-                    */
-
-                    goto exit_err_obj;
-                }
-            }
+    /* Clones may be reading the block, so they keep it */
+    if (json_unshare(arr))
+        return 1;
 
-            break;
+    if (!(arr->flags & JSON_VALUE_PACKED))
+        return 0;
 
-exit_err_obj:
-            json_free(obj);
+    packed = arr->value.jpacked;
 
-            return NULL;
-        }
-        case TOK_SQUARE_BRACKET_OPEN: {
-            /* Read values until TOK_SQUARE_BRACKET_CLOSE */
-            struct json_value *arr = json_array_new();
+    if (((list = _json_packed_list(packed, NULL)) == NULL) && (packed->len > 0))
+        return 1;
 
-            /*
-             * Can't expect with arrays the way we can expect with objects,
-             * so we have to peek
-             */
-            size_t oldpos = lex->pos;
-
-            while (!json_lexer_next_token(lex, &next)) {
-                if (next.type == TOK_SQUARE_BRACKET_CLOSE) {
-                    /* In case it's an empty array */
-                    return arr;
-                } else {
-                    struct json_value *val;
-
-                    /* Jump back so json_parse_value can correctly pars */
-                    lex->pos = oldpos;
-
-                    val = json_parse_value(lex);
-                    if (!val)
-                        goto exit_err_arr;
-
-                    arr->value.jarray = list_append(arr->value.jarray, val);
-
-                    if (json_lexer_next_token(lex, &next) != 0)
-                        goto exit_err_arr;
-
-                    if (next.type == TOK_COMMA) {
-                        oldpos = lex->pos;
-
-                        continue;
-                    } else if (next.type == TOK_SQUARE_BRACKET_CLOSE) {
-                        return arr;
-                    } else {
-                        /*
-                        fprintf(stderr, "expected `%s' or `%s', got `%s'\n",
-                            json_token_str[TOK_COMMA],
-                            json_token_str[TOK_SQUARE_BRACKET_CLOSE],
-                            json_token_str[next.type]);
-                        */
-
-                        goto exit_err_arr;
-                    }
-                }
-            }
+    arr->flags &= ~JSON_VALUE_PACKED;
+    arr->value.jarray = list;
 
-            break;
+    free(packed);
+    return 0;
+}
 
-exit_err_arr:
-            json_free(arr);
+size_t json_array_size(const struct json_value *arr)
+{
+    if (arr->type != JSON_ARRAY)
+        return 0;
 
-            return NULL;
-        }
-        case TOK_STRING: {
-            struct json_value *str = json_value_new(JSON_STRING);
-            str->value.jstring = json_parse_string(lex, &tok);
+    if (arr->flags & JSON_VALUE_SHARED)
+        arr = arr->value.jshared;
 
-            return str->value.jstring != NULL ? str : NULL;
-        }
-        case TOK_NUMBER: {
-            /* sscanf() number and return */
-            double n;
+    return (arr->flags & JSON_VALUE_PACKED)
+        ? arr->value.jpacked->len
+        : list_length(arr->value.jarray);
+}
 
-            if ((sscanf(lex->input + tok.i, "%lf", &n)) != 1) {
-                /* fprintf(stderr, "Bad number format!\n"); */
-                return NULL;
-            }
+void json_array_iterator_init(struct json_array_iterator *iter,
+                              const struct json_value *arr)
+{
+    if (arr->flags & JSON_VALUE_SHARED)
+        arr = arr->value.jshared;
 
-            return json_number_new(n);
-        }
-        case TOK_TRUE:
-            return json_bool_new(true);
+    memset(iter, 0, sizeof(*iter));
 
-        case TOK_FALSE:
-            return json_bool_new(false);
+    iter->arr = arr;
+    iter->tmp.type = JSON_NUMBER;
 
-        case TOK_NULL:
-            return json_null_new();
+    if (!(arr->flags & JSON_VALUE_PACKED))
+        iter->ptr = arr->value.jarray;
+}
 
-        default:
-            /*
-            fprintf(stderr, "Unexpected token `%s'!\n",
-                json_token_str[tok.type]);
-            */
+bool json_array_iterator_next(struct json_array_iterator *iter,
+                              struct json_value **val)
+{
+    const struct json_value *arr = iter->arr;
 
-            return NULL;
-        }
-    } else {
-        /* fprintf(stderr, "prematurely reached EOF\n"); */
+    if (arr->flags & JSON_VALUE_PACKED) {
+        if (iter->i >= arr->value.jpacked->len)
+            return false;
+
+        iter->tmp.value.jnumber = arr->value.jpacked->values[iter->i++];
+        *val = &iter->tmp;
+
+        return true;
     }
 
-    return NULL;
+    if (iter->ptr == NULL)
+        return false;
+
+    *val = LIST_DATA(iter->ptr, struct json_value *);
+    iter->ptr = iter->ptr->next;
+
+    return true;
 }
 
-char *json_parse_string(struct json_lexer_state *lex,
-                        struct json_token *tok)
+struct hashtable *json_get_object(struct json_value *val)
 {
-    size_t i;
-    size_t j;
-
-    /*
-     * TODO: calculate length after reducing escapes, but for now, the
-     *       unescaped string can not be longer than the escaped string
-     */
-    size_t len = tok->j - tok->i;
+    if (val->type != JSON_OBJECT)
+        return NULL;
 
-    char *str = malloc(sizeof(char) * len);
-    memset(str, 0, sizeof(char) * len);
+    json_cache_modified(val);
 
-    /* From i+1 to j-1 to skip the first and last quotes */
-    for (i = tok->i + 1, j = 0; i < tok->j - 1; ++i) {
-        char esc;
+    if ((val->flags & JSON_VALUE_SHARED) && _json_unshare(val))
+        return NULL;
 
-        if (lex->input[i] != '\\') {
-            str[j++] = lex->input[i];
+    if (val->flags & JSON_VALUE_SHAPED) {
+        struct json_value *obj = _json_shaped_unshape(val->value.jshaped);
 
-            continue;
-        }
+        val->flags &= ~JSON_VALUE_SHAPED;
+        val->value.jobject = obj->value.jobject;
 
-        esc = lex->input[++i];
-
-        switch (esc) {
-        case '\"': str[j++] = '\"'; break;
-        case '\\': str[j++] = '\\'; break;
-        case '/':  str[j++] = '/';  break;
-        case 'b':  str[j++] = '\b'; break;
-        case 'f':  str[j++] = '\f'; break;
-        case 'n':  str[j++] = '\n'; break;
-        case 'r':  str[j++] = '\r'; break;
-        case 't':  str[j++] = '\t'; break;
-        case 'u': {
-            /* Because you can't tell scanf to scan EXACTLY 4 characters. */
-            unsigned cp0, cp1, cp2, cp3;
-            unsigned short codepoint;
-
-            i++; /* Skip the 'u' */
-
-            /* Make sure there's at least 4 characters left */
-            if ((long)(tok->i + len - (i + 4)) < 0) {
-                /*
-                fprintf(stderr, "incomplete unicode escape `%.*s'\n",
-                    (int)(tok->i + len - (i + 4)), lex->input + i);
-                */
-                goto exit_err;
-            }
+        free(obj);
+    } else if (val->flags & (JSON_VALUE_VIEW | JSON_VALUE_BORROWED)) {
+        /* Callers expect plain, owned string keys, so convert them first */
+        struct hashtable *view = val->value.jobject;
+        struct hashtable *obj = hashtable_new_real(
+            view->bucket_count, str_hash, str_equal, free, view->free_value);
 
-            if (sscanf(lex->input + i, "%1x%1x%1x%1x",
-                       &cp0, &cp1, &cp2, &cp3) != 4) {
-                /*
-                fprintf(stderr, "invalid unicode escape `%.4s'\n",
-                            lex->input + i);
-                */
+        struct hashtable_iterator iter;
+        void *key;
+        void *value;
 
-                goto exit_err;
-            }
+        hashtable_iterator_init(&iter, view);
+        while (hashtable_iterator_next(&iter, &key, &value)) {
+            char *copy;
 
-            codepoint = (char)cp0 << 12
-                      | (char)cp1 << 8
-                      | (char)cp2 << 4
-                      | (char)cp3;
+            if (val->flags & JSON_VALUE_VIEW) {
+                char *tmp;
+                size_t n;
+                const char *str = json_view_key(key, &n, &tmp);
 
-            j += utf8_encode(str + j, len - j, codepoint);
+                copy = (tmp != NULL) ? tmp : strndup(str, n);
+            } else {
+                copy = strdup(key);
+            }
 
-            /*
-             * Skip 2 digits, let the next be skipped below and the ine after
-             * that by the for-loop
-             */
-            i += 2;
-            break;
+            hashtable_insert(obj, copy, value);
         }
 
-        default:
-            /* Ignore unknown escape code */
-            continue;
-        }
+        /* The values moved over, only drop the entries */
+        hashtable_clear_shallow(view);
+        hashtable_free(view);
 
-        ++i;
+        val->value.jobject = obj;
+        val->flags &= ~(JSON_VALUE_VIEW | JSON_VALUE_BORROWED);
     }
 
-    return str;
+    return val->value.jobject;
+}
 
-exit_err:
-    free(str);
-    return NULL;
+struct json_value *json_object_lookup(struct json_value *obj, const char *key)
+{
+    /* The result may be modified, so it can't be shared with other clones */
+    if ((obj->type != JSON_OBJECT) || json_unshare(obj))
+        return NULL;
+
+    return (struct json_value *)json_object_lookup_const(obj, key);
 }
 
+const struct json_value *json_object_lookup_const(const struct json_value *obj,
+                                                  const char *key)
+{
+    size_t i;
 
-/* Because this next part makes a lot of use of snprintf */
-#if __STDC_VERSION__ >= 199901L
+    if (obj->type != JSON_OBJECT)
+        return NULL;
 
-/*
- * Basically disgusting, aka a way to not spam inline ifs everywhere to prevent
- * buffer overflows by short circuiting both the offsetting and length
- * adjustment if the buffer has run out, so you don't explicitely have to
- * check after every. single. snprintf. and. json_dump_*. If the buffer runs
- * out, replaces the buffer offsetting by NULL and the length adjustment by 0
- * and keep going. The snprintfs will produce the correct return values but
- * write nothing, and the total result is still correct.
- */
-#define BUFORNULL ((pos > nout) ? NULL : (out + pos)), \
-                   (pos > nout) ? 0    : (nout - pos)
+    if (obj->flags & JSON_VALUE_SHARED)
+        obj = obj->value.jshared;
 
-size_t json_dump(char *out, size_t nout, struct json_value *val)
-{
-    size_t pos = 0;
+    if (obj->flags & JSON_VALUE_SHAPED) {
+        struct json_shaped *shaped = obj->value.jshaped;
 
-    switch (val->type) {
-    case JSON_STRING:
-        return json_dump_string(out, nout, val->value.jstring);
+        i = _json_shape_find(shaped->shape, key, strlen(key));
+        return (i != (size_t)-1) ? &shaped->values[i] : NULL;
+    }
 
-    case JSON_NUMBER:
-        return snprintf(out, nout, "%.2f", val->value.jnumber);
+    /* View keys are escaped string text, key would be taken for one, too */
+    if (obj->flags & JSON_VALUE_VIEW)
+        return _json_view_lookup(obj->value.jobject, key);
 
-    case JSON_NULL:
-        return snprintf(out, nout, "null");
+    return hashtable_lookup(obj->value.jobject, key);
+}
 
-    case JSON_BOOLEAN:
-        return snprintf(out, nout, val->value.jbool ? "true" : "false");
+size_t json_object_size(const struct json_value *obj)
+{
+    if (obj->type != JSON_OBJECT)
+        return 0;
 
-    case JSON_ARRAY: {
-        struct list *ptr;
+    if (obj->flags & JSON_VALUE_SHARED)
+        obj = obj->value.jshared;
 
-        pos += snprintf(out, nout, "[");
+    return (obj->flags & JSON_VALUE_SHAPED)
+        ? obj->value.jshaped->shape->count
+        : hashtable_size(obj->value.jobject);
+}
 
-        for (ptr = val->value.jarray; ptr != NULL; ptr = ptr->next) {
-            pos += json_dump(BUFORNULL, LIST_DATA(ptr, struct json_value *));
+void json_object_iterator_init(struct json_object_iterator *iter,
+                               const struct json_value *obj)
+{
+    if (obj->flags & JSON_VALUE_SHARED)
+        obj = obj->value.jshared;
 
-            if (ptr->next != NULL)
-                pos += snprintf(BUFORNULL, ", ");
-        }
+    iter->obj = obj;
+    iter->i = 0;
+    iter->tmp = NULL;
 
-        pos += snprintf(BUFORNULL, "]");
-        return pos;
-    }
-    case JSON_OBJECT: {
-        struct hashtable_iterator iter;
-        size_t i = 0;
+    if (!(obj->flags & JSON_VALUE_SHAPED))
+        hashtable_iterator_init(&iter->iter, obj->value.jobject);
+}
 
-        void *key = NULL;
-        void *value = NULL;
+bool json_object_iterator_next(struct json_object_iterator *iter,
+                               const char **key,
+                               size_t *n,
+                               struct json_value **val)
+{
+    const struct json_value *obj = iter->obj;
+    void *k;
+    void *v;
 
-        pos += snprintf(out, nout, "{");
+    json_object_iterator_free(iter);
 
-        hashtable_iterator_init(&iter, val->value.jobject);
-        while (hashtable_iterator_next(&iter, &key, &value)) {
-            pos += json_dump_string(BUFORNULL, key);
-            pos += snprintf(BUFORNULL, ": ");
-            pos += json_dump(BUFORNULL, value);
+    if (obj->flags & JSON_VALUE_SHAPED) {
+        struct json_shaped *shaped = obj->value.jshaped;
 
-            if (++i < hashtable_size(val->value.jobject))
-                pos += snprintf(BUFORNULL, ", ");
-        }
+        if (iter->i >= shaped->shape->count)
+            return false;
+
+        *key = shaped->shape->keys[iter->i];
+        *n = shaped->shape->lens[iter->i];
+        *val = &shaped->values[iter->i];
 
-        pos += snprintf(BUFORNULL, "}");
-        return pos;
+        iter->i++;
+        return true;
     }
+
+    if (!hashtable_iterator_next(&iter->iter, &k, &v))
+        return false;
+
+    if (obj->flags & JSON_VALUE_VIEW) {
+        *key = json_view_key(k, n, &iter->tmp);
+    } else {
+        *key = k;
+        *n = strlen(k);
     }
 
-    return pos;
+    *val = v;
+    return true;
 }
 
-size_t json_dump_string(char *out, size_t nout, const char *str)
+void json_object_iterator_free(struct json_object_iterator *iter)
 {
-    size_t pos = 0;
+    free(iter->tmp);
+    iter->tmp = NULL;
+}
+
+const char *json_view_key(const void *key, size_t *n, char **tmp)
+{
+    bool escaped;
+    size_t len = _json_view_key_len(key, &escaped);
 
-    pos += snprintf(BUFORNULL, "\"");
+    *tmp = NULL;
 
-    for (const char *ptr = str; *ptr != 0; ++ptr) {
-        switch (*ptr) {
-            case '\"': pos += snprintf(BUFORNULL, "\\\"");     break;
-            case '\\': pos += snprintf(BUFORNULL, "\\\\");     break;
-            case '\b': pos += snprintf(BUFORNULL, "\\b");      break;
-            case '\f': pos += snprintf(BUFORNULL, "\\f");      break;
-            case '\n': pos += snprintf(BUFORNULL, "\\n");      break;
-            case '\r': pos += snprintf(BUFORNULL, "\\r");      break;
-            case '\t': pos += snprintf(BUFORNULL, "\\t");      break;
-            default:   pos += snprintf(BUFORNULL, "%c", *ptr); break;
-        }
+    if (!escaped) {
+        *n = len;
+        return key;
     }
 
-    pos += snprintf(BUFORNULL, "\"");
-    return pos;
+    *tmp = malloc(len + 1);
+    *n = _json_unescape(key, len, *tmp);
+
+    /* Malformed escapes are rejected by the parser, but still */
+    if (*n == (size_t)-1)
+        *n = 0;
+
+    (*tmp)[*n] = '\0';
+    return *tmp;
 }
 
-#undef BUFORNULL
 
-#endif
+void json_free_wrapper_hash(void *val)
+{
+    json_free(val);
+}
 
-int json_lexer_next_token(struct json_lexer_state *state,
-                          struct json_token *tok)
+void json_free_wrapper(void *val, void *ud)
 {
-    for (;;) {
-        char c = state->input[state->pos];
+    (void)ud;
 
-        if (!c) {
-            tok->i = state->pos;
-            return 1;
-        }
+    json_free(val);
+}
 
-        if (strchr("{}[]:,", c) != NULL) {
-            size_t i;
+void json_free(struct json_value *v)
+{
+    json_free_contents(v);
+    free(v);
+}
 
-            /* Simple symbol, look it up */
-            for (i = 0; i < TOK_MAX; ++i) {
-                if (c == *json_token_str[i]) {
-                    tok->type = (enum json_token_type)i;
+void json_free_contents(struct json_value *v)
+{
+    if (v->flags & JSON_VALUE_SHARED) {
+        RC_DECREF(v->value.jshared);
+        return;
+    }
+
+    switch (v->type) {
+    case JSON_STRING:
+        if (!(v->flags & (JSON_VALUE_VIEW | JSON_VALUE_BORROWED)))
+            free(v->value.jstring);
+        break;
+
+    case JSON_NUMBER:
+        if ((v->flags & JSON_VALUE_RAW)
+                && !(v->flags & (JSON_VALUE_VIEW | JSON_VALUE_BORROWED)))
+            free(v->value.jraw);
+        break;
+
+    case JSON_ARRAY:
+        if (v->flags & JSON_VALUE_PACKED)
+            free(v->value.jpacked);
+        else
+            list_free_all(v->value.jarray, json_free_wrapper, NULL);
+
+        break;
+
+    case JSON_OBJECT:
+        if (v->flags & JSON_VALUE_SHAPED) {
+            struct json_shaped *shaped = v->value.jshaped;
+            size_t i;
+
+            for (i = 0; i < shaped->shape->count; ++i)
+                json_free_contents(&shaped->values[i]);
+
+            _json_shape_release(shaped->shape);
+            free(shaped);
+        } else {
+            hashtable_free(v->value.jobject);
+        }
+
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Move the contents of a string, array or object into a reference counted
+ * copy of val for sharing, unless that happened already. Everything else is
+ * simply copied by json_clone(). Returns 0 on success.
+ */
+static int _json_share(struct json_value *val)
+{
+    struct json_value *shared;
+
+    if ((val->flags & JSON_VALUE_SHARED)
+            || ((val->type != JSON_STRING)
+                && (val->type != JSON_ARRAY)
+                && (val->type != JSON_OBJECT)))
+        return 0;
+
+    if ((shared = rc_malloc(sizeof(*shared), _json_shared_free, NULL)) == NULL)
+        return 1;
+
+    *shared = *val;
+    shared->flags &= ~JSON_VALUE_CACHED;
+
+    /* Only the contents moved, text cached of val stays good */
+    val->flags = JSON_VALUE_SHARED | (val->flags & JSON_VALUE_CACHED);
+    val->value.jshared = shared;
+
+    return 0;
+}
+
+/*
+ * Give val contents of its own. The last reference simply takes the shared
+ * contents back, others copy them one level deep, cloning the values in them
+ * so those stay shared. Returns 0 on success.
+ */
+static int _json_unshare(struct json_value *val)
+{
+    struct json_value *shared = val->value.jshared;
+    struct json_value copy;
+
+    if (RC_NUMREFS(shared) == 1) {
+        /* Same contents as before, so text cached of val stays good */
+        unsigned cached = val->flags & JSON_VALUE_CACHED;
+
+        *val = *shared;
+        val->flags |= cached;
+
+        /* Without running the destructor, the contents live on in val */
+        free(RC_GETOBJ(shared));
+        return 0;
+    }
+
+    copy.type = shared->type;
+    copy.flags = 0;
+
+    switch (shared->type) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_get_string_n(shared, &n);
+
+        if ((copy.value.jstring = strndup(str, n)) == NULL)
+            return 1;
+
+        break;
+    }
+    case JSON_ARRAY: {
+        struct list *tail = NULL;
+        struct list *ptr;
+
+        if (shared->flags & JSON_VALUE_PACKED) {
+            /* Nothing in there to share */
+            size_t size = sizeof(struct json_packed)
+                + sizeof(double) * shared->value.jpacked->cap;
+
+            if ((copy.value.jpacked = malloc(size)) == NULL)
+                return 1;
+
+            memcpy(copy.value.jpacked, shared->value.jpacked, size);
+            copy.flags = JSON_VALUE_PACKED;
+
+            break;
+        }
+
+        copy.value.jarray = NULL;
+
+        for (ptr = shared->value.jarray; ptr != NULL; ptr = ptr->next) {
+            struct json_value *elem = json_clone(LIST_DATA(ptr, void *));
+            struct list *link;
+
+            if (elem == NULL) {
+                json_free_contents(&copy);
+                return 1;
+            }
+
+            /* Appending in constant time, as the parser does */
+            link = list_new_with_data(elem);
+
+            if (tail != NULL) {
+                link->prev = tail;
+                tail->next = link;
+            } else {
+                copy.value.jarray = link;
+            }
+
+            tail = link;
+        }
+
+        break;
+    }
+    case JSON_OBJECT: {
+        struct json_value *obj = json_object_new();
+        struct json_object_iterator iter;
+        struct json_value *member;
+        const char *key;
+        size_t n;
+
+        copy.value.jobject = obj->value.jobject;
+        free(obj);
+
+        json_object_iterator_init(&iter, shared);
+
+        while (json_object_iterator_next(&iter, &key, &n, &member)) {
+            struct json_value *elem = json_clone(member);
+
+            if (elem == NULL) {
+                json_object_iterator_free(&iter);
+                json_free_contents(&copy);
+                return 1;
+            }
+
+            hashtable_insert(copy.value.jobject, strndup(key, n), elem);
+        }
+
+        break;
+    }
+    default:
+        break;
+    }
+
+    /* The values in the copy are new, changes to them go unnoticed */
+    json_cache_modified(val);
+    RC_DECREF(val->value.jshared);
+
+    *val = copy;
+    return 0;
+}
+
+static void _json_shared_free(void *data, void *udata)
+{
+    (void)udata;
+
+    json_free_contents(data);
+}
+
+struct json_value *json_parse(const char *input)
+{
+    return json_parse_n(input, strlen(input));
+}
+
+struct json_value *json_parse_n(const char *input, size_t n)
+{
+    return json_parse_ex(input, n, 0);
+}
+
+struct json_value *json_parse_ex(const char *input, size_t n, unsigned flags)
+{
+    struct json_lexer_state state;
+    struct json_value *val;
+
+    json_lexer_init(&state, input, n);
+    state.flags = flags & ~JSON_PARSE_INSITU;
+
+    /* The shapes stick around for as long as there are objects using them */
+    if (flags & JSON_PARSE_SHAPES)
+        state.shapes = _json_shape_new(NULL, NULL, 0);
+
+    val = json_parse_value(&state);
+
+    if (state.shapes != NULL)
+        _json_shape_release(state.shapes);
+
+    return val;
+}
+
+struct json_value *json_parse_insitu(char *input, size_t n)
+{
+    struct json_lexer_state state;
+
+    json_lexer_init(&state, input, n);
+    state.flags = JSON_PARSE_INSITU;
+
+    return json_parse_value(&state);
+}
+
+struct json_value *json_parse_file(const char *path)
+{
+    struct json_value *val = NULL;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            struct json_lexer_state lex;
+            size_t i;
+
+            posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+            json_lexer_init(&lex, map, st.st_size);
+            val = json_parse_value(&lex);
+
+            /* The same rule as for the push parser below, see there */
+            for (i = lex.pos; (val != NULL) && (i < (size_t)st.st_size); ++i) {
+                if (!isspace(((unsigned char *)map)[i])) {
+                    json_free(val);
+                    val = NULL;
+                }
+            }
+
+            munmap(map, st.st_size);
+
+            close(fd);
+            return val;
+        }
+    }
+
+    {
+        /* Not mappable, so read it piecewise into the push parser instead */
+        struct json_parser *p = json_parser_new();
+        char buf[BUFSIZ];
+        ssize_t n;
+
+        /* All of it, anything but whitespace after the value is an error */
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            if (json_parser_feed(p, buf, n) == JSON_PARSER_ERROR)
+                break;
+
+        if (n >= 0)
+            val = json_parser_finish(p);
+
+        json_parser_free(p);
+    }
+
+    close(fd);
+    return val;
+}
+
+/*
+ * The parser keeps the containers it's in on a stack of its own instead of
+ * recursing, so nesting costs no native stack and is limited by
+ * lex->max_depth alone. Every value is parsed in the same loop: containers
+ * are pushed when they open, and completed values are handed to the
+ * innermost container, which is popped (and handed on) once it closes.
+ */
+struct json_value *json_parse_value(struct json_lexer_state *lex)
+{
+    struct json_parse_frame local[JSON_PARSE_STACK];
+    struct json_parse_frame *stack = local;
+    size_t cap = JSON_PARSE_STACK;
+    size_t depth = 0;
+
+    struct json_value *val;
+    struct json_token tok;
+    int res;
+
+    for (;;) {
+        if (json_lexer_next_token(lex, &tok))
+            goto exit_err;
+
+        if ((tok.type == TOK_BRACE_OPEN)
+                || (tok.type == TOK_SQUARE_BRACKET_OPEN)) {
+            struct json_parse_frame *frame;
+
+            if (depth == lex->max_depth)
+                goto exit_err;
+
+            if (depth == cap) {
+                struct json_parse_frame *grown = (stack == local)
+                    ? malloc(sizeof(*stack) * cap * 2)
+                    : realloc(stack, sizeof(*stack) * cap * 2);
+
+                if (grown == NULL)
+                    goto exit_err;
+
+                if (stack == local)
+                    memcpy(grown, local, sizeof(local));
+
+                stack = grown;
+                cap *= 2;
+            }
+
+            frame = &stack[depth++];
+            _json_frame_open(lex, frame, tok.type == TOK_BRACE_OPEN);
+
+            /* The first member or element follows, or the end already */
+            if ((res = _json_frame_next(lex, frame)) < 0)
+                goto exit_err;
+            else if (res == 0)
+                continue;
+
+            val = _json_frame_close(frame);
+            depth--;
+        } else if ((val = _json_parse_scalar(lex, &tok)) == NULL) {
+            goto exit_err;
+        }
+
+        /* Hand val to its container, and that one to its own once it closes */
+        for (;;) {
+            struct json_parse_frame *frame;
+            enum json_token_type close;
+
+            if (depth == 0) {
+                if (stack != local)
+                    free(stack);
+
+                return val;
+            }
+
+            frame = &stack[depth - 1];
+            _json_frame_attach(frame, val);
+
+            close = ((frame->type == JSON_FRAME_ARRAY)
+                        || (frame->type == JSON_FRAME_PACKED))
+                ? TOK_SQUARE_BRACKET_CLOSE
+                : TOK_BRACE_CLOSE;
+
+            if (json_lexer_next_token(lex, &tok))
+                goto exit_err;
+
+            if (tok.type == TOK_COMMA)
+                res = _json_frame_next(lex, frame);
+            else
+                res = (tok.type == close) ? 1 : -1;
+
+            if (res < 0)
+                goto exit_err;
+            else if (res == 0)
+                break;
+
+            val = _json_frame_close(frame);
+            depth--;
+        }
+    }
+
+exit_err:
+    while (depth > 0)
+        _json_frame_free(&stack[--depth]);
+
+    if (stack != local)
+        free(stack);
+
+    return NULL;
+}
+
+char *json_parse_string(struct json_lexer_state *lex,
+                        struct json_token *tok)
+{
+    size_t n;
+
+    return json_parse_string_n(lex, tok, &n);
+}
+
+char *json_parse_string_n(struct json_lexer_state *lex,
+                          struct json_token *tok,
+                          size_t *n)
+{
+    /* Without the quotes */
+    size_t len = tok->j - tok->i - 2;
+
+    /* The unescaped string can not be longer than the escaped string */
+    char *str = malloc(len + 1);
+
+    if (str == NULL)
+        return NULL;
+
+    if ((*n = _json_unescape(lex->input + tok->i + 1, len, str))
+            == (size_t)-1) {
+        free(str);
+        return NULL;
+    }
+
+    str[*n] = '\0';
+    return str;
+}
+
+/*
+ * The input isn't necessarily terminated after the number (or at all), so it
+ * is copied into a terminated buffer for strtod() to look at.
+ */
+int json_parse_number(const char *str, size_t n, double *out)
+{
+    char buf[JSON_NUMBER_BUFSIZ];
+    char *tmp = (n < sizeof(buf)) ? buf : malloc(n + 1);
+    char *end;
+
+    memcpy(tmp, str, n);
+    tmp[n] = '\0';
+
+    *out = strtod(tmp, &end);
+
+    if (tmp != buf)
+        free(tmp);
+
+    return end == tmp;
+}
+
+/*
+ * A single pass over the input that knows just enough to tell what comes
+ * next: containers are a bit each on a fixed stack (set for objects), the
+ * rest is checked as it's passed.
+ */
+int json_validate(const char *input, size_t n, struct json_error *err)
+{
+    unsigned char stack[JSON_PARSE_MAX_DEPTH / 8];
+    size_t depth = 0;
+    size_t i = 0;
+    size_t end;
+
+    const char *what;
+    bool object;
+
+    for (;;) {
+        /* A value */
+        if ((i = _json_validate_ws(input, n, i)) >= n) {
+            what = "unexpected end of input";
+            goto exit_err;
+        }
+
+        switch (input[i]) {
+        case '{':
+        case '[':
+            if (depth == JSON_PARSE_MAX_DEPTH) {
+                what = "nested too deeply";
+                goto exit_err;
+            }
+
+            object = (input[i] == '{');
+
+            if (object)
+                stack[depth / 8] |= 1 << (depth % 8);
+            else
+                stack[depth / 8] &= ~(1 << (depth % 8));
+
+            depth++;
+            i = _json_validate_ws(input, n, i + 1);
+
+            /* Empty, so already done with it */
+            if ((i < n) && (input[i] == (object ? '}' : ']'))) {
+                i++;
+                depth--;
+                break;
+            }
+
+            if (object && ((what = _json_validate_key(input, n, &i)) != NULL))
+                goto exit_err;
+
+            continue;
+
+        case '"':
+            i++;
+
+            if ((what = _json_validate_string(input, n, &i)) != NULL)
+                goto exit_err;
+
+            break;
+
+        case 't':
+        case 'f':
+        case 'n': {
+            const char *lit = (input[i] == 't')
+                ? "true"
+                : ((input[i] == 'f') ? "false" : "null");
+            size_t len = strlen(lit);
+
+            if ((n - i < len) || memcmp(input + i, lit, len)) {
+                what = "unexpected character";
+                goto exit_err;
+            }
+
+            i += len;
+            break;
+        }
+        default:
+            if ((input[i] != '-') && !isdigit((unsigned char)input[i])) {
+                what = "unexpected character";
+                goto exit_err;
+            }
+
+            if ((end = _json_validate_number(input, n, i)) == 0) {
+                what = "malformed number";
+                goto exit_err;
+            }
+
+            i = end;
+            break;
+        }
+
+        /* Whatever follows a value: the next one or the end of containers */
+        for (;;) {
+            i = _json_validate_ws(input, n, i);
+
+            if (depth == 0) {
+                if (i < n) {
+                    what = "data after the value";
+                    goto exit_err;
+                }
+
+                return 0;
+            }
+
+            if (i >= n) {
+                what = "unexpected end of input";
+                goto exit_err;
+            }
+
+            object = stack[(depth - 1) / 8] & (1 << ((depth - 1) % 8));
+
+            if (input[i] == ',') {
+                i++;
+
+                if (object
+                        && ((what = _json_validate_key(input, n, &i)) != NULL))
+                    goto exit_err;
+
+                break;
+            }
+
+            if (input[i] != (object ? '}' : ']')) {
+                what = object ? "expected ',' or '}'" : "expected ',' or ']'";
+                goto exit_err;
+            }
+
+            i++;
+            depth--;
+        }
+    }
+
+exit_err:
+    if (err != NULL) {
+        err->pos = i;
+        err->message = what;
+    }
+
+    return 1;
+}
+
+/*
+ * Runs of text outside of strings are copied up to the next whitespace or
+ * quote, strings as a whole. Nothing ever moves forward, so out may be input.
+ */
+size_t json_minify(char *out, const char *input, size_t n)
+{
+    size_t len = 0;
+    size_t i = 0;
+    size_t j;
+
+    while (i < n) {
+        j = _json_minify_scan(input, n, i);
+
+        if ((j < n) && (input[j] == '"'))
+            j = _json_minify_string(input, n, j + 1);
+
+        /* Nothing to move until the first whitespace */
+        if (out + len != input + i)
+            memmove(out + len, input + i, j - i);
+
+        len += j - i;
+
+        i = _json_minify_space(input, n, j);
+    }
+
+    return len;
+}
+
+/*
+ * Every opening bracket goes up a level and every closing one down, commas
+ * start a new line at the current level. Empty containers stay on one line.
+ */
+size_t json_reformat(char *out,
+                     size_t nout,
+                     const char *input,
+                     size_t n,
+                     unsigned indent)
+{
+    struct json_writer w;
+    size_t depth = 0;
+    size_t i = 0;
+    size_t j;
+
+    json_writer_init_fixed(&w, out, nout);
+
+    while (i < n) {
+        char c = input[i];
+
+        if (_json_is_space(c)) {
+            i++;
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            j = _json_minify_string(input, n, i + 1);
+            json_writer_write(&w, input + i, j - i);
+
+            i = j;
+            continue;
+
+        case '[':
+        case '{':
+            for (j = i + 1; (j < n) && _json_is_space(input[j]); ++j);
+
+            if ((j < n) && (input[j] == ((c == '[') ? ']' : '}'))) {
+                json_writer_write(&w, (c == '[') ? "[]" : "{}", 2);
+
+                i = j + 1;
+                continue;
+            }
+
+            json_writer_write(&w, &c, 1);
+            depth++;
+            break;
+
+        case ']':
+        case '}':
+            if (depth > 0)
+                depth--;
+
+            _json_reformat_newline(&w, depth * indent);
+            json_writer_write(&w, &c, 1);
+
+            i++;
+            continue;
+
+        case ',':
+            json_writer_write(&w, &c, 1);
+            break;
+
+        case ':':
+            json_writer_write(&w, ": ", 2);
+
+            i++;
+            continue;
+
+        default:
+            /* Anything else is part of a number or literal */
+            for (j = i + 1; (j < n) && !_json_is_space(input[j])
+                    && !strchr("\"[]{},:", input[j]); ++j);
+
+            json_writer_write(&w, input + i, j - i);
+
+            i = j;
+            continue;
+        }
+
+        /* After an opening bracket or a comma */
+        _json_reformat_newline(&w, depth * indent);
+        i++;
+    }
+
+    json_writer_flush(&w);
+    json_writer_free(&w);
+
+    return w.total;
+}
+
+
+/* The writer formats numbers using snprintf */
+#if __STDC_VERSION__ >= 199901L
+
+/*
+ * Both are thin wrappers around a json_writer writing to a fixed buffer, which
+ * gives them snprintf() semantics: at most nout bytes (including the
+ * terminator) are written, and the full length is returned either way.
+ */
+size_t json_dump(char *out, size_t nout, struct json_value *val)
+{
+    struct json_writer w;
+
+    json_writer_init_fixed(&w, out, nout);
+
+    w.flags = JSON_WRITER_SPACED;
+    w.number_format = "%.2f";
+
+    json_writer_value(&w, val);
+    json_writer_flush(&w);
+    json_writer_free(&w);
+
+    return w.total;
+}
+
+size_t json_dump_string(char *out, size_t nout, const char *str)
+{
+    struct json_writer w;
+
+    json_writer_init_fixed(&w, out, nout);
+
+    json_writer_string(&w, str, strlen(str));
+    json_writer_flush(&w);
+    json_writer_free(&w);
+
+    return w.total;
+}
+
+#endif
+
+void json_lexer_init(struct json_lexer_state *state,
+                     const char *input,
+                     size_t n)
+{
+    state->pos = 0;
+    state->len = n;
+    state->input = input;
+    state->flags = 0;
+    state->max_depth = JSON_PARSE_MAX_DEPTH;
+    state->shapes = NULL;
+}
+
+int json_lexer_next_token(struct json_lexer_state *state,
+                          struct json_token *tok)
+{
+    for (;;) {
+        char c;
+
+        /* A NUL byte still marks the end of input, as for json_parse() */
+        if ((state->pos >= state->len) || !(c = state->input[state->pos])) {
+            tok->i = state->pos;
+            return 1;
+        }
+
+        if (strchr("{}[]:,", c) != NULL) {
+            size_t i;
+
+            /* Simple symbol, look it up */
+            for (i = 0; i < TOK_MAX; ++i) {
+                if (c == *json_token_str[i]) {
+                    tok->type = (enum json_token_type)i;
                     tok->i = state->pos;
                     tok->j = state->pos + 1;
 
-                    state->pos++;
-                    return 0;
-                }
+                    state->pos++;
+                    return 0;
+                }
+            }
+        } else if (isspace((unsigned char)c) || iscntrl((unsigned char)c)) {
+            state->pos++;
+        } else if (c == '"') {
+            tok->type = TOK_STRING;
+            tok->i = state->pos++;
+
+            if (_json_lexer_scan_string(state)) {
+                /* Ran off the end, or into invalid UTF-8 */
+                if (state->pos >= state->len)
+                    state->pos = tok->i;
+                else
+                    tok->i = state->pos;
+
+                return 1;
+            }
+
+            tok->j = ++state->pos;
+            return 0;
+        } else if (isdigit((unsigned char)c) || (c == '+') || (c == '-')) {
+            tok->type = TOK_NUMBER;
+            tok->i = state->pos;
+
+            /*
+             * For the sake of simplicity let's just ignore what order the
+             * individual parts are in and let the parser worry about that.
+             */
+            while ((state->pos < state->len)
+                    && _json_is_number_char(state->input[state->pos]))
+                state->pos++;
+
+            tok->j = state->pos;
+            return 0;
+        } else if (isalpha((unsigned char)c)) {
+            size_t len;
+
+            /* true, false or null, scan until non-alpha */
+            tok->i = state->pos;
+
+            while ((state->pos < state->len)
+                    && isalpha((unsigned char)state->input[state->pos]))
+                state->pos++;
+
+            tok->j = state->pos;
+            len = state->pos - tok->i;
+
+            if ((len == 4) && !strncmp(state->input + tok->i, "null", len))
+                tok->type = TOK_NULL;
+            else if ((len == 5) && !strncmp(state->input + tok->i, "false", len))
+                tok->type = TOK_FALSE;
+            else if ((len == 4) && !strncmp(state->input + tok->i, "true", len))
+                tok->type = TOK_TRUE;
+            else
+                return 1;
+
+            return 0;
+        } else {
+            tok->i = state->pos;
+            return 1;
+        }
+    }
+}
+
+int json_lexer_skip_value(struct json_lexer_state *lex)
+{
+    struct json_token tok;
+    size_t depth = 1;
+
+    if (json_lexer_next_token(lex, &tok))
+        return 1;
+
+    if ((tok.type != TOK_BRACE_OPEN) && (tok.type != TOK_SQUARE_BRACKET_OPEN))
+        return (tok.type >= TOK_STRING) ? 0 : 1;
+
+    /*
+     * No need to tokenize what's inside, only strings (which might contain
+     * brackets) need special care.
+     */
+    while (lex->pos < lex->len) {
+        switch (lex->input[lex->pos++]) {
+        case '"':
+            if (_json_lexer_scan_string(lex))
+                return 1;
+
+            lex->pos++;
+            break;
+
+        case '{':
+        case '[':
+            depth++;
+            break;
+
+        case '}':
+        case ']':
+            if (--depth == 0)
+                return 0;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    lex->pos = lex->len;
+    return 1;
+}
+
+/*
+ * Decode the string token in place (the decoded string is never longer) and
+ * terminate it where it ends, at the latest on the closing quote.
+ */
+static char *_json_parse_string_insitu(struct json_lexer_state *lex,
+                                       struct json_token *tok)
+{
+    char *str = (char *)lex->input + tok->i + 1;
+    size_t n = _json_unescape(str, tok->j - tok->i - 2, str);
+
+    if (n == (size_t)-1)
+        return NULL;
+
+    str[n] = '\0';
+    return str;
+}
+
+/*
+ * Decode the n bytes of string text (without quotes) at in into out, which
+ * must have room for n bytes and may be the same as in. Returns the decoded
+ * length, or (size_t)-1 on malformed escapes.
+ */
+static size_t _json_unescape(const char *in, size_t n, char *out)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0, j = 0; i < n; ) {
+        const char *bs;
+        size_t used;
+        size_t len;
+
+        if (in[i] != '\\') {
+            /* Copy everything up to the next escape in one go */
+            size_t run = ((bs = memchr(in + i, '\\', n - i)) != NULL)
+                       ? (size_t)(bs - in) - i
+                       : n - i;
+
+            if (out + j != in + i)
+                memmove(out + j, in + i, run);
+
+            i += run;
+            j += run;
+
+            continue;
+        }
+
+        if ((len = _json_unescape_one(in + i, n - i, out + j, &used))
+                == (size_t)-1)
+            return (size_t)-1;
+
+        i += used;
+        j += len;
+    }
+
+    return j;
+}
+
+/*
+ * Decode the one escape sequence at in (n bytes left, in[0] is the
+ * backslash) into out, storing the number of input bytes it takes in used.
+ * Never writes more than those, nor more than 4 bytes. Returns the decoded
+ * length, or (size_t)-1 if the sequence is malformed.
+ */
+static size_t _json_unescape_one(const char *in, size_t n, char *out,
+                                 size_t *used)
+{
+    unsigned codepoint;
+    unsigned low;
+
+    if (n < 2)
+        return (size_t)-1;
+
+    *used = 2;
+
+    switch (in[1]) {
+    case '\"': *out = '\"'; return 1;
+    case '\\': *out = '\\'; return 1;
+    case '/':  *out = '/';  return 1;
+    case 'b':  *out = '\b'; return 1;
+    case 'f':  *out = '\f'; return 1;
+    case 'n':  *out = '\n'; return 1;
+    case 'r':  *out = '\r'; return 1;
+    case 't':  *out = '\t'; return 1;
+    case 'u':
+        break;
+
+    default:
+        /* Ignore unknown escape code */
+        return 0;
+    }
+
+    /* The four digits follow the 'u' */
+    if ((n < 6) || _json_hex4(in + 2, &codepoint))
+        return (size_t)-1;
+
+    *used = 6;
+
+    /* UTF-16 surrogates, only valid as a high-low pair */
+    if ((codepoint >= 0xdc00) && (codepoint <= 0xdfff))
+        return (size_t)-1;
+
+    if ((codepoint >= 0xd800) && (codepoint <= 0xdbff)) {
+        if ((n < 12) || (in[6] != '\\') || (in[7] != 'u')
+                || _json_hex4(in + 8, &low)
+                || (low < 0xdc00) || (low > 0xdfff))
+            return (size_t)-1;
+
+        codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+        *used = 12;
+    }
+
+    /* Never more than the 6 or 12 bytes of the escape sequence */
+    return utf8_encode(out, *used, codepoint);
+}
+
+/* Hex digit values plus one, zero for anything that isn't a hex digit */
+static const unsigned char _json_hex_value[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,
+    ['5'] = 6,  ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+/* Decode exactly four hex digits at in, returns 0 on success */
+static int _json_hex4(const char *in, unsigned *out)
+{
+    size_t i;
+
+    *out = 0;
+
+    for (i = 0; i < 4; ++i) {
+        unsigned char v = _json_hex_value[(unsigned char)in[i]];
+
+        if (!v)
+            return 1;
+
+        *out = (*out << 4) | (v - 1);
+    }
+
+    return 0;
+}
+
+/* Length of a view key, up to the closing quote (or the end of a C string) */
+static size_t _json_view_key_len(const char *key, bool *escaped)
+{
+    size_t i;
+
+    *escaped = false;
+
+    for (i = 0; (key[i] != '"') && (key[i] != '\0'); ++i) {
+        if (key[i] == '\\') {
+            *escaped = true;
+
+            if (key[++i] == '\0')
+                break;
+        }
+    }
+
+    return i;
+}
+
+static void _json_view_key_reader_init(struct json_view_key_reader *r,
+                                       const char *key)
+{
+    bool escaped;
+
+    r->key = key;
+    r->len = _json_view_key_len(key, &escaped);
+    r->i = 0;
+    r->j = 0;
+    r->n = 0;
+}
+
+/*
+ * The next byte of the decoded key, or -1 at its end. Malformed escapes end
+ * the key early, the parser doesn't let them through anyway.
+ */
+static int _json_view_key_getc(struct json_view_key_reader *r)
+{
+    size_t used;
+
+    while (r->j >= r->n) {
+        if (r->i >= r->len)
+            return -1;
+
+        if (r->key[r->i] != '\\')
+            return (unsigned char)r->key[r->i++];
+
+        r->n = _json_unescape_one(r->key + r->i, r->len - r->i, r->buf, &used);
+        r->j = 0;
+
+        if (r->n == (size_t)-1) {
+            r->n = 0;
+            r->i = r->len;
+            return -1;
+        }
+
+        r->i += used;
+    }
+
+    return (unsigned char)r->buf[r->j++];
+}
+
+/*
+ * Hash and equality for view keys, which are compared by their decoded form.
+ * Escapes are decoded on the fly, so neither allocates. Since view keys end
+ * at a NUL byte too, plain strings without quotes and backslashes can be
+ * looked up directly. Hashes match str_hash().
+ */
+static size_t _json_view_key_hash(const void *key)
+{
+    struct json_view_key_reader r;
+    size_t hash = 5381;
+    int c;
+
+    _json_view_key_reader_init(&r, key);
+
+    while ((c = _json_view_key_getc(&r)) != -1)
+        hash = ((hash << 5) + hash) + (char)c;
+
+    return hash;
+}
+
+static int _json_view_key_equal(const void *a, const void *b)
+{
+    struct json_view_key_reader ra;
+    struct json_view_key_reader rb;
+    int c;
+
+    _json_view_key_reader_init(&ra, a);
+    _json_view_key_reader_init(&rb, b);
+
+    /* Same text, nothing to decode */
+    if ((ra.len == rb.len) && !memcmp(ra.key, rb.key, ra.len))
+        return 0;
+
+    do {
+        if ((c = _json_view_key_getc(&ra)) != _json_view_key_getc(&rb))
+            return 1;
+    } while (c != -1);
+
+    return 0;
+}
+
+/* Whether the view key view decodes to the plain string key, like strcmp() */
+static int _json_view_key_equal_plain(const char *view, const char *key)
+{
+    struct json_view_key_reader r;
+    size_t i = 0;
+    int c;
+
+    _json_view_key_reader_init(&r, view);
+
+    while ((c = _json_view_key_getc(&r)) != -1)
+        if ((key[i] == '\0') || ((unsigned char)key[i++] != c))
+            return 1;
+
+    return key[i] != '\0';
+}
+
+/*
+ * Looks up the plain string key in a table of view keys, without escaping it
+ * into a view key first: the hashes are the same, so only its bucket needs
+ * comparing, one decoded key at a time.
+ */
+static struct json_value *_json_view_lookup(const struct hashtable *table,
+                                            const char *key)
+{
+    struct list *n = table->buckets[str_hash(key) % table->bucket_count];
+
+    for (; n != NULL; n = n->next) {
+        struct hashtable_entry *entry = LIST_DATA(n, struct hashtable_entry *);
+
+        if (!_json_view_key_equal_plain(entry->key, key))
+            return entry->value;
+    }
+
+    return NULL;
+}
+
+/* Turns shaped into a regular object, moving the values over */
+static struct json_value *_json_shaped_unshape(struct json_shaped *shaped)
+{
+    struct json_value *obj = json_object_new();
+    size_t i;
+
+    for (i = 0; i < shaped->shape->count; ++i) {
+        struct json_value *val = malloc(sizeof(*val));
+
+        /* At a new address, so it's not what anything cached refers to */
+        *val = shaped->values[i];
+        val->flags &= ~JSON_VALUE_CACHED;
+
+        hashtable_insert(obj->value.jobject,
+                         strdup(shaped->shape->keys[i]),
+                         val);
+    }
+
+    _json_shape_release(shaped->shape);
+    free(shaped);
+
+    return obj;
+}
+
+/* Appends d to arr, which is packed unless it's still empty */
+static int _json_packed_push(struct json_value *arr, double d)
+{
+    struct json_packed *packed = (arr->flags & JSON_VALUE_PACKED)
+        ? arr->value.jpacked
+        : NULL;
+
+    if ((packed == NULL) || (packed->len == packed->cap)) {
+        size_t cap = (packed != NULL) ? packed->cap * 2 : 8;
+        struct json_packed *grown = realloc(
+            packed, sizeof(*packed) + sizeof(double) * cap);
+
+        if (grown == NULL)
+            return 1;
+
+        if (packed == NULL)
+            grown->len = 0;
+
+        grown->cap = cap;
+        packed = grown;
+    }
+
+    packed->values[packed->len++] = d;
+
+    arr->flags |= JSON_VALUE_PACKED;
+    arr->value.jpacked = packed;
+
+    return 0;
+}
+
+/*
+ * A list of new number values holding the numbers of packed, storing its last
+ * link in tail unless that's NULL. Returns NULL if out of memory (packed
+ * itself is left alone), or if packed is empty.
+ */
+static struct list *_json_packed_list(const struct json_packed *packed,
+                                      struct list **tail)
+{
+    struct list *head = NULL;
+    struct list *last = NULL;
+    size_t i;
+
+    for (i = 0; i < packed->len; ++i) {
+        struct json_value *val = malloc(sizeof(*val));
+        struct list *link = malloc(sizeof(*link));
+
+        if ((val == NULL) || (link == NULL)) {
+            free(val);
+            free(link);
+            list_free_all(head, json_free_wrapper, NULL);
+
+            return NULL;
+        }
+
+        memset(val, 0, sizeof(*val));
+        val->type = JSON_NUMBER;
+        val->value.jnumber = packed->values[i];
+
+        link->data = val;
+        link->next = NULL;
+        link->prev = NULL;
+
+        if (last != NULL) {
+            link->prev = last;
+            last->next = link;
+        } else {
+            head = link;
+        }
+
+        last = link;
+    }
+
+    if (tail != NULL)
+        *tail = last;
+
+    return head;
+}
+
+/*
+ * A new shape with key added to the keys of parent, or the empty root shape
+ * (which is held by the parser) if parent is NULL.
+ */
+static struct json_shape *_json_shape_new(struct json_shape *parent,
+                                          const char *key,
+                                          size_t n)
+{
+    struct json_shape *shape = malloc(sizeof(*shape));
+    size_t count = (parent != NULL) ? parent->count + 1 : 0;
+
+    shape->parent = parent;
+    shape->refs = (parent == NULL);
+    shape->count = count;
+    shape->keys = malloc(sizeof(*shape->keys) * (count + 1));
+    shape->lens = malloc(sizeof(*shape->lens) * (count + 1));
+    shape->next = NULL;
+    shape->nnext = 0;
+
+    if (parent != NULL) {
+        memcpy(shape->keys, parent->keys, sizeof(*shape->keys) * (count - 1));
+        memcpy(shape->lens, parent->lens, sizeof(*shape->lens) * (count - 1));
+
+        shape->keys[count - 1] = malloc(n + 1);
+        shape->lens[count - 1] = n;
+
+        memcpy(shape->keys[count - 1], key, n);
+        shape->keys[count - 1][n] = '\0';
+
+        /* Room doubles whenever nnext reaches a power of two */
+        if ((parent->nnext & (parent->nnext - 1)) == 0) {
+            size_t room = parent->nnext ? parent->nnext * 2 : 1;
+
+            parent->next = realloc(parent->next, sizeof(*parent->next) * room);
+        }
+
+        parent->next[parent->nnext++] = shape;
+        parent->refs++;
+    }
+
+    return shape;
+}
+
+/* The shape following shape on key, NULL if there is none yet */
+static struct json_shape *_json_shape_transition(struct json_shape *shape,
+                                                 const char *key,
+                                                 size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < shape->nnext; ++i) {
+        struct json_shape *next = shape->next[i];
+
+        if ((next->lens[shape->count] == n)
+                && !memcmp(next->keys[shape->count], key, n))
+            return next;
+    }
+
+    return NULL;
+}
+
+/* Index of key within shape, (size_t)-1 if it's not there */
+static size_t _json_shape_find(const struct json_shape *shape,
+                               const char *key,
+                               size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < shape->count; ++i)
+        if ((shape->lens[i] == n) && !memcmp(shape->keys[i], key, n))
+            return i;
+
+    return (size_t)-1;
+}
+
+/*
+ * Objects sharing a shape may be freed on different threads, see
+ * json_clone(). Only one of them drops the last reference to the shape, but
+ * its siblings may go at the same time, each removing itself from the parent.
+ */
+static void _json_shape_release(struct json_shape *shape)
+{
+    while ((shape != NULL) && (--shape->refs == 0)) {
+        struct json_shape *parent = shape->parent;
+
+        if (parent != NULL) {
+            size_t i;
+
+            pthread_mutex_lock(&_json_shape_lock);
+
+            for (i = 0; parent->next[i] != shape; ++i)
+                ;
+
+            parent->next[i] = parent->next[--parent->nnext];
+
+            pthread_mutex_unlock(&_json_shape_lock);
+            free(shape->keys[shape->count - 1]);
+        }
+
+        free(shape->keys);
+        free(shape->lens);
+        free(shape->next);
+        free(shape);
+
+        shape = parent;
+    }
+}
+
+/* Parses a value that isn't a container */
+static struct json_value *_json_parse_scalar(struct json_lexer_state *lex,
+                                             struct json_token *tok)
+{
+    switch (tok->type) {
+    case TOK_STRING: {
+        struct json_value *str = json_value_new(JSON_STRING);
+        const char *raw = lex->input + tok->i + 1;
+
+        if ((lex->flags & JSON_PARSE_VIEW)
+                && !memchr(raw, '\\', tok->j - tok->i - 2)) {
+            /* Nothing to decode, so refer to the input directly */
+            str->flags = JSON_VALUE_VIEW;
+            str->value.jstring = (char *)raw;
+
+            return str;
+        }
+
+        if (lex->flags & JSON_PARSE_INSITU) {
+            str->flags = JSON_VALUE_BORROWED;
+            str->value.jstring = _json_parse_string_insitu(lex, tok);
+        } else {
+            str->value.jstring = json_parse_string(lex, tok);
+        }
+
+        if (str->value.jstring == NULL) {
+            free(str);
+            return NULL;
+        }
+
+        return str;
+    }
+    case TOK_NUMBER: {
+        const char *raw = lex->input + tok->i;
+        size_t len = tok->j - tok->i;
+        struct json_value *num;
+        double n;
+
+        if (!(lex->flags & JSON_PARSE_LAZY)) {
+            if (json_parse_number(raw, len, &n))
+                return NULL;
+
+            return json_number_new(n);
+        }
+
+        /* The text is written out as is later on, so it better be right */
+        if (!_json_is_number(raw, len))
+            return NULL;
+
+        num = json_value_new(JSON_NUMBER);
+        num->flags = JSON_VALUE_RAW;
+
+        /*
+         * The length is found again by looking for the end of the text, so
+         * views need something after them in the input that stops that
+         */
+        if ((lex->flags & (JSON_PARSE_VIEW | JSON_PARSE_INSITU))
+                && (tok->j < lex->len)) {
+            num->flags |= (lex->flags & JSON_PARSE_VIEW)
+                ? JSON_VALUE_VIEW
+                : JSON_VALUE_BORROWED;
+            num->value.jraw = (char *)raw;
+        } else {
+            num->value.jraw = strndup(raw, len);
+        }
+
+        return num;
+    }
+    case TOK_TRUE:
+        return json_bool_new(true);
+
+    case TOK_FALSE:
+        return json_bool_new(false);
+
+    case TOK_NULL:
+        return json_null_new();
+
+    default:
+        return NULL;
+    }
+}
+
+/* Sets up frame for an object or array that was just opened */
+static void _json_frame_open(struct json_lexer_state *lex,
+                             struct json_parse_frame *frame,
+                             bool object)
+{
+    memset(frame, 0, sizeof(*frame));
+
+    if (!object) {
+        /* Packed from the first number on, until anything else shows up */
+        frame->type = (lex->flags & JSON_PARSE_PACKED)
+            ? JSON_FRAME_PACKED
+            : JSON_FRAME_ARRAY;
+        frame->container = json_array_new();
+    } else if (lex->shapes != NULL) {
+        /* Values go into a block of their own, the object comes last */
+        frame->type = JSON_FRAME_SHAPED;
+        frame->shape = lex->shapes;
+        frame->shape->refs++;
+
+        frame->cap = 4;
+        frame->shaped = malloc(
+            sizeof(*frame->shaped) + sizeof(struct json_value) * frame->cap);
+    } else if (lex->flags & JSON_PARSE_INSITU) {
+        /* Keys are decoded in the input and stay there */
+        frame->type = JSON_FRAME_INSITU;
+        frame->container = json_value_new(JSON_OBJECT);
+        frame->container->flags = JSON_VALUE_BORROWED;
+        frame->container->value.jobject = hashtable_new_with_free(
+            str_hash, str_equal,
+            NULL, (void (*)(void*))json_free_wrapper_hash);
+    } else if (lex->flags & JSON_PARSE_VIEW) {
+        /* Keys stay in the input, see json_view_key() */
+        frame->type = JSON_FRAME_VIEW;
+        frame->container = json_value_new(JSON_OBJECT);
+        frame->container->flags = JSON_VALUE_VIEW;
+        frame->container->value.jobject = hashtable_new_with_free(
+            _json_view_key_hash, _json_view_key_equal,
+            NULL, (void (*)(void*))json_free_wrapper_hash);
+    } else {
+        frame->type = JSON_FRAME_OBJECT;
+        frame->container = json_object_new();
+    }
+}
+
+/*
+ * Reads on after the opening bracket or a comma: returns 0 if a value follows
+ * (with the key of objects already read), 1 if the container closed and -1
+ * on error. Trailing commas are fine.
+ */
+static int _json_frame_next(struct json_lexer_state *lex,
+                            struct json_parse_frame *frame)
+{
+    struct json_token tok;
+    size_t oldpos = lex->pos;
+
+    if (json_lexer_next_token(lex, &tok))
+        return -1;
+
+    if ((frame->type == JSON_FRAME_ARRAY)
+            || (frame->type == JSON_FRAME_PACKED)) {
+        if (tok.type == TOK_SQUARE_BRACKET_CLOSE)
+            return 1;
+
+        /* Leave the token to be read as the start of the element */
+        lex->pos = oldpos;
+        return 0;
+    }
+
+    if (tok.type == TOK_BRACE_CLOSE)
+        return 1;
+
+    if (tok.type != TOK_STRING)
+        return -1;
+
+    frame->key = (char *)lex->input + tok.i + 1;
+    frame->keylen = tok.j - tok.i - 2;
+
+    switch (frame->type) {
+    case JSON_FRAME_INSITU:
+        frame->key = _json_parse_string_insitu(lex, &tok);
+        break;
+
+    case JSON_FRAME_VIEW:
+        /* Only check the escapes, it's decoded on demand */
+        if (memchr(frame->key, '\\', frame->keylen)) {
+            char *tmp = json_parse_string(lex, &tok);
+
+            if (tmp == NULL)
+                return -1;
+
+            free(tmp);
+        }
+
+        break;
+
+    case JSON_FRAME_SHAPED:
+        if (memchr(frame->key, '\\', frame->keylen)) {
+            frame->key = frame->tmp = json_parse_string(lex, &tok);
+
+            if (frame->tmp == NULL)
+                return -1;
+
+            frame->keylen = strlen(frame->tmp);
+        }
+
+        break;
+
+    default:
+        frame->key = json_parse_string(lex, &tok);
+        break;
+    }
+
+    if (frame->key == NULL)
+        return -1;
+
+    if (json_lexer_next_token(lex, &tok) || (tok.type != TOK_COLON))
+        return -1;
+
+    return 0;
+}
+
+/* Adds val to the container (as the value of the key just read) */
+static void _json_frame_attach(struct json_parse_frame *frame,
+                               struct json_value *val)
+{
+    switch (frame->type) {
+    case JSON_FRAME_PACKED: {
+        struct json_value *arr = frame->container;
+
+        if (val->type == JSON_NUMBER) {
+            _json_packed_push(arr, *json_get_number(val));
+            json_free(val);
+            break;
+        }
+
+        /* Not just numbers after all */
+        frame->type = JSON_FRAME_ARRAY;
+
+        if (arr->flags & JSON_VALUE_PACKED) {
+            struct json_packed *packed = arr->value.jpacked;
+
+            arr->value.jarray = _json_packed_list(packed, &frame->tail);
+            arr->flags &= ~JSON_VALUE_PACKED;
+
+            free(packed);
+        }
+    }
+    /* fall through */
+    case JSON_FRAME_ARRAY: {
+        /* Appending in constant time, list_append() would walk the list */
+        struct list *link = list_new_with_data(val);
+
+        if (frame->tail != NULL) {
+            link->prev = frame->tail;
+            frame->tail->next = link;
+        } else {
+            frame->container->value.jarray = link;
+        }
+
+        frame->tail = link;
+        break;
+    }
+    case JSON_FRAME_SHAPED:
+        _json_frame_attach_shaped(frame, val);
+        break;
+
+    default:
+        hashtable_insert(frame->container->value.jobject, frame->key, val);
+        frame->key = NULL;
+        break;
+    }
+}
+
+/*
+ * Follows the transition of the shape for the key just read (or adds one) and
+ * moves val in with the other values. Objects that turn out to have too many
+ * keys carry on as regular objects.
+ */
+static void _json_frame_attach_shaped(struct json_parse_frame *frame,
+                                      struct json_value *val)
+{
+    struct json_shape *shape = frame->shape;
+    struct json_shape *next;
+    size_t i;
+
+    /*
+     * Shapes are only ever extended by keys they don't have yet, so an
+     * existing transition also rules out duplicates.
+     */
+    if ((next = _json_shape_transition(shape, frame->key, frame->keylen))
+            == NULL) {
+        if ((i = _json_shape_find(shape, frame->key, frame->keylen))
+                != (size_t)-1) {
+            /* Duplicate key, the last one wins */
+            json_free_contents(&frame->shaped->values[i]);
+            frame->shaped->values[i] = *val;
+
+            goto exit;
+        }
+
+        if (shape->count == JSON_SHAPE_MAX_KEYS) {
+            frame->shaped->shape = shape;
+
+            frame->type = JSON_FRAME_OBJECT;
+            frame->container = _json_shaped_unshape(frame->shaped);
+
+            hashtable_insert(frame->container->value.jobject,
+                             (frame->tmp != NULL)
+                                 ? frame->tmp
+                                 : strndup(frame->key, frame->keylen),
+                             val);
+
+            frame->shaped = NULL;
+            frame->shape = NULL;
+            frame->key = NULL;
+            frame->tmp = NULL;
+            return;
+        }
+
+        next = _json_shape_new(shape, frame->key, frame->keylen);
+    }
+
+    if (shape->count == frame->cap) {
+        frame->cap *= 2;
+        frame->shaped = realloc(
+            frame->shaped,
+            sizeof(*frame->shaped) + sizeof(struct json_value) * frame->cap);
+    }
+
+    frame->shaped->values[shape->count] = *val;
+
+    next->refs++;
+    _json_shape_release(shape);
+    frame->shape = next;
+
+exit:
+    free(val);
+    free(frame->tmp);
+
+    frame->key = NULL;
+    frame->tmp = NULL;
+}
+
+/* The finished container */
+static struct json_value *_json_frame_close(struct json_parse_frame *frame)
+{
+    struct json_value *obj;
+    size_t size;
+
+    if (frame->type != JSON_FRAME_SHAPED)
+        return frame->container;
+
+    /* Only as much as needed */
+    size = sizeof(struct json_value) * frame->shape->count;
+    frame->shaped = realloc(frame->shaped, sizeof(*frame->shaped) + size);
+    frame->shaped->shape = frame->shape;
+
+    obj = json_value_new(JSON_OBJECT);
+    obj->flags = JSON_VALUE_SHAPED;
+    obj->value.jshaped = frame->shaped;
+
+    return obj;
+}
+
+/* Frees the unfinished container, along with the key read for it if any */
+static void _json_frame_free(struct json_parse_frame *frame)
+{
+    if (frame->type == JSON_FRAME_OBJECT)
+        free(frame->key);
+
+    free(frame->tmp);
+    json_free(_json_frame_close(frame));
+}
+
+static int _json_is_number_char(char c)
+{
+    return isdigit((unsigned char)c) || (c == '+') || (c == '-') || (c == '.')
+        || (c == 'e') || (c == 'E');
+}
+
+/*
+ * Whether the n bytes at str are a number exactly as the JSON grammar has it,
+ * which the lexer doesn't care about: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?
+ * [0-9]+)?
+ */
+static bool _json_is_number(const char *str, size_t n)
+{
+    size_t i = 0;
+    size_t start;
+
+    if ((i < n) && (str[i] == '-'))
+        i++;
+
+    if ((i < n) && (str[i] == '0')) {
+        i++;
+    } else {
+        for (start = i; (i < n) && isdigit((unsigned char)str[i]); ++i);
+
+        if (i == start)
+            return false;
+    }
+
+    if ((i < n) && (str[i] == '.')) {
+        for (start = ++i; (i < n) && isdigit((unsigned char)str[i]); ++i);
+
+        if (i == start)
+            return false;
+    }
+
+    if ((i < n) && ((str[i] == 'e') || (str[i] == 'E'))) {
+        if ((++i < n) && ((str[i] == '+') || (str[i] == '-')))
+            i++;
+
+        for (start = i; (i < n) && isdigit((unsigned char)str[i]); ++i);
+
+        if (i == start)
+            return false;
+    }
+
+    return i == n;
+}
+
+/* Skips JSON whitespace (which is just these four) from i on */
+static size_t _json_validate_ws(const char *s, size_t n, size_t i)
+{
+    while ((i < n)
+            && ((s[i] == ' ') || (s[i] == '\n')
+                || (s[i] == '\r') || (s[i] == '\t')))
+        i++;
+
+    return i;
+}
+
+/*
+ * Moves i from just past an opening quote to just past the closing one like
+ * _json_lexer_scan_string() does, but also checks escapes and rejects control
+ * characters. Returns NULL if the string is fine, otherwise what's wrong with
+ * it, with i on the offending byte.
+ */
+static const char *_json_validate_string(const char *s, size_t n, size_t *i)
+{
+    size_t j = *i;
+
+#ifdef JSON_LEXER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+#endif
+
+    while (j < n) {
+        unsigned char c;
+        unsigned code;
+        int w;
+
+#ifdef JSON_LEXER_SSE2
+        for (; j + 16 <= n; j += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + j));
+
+            /* Signed, so non-ASCII bytes are less than a space too */
+            int mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                             _mm_cmpeq_epi8(v, bslash)),
+                _mm_cmplt_epi8(v, space)));
+
+            if (mask) {
+                j += __builtin_ctz(mask);
+                break;
             }
-        } else if (isspace(c) || iscntrl(c)) {
-            state->pos++;
-        } else if (c == '"') {
-            tok->type = TOK_STRING;
-            tok->i = state->pos++;
+        }
+#else
+        #define ONES  ((uint64_t)0x0101010101010101ULL)
+        #define HIGHS ((uint64_t)0x8080808080808080ULL)
 
-            while (state->input[state->pos] != '"') {
-                if (state->input[state->pos] == '\\')
-                    /*
-                     * skip backspace and let next line skip escape code, we'll
-                     * let the parser take care of validating the string.
-                     */
-                    state->pos++;
-                state->pos++;
+        for (; j + 8 <= n; j += 8) {
+            uint64_t x;
+            uint64_t q;
+            uint64_t b;
+
+            memcpy(&x, s + j, sizeof(x));
+
+            q = x ^ (ONES * '"');
+            b = x ^ (ONES * '\\');
+
+            /* Quotes, backslashes, control characters and non-ASCII */
+            if (((q - ONES) | (b - ONES) | (x - ONES * ' ') | x) & HIGHS)
+                break;
+        }
+
+        #undef ONES
+        #undef HIGHS
+#endif
+
+        if (j >= n)
+            break;
+
+        c = s[j];
+
+        if (c == '"') {
+            *i = j + 1;
+            return NULL;
+        } else if (c < ' ') {
+            *i = j;
+            return "control character in string";
+        } else if (c < 0x80 && c != '\\') {
+            j++;
+            continue;
+        } else if (c >= 0x80) {
+            if ((w = utf8_validate_char(s + j, n - j)) == 0) {
+                *i = j;
+                return "malformed UTF-8";
             }
 
-            tok->j = ++state->pos;
-            return 0;
-        } else if (isdigit(c) || (c == '+') || (c == '-')) {
-            tok->type = TOK_NUMBER;
-            tok->i = state->pos;
+            j += w;
+            continue;
+        }
 
-            /*
-             * For the sake of simplicity let's just ignore what order the
-             * individual parts are in and let the parser worry about that.
-             */
-            for (;;) {
-                char c = state->input[state->pos++];
+        /* An escape */
+        if (j + 1 >= n)
+            break;
 
-                if (isdigit(c) || (strchr("+-.eE", c) != NULL))
-                    continue;
-                else
-                    break;
+        if ((s[j + 1] != '\0') && strchr("\"\\/bfnrt", s[j + 1])) {
+            j += 2;
+            continue;
+        }
+
+        if ((s[j + 1] != 'u') || (n - j < 6) || _json_hex4(s + j + 2, &code)) {
+            *i = j;
+            return "malformed escape";
+        }
+
+        /* Surrogates only come in pairs, high first */
+        if ((code >= 0xdc00) && (code <= 0xdfff)) {
+            *i = j;
+            return "unpaired surrogate";
+        } else if ((code >= 0xd800) && (code <= 0xdbff)) {
+            if ((n - j < 12) || (s[j + 6] != '\\') || (s[j + 7] != 'u')
+                    || _json_hex4(s + j + 8, &code)
+                    || (code < 0xdc00) || (code > 0xdfff)) {
+                *i = j;
+                return "unpaired surrogate";
             }
 
-            /*
-             * Back pos back up a character so we can look at that in the next
-             * round.
-             */
-            tok->j = --state->pos;
+            j += 6;
+        }
+
+        j += 6;
+    }
+
+    *i = n;
+    return "unexpected end of input";
+}
+
+/*
+ * The end of the number at i, or 0 if it's malformed. This is
+ * _json_is_number() without having to find the end first.
+ */
+static size_t _json_validate_number(const char *s, size_t n, size_t i)
+{
+    size_t start;
+
+    if (s[i] == '-')
+        i++;
+
+    if ((i < n) && (s[i] == '0')) {
+        i++;
+    } else {
+        start = i;
+
+        if ((i = _json_validate_digits(s, n, i)) == start)
             return 0;
-        } else if (isalpha(c)) {
-            size_t len;
+    }
 
-            /* true, false or null, scan until non-alpha */
-            tok->i = state->pos;
+    if ((i < n) && (s[i] == '.')) {
+        start = ++i;
 
-            while (isalpha(state->input[state->pos]))
-                state->pos++;
+        if ((i = _json_validate_digits(s, n, i)) == start)
+            return 0;
+    }
 
-            len = state->pos - tok->i;
+    if ((i < n) && ((s[i] == 'e') || (s[i] == 'E'))) {
+        if ((++i < n) && ((s[i] == '+') || (s[i] == '-')))
+            i++;
 
-            if (!strncmp(state->input + tok->i, "null", len))
-                tok->type = TOK_NULL;
-            else if (!strncmp(state->input + tok->i, "false", len))
-                tok->type = TOK_FALSE;
-            else if (!strncmp(state->input + tok->i, "true", len))
-                tok->type = TOK_TRUE;
-            else
-                return 1;
+        start = i;
+
+        if ((i = _json_validate_digits(s, n, i)) == start)
+            return 0;
+    }
+
+    /* As in 01 or 1.2.3, which the lexer takes for one token */
+    if ((i < n) && _json_is_number_char(s[i]))
+        return 0;
+
+    return i;
+}
+
+/* Skips digits from i on, eight at a time for as long as possible */
+static size_t _json_validate_digits(const char *s, size_t n, size_t i)
+{
+    #define ONES ((uint64_t)0x0101010101010101ULL)
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+
+        memcpy(&x, s + i, sizeof(x));
+
+        /* Digits are 0x30 to 0x39, so adding 6 leaves the high nibble as is */
+        if (((x & (ONES * 0xf0))
+                    | (((x + ONES * 0x06) & (ONES * 0xf0)) >> 4))
+                != ONES * 0x33)
+            break;
+    }
+
+    #undef ONES
+
+    while ((i < n) && ((unsigned)(s[i] - '0') < 10))
+        i++;
+
+    return i;
+}
+
+/* Moves i past an object key and the colon after it, see above */
+static const char *_json_validate_key(const char *s, size_t n, size_t *i)
+{
+    const char *what;
+
+    if ((*i = _json_validate_ws(s, n, *i)) >= n)
+        return "unexpected end of input";
+    else if (s[*i] != '"')
+        return "expected a key";
+
+    (*i)++;
+
+    if ((what = _json_validate_string(s, n, i)) != NULL)
+        return what;
+
+    if ((*i = _json_validate_ws(s, n, *i)) >= n)
+        return "unexpected end of input";
+    else if (s[*i] != ':')
+        return "expected ':'";
+
+    (*i)++;
+    return NULL;
+}
+
+static bool _json_is_space(char c)
+{
+    return (c == ' ') || (c == '\n') || (c == '\r') || (c == '\t');
+}
+
+/*
+ * The next whitespace or quote from i on, or n. Anything up to a space is
+ * worth a closer look, but only proper whitespace counts.
+ */
+static size_t _json_minify_scan(const char *s, size_t n, size_t i)
+{
+#ifdef JSON_LEXER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i space = _mm_set1_epi8(' ');
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+        /* Unsigned, v is at most a space where the minimum is v itself */
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(v, quote),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, space), v)));
+
+        if (mask) {
+            i += __builtin_ctz(mask);
+            break;
+        }
+    }
+#else
+    #define ONES  ((uint64_t)0x0101010101010101ULL)
+    #define HIGHS ((uint64_t)0x8080808080808080ULL)
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        uint64_t q;
+
+        memcpy(&x, s + i, sizeof(x));
+        q = x ^ (ONES * '"');
+
+        /* Quotes and bytes up to a space */
+        if (((q - ONES) | (x - ONES * 0x21)) & ~x & HIGHS)
+            break;
+    }
+
+    #undef ONES
+    #undef HIGHS
+#endif
+
+    for (; (i < n) && (s[i] != '"') && !_json_is_space(s[i]); ++i);
+
+    return i;
+}
+
+/*
+ * Just past the quote that ends the string starting at i (or n), like
+ * _json_lexer_scan_string() without checking any of it
+ */
+static size_t _json_minify_string(const char *s, size_t n, size_t i)
+{
+#ifdef JSON_LEXER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+#endif
 
+    while (i < n) {
+#ifdef JSON_LEXER_SSE2
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+            int mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(v, quote),
+                _mm_cmpeq_epi8(v, bslash)));
+
+            if (mask) {
+                i += __builtin_ctz(mask);
+                break;
+            }
+        }
+#else
+        #define ONES  ((uint64_t)0x0101010101010101ULL)
+        #define HIGHS ((uint64_t)0x8080808080808080ULL)
+
+        for (; i + 8 <= n; i += 8) {
+            uint64_t x;
+            uint64_t q;
+            uint64_t b;
+
+            memcpy(&x, s + i, sizeof(x));
+
+            q = x ^ (ONES * '"');
+            b = x ^ (ONES * '\\');
+
+            if (((q - ONES) & ~q & HIGHS) || ((b - ONES) & ~b & HIGHS))
+                break;
+        }
+
+        #undef ONES
+        #undef HIGHS
+#endif
+
+        for (; (i < n) && (s[i] != '"') && (s[i] != '\\'); ++i);
+
+        if (i >= n)
+            break;
+        else if (s[i] == '"')
+            return i + 1;
+
+        /* Skip whatever is escaped */
+        i += 2;
+    }
+
+    return n;
+}
+
+/* The first byte from i on that isn't whitespace, or n */
+static size_t _json_minify_space(const char *s, size_t n, size_t i)
+{
+#ifdef JSON_LEXER_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i tab = _mm_set1_epi8('\t');
+#endif
+
+    /* Mostly there's a single space or none at all */
+    if ((i + 1 >= n) || !_json_is_space(s[i + 1]))
+        return ((i < n) && _json_is_space(s[i])) ? i + 1 : i;
+
+#ifdef JSON_LEXER_SSE2
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+        /* Anything but the four bytes _json_is_space() takes */
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, newline)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, tab))))
+            ^ 0xffff;
+
+        if (mask) {
+            i += __builtin_ctz(mask);
+            break;
+        }
+    }
+#endif
+
+    for (; (i < n) && _json_is_space(s[i]); ++i);
+
+    return i;
+}
+
+static void _json_reformat_newline(struct json_writer *w, size_t indent)
+{
+    static const char spaces[] = "                                ";
+
+    json_writer_write(w, "\n", 1);
+
+    for (; indent >= sizeof(spaces) - 1; indent -= sizeof(spaces) - 1)
+        json_writer_write(w, spaces, sizeof(spaces) - 1);
+
+    if (indent > 0)
+        json_writer_write(w, spaces, indent);
+}
+
+/*
+ * Advance lex from just past an opening quote to the closing one, validating
+ * the UTF-8 in between (escapes are left to _json_unescape()). Plain ASCII is
+ * skipped 16 bytes at a time with SSE2, or 8 bytes at a time using integer
+ * arithmetic otherwise. Returns 1 with lex->pos on the offending byte if the
+ * string is malformed, or at the end of input if it isn't terminated.
+ */
+static int _json_lexer_scan_string(struct json_lexer_state *lex)
+{
+    const char *s = lex->input;
+    size_t n = lex->len;
+    size_t i = lex->pos;
+
+#ifdef JSON_LEXER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+#endif
+
+    while (i < n) {
+        unsigned char c;
+        int w;
+
+#ifdef JSON_LEXER_SSE2
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+            /* The high bits are exactly the non-ASCII bytes */
+            int mask = _mm_movemask_epi8(_mm_or_si128(
+                           _mm_cmpeq_epi8(v, quote),
+                           _mm_cmpeq_epi8(v, bslash)))
+                     | _mm_movemask_epi8(v);
+
+            if (mask) {
+                i += __builtin_ctz(mask);
+                break;
+            }
+        }
+#else
+        #define ONES  ((uint64_t)0x0101010101010101ULL)
+        #define HIGHS ((uint64_t)0x8080808080808080ULL)
+
+        /* As in _json_writer_scan(), the exact position is found below */
+        for (; i + 8 <= n; i += 8) {
+            uint64_t x;
+            uint64_t q;
+            uint64_t b;
+
+            memcpy(&x, s + i, sizeof(x));
+
+            q = x ^ (ONES * '"');
+            b = x ^ (ONES * '\\');
+
+            if ((((q - ONES) | (b - ONES)) & ~x & HIGHS) || (x & HIGHS))
+                break;
+        }
+
+        #undef ONES
+        #undef HIGHS
+#endif
+
+        if (i >= n)
+            break;
+
+        c = s[i];
+
+        if (c == '"') {
+            lex->pos = i;
             return 0;
+        } else if (c == '\\') {
+            /* Whatever is escaped is checked when decoding */
+            i += 2;
+        } else if (c < 0x80) {
+            i++;
+        } else if ((w = utf8_validate_char(s + i, n - i)) != 0) {
+            i += w;
         } else {
-            tok->i = state->pos;
+            lex->pos = i;
             return 1;
         }
     }
+
+    lex->pos = n;
+    return 1;
 }
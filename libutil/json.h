@@ -7,6 +7,7 @@
 #include "container/hashtable.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <uchar.h>
 #include <stdbool.h>
@@ -21,21 +22,54 @@ enum json_value_type
     JSON_OBJECT
 };
 
+/* Flags for json_value.flags */
+#define JSON_VALUE_VIEW     0x01 /* string or keys point into the parser input */
+#define JSON_VALUE_BORROWED 0x02 /* string or keys are not owned by the value  */
+#define JSON_VALUE_SHAPED   0x04 /* object members are a struct json_shaped   */
+#define JSON_VALUE_SHARED   0x08 /* contents are shared with clones (rc.h)    */
+#define JSON_VALUE_CACHED   0x10 /* container text is cached, see json/cache.h */
+#define JSON_VALUE_RAW      0x20 /* number is still its text from the input   */
+#define JSON_VALUE_PACKED   0x40 /* array elements are a struct json_packed   */
+
+/* A sequence of object keys shared by all objects having them, see below */
+struct json_shape;
+struct json_shaped;
+struct json_packed;
+
 struct json_value
 {
     enum json_value_type type;
+    unsigned flags;
 
     union json_value_value
     {
         char *jstring;
         double jnumber;
+        char *jraw; /* with JSON_VALUE_RAW, see JSON_PARSE_LAZY */
         bool jbool;
 
         struct list *jarray;
         struct hashtable *jobject;
+        struct json_shaped *jshaped;
+        struct json_packed *jpacked;
+        struct json_value *jshared; /* reference counted, see rc.h */
     } value;
 };
 
+struct json_shaped
+{
+    struct json_shape *shape;
+    struct json_value values[]; /* one per key of shape, in the same order */
+};
+
+/* An array of nothing but numbers, see JSON_PARSE_PACKED */
+struct json_packed
+{
+    size_t len;
+    size_t cap;
+    double values[];
+};
+
 enum json_token_type
 {
     /* Object tokens */
@@ -71,10 +105,54 @@ struct json_token
     enum json_token_type type;
 };
 
+/* Flags for json_parse_ex() */
+#define JSON_PARSE_VIEW   0x01 /* reference strings in the input, see below */
+#define JSON_PARSE_INSITU 0x02 /* only used by json_parse_insitu()         */
+#define JSON_PARSE_SHAPES 0x04 /* share keys between same shaped objects   */
+#define JSON_PARSE_LAZY   0x08 /* convert numbers only once they are read   */
+#define JSON_PARSE_PACKED 0x10 /* store arrays of numbers as double[]       */
+
+#define JSON_SHAPE_MAX_KEYS 32
+
+/* Default nesting limit for json_parse_value(), deeper documents are errors */
+#define JSON_PARSE_MAX_DEPTH 1024
+
 struct json_lexer_state
 {
     size_t pos; /* position within the input range */
+    size_t len; /* length of the input range */
     const char *input;
+
+    unsigned flags;   /* JSON_PARSE_* flags for json_parse_value() */
+    size_t max_depth; /* nesting limit for json_parse_value() */
+
+    /* The empty shape all others derive from, with JSON_PARSE_SHAPES */
+    struct json_shape *shapes;
+};
+
+struct json_object_iterator
+{
+    const struct json_value *obj;
+
+    struct hashtable_iterator iter;
+    size_t i;
+    char *tmp;
+};
+
+/* Where and why json_validate() failed */
+struct json_error
+{
+    size_t pos;          /* offset of the offending byte, or of the end */
+    const char *message; /* static, never to be freed */
+};
+
+struct json_array_iterator
+{
+    const struct json_value *arr;
+
+    struct list *ptr;
+    size_t i;
+    struct json_value tmp;
 };
 
 struct json_value *json_value_new(enum json_value_type type);
@@ -86,6 +164,34 @@ struct json_value *json_null_new();
 struct json_value *json_array_new();
 struct json_value *json_object_new();
 
+/*
+ * Returns a copy of val that shares all of its contents with val, in constant
+ * time. Strings, arrays and objects that are cloned turn into references to
+ * the same reference counted contents and have JSON_VALUE_SHARED set (val
+ * does too, afterwards). The contents are copied one level deep when one of
+ * the sharers is modified, by json_set_string(), json_get_array(),
+ * json_get_object() or json_unshare(), so the values inside them stay shared
+ * until those are modified in turn.
+ *
+ * json_object_lookup() and json_pointer_get() unshare every container on
+ * the way, so what they return is the caller's own to modify (through the
+ * accessors above, should it be shared itself). Values reached any other way
+ * (json_object_lookup_const() or the iterators) may still be shared and must
+ * not be modified. Returns NULL if out of memory.
+ *
+ * Reference counts are atomic, so clones may be read and freed on different
+ * threads. Unsharing writes to the values that are still shared with others
+ * though, so none of the clones of a document may be modified while another
+ * thread is using any of them.
+ */
+struct json_value *json_clone(struct json_value *val);
+
+/*
+ * Gives val contents of its own, copying them one level deep if they are
+ * shared with clones. Returns 0 on success and 1 if out of memory.
+ */
+int json_unshare(struct json_value *val);
+
 bool json_is_null(struct json_value *val);
 enum json_value_type json_get_value_type(struct json_value *val);
 
@@ -97,9 +203,35 @@ enum json_value_type json_get_value_type(struct json_value *val);
 const char *json_get_string(struct json_value *val);
 void        json_set_string(struct json_value *val, const char *newstring);
 
+/*
+ * Like json_get_string(), but also stores the length of the string in n and
+ * never copies a string that's only a view into the parser input (in which
+ * case the result is not zero terminated).
+ */
+const char *json_get_string_n(const struct json_value *val, size_t *n);
+
 double *json_get_number(struct json_value *val);
 bool   *json_get_bool  (struct json_value *val);
 
+/*
+ * The value of the number val (0 for anything else) for when val is const,
+ * converting JSON_VALUE_RAW numbers on every call rather than once in place.
+ */
+double json_get_number_value(const struct json_value *val);
+
+/*
+ * Stores the number val in out if it's an integer that fits, exactly, and
+ * returns 0. Returns 1 otherwise. JSON_VALUE_RAW numbers are read from their
+ * text (so integers beyond 2^53 come out right) and stay as they are.
+ */
+int json_get_int64(const struct json_value *val, int64_t *out);
+
+/*
+ * The text of a JSON_VALUE_RAW number as it was in the input (not zero
+ * terminated) with its length stored in n, or NULL for any other value.
+ */
+const char *json_get_number_text(const struct json_value *val, size_t *n);
+
 /*
  * Returns true or false in a more weakly typed manner. Empty strings, false,
  * null, zero, an empty array, an empty hashtable return false. Everything else
@@ -116,11 +248,103 @@ bool json_get_logical_bool(struct json_value *val);
 struct list      *json_get_array (struct json_value *val);
 struct hashtable *json_get_object(struct json_value *val);
 
+/*
+ * The numbers of a JSON_VALUE_PACKED array as a single block, to be read or
+ * modified in place, with their count stored in n. Returns NULL if arr is
+ * anything else.
+ */
+double *json_get_packed(struct json_value *arr, size_t *n);
+
+/*
+ * Appends val to the array arr, which takes it over. Numbers appended to
+ * packed arrays are stored as such (and val is freed), anything else turns
+ * them into regular arrays first. Returns 0 on success and 1 if arr isn't an
+ * array.
+ */
+int json_array_append(struct json_value *arr, struct json_value *val);
+
+/*
+ * Turns a packed array into a regular one in place, as json_get_array() does,
+ * unsharing it first (see json_clone()). Nothing happens to anything else.
+ * Returns 0 on success and 1 if out of memory, leaving arr as it was.
+ */
+int json_array_unpack(struct json_value *arr);
+
+/* Number of elements of the array arr, whatever its form */
+size_t json_array_size(const struct json_value *arr);
+
+/*
+ * Iterates the elements of any kind of array without converting it. The
+ * elements of packed arrays are numbers made up on the spot, only valid
+ * until the next call.
+ *
+ *     struct json_array_iterator iter;
+ *     struct json_value *val;
+ *
+ *     json_array_iterator_init(&iter, arr);
+ *     while (json_array_iterator_next(&iter, &val))
+ *         ...
+ */
+void json_array_iterator_init(struct json_array_iterator *iter,
+                              const struct json_value *arr);
+
+bool json_array_iterator_next(struct json_array_iterator *iter,
+                              struct json_value **val);
+
+/*
+ * Looks up key in the object obj, returns NULL if there is no such key or obj
+ * is not an object. Unlike hashtable_lookup() on json_get_object(), this
+ * works on objects with JSON_VALUE_VIEW keys and on JSON_VALUE_SHAPED objects
+ * as they are. obj is unshared first (see json_clone()), so the result may
+ * be modified.
+ */
+struct json_value *json_object_lookup(struct json_value *obj, const char *key);
+
+/* Same for reading only, without unsharing anything */
+const struct json_value *json_object_lookup_const(const struct json_value *obj,
+                                                  const char *key);
+
+/* Number of members of the object obj, whatever its keys look like */
+size_t json_object_size(const struct json_value *obj);
+
+/*
+ * Iterates the members of any kind of object without converting it. Keys are
+ * decoded, but not necessarily zero terminated (their length is stored in n)
+ * and only valid until the next call. Iterators that are abandoned before
+ * json_object_iterator_next() returned false have to be freed.
+ *
+ *     struct json_object_iterator iter;
+ *     struct json_value *val;
+ *     const char *key;
+ *     size_t n;
+ *
+ *     json_object_iterator_init(&iter, obj);
+ *     while (json_object_iterator_next(&iter, &key, &n, &val))
+ *         printf("%.*s\n", (int)n, key);
+ */
+void json_object_iterator_init(struct json_object_iterator *iter,
+                               const struct json_value *obj);
+
+bool json_object_iterator_next(struct json_object_iterator *iter,
+                               const char **key,
+                               size_t *n,
+                               struct json_value **val);
+
+void json_object_iterator_free(struct json_object_iterator *iter);
+
 /*
  * Although little helpers never harmed anybody.
  */
-#define JSON_OBJECT_LOOKUP(obj, key) \
-    (struct json_value *)hashtable_lookup(json_get_object((obj)), (key))
+#define JSON_OBJECT_LOOKUP(obj, key) json_object_lookup((obj), (key))
+
+/*
+ * The keys of JSON_VALUE_VIEW objects point just past the opening quote of
+ * the key in the input, escapes and all. This returns the decoded key and
+ * stores its length in n. That's key itself if there is nothing to decode
+ * (not zero terminated), otherwise a new string that's also stored in *tmp
+ * for the caller to free (*tmp is NULL otherwise).
+ */
+const char *json_view_key(const void *key, size_t *n, char **tmp);
 
 /*
  * Or bigger helpers. This one will segfault on a type mismatch (unless it
@@ -144,11 +368,113 @@ void json_free_wrapper(void *val, void *ud);
 void json_free(struct json_value *v);
 void json_free_contents(struct json_value *v);
 
+/*
+ * json_parse() parses a zero terminated string, json_parse_n() parses exactly
+ * n bytes of input which need not be terminated at all (or may contain more
+ * data after the first n bytes).
+ *
+ * json_parse_file() maps the file at path into memory and parses it in place,
+ * without first copying it to the heap. Files that can't be mapped (pipes and
+ * the like) are read and parsed in chunks instead, with the push parser (see
+ * json/stream.h). Either way, the file must hold the value and nothing but
+ * whitespace after it. Returns NULL on parse error or if the file can't be
+ * read.
+ */
 struct json_value *json_parse(const char *input);
+struct json_value *json_parse_n(const char *input, size_t n);
+struct json_value *json_parse_file(const char *path);
+
+/*
+ * json_parse_n() with JSON_PARSE_* flags.
+ *
+ * With JSON_PARSE_VIEW, strings and object keys that contain no escapes are
+ * not copied but point into input (which may just as well be a mapped file),
+ * so input must stay around for as long as the document does. Such values
+ * and objects have JSON_VALUE_VIEW set. Views are transparent for the most
+ * part: json_get_string() makes a copy of the string the first time it's
+ * called on one, json_get_object() converts the keys to regular strings (use
+ * json_object_lookup() to look up keys without converting anything).
+ *
+ * With JSON_PARSE_SHAPES, objects with the same keys in the same order (as
+ * in arrays of records) share a single shape holding the keys, while their
+ * values are stored inline in one block, in key order. Such objects have
+ * JSON_VALUE_SHAPED set, json_get_object() turns them into regular objects
+ * (moving their values, so pointers to members become invalid). Objects with
+ * more than JSON_SHAPE_MAX_KEYS keys are regular objects to begin with.
+ *
+ * With JSON_PARSE_LAZY, numbers are kept as the text they were in the
+ * input (pointing into it with JSON_PARSE_VIEW, copied otherwise) and have
+ * JSON_VALUE_RAW set. json_get_number() converts them to a double in place
+ * the first time it's called, until then they are written out exactly as
+ * they were read. Such numbers must follow the JSON grammar to the letter
+ * (no leading zeros or plus signs), as the text is written out unchecked.
+ *
+ * With JSON_PARSE_PACKED, arrays holding nothing but numbers (and at least
+ * one) store them as one block of doubles rather than as a list of values,
+ * and have JSON_VALUE_PACKED set. See json_get_packed() for the block,
+ * json_get_array() turns them into regular arrays. Numbers in such arrays
+ * are always converted, JSON_PARSE_LAZY or not.
+ */
+struct json_value *json_parse_ex(const char *input, size_t n, unsigned flags);
+
+/*
+ * Destructive parsing of a buffer owned by the caller: strings and keys are
+ * decoded and zero terminated right where they are in input, so no string
+ * is ever copied. The buffer is garbage afterwards, except as the storage
+ * for the document's strings, so it must outlive the document. Values and
+ * objects using it have JSON_VALUE_BORROWED set, json_get_object() moves the
+ * keys of such objects onto the heap.
+ */
+struct json_value *json_parse_insitu(char *input, size_t n);
+
 struct json_value *json_parse_value(struct json_lexer_state *lex);
 char *json_parse_string(struct json_lexer_state *lex,
                         struct json_token *tok);
 
+/* Same, storing the length in n as the string may contain U+0000 */
+char *json_parse_string_n(struct json_lexer_state *lex,
+                          struct json_token *tok,
+                          size_t *n);
+
+/*
+ * Converts the n bytes of number text at str (as found in a TOK_NUMBER token)
+ * into out. Returns 0 on success and 1 if str doesn't hold a number.
+ */
+int json_parse_number(const char *str, size_t n, double *out);
+
+/*
+ * Checks whether the n bytes at input are exactly one JSON value (surrounded
+ * by whitespace at most) without building anything or touching the heap.
+ * Returns 0 if so, otherwise 1 with the offset of the error and what it is
+ * stored in err (unless that's NULL).
+ *
+ * This goes by RFC 8259 to the letter and is stricter than the parser, which
+ * lets a few things slide: trailing commas, numbers like 01 or +1, control
+ * characters in strings and anything after the value. Nesting is limited to
+ * JSON_PARSE_MAX_DEPTH, as with the parser.
+ */
+int json_validate(const char *input, size_t n, struct json_error *err);
+
+/*
+ * Copies the n bytes of JSON text at input to out without any whitespace
+ * outside of strings, returning the new length. out must have space for n
+ * bytes and may be input itself, the result is not zero terminated. The text
+ * is not checked, see json_validate(), but strings are never touched.
+ */
+size_t json_minify(char *out, const char *input, size_t n);
+
+/*
+ * Same the other way around, with every element and member on a line of its
+ * own, indented by indent spaces per level. Like json_dump(), at most nout
+ * bytes (including the terminator) are written to out and the full length is
+ * returned either way.
+ */
+size_t json_reformat(char *out,
+                     size_t nout,
+                     const char *input,
+                     size_t n,
+                     unsigned indent);
+
 /*
  * These make use of snprintf which is not ANSI C90, so they are only exported
  * (and compiled) if C99 support is enabled
@@ -158,6 +484,14 @@ char *json_parse_string(struct json_lexer_state *lex,
     size_t json_dump_string(char *out, size_t nout, const char *str);
 #endif
 
+/*
+ * Set up state to lex the n bytes at input, with no flags and a max_depth of
+ * JSON_PARSE_MAX_DEPTH.
+ */
+void json_lexer_init(struct json_lexer_state *state,
+                     const char *input,
+                     size_t n);
+
 /*
  * Attempt to fetch the next token from state into tok. Returns 0 on success and
  * 1 on error. If 1 is returned, the position where to error occured is stored
@@ -166,5 +500,12 @@ char *json_parse_string(struct json_lexer_state *lex,
 int json_lexer_next_token(struct json_lexer_state *state,
                           struct json_token *tok);
 
+/*
+ * Skip over the next value, containers included, without building or fully
+ * validating it. Only string boundaries and bracket nesting are tracked.
+ * Returns 0 on success and 1 if the input ended prematurely.
+ */
+int json_lexer_skip_value(struct json_lexer_state *lex);
+
 
 #endif /* defined JSON_H */
@@ -0,0 +1,57 @@
+#ifndef JSON_BINARY_H
+#define JSON_BINARY_H
+
+#include <libutil/json/writer.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * What json/cbor.c and json/msgpack.c have in common: both write and read
+ * big endian integers of up to 64 bits behind a lead byte. Internal, not
+ * installed along with the other headers.
+ */
+
+struct json_binary_decoder
+{
+    const unsigned char *buf;
+    size_t len;
+    size_t pos;
+
+    size_t depth;
+};
+
+/* Write lead followed by the low nbytes bytes of val, in network order */
+static inline int _json_binary_put(struct json_writer *w,
+                                   unsigned char lead,
+                                   uint64_t val,
+                                   unsigned nbytes)
+{
+    char buf[9];
+    unsigned i;
+
+    buf[0] = lead;
+
+    for (i = 0; i < nbytes; ++i)
+        buf[nbytes - i] = (val >> (i * 8)) & 0xff;
+
+    return json_writer_write(w, buf, nbytes + 1);
+}
+
+/* Read an nbytes wide big endian integer */
+static inline int _json_binary_read(struct json_binary_decoder *dec,
+                                    unsigned nbytes,
+                                    uint64_t *out)
+{
+    unsigned i;
+
+    if (nbytes > dec->len - dec->pos)
+        return 1;
+
+    for (*out = 0, i = 0; i < nbytes; ++i)
+        *out = (*out << 8) | dec->buf[dec->pos++];
+
+    return 0;
+}
+
+#endif /* defined JSON_BINARY_H */
@@ -0,0 +1,350 @@
+#include <libutil/json/cache.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * What is known about a container that has been written: its text (unless
+ * that's too short to keep), whether it changed since, and the entry of the
+ * container it was last written in, for json_cache_touch() to follow. Parents
+ * of modified entries are always modified as well.
+ */
+struct json_cache_entry
+{
+    struct json_cache_entry *parent;
+
+    char *text;
+    size_t len;
+
+    bool dirty;
+    unsigned mark; /* number of the last sweep that found it in use */
+};
+
+/*
+ * All caches there are, for json_cache_modified() to find the one a
+ * container was written through
+ */
+static pthread_mutex_t _json_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list *_json_caches;
+
+static size_t _json_cache_hash(const void *key);
+static int _json_cache_equal(const void *a, const void *b);
+static void _json_cache_entry_free(void *data);
+
+static int _json_cache_put(struct json_cache *cache,
+                           struct json_value *val,
+                           struct json_cache_entry *parent);
+
+static void _json_cache_sweep(struct json_cache *cache,
+                              const struct json_value *root);
+static size_t _json_cache_mark(struct json_cache *cache,
+                               const struct json_value *val);
+
+
+void json_cache_init(struct json_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    cache->entries = hashtable_new_with_free(
+        _json_cache_hash, _json_cache_equal, NULL, _json_cache_entry_free);
+
+    json_writer_init_buffer(&cache->scratch);
+
+    pthread_mutex_lock(&_json_cache_lock);
+    _json_caches = list_prepend(_json_caches, cache);
+    pthread_mutex_unlock(&_json_cache_lock);
+}
+
+void json_cache_free(struct json_cache *cache)
+{
+    pthread_mutex_lock(&_json_cache_lock);
+    _json_caches = list_remove(_json_caches, cache, NULL, NULL);
+    pthread_mutex_unlock(&_json_cache_lock);
+
+    hashtable_free(cache->entries);
+    json_writer_free(&cache->scratch);
+}
+
+void json_cache_clear(struct json_cache *cache)
+{
+    hashtable_clear(cache->entries);
+    cache->live = 0;
+}
+
+void json_cache_touch(struct json_cache *cache, const struct json_value *val)
+{
+    struct json_cache_entry *entry = hashtable_lookup(cache->entries, val);
+
+    /* Stop at the first one that's marked already, so are its parents */
+    for (; (entry != NULL) && !entry->dirty; entry = entry->parent)
+        entry->dirty = true;
+}
+
+void json_cache_modified(struct json_value *val)
+{
+    struct list *ptr;
+
+    if (!(val->flags & JSON_VALUE_CACHED))
+        return;
+
+    pthread_mutex_lock(&_json_cache_lock);
+
+    for (ptr = _json_caches; ptr != NULL; ptr = ptr->next)
+        json_cache_touch(LIST_DATA(ptr, struct json_cache *), val);
+
+    pthread_mutex_unlock(&_json_cache_lock);
+
+    /* Marked for good until written again, which sets it again */
+    val->flags &= ~JSON_VALUE_CACHED;
+}
+
+int json_cache_write(struct json_cache *cache,
+                     struct json_writer *w,
+                     struct json_value *val)
+{
+    struct json_writer *s = &cache->scratch;
+
+    if ((w->flags != cache->flags)
+            || (w->number_format != cache->number_format)) {
+        json_cache_clear(cache);
+
+        cache->flags = w->flags;
+        cache->number_format = w->number_format;
+    }
+
+    /* Written at the top level of the scratch writer, so without separators */
+    s->len = 0;
+    s->total = 0;
+    s->error = false;
+    s->flags = w->flags;
+    s->number_format = w->number_format;
+
+    if (_json_cache_put(cache, val, NULL))
+        return 1;
+
+    /*
+     * Entries of containers that are gone pile up, so get rid of them once
+     * there are as many as there were in use the last time. That takes no
+     * longer than writing the containers added since did.
+     */
+    if (hashtable_size(cache->entries) > cache->live * 2)
+        _json_cache_sweep(cache, val);
+
+    return json_writer_raw(w, s->buf, s->len);
+}
+
+char *json_cache_dump(struct json_cache *cache,
+                      struct json_value *val,
+                      size_t *n)
+{
+    struct json_writer w;
+
+    json_writer_init_buffer(&w);
+
+    if (json_cache_write(cache, &w, val)) {
+        json_writer_free(&w);
+        return NULL;
+    }
+
+    return json_writer_detach(&w, n);
+}
+
+/* Entries are looked up by the address of their container */
+static size_t _json_cache_hash(const void *key)
+{
+    uintptr_t k = (uintptr_t)key;
+
+    /* The low bits are the same for all allocations */
+    return (size_t)(k >> 4) ^ (size_t)(k >> 12);
+}
+
+/* Zero if equal, like strcmp() */
+static int _json_cache_equal(const void *a, const void *b)
+{
+    return a != b;
+}
+
+static void _json_cache_entry_free(void *data)
+{
+    struct json_cache_entry *entry = data;
+
+    free(entry->text);
+    free(entry);
+}
+
+/*
+ * Write val to the scratch writer, as cached if it's a container that hasn't
+ * changed since. The entries of all containers written are updated, the ones
+ * inside of cached text are left as they are (as is their text).
+ *
+ * JSON_VALUE_CACHED is set on containers that have been written. Values that
+ * are new or moved don't have it, which tells them apart from whatever was
+ * at the same address before.
+ */
+static int _json_cache_put(struct json_cache *cache,
+                           struct json_value *val,
+                           struct json_cache_entry *parent)
+{
+    struct json_writer *s = &cache->scratch;
+    const char *comma = (s->flags & JSON_WRITER_SPACED) ? ", " : ",";
+    const char *colon = (s->flags & JSON_WRITER_SPACED) ? ": " : ":";
+
+    struct json_cache_entry *entry;
+    const struct json_value *contents = val;
+    size_t start = s->len;
+    size_t len;
+
+    if ((val->type != JSON_ARRAY) && (val->type != JSON_OBJECT))
+        return json_writer_value(s, val);
+
+    if ((entry = hashtable_lookup(cache->entries, val)) == NULL) {
+        entry = calloc(1, sizeof(*entry));
+        hashtable_insert(cache->entries, val, entry);
+    } else if ((val->flags & JSON_VALUE_CACHED)
+            && !entry->dirty
+            && (entry->text != NULL)) {
+        entry->parent = parent;
+        return json_writer_write(s, entry->text, entry->len);
+    }
+
+    entry->parent = parent;
+
+    if (val->flags & JSON_VALUE_SHARED)
+        contents = val->value.jshared;
+
+    if (val->type == JSON_ARRAY) {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+        bool first = true;
+
+        json_writer_write(s, "[", 1);
+
+        json_array_iterator_init(&iter, contents);
+        while (json_array_iterator_next(&iter, &elem)) {
+            if (!first)
+                json_writer_write(s, comma, strlen(comma));
+
+            _json_cache_put(cache, elem, entry);
+            first = false;
+        }
+
+        json_writer_write(s, "]", 1);
+    } else {
+        struct json_object_iterator iter;
+        struct json_value *member;
+        const char *key;
+        size_t n;
+        bool first = true;
+
+        json_writer_write(s, "{", 1);
+
+        json_object_iterator_init(&iter, contents);
+        while (json_object_iterator_next(&iter, &key, &n, &member)) {
+            if (!first)
+                json_writer_write(s, comma, strlen(comma));
+
+            json_writer_string(s, key, n);
+            json_writer_write(s, colon, strlen(colon));
+            _json_cache_put(cache, member, entry);
+
+            first = false;
+        }
+
+        json_writer_write(s, "}", 1);
+    }
+
+    if (s->error)
+        return 1;
+
+    free(entry->text);
+    entry->text = NULL;
+
+    if ((len = s->len - start) >= JSON_CACHE_MIN_FRAGMENT) {
+        entry->text = malloc(len);
+        entry->len = len;
+
+        memcpy(entry->text, s->buf + start, len);
+    }
+
+    entry->dirty = false;
+    val->flags |= JSON_VALUE_CACHED;
+
+    return 0;
+}
+
+/*
+ * Drop the entries of all containers that aren't part of root anymore. Those
+ * that are get the number of this sweep first.
+ */
+static void _json_cache_sweep(struct json_cache *cache,
+                              const struct json_value *root)
+{
+    struct hashtable_iterator iter;
+    struct list *dead = NULL;
+    struct list *ptr;
+    void *key;
+    void *value;
+
+    cache->mark++;
+    cache->live = _json_cache_mark(cache, root);
+
+    /*
+     * Containers moved elsewhere without their old parent being written since
+     * may still refer to it, don't let them
+     */
+    hashtable_iterator_init(&iter, cache->entries);
+    while (hashtable_iterator_next(&iter, &key, &value)) {
+        struct json_cache_entry *entry = value;
+
+        if (entry->mark != cache->mark)
+            dead = list_prepend(dead, key);
+        else if ((entry->parent != NULL)
+                && (entry->parent->mark != cache->mark))
+            entry->parent = NULL;
+    }
+
+    for (ptr = dead; ptr != NULL; ptr = ptr->next)
+        hashtable_remove(cache->entries, ptr->data);
+
+    list_free_all(dead, NULL, NULL);
+}
+
+/* Returns the number of entries found in use */
+static size_t _json_cache_mark(struct json_cache *cache,
+                               const struct json_value *val)
+{
+    struct json_cache_entry *entry;
+    size_t live = 0;
+
+    if ((val->type != JSON_ARRAY) && (val->type != JSON_OBJECT))
+        return 0;
+
+    if ((entry = hashtable_lookup(cache->entries, val)) != NULL) {
+        entry->mark = cache->mark;
+        live++;
+    }
+
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    if (val->type == JSON_ARRAY) {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem))
+            live += _json_cache_mark(cache, elem);
+    } else {
+        struct json_object_iterator iter;
+        struct json_value *member;
+        const char *key;
+        size_t n;
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter, &key, &n, &member))
+            live += _json_cache_mark(cache, member);
+    }
+
+    return live;
+}
@@ -0,0 +1,101 @@
+#ifndef JSON_CACHE_H
+#define JSON_CACHE_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdlib.h>
+
+/*
+ * Incremental serialization of a document that is dumped over and over with
+ * only small changes in between. The cache keeps the text of every array and
+ * object it writes, and writes it again as is until the container is marked
+ * as changed:
+ *
+ *     struct json_cache cache;
+ *
+ *     json_cache_init(&cache);
+ *
+ *     for (;;) {
+ *         struct json_value *user = json_object_lookup(state, "user");
+ *
+ *         json_set_string(json_object_lookup(user, "name"), name);
+ *         json_cache_touch(&cache, user);
+ *
+ *         json_cache_write(&cache, &w, state);
+ *     }
+ *
+ *     json_cache_free(&cache);
+ *
+ * json_cache_touch() marks a container and all containers it was written as
+ * part of, so only those are written anew while everything else is copied
+ * from the cache. Arrays and objects changed through json_get_array(),
+ * json_get_object(), json_get_packed(), json_array_append() or
+ * json_array_unpack(), or replaced by json_set_string(), are marked that way
+ * by those. Anything else has to be marked by hand before the container is written
+ * again, namely strings, numbers or booleans changed in place (as name is
+ * above, its object user needs touching) and containers changed through
+ * their struct json_value directly. Containers that are created or moved in
+ * are noticed by themselves, but the ones they are put into are only if
+ * that happens through one of the functions above.
+ *
+ * Each container is cached with all of its contents, so the cache takes up
+ * about as many times the size of the output as the document is deep. A
+ * value must not be written through more than one cache.
+ */
+
+/* Containers writing to fewer bytes are cheaper to write than to keep */
+#define JSON_CACHE_MIN_FRAGMENT 64
+
+struct json_cache
+{
+    /* Entries by container (struct json_value *), see cache.c */
+    struct hashtable *entries;
+
+    /* Where containers are written first, to see what to cache */
+    struct json_writer scratch;
+
+    /* The settings of the writer the cached text was written for */
+    unsigned flags;
+    const char *number_format;
+
+    /* Entries known to be in use after the last sweep, and its number */
+    size_t live;
+    unsigned mark;
+};
+
+void json_cache_init(struct json_cache *cache);
+void json_cache_free(struct json_cache *cache);
+
+/* Forget everything cached, e.g. to write a different document */
+void json_cache_clear(struct json_cache *cache);
+
+/*
+ * Marks val, which must be an array or object, as modified, along with all
+ * containers it has been written in. Does nothing for anything else or for
+ * containers that haven't been written yet.
+ */
+void json_cache_touch(struct json_cache *cache, const struct json_value *val);
+
+/*
+ * Same for whichever cache val has been written through (JSON_VALUE_CACHED
+ * is set), if any, and clears JSON_VALUE_CACHED. The functions modifying
+ * containers in json.h call this, it's not needed on top of them.
+ */
+void json_cache_modified(struct json_value *val);
+
+/*
+ * Write val to w like json_writer_value() does, using and updating the cache.
+ * Everything cached is dropped when the flags or number_format of w differ
+ * from the last time. Returns 0 on success and 1 on error.
+ */
+int json_cache_write(struct json_cache *cache,
+                     struct json_writer *w,
+                     struct json_value *val);
+
+/* Same into a new buffer (to be freed by the caller) of length n */
+char *json_cache_dump(struct json_cache *cache,
+                      struct json_value *val,
+                      size_t *n);
+
+#endif /* defined JSON_CACHE_H */
@@ -0,0 +1,450 @@
+#include <libutil/json/cbor.h>
+#include <libutil/utf8.h>
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "binary.h"
+
+/* Major types */
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK      0xff
+
+static int _json_cbor_head(struct json_writer *w, unsigned major, uint64_t arg);
+static int _json_cbor_number(struct json_writer *w, double d);
+
+static struct json_value *_json_cbor_item(struct json_binary_decoder *dec);
+
+static struct json_value *_json_cbor_array(struct json_binary_decoder *dec,
+                                           uint64_t count,
+                                           bool indefinite);
+
+static struct json_value *_json_cbor_map(struct json_binary_decoder *dec,
+                                         uint64_t count,
+                                         bool indefinite);
+
+static char *_json_cbor_string(struct json_binary_decoder *dec,
+                               unsigned major,
+                               unsigned ai);
+
+static int _json_cbor_argument(struct json_binary_decoder *dec,
+                               unsigned ai,
+                               uint64_t *arg);
+
+static bool _json_cbor_break(struct json_binary_decoder *dec);
+static double _json_cbor_half(unsigned half);
+
+
+int json_cbor_write(struct json_writer *w, const struct json_value *val)
+{
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    switch (val->type) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_get_string_n(val, &n);
+
+        return _json_cbor_head(w, CBOR_TEXT, n) || json_writer_write(w, str, n);
+    }
+    case JSON_NUMBER:
+        return _json_cbor_number(w, json_get_number_value(val));
+
+    case JSON_NULL:
+        return json_writer_write(w, "\xf6", 1);
+
+    case JSON_BOOLEAN:
+        return json_writer_write(w, val->value.jbool ? "\xf5" : "\xf4", 1);
+
+    case JSON_ARRAY: {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+
+        _json_cbor_head(w, CBOR_ARRAY, json_array_size(val));
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem))
+            json_cbor_write(w, elem);
+
+        return w->error;
+    }
+    case JSON_OBJECT: {
+        struct json_object_iterator iter;
+        struct json_value *value;
+        const char *key;
+        size_t n;
+
+        _json_cbor_head(w, CBOR_MAP, json_object_size(val));
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter, &key, &n, &value)) {
+            _json_cbor_head(w, CBOR_TEXT, n);
+            json_writer_write(w, key, n);
+
+            json_cbor_write(w, value);
+        }
+
+        return w->error;
+    }
+    }
+
+    return w->error;
+}
+
+char *json_cbor_encode(const struct json_value *val, size_t *n)
+{
+    struct json_writer w;
+
+    json_writer_init_buffer(&w);
+    json_cbor_write(&w, val);
+
+    return json_writer_detach(&w, n);
+}
+
+struct json_value *json_cbor_decode(const char *buf, size_t n, size_t *used)
+{
+    struct json_binary_decoder dec;
+    struct json_value *val;
+
+    dec.buf = (const unsigned char *)buf;
+    dec.len = n;
+    dec.pos = 0;
+    dec.depth = 0;
+
+    if (((val = _json_cbor_item(&dec)) != NULL) && (used != NULL))
+        *used = dec.pos;
+
+    return val;
+}
+
+/* The initial byte and argument, in the shortest form */
+static int _json_cbor_head(struct json_writer *w, unsigned major, uint64_t arg)
+{
+    unsigned char lead = major << 5;
+
+    if (arg < 24)
+        return _json_binary_put(w, lead | arg, 0, 0);
+    else if (arg <= UINT8_MAX)
+        return _json_binary_put(w, lead | 24, arg, 1);
+    else if (arg <= UINT16_MAX)
+        return _json_binary_put(w, lead | 25, arg, 2);
+    else if (arg <= UINT32_MAX)
+        return _json_binary_put(w, lead | 26, arg, 4);
+    else
+        return _json_binary_put(w, lead | 27, arg, 8);
+}
+
+static int _json_cbor_number(struct json_writer *w, double d)
+{
+    union { double d; uint64_t u; } dbl;
+    union { float f; uint32_t u; } flt;
+
+    /* Integral values that fit into 64 bits (but not -0) are integers */
+    if (!signbit(d) && (d < 18446744073709551616.0)
+            && ((double)(uint64_t)d == d))
+        return _json_cbor_head(w, CBOR_UINT, (uint64_t)d);
+
+    if ((d < 0) && (d >= -9223372036854775808.0)
+            && ((double)(int64_t)d == d))
+        return _json_cbor_head(w, CBOR_NINT, (uint64_t)-(int64_t)d - 1);
+
+    /* Single precision if that loses nothing */
+    if (isinf(d) || ((d >= -FLT_MAX) && (d <= FLT_MAX) && ((float)d == d))) {
+        flt.f = (float)d;
+        return _json_binary_put(w, 0xfa, flt.u, 4);
+    }
+
+    dbl.d = d;
+    return _json_binary_put(w, 0xfb, dbl.u, 8);
+}
+
+static struct json_value *_json_cbor_item(struct json_binary_decoder *dec)
+{
+    struct json_value *val;
+    unsigned char ib;
+    unsigned major;
+    unsigned ai;
+    uint64_t arg = 0;
+
+    if (dec->pos >= dec->len)
+        return NULL;
+
+    ib = dec->buf[dec->pos++];
+    major = ib >> 5;
+    ai = ib & 0x1f;
+
+    switch (major) {
+    case CBOR_UINT:
+    case CBOR_NINT:
+        if (_json_cbor_argument(dec, ai, &arg))
+            return NULL;
+
+        return json_number_new(
+            (major == CBOR_UINT) ? (double)arg : -1.0 - (double)arg);
+
+    case CBOR_BYTES:
+    case CBOR_TEXT: {
+        char *str = _json_cbor_string(dec, major, ai);
+
+        if (str == NULL)
+            return NULL;
+
+        val = json_value_new(JSON_STRING);
+        val->value.jstring = str;
+
+        return val;
+    }
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+    case CBOR_TAG: {
+        bool indefinite = (ai == CBOR_INDEFINITE) && (major != CBOR_TAG);
+
+        if (!indefinite && _json_cbor_argument(dec, ai, &arg))
+            return NULL;
+
+        /* Every element takes up at least a byte, don't trust the count */
+        if ((major != CBOR_TAG) && (arg > dec->len - dec->pos))
+            return NULL;
+
+        if (dec->depth >= JSON_CBOR_MAX_DEPTH)
+            return NULL;
+
+        dec->depth++;
+
+        if (major == CBOR_ARRAY)
+            val = _json_cbor_array(dec, arg, indefinite);
+        else if (major == CBOR_MAP)
+            val = _json_cbor_map(dec, arg, indefinite);
+        else
+            val = _json_cbor_item(dec); /* the tag itself doesn't matter */
+
+        dec->depth--;
+        return val;
+    }
+    case CBOR_SIMPLE:
+        switch (ai) {
+        case 20: return json_bool_new(false);
+        case 21: return json_bool_new(true);
+        case 22: /* null */
+        case 23: /* undefined */
+            return json_null_new();
+
+        case 25:
+            if (_json_binary_read(dec, 2, &arg))
+                return NULL;
+
+            return json_number_new(_json_cbor_half(arg));
+
+        case 26: {
+            union { float f; uint32_t u; } flt;
+
+            if (_json_binary_read(dec, 4, &arg))
+                return NULL;
+
+            flt.u = arg;
+            return json_number_new(flt.f);
+        }
+        case 27: {
+            union { double d; uint64_t u; } dbl;
+
+            if (_json_binary_read(dec, 8, &arg))
+                return NULL;
+
+            dbl.u = arg;
+            return json_number_new(dbl.d);
+        }
+        default:
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+static struct json_value *_json_cbor_array(struct json_binary_decoder *dec,
+                                           uint64_t count,
+                                           bool indefinite)
+{
+    struct json_value *arr = json_array_new();
+    struct list *tail = NULL;
+    uint64_t i;
+
+    for (i = 0; indefinite ? !_json_cbor_break(dec) : (i < count); ++i) {
+        struct json_value *elem = _json_cbor_item(dec);
+        struct list *link;
+
+        if (elem == NULL) {
+            json_free(arr);
+            return NULL;
+        }
+
+        link = list_new_with_data(elem);
+
+        if (tail != NULL) {
+            link->prev = tail;
+            tail->next = link;
+        } else {
+            arr->value.jarray = link;
+        }
+
+        tail = link;
+    }
+
+    return arr;
+}
+
+static struct json_value *_json_cbor_map(struct json_binary_decoder *dec,
+                                         uint64_t count,
+                                         bool indefinite)
+{
+    struct json_value *obj = json_object_new();
+    uint64_t i;
+
+    for (i = 0; indefinite ? !_json_cbor_break(dec) : (i < count); ++i) {
+        struct json_value *val;
+        unsigned char ib;
+        char *key;
+
+        /* Only string keys make sense for JSON */
+        if (dec->pos >= dec->len)
+            goto exit_err;
+
+        ib = dec->buf[dec->pos++];
+
+        if ((ib >> 5 != CBOR_TEXT) && (ib >> 5 != CBOR_BYTES))
+            goto exit_err;
+
+        if ((key = _json_cbor_string(dec, ib >> 5, ib & 0x1f)) == NULL)
+            goto exit_err;
+
+        if ((val = _json_cbor_item(dec)) == NULL) {
+            free(key);
+            goto exit_err;
+        }
+
+        hashtable_insert(obj->value.jobject, key, val);
+    }
+
+    return obj;
+
+exit_err:
+    json_free(obj);
+    return NULL;
+}
+
+/* A definite string, or the concatenation of the chunks of an indefinite one */
+static char *_json_cbor_string(struct json_binary_decoder *dec,
+                               unsigned major,
+                               unsigned ai)
+{
+    char *str = NULL;
+    size_t len = 0;
+    bool indefinite = (ai == CBOR_INDEFINITE);
+
+    do {
+        uint64_t n;
+
+        if (indefinite) {
+            unsigned char ib;
+
+            if (_json_cbor_break(dec))
+                break;
+
+            if (dec->pos >= dec->len)
+                goto exit_err;
+
+            /* Chunks are definite strings of the same type */
+            ib = dec->buf[dec->pos++];
+            ai = ib & 0x1f;
+
+            if ((ib >> 5 != major) || (ai == CBOR_INDEFINITE))
+                goto exit_err;
+        }
+
+        if (_json_cbor_argument(dec, ai, &n) || (n > dec->len - dec->pos))
+            goto exit_err;
+
+        str = realloc(str, len + n + 1);
+        memcpy(str + len, dec->buf + dec->pos, n);
+
+        dec->pos += n;
+        len += n;
+    } while (indefinite);
+
+    if (str == NULL)
+        str = malloc(1);
+
+    str[len] = '\0';
+
+    /* Byte strings are taken as they are, but text has to be UTF-8 */
+    if ((major == CBOR_TEXT) && (utf8_validate(str, len) != len))
+        goto exit_err;
+
+    return str;
+
+exit_err:
+    free(str);
+    return NULL;
+}
+
+static int _json_cbor_argument(struct json_binary_decoder *dec,
+                               unsigned ai,
+                               uint64_t *arg)
+{
+    if (ai < 24) {
+        *arg = ai;
+        return 0;
+    }
+
+    switch (ai) {
+    case 24: return _json_binary_read(dec, 1, arg);
+    case 25: return _json_binary_read(dec, 2, arg);
+    case 26: return _json_binary_read(dec, 4, arg);
+    case 27: return _json_binary_read(dec, 8, arg);
+    default:
+        /* Reserved, or indefinite where that's not allowed */
+        return 1;
+    }
+}
+
+/* Consume the break ending an indefinite length item, if it's next */
+static bool _json_cbor_break(struct json_binary_decoder *dec)
+{
+    if ((dec->pos < dec->len) && (dec->buf[dec->pos] == CBOR_BREAK)) {
+        dec->pos++;
+        return true;
+    }
+
+    return false;
+}
+
+/* Widen a half precision float by way of its single precision bit pattern */
+static double _json_cbor_half(unsigned half)
+{
+    union { float f; uint32_t u; } flt;
+
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exp = (half >> 10) & 0x1f;
+    uint32_t mant = half & 0x3ff;
+
+    if (exp == 0) {
+        /* Subnormal (or zero), 2^-24 per unit */
+        double d = mant / 16777216.0;
+
+        return sign ? -d : d;
+    }
+
+    flt.u = sign | (((exp == 31) ? 255 : exp - 15 + 127) << 23) | (mant << 13);
+    return flt.f;
+}
@@ -0,0 +1,879 @@
+#include <libutil/json/compact.h>
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Anything with the sign bit, all exponent bits and the quiet bit set is a
+ * NaN, so such boxes are never numbers. Three bits of tag follow, then 48
+ * bits of payload.
+ */
+#define BOX_NAN             0xfff8000000000000ULL
+#define BOX_PAYLOAD_MASK    0x0000ffffffffffffULL
+
+#define BOX_IS_NUMBER(box)  (((box) & BOX_NAN) != BOX_NAN)
+#define BOX_TAG(box)        ((enum json_box_tag)(((box) >> 48) & 0x7))
+#define BOX_PAYLOAD(box)    ((box) & BOX_PAYLOAD_MASK)
+#define BOX_PTR(box)        ((void *)(uintptr_t)BOX_PAYLOAD(box))
+#define BOX(tag, payload)   (BOX_NAN | ((uint64_t)(tag) << 48) | (payload))
+
+/* Tag 0 would be the plain negative NaN, leave it at that */
+enum json_box_tag
+{
+    BOX_NULL = 1,
+    BOX_FALSE,
+    BOX_TRUE,
+    BOX_INT,    /* 32 bit two's complement integer */
+    BOX_STRING, /* struct json_compact_string * */
+    BOX_ARRAY,  /* struct json_compact_vector * */
+    BOX_OBJECT  /* struct json_compact_vector *, keys and values taking turns */
+};
+
+/* Nesting levels json_compact_parse() handles without allocating */
+#define JSON_COMPACT_STACK 16
+
+struct json_compact_string
+{
+    size_t len;
+    char str[]; /* zero terminated */
+};
+
+struct json_compact_vector
+{
+    size_t len; /* elements or members */
+    json_box boxes[];
+};
+
+/* A container json_compact_parse() is in */
+struct json_compact_frame
+{
+    size_t start; /* where its elements begin on the value stack */
+    bool object;
+};
+
+/*
+ * The values of all open containers, one after the other. Containers are
+ * allocated only once they close and their size is known.
+ */
+struct json_compact_parser
+{
+    struct json_compact *doc;
+    struct json_lexer_state lex;
+
+    json_box *vals;
+    size_t len;
+    size_t cap;
+};
+
+static json_box _json_compact_ptr(enum json_box_tag tag, void *ptr);
+static json_box _json_compact_number(double d);
+static json_box _json_compact_string(const char *str, size_t n);
+static json_box _json_compact_key(struct json_compact *doc,
+                                  const char *key,
+                                  size_t n);
+
+static size_t _json_compact_key_hash_n(const char *key, size_t n);
+static size_t _json_compact_key_hash(const void *key);
+static int _json_compact_key_equal(const void *a, const void *b);
+
+static json_box _json_compact_from_value(struct json_compact *doc,
+                                         const struct json_value *val);
+static void _json_compact_free_box(json_box box);
+
+static int _json_compact_push(struct json_compact_parser *p, json_box box);
+static json_box _json_compact_scalar(struct json_compact_parser *p,
+                                     struct json_token *tok);
+static int _json_compact_next(struct json_compact_parser *p,
+                              struct json_compact_frame *frame);
+static json_box _json_compact_close(struct json_compact_parser *p,
+                                    struct json_compact_frame *frame);
+
+
+int json_compact_parse(struct json_compact *doc, const char *input, size_t n)
+{
+    struct json_compact_frame local[JSON_COMPACT_STACK];
+    struct json_compact_frame *stack = local;
+    size_t cap = JSON_COMPACT_STACK;
+    size_t depth = 0;
+
+    struct json_compact_parser p;
+    struct json_token tok;
+    json_box val;
+    int res;
+
+    memset(doc, 0, sizeof(*doc));
+    doc->keys = hashtable_new_with_free(_json_compact_key_hash,
+                                        _json_compact_key_equal,
+                                        NULL,
+                                        free);
+
+    memset(&p, 0, sizeof(p));
+    p.doc = doc;
+    json_lexer_init(&p.lex, input, n);
+
+    /* Structured like json_parse_value(), see there */
+    for (;;) {
+        if (json_lexer_next_token(&p.lex, &tok))
+            goto exit_err;
+
+        if ((tok.type == TOK_BRACE_OPEN)
+                || (tok.type == TOK_SQUARE_BRACKET_OPEN)) {
+            struct json_compact_frame *frame;
+
+            if (depth == p.lex.max_depth)
+                goto exit_err;
+
+            if (depth == cap) {
+                struct json_compact_frame *grown = (stack == local)
+                    ? malloc(sizeof(*stack) * cap * 2)
+                    : realloc(stack, sizeof(*stack) * cap * 2);
+
+                if (grown == NULL)
+                    goto exit_err;
+
+                if (stack == local)
+                    memcpy(grown, local, sizeof(local));
+
+                stack = grown;
+                cap *= 2;
+            }
+
+            frame = &stack[depth++];
+            frame->start = p.len;
+            frame->object = (tok.type == TOK_BRACE_OPEN);
+
+            if ((res = _json_compact_next(&p, frame)) < 0)
+                goto exit_err;
+            else if (res == 0)
+                continue;
+
+            if ((val = _json_compact_close(&p, frame)) == 0)
+                goto exit_err;
+
+            depth--;
+        } else if ((val = _json_compact_scalar(&p, &tok)) == 0) {
+            goto exit_err;
+        }
+
+        for (;;) {
+            struct json_compact_frame *frame;
+            enum json_token_type close;
+
+            if (depth == 0) {
+                if (stack != local)
+                    free(stack);
+
+                free(p.vals);
+
+                doc->root = val;
+                return 0;
+            }
+
+            frame = &stack[depth - 1];
+
+            if (_json_compact_push(&p, val)) {
+                _json_compact_free_box(val);
+                goto exit_err;
+            }
+
+            close = frame->object
+                ? TOK_BRACE_CLOSE
+                : TOK_SQUARE_BRACKET_CLOSE;
+
+            if (json_lexer_next_token(&p.lex, &tok))
+                goto exit_err;
+
+            if (tok.type == TOK_COMMA)
+                res = _json_compact_next(&p, frame);
+            else
+                res = (tok.type == close) ? 1 : -1;
+
+            if (res < 0)
+                goto exit_err;
+            else if (res == 0)
+                break;
+
+            if ((val = _json_compact_close(&p, frame)) == 0)
+                goto exit_err;
+
+            depth--;
+        }
+    }
+
+exit_err:
+    /* Keys are owned by doc->keys, only the values of objects are freed */
+    while (depth > 0) {
+        struct json_compact_frame *frame = &stack[--depth];
+
+        for (; p.len > frame->start; p.len--) {
+            if (!frame->object || ((p.len - frame->start) % 2 == 0))
+                _json_compact_free_box(p.vals[p.len - 1]);
+        }
+    }
+
+    if (stack != local)
+        free(stack);
+
+    free(p.vals);
+    json_compact_free(doc);
+
+    return 1;
+}
+
+int json_compact_from_value(struct json_compact *doc,
+                            const struct json_value *val)
+{
+    memset(doc, 0, sizeof(*doc));
+    doc->keys = hashtable_new_with_free(_json_compact_key_hash,
+                                        _json_compact_key_equal,
+                                        NULL,
+                                        free);
+
+    if ((doc->root = _json_compact_from_value(doc, val)) == 0) {
+        json_compact_free(doc);
+        return 1;
+    }
+
+    return 0;
+}
+
+void json_compact_free(struct json_compact *doc)
+{
+    if (doc->root != 0)
+        _json_compact_free_box(doc->root);
+
+    if (doc->keys != NULL)
+        hashtable_free(doc->keys);
+
+    memset(doc, 0, sizeof(*doc));
+}
+
+struct json_value *json_compact_value(json_box box)
+{
+    switch (json_compact_type(box)) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_compact_get_string(box, &n);
+
+        return json_string_new_n(str, n);
+    }
+    case JSON_NUMBER: {
+        double d;
+
+        json_compact_get_number(box, &d);
+        return json_number_new(d);
+    }
+    case JSON_BOOLEAN:
+        return json_bool_new(BOX_TAG(box) == BOX_TRUE);
+
+    case JSON_NULL:
+        return json_null_new();
+
+    case JSON_ARRAY: {
+        struct json_value *arr = json_array_new();
+        struct list *tail = NULL;
+        json_box elem;
+        size_t i;
+
+        for (i = 0; !json_compact_index(box, i, &elem); ++i) {
+            struct json_value *val = json_compact_value(elem);
+            struct list *link;
+
+            if (val == NULL) {
+                json_free(arr);
+                return NULL;
+            }
+
+            link = list_new_with_data(val);
+
+            if (tail != NULL) {
+                link->prev = tail;
+                tail->next = link;
+            } else {
+                arr->value.jarray = link;
+            }
+
+            tail = link;
+        }
+
+        return arr;
+    }
+    case JSON_OBJECT: {
+        struct json_value *obj = json_object_new();
+        const char *key;
+        json_box member;
+        size_t n;
+        size_t i;
+
+        for (i = 0; !json_compact_member(box, i, &key, &n, &member); ++i) {
+            struct json_value *v = json_compact_value(member);
+            char *copy = (v != NULL) ? malloc(n + 1) : NULL;
+
+            if (copy == NULL) {
+                if (v != NULL)
+                    json_free(v);
+
+                json_free(obj);
+                return NULL;
+            }
+
+            /* All of it, as json_tape_value() does */
+            memcpy(copy, key, n);
+            copy[n] = '\0';
+
+            hashtable_insert(obj->value.jobject, copy, v);
+        }
+
+        return obj;
+    }
+    }
+
+    return NULL;
+}
+
+int json_compact_write(struct json_writer *w, json_box box)
+{
+    const char *str;
+    json_box val;
+    double d;
+    size_t n;
+    size_t i;
+
+    switch (json_compact_type(box)) {
+    case JSON_STRING:
+        str = json_compact_get_string(box, &n);
+        return json_writer_string(w, str, n);
+
+    case JSON_NUMBER:
+        json_compact_get_number(box, &d);
+        return json_writer_number(w, d);
+
+    case JSON_BOOLEAN:
+        return json_writer_bool(w, BOX_TAG(box) == BOX_TRUE);
+
+    case JSON_NULL:
+        return json_writer_null(w);
+
+    case JSON_ARRAY:
+        json_writer_begin_array(w);
+
+        for (i = 0; !json_compact_index(box, i, &val); ++i)
+            json_compact_write(w, val);
+
+        return json_writer_end_array(w);
+
+    case JSON_OBJECT:
+        json_writer_begin_object(w);
+
+        for (i = 0; !json_compact_member(box, i, &str, &n, &val); ++i) {
+            json_writer_key_n(w, str, n);
+            json_compact_write(w, val);
+        }
+
+        return json_writer_end_object(w);
+    }
+
+    return 1;
+}
+
+enum json_value_type json_compact_type(json_box box)
+{
+    if (BOX_IS_NUMBER(box))
+        return JSON_NUMBER;
+
+    switch (BOX_TAG(box)) {
+    case BOX_FALSE:
+    case BOX_TRUE:   return JSON_BOOLEAN;
+    case BOX_INT:    return JSON_NUMBER;
+    case BOX_STRING: return JSON_STRING;
+    case BOX_ARRAY:  return JSON_ARRAY;
+    case BOX_OBJECT: return JSON_OBJECT;
+    default:         return JSON_NULL;
+    }
+}
+
+bool json_compact_is_null(json_box box)
+{
+    return json_compact_type(box) == JSON_NULL;
+}
+
+const char *json_compact_get_string(json_box box, size_t *n)
+{
+    struct json_compact_string *str;
+
+    if (BOX_IS_NUMBER(box) || (BOX_TAG(box) != BOX_STRING))
+        return NULL;
+
+    str = BOX_PTR(box);
+
+    if (n != NULL)
+        *n = str->len;
+
+    return str->str;
+}
+
+int json_compact_get_number(json_box box, double *out)
+{
+    if (BOX_IS_NUMBER(box)) {
+        memcpy(out, &box, sizeof(*out));
+        return 0;
+    }
+
+    if (BOX_TAG(box) != BOX_INT)
+        return 1;
+
+    *out = (int32_t)(uint32_t)BOX_PAYLOAD(box);
+    return 0;
+}
+
+int json_compact_get_bool(json_box box, bool *out)
+{
+    if (json_compact_type(box) != JSON_BOOLEAN)
+        return 1;
+
+    *out = (BOX_TAG(box) == BOX_TRUE);
+    return 0;
+}
+
+size_t json_compact_length(json_box box)
+{
+    if ((json_compact_type(box) != JSON_ARRAY)
+            && (json_compact_type(box) != JSON_OBJECT))
+        return 0;
+
+    return ((struct json_compact_vector *)BOX_PTR(box))->len;
+}
+
+int json_compact_index(json_box arr, size_t i, json_box *out)
+{
+    struct json_compact_vector *vec;
+
+    if (json_compact_type(arr) != JSON_ARRAY)
+        return 1;
+
+    vec = BOX_PTR(arr);
+
+    if (i >= vec->len)
+        return 1;
+
+    *out = vec->boxes[i];
+    return 0;
+}
+
+int json_compact_lookup(json_box obj, const char *key, json_box *out)
+{
+    struct json_compact_vector *vec;
+    size_t n = strlen(key);
+    size_t i;
+
+    if (json_compact_type(obj) != JSON_OBJECT)
+        return 1;
+
+    vec = BOX_PTR(obj);
+
+    /* Backwards, so later duplicates win as they do in regular objects */
+    for (i = vec->len; i > 0; --i) {
+        struct json_compact_string *k = BOX_PTR(vec->boxes[2 * (i - 1)]);
+
+        if ((k->len == n) && !memcmp(k->str, key, n)) {
+            *out = vec->boxes[2 * (i - 1) + 1];
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int json_compact_member(json_box obj,
+                        size_t i,
+                        const char **key,
+                        size_t *n,
+                        json_box *val)
+{
+    struct json_compact_vector *vec;
+    struct json_compact_string *k;
+
+    if (json_compact_type(obj) != JSON_OBJECT)
+        return 1;
+
+    vec = BOX_PTR(obj);
+
+    if (i >= vec->len)
+        return 1;
+
+    k = BOX_PTR(vec->boxes[2 * i]);
+
+    if (key != NULL)
+        *key = k->str;
+
+    if (n != NULL)
+        *n = k->len;
+
+    *val = vec->boxes[2 * i + 1];
+    return 0;
+}
+
+/* Pointers have to fit 48 bits, as they do on all current 64 bit systems */
+static json_box _json_compact_ptr(enum json_box_tag tag, void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+
+    assert(((uintptr_t)ptr & ~(uintptr_t)BOX_PAYLOAD_MASK) == 0);
+    return BOX(tag, (uintptr_t)ptr);
+}
+
+static json_box _json_compact_number(double d)
+{
+    json_box box;
+
+    /*
+     * There is no NaN in JSON, and they'd be mistaken for other boxes. Zero
+     * is an integer, which leaves a box of all zeroes to mean none at all.
+     */
+    if (d != d)
+        return BOX(BOX_NULL, 0);
+
+    if ((d >= INT32_MIN) && (d <= INT32_MAX) && (d == (int32_t)d)
+            && ((d != 0) || !signbit(d)))
+        return BOX(BOX_INT, (uint32_t)(int32_t)d);
+
+    memcpy(&box, &d, sizeof(box));
+    return box;
+}
+
+static json_box _json_compact_string(const char *str, size_t n)
+{
+    struct json_compact_string *s = malloc(sizeof(*s) + n + 1);
+
+    if (s == NULL)
+        return 0;
+
+    s->len = n;
+    memcpy(s->str, str, n);
+    s->str[n] = '\0';
+
+    return _json_compact_ptr(BOX_STRING, s);
+}
+
+/*
+ * Keys are looked up in the key table first and only added if new. The n
+ * bytes at key needn't be terminated (views aren't) and may include U+0000,
+ * so only the bucket of key is searched, by length and bytes.
+ */
+static json_box _json_compact_key(struct json_compact *doc,
+                                  const char *key,
+                                  size_t n)
+{
+    size_t hash = _json_compact_key_hash_n(key, n);
+    struct list *l = doc->keys->buckets[hash % doc->keys->bucket_count];
+    struct json_compact_string *s;
+    json_box box;
+
+    for (; l != NULL; l = l->next) {
+        s = LIST_DATA(l, struct hashtable_entry *)->value;
+
+        if ((s->len == n) && !memcmp(s->str, key, n))
+            return _json_compact_ptr(BOX_STRING, s);
+    }
+
+    if ((box = _json_compact_string(key, n)) != 0) {
+        s = BOX_PTR(box);
+        hashtable_insert(doc->keys, s, s);
+    }
+
+    return box;
+}
+
+/* djb2, over exactly n bytes */
+static size_t _json_compact_key_hash_n(const char *key, size_t n)
+{
+    size_t hash = 5381;
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        hash = ((hash << 5) + hash) + (unsigned char)key[i];
+
+    return hash;
+}
+
+/* The key table is keyed by the struct json_compact_string of every key */
+static size_t _json_compact_key_hash(const void *key)
+{
+    const struct json_compact_string *s = key;
+
+    return _json_compact_key_hash_n(s->str, s->len);
+}
+
+/* Zero if equal, like strcmp() */
+static int _json_compact_key_equal(const void *a, const void *b)
+{
+    const struct json_compact_string *sa = a;
+    const struct json_compact_string *sb = b;
+
+    return (sa->len != sb->len) || memcmp(sa->str, sb->str, sa->len);
+}
+
+static json_box _json_compact_from_value(struct json_compact *doc,
+                                         const struct json_value *val)
+{
+    struct json_compact_vector *vec;
+    size_t len;
+    size_t i = 0;
+
+    switch (val->type) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_get_string_n(val, &n);
+
+        return _json_compact_string(str, n);
+    }
+    case JSON_NUMBER:
+        return _json_compact_number(json_get_number_value(val));
+
+    case JSON_BOOLEAN:
+        return BOX(val->value.jbool ? BOX_TRUE : BOX_FALSE, 0);
+
+    case JSON_NULL:
+        return BOX(BOX_NULL, 0);
+
+    case JSON_ARRAY: {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+
+        len = json_array_size(val);
+
+        if ((vec = malloc(sizeof(*vec) + sizeof(json_box) * len)) == NULL)
+            return 0;
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem)) {
+            if ((vec->boxes[i] = _json_compact_from_value(doc, elem)) == 0)
+                break;
+
+            i++;
+        }
+
+        vec->len = i;
+
+        if (i < len) {
+            _json_compact_free_box(_json_compact_ptr(BOX_ARRAY, vec));
+            return 0;
+        }
+
+        return _json_compact_ptr(BOX_ARRAY, vec);
+    }
+    case JSON_OBJECT: {
+        struct json_object_iterator iter;
+        struct json_value *member;
+        const char *key;
+        size_t n;
+
+        len = json_object_size(val);
+
+        if ((vec = malloc(sizeof(*vec) + sizeof(json_box) * len * 2)) == NULL)
+            return 0;
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter, &key, &n, &member)) {
+            vec->boxes[2 * i] = _json_compact_key(doc, key, n);
+            vec->boxes[2 * i + 1] = (vec->boxes[2 * i] != 0)
+                ? _json_compact_from_value(doc, member)
+                : 0;
+
+            if (vec->boxes[2 * i + 1] == 0) {
+                json_object_iterator_free(&iter);
+                break;
+            }
+
+            i++;
+        }
+
+        vec->len = i;
+
+        if (i < len) {
+            _json_compact_free_box(_json_compact_ptr(BOX_OBJECT, vec));
+            return 0;
+        }
+
+        return _json_compact_ptr(BOX_OBJECT, vec);
+    }
+    }
+
+    return 0;
+}
+
+/* Keys belong to the document, so they're left alone */
+static void _json_compact_free_box(json_box box)
+{
+    struct json_compact_vector *vec;
+    size_t i;
+
+    if (BOX_IS_NUMBER(box))
+        return;
+
+    switch (BOX_TAG(box)) {
+    case BOX_STRING:
+        free(BOX_PTR(box));
+        break;
+
+    case BOX_ARRAY:
+        vec = BOX_PTR(box);
+
+        for (i = 0; i < vec->len; ++i)
+            _json_compact_free_box(vec->boxes[i]);
+
+        free(vec);
+        break;
+
+    case BOX_OBJECT:
+        vec = BOX_PTR(box);
+
+        for (i = 0; i < vec->len; ++i)
+            _json_compact_free_box(vec->boxes[2 * i + 1]);
+
+        free(vec);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static int _json_compact_push(struct json_compact_parser *p, json_box box)
+{
+    if (p->len == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 64;
+        json_box *grown = realloc(p->vals, sizeof(*grown) * cap);
+
+        if (grown == NULL)
+            return 1;
+
+        p->vals = grown;
+        p->cap = cap;
+    }
+
+    p->vals[p->len++] = box;
+    return 0;
+}
+
+/* Returns 0 on error */
+static json_box _json_compact_scalar(struct json_compact_parser *p,
+                                     struct json_token *tok)
+{
+    const char *text = p->lex.input + tok->i;
+    size_t len = tok->j - tok->i;
+
+    switch (tok->type) {
+    case TOK_STRING: {
+        size_t n;
+        char *str = json_parse_string_n(&p->lex, tok, &n);
+        json_box box;
+
+        if (str == NULL)
+            return 0;
+
+        box = _json_compact_string(str, n);
+        free(str);
+
+        return box;
+    }
+    case TOK_NUMBER: {
+        bool neg = (text[0] == '-');
+        int32_t i = 0;
+        size_t k = neg;
+        double d;
+
+        /* Most numbers are small integers, which don't need strtod() */
+        if ((len > k) && (len - k <= 9)) {
+            for (; (k < len) && (text[k] >= '0') && (text[k] <= '9'); ++k)
+                i = i * 10 + (text[k] - '0');
+
+            /* -0 is a double */
+            if ((k == len) && !(neg && (i == 0)))
+                return BOX(BOX_INT, (uint32_t)(neg ? -i : i));
+        }
+
+        if (json_parse_number(text, len, &d))
+            return 0;
+
+        return _json_compact_number(d);
+    }
+    case TOK_TRUE:
+        return BOX(BOX_TRUE, 0);
+
+    case TOK_FALSE:
+        return BOX(BOX_FALSE, 0);
+
+    case TOK_NULL:
+        return BOX(BOX_NULL, 0);
+
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Reads on after the opening bracket or a comma, like _json_frame_next() in
+ * json.c: returns 0 if a value follows (with the key of objects already
+ * pushed), 1 if the container closed and -1 on error.
+ */
+static int _json_compact_next(struct json_compact_parser *p,
+                              struct json_compact_frame *frame)
+{
+    struct json_token tok;
+    size_t oldpos = p->lex.pos;
+    json_box key;
+    char *str;
+    size_t n;
+
+    if (json_lexer_next_token(&p->lex, &tok))
+        return -1;
+
+    if (!frame->object) {
+        if (tok.type == TOK_SQUARE_BRACKET_CLOSE)
+            return 1;
+
+        /* Part of the element, so leave it to be read again */
+        p->lex.pos = oldpos;
+        return 0;
+    }
+
+    if (tok.type == TOK_BRACE_CLOSE)
+        return 1;
+    else if (tok.type != TOK_STRING)
+        return -1;
+
+    if ((str = json_parse_string_n(&p->lex, &tok, &n)) == NULL)
+        return -1;
+
+    key = _json_compact_key(p->doc, str, n);
+    free(str);
+
+    if ((key == 0) || _json_compact_push(p, key))
+        return -1;
+
+    if (json_lexer_next_token(&p->lex, &tok) || (tok.type != TOK_COLON))
+        return -1;
+
+    return 0;
+}
+
+/* Moves the values of frame off the stack into a container of their own */
+static json_box _json_compact_close(struct json_compact_parser *p,
+                                    struct json_compact_frame *frame)
+{
+    size_t n = p->len - frame->start;
+    struct json_compact_vector *vec;
+
+    if ((vec = malloc(sizeof(*vec) + sizeof(json_box) * n)) == NULL)
+        return 0;
+
+    vec->len = frame->object ? n / 2 : n;
+    memcpy(vec->boxes, p->vals + frame->start, sizeof(json_box) * n);
+
+    p->len = frame->start;
+
+    return _json_compact_ptr(frame->object ? BOX_OBJECT : BOX_ARRAY, vec);
+}
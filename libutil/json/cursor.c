@@ -0,0 +1,308 @@
+#include <libutil/json/cursor.h>
+
+#include <string.h>
+#include <ctype.h>
+
+static int _json_cursor_seek(struct json_lexer_state *lex,
+                             struct json_cursor *out);
+
+static int _json_cursor_token(const struct json_cursor *cur,
+                              struct json_lexer_state *lex,
+                              struct json_token *tok);
+
+
+int json_cursor_init(struct json_cursor *cur, const char *input, size_t n)
+{
+    struct json_lexer_state lex;
+
+    json_lexer_init(&lex, input, n);
+
+    return _json_cursor_seek(&lex, cur);
+}
+
+enum json_value_type json_cursor_type(const struct json_cursor *cur)
+{
+    char c = cur->input[cur->pos];
+
+    switch (c) {
+    case '{': return JSON_OBJECT;
+    case '[': return JSON_ARRAY;
+    case '"': return JSON_STRING;
+    case 't':
+    case 'f': return JSON_BOOLEAN;
+    default:
+        return (isdigit((unsigned char)c) || (c == '+') || (c == '-'))
+            ? JSON_NUMBER
+            : JSON_NULL;
+    }
+}
+
+int json_cursor_lookup(const struct json_cursor *obj,
+                       const char *key,
+                       struct json_cursor *out)
+{
+    struct json_cursor_iterator iter;
+    struct json_cursor k;
+
+    if (!json_cursor_iterator_init(&iter, obj) || (iter.type != JSON_OBJECT))
+        return 1;
+
+    while (json_cursor_iterator_next(&iter, &k, out))
+        if (json_cursor_string_equal(&k, key))
+            return 0;
+
+    return 1;
+}
+
+int json_cursor_index(const struct json_cursor *arr,
+                      size_t n,
+                      struct json_cursor *out)
+{
+    struct json_cursor_iterator iter;
+
+    if (!json_cursor_iterator_init(&iter, arr) || (iter.type != JSON_ARRAY))
+        return 1;
+
+    while (json_cursor_iterator_next(&iter, NULL, out))
+        if (!n--)
+            return 0;
+
+    return 1;
+}
+
+bool json_cursor_iterator_init(struct json_cursor_iterator *iter,
+                               const struct json_cursor *cur)
+{
+    struct json_token tok;
+
+    memset(iter, 0, sizeof(*iter));
+
+    if (_json_cursor_token(cur, &iter->lex, &tok))
+        return false;
+
+    if (tok.type == TOK_BRACE_OPEN)
+        iter->type = JSON_OBJECT;
+    else if (tok.type == TOK_SQUARE_BRACKET_OPEN)
+        iter->type = JSON_ARRAY;
+    else
+        return false;
+
+    iter->first = true;
+    return true;
+}
+
+bool json_cursor_iterator_next(struct json_cursor_iterator *iter,
+                               struct json_cursor *key,
+                               struct json_cursor *val)
+{
+    struct json_lexer_state *lex = &iter->lex;
+    struct json_token tok;
+
+    enum json_token_type close = (iter->type == JSON_OBJECT)
+        ? TOK_BRACE_CLOSE
+        : TOK_SQUARE_BRACKET_CLOSE;
+
+    if (iter->error || iter->done)
+        return false;
+
+    /* The value returned last time, unless the caller went past it already */
+    if (iter->has_pending) {
+        lex->pos = iter->pending;
+        iter->has_pending = false;
+
+        if (json_lexer_skip_value(lex))
+            goto exit_err;
+    }
+
+    if (json_lexer_next_token(lex, &tok))
+        goto exit_err;
+
+    if (tok.type == close) {
+        iter->done = true;
+        return false;
+    }
+
+    /* Every element but the first is preceded by a comma */
+    if (!iter->first) {
+        if ((tok.type != TOK_COMMA) || json_lexer_next_token(lex, &tok))
+            goto exit_err;
+    }
+
+    iter->first = false;
+
+    if (iter->type == JSON_OBJECT) {
+        if (tok.type != TOK_STRING)
+            goto exit_err;
+
+        if (key != NULL) {
+            key->input = lex->input;
+            key->len = lex->len;
+            key->pos = tok.i;
+        }
+
+        if (json_lexer_next_token(lex, &tok) || (tok.type != TOK_COLON))
+            goto exit_err;
+    } else {
+        /* That was the element itself already, back up */
+        lex->pos = tok.i;
+    }
+
+    /* Trailing commas and missing values leave no value to return */
+    if (_json_cursor_seek(lex, val) || strchr("}],:", lex->input[lex->pos]))
+        goto exit_err;
+
+    iter->pending = lex->pos;
+    iter->has_pending = true;
+
+    return true;
+
+exit_err:
+    iter->error = true;
+    return false;
+}
+
+void json_cursor_iterator_consumed(struct json_cursor_iterator *iter,
+                                   size_t end)
+{
+    if (iter->has_pending) {
+        iter->lex.pos = end;
+        iter->has_pending = false;
+    }
+}
+
+size_t json_cursor_iterator_end(struct json_cursor_iterator *iter)
+{
+    struct json_cursor val;
+
+    while (json_cursor_iterator_next(iter, NULL, &val));
+
+    return iter->error ? 0 : iter->lex.pos;
+}
+
+char *json_cursor_get_string(const struct json_cursor *cur)
+{
+    struct json_lexer_state lex;
+    struct json_token tok;
+
+    if (_json_cursor_token(cur, &lex, &tok) || (tok.type != TOK_STRING))
+        return NULL;
+
+    return json_parse_string(&lex, &tok);
+}
+
+int json_cursor_get_number(const struct json_cursor *cur, double *out)
+{
+    struct json_lexer_state lex;
+    struct json_token tok;
+
+    if (_json_cursor_token(cur, &lex, &tok) || (tok.type != TOK_NUMBER))
+        return 1;
+
+    return json_parse_number(cur->input + tok.i, tok.j - tok.i, out);
+}
+
+int json_cursor_get_bool(const struct json_cursor *cur, bool *out)
+{
+    struct json_lexer_state lex;
+    struct json_token tok;
+
+    if (_json_cursor_token(cur, &lex, &tok))
+        return 1;
+
+    if ((tok.type != TOK_TRUE) && (tok.type != TOK_FALSE))
+        return 1;
+
+    *out = tok.type == TOK_TRUE;
+    return 0;
+}
+
+bool json_cursor_is_null(const struct json_cursor *cur)
+{
+    struct json_lexer_state lex;
+    struct json_token tok;
+
+    return !_json_cursor_token(cur, &lex, &tok) && (tok.type == TOK_NULL);
+}
+
+bool json_cursor_string_equal(const struct json_cursor *cur, const char *str)
+{
+    struct json_lexer_state lex;
+    struct json_token tok;
+
+    const char *raw;
+    size_t rawlen;
+
+    if (_json_cursor_token(cur, &lex, &tok) || (tok.type != TOK_STRING))
+        return false;
+
+    /* Without the quotes */
+    raw = cur->input + tok.i + 1;
+    rawlen = tok.j - tok.i - 2;
+
+    if (memchr(raw, '\\', rawlen) == NULL) {
+        /* Nothing to decode, compare in place */
+        return (strncmp(raw, str, rawlen) == 0) && (str[rawlen] == '\0');
+    } else {
+        char *decoded = json_parse_string(&lex, &tok);
+        bool equal = (decoded != NULL) && !strcmp(decoded, str);
+
+        free(decoded);
+        return equal;
+    }
+}
+
+size_t json_cursor_raw(const struct json_cursor *cur, const char **raw)
+{
+    struct json_lexer_state lex;
+
+    json_lexer_init(&lex, cur->input, cur->len);
+    lex.pos = cur->pos;
+
+    if (json_lexer_skip_value(&lex))
+        return 0;
+
+    *raw = cur->input + cur->pos;
+    return lex.pos - cur->pos;
+}
+
+struct json_value *json_cursor_value(const struct json_cursor *cur)
+{
+    struct json_lexer_state lex;
+
+    json_lexer_init(&lex, cur->input, cur->len);
+    lex.pos = cur->pos;
+
+    return json_parse_value(&lex);
+}
+
+/* Skip whitespace up to the start of the next value and point out there */
+static int _json_cursor_seek(struct json_lexer_state *lex,
+                             struct json_cursor *out)
+{
+    while ((lex->pos < lex->len) && lex->input[lex->pos]) {
+        unsigned char c = lex->input[lex->pos];
+
+        if (!isspace(c) && !iscntrl(c)) {
+            out->input = lex->input;
+            out->len = lex->len;
+            out->pos = lex->pos;
+
+            return 0;
+        }
+
+        lex->pos++;
+    }
+
+    return 1;
+}
+
+/* Lex the first token of the value at cur */
+static int _json_cursor_token(const struct json_cursor *cur,
+                              struct json_lexer_state *lex,
+                              struct json_token *tok)
+{
+    json_lexer_init(lex, cur->input, cur->len);
+    lex->pos = cur->pos;
+
+    return json_lexer_next_token(lex, tok);
+}
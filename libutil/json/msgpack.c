@@ -0,0 +1,462 @@
+#include <libutil/json/msgpack.h>
+#include <libutil/utf8.h>
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "binary.h"
+
+static int _json_msgpack_head(struct json_writer *w,
+                              unsigned char fix,
+                              size_t fixmax,
+                              unsigned char lead8,
+                              unsigned char lead16,
+                              size_t n);
+
+static int _json_msgpack_string(struct json_writer *w,
+                                const char *str,
+                                size_t n);
+
+static int _json_msgpack_number(struct json_writer *w, double d);
+
+static struct json_value *_json_msgpack_object(
+        struct json_binary_decoder *dec);
+
+static struct json_value *_json_msgpack_array(struct json_binary_decoder *dec,
+                                              uint64_t count);
+
+static struct json_value *_json_msgpack_map(struct json_binary_decoder *dec,
+                                            uint64_t count);
+
+static char *_json_msgpack_str(struct json_binary_decoder *dec,
+                               uint64_t n,
+                               bool text);
+
+static struct json_value *_json_msgpack_string_value(
+        struct json_binary_decoder *dec,
+        uint64_t n,
+        bool text);
+
+static int _json_msgpack_key(struct json_binary_decoder *dec, char **key);
+
+
+int json_msgpack_write(struct json_writer *w, const struct json_value *val)
+{
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    switch (val->type) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_get_string_n(val, &n);
+
+        return _json_msgpack_string(w, str, n);
+    }
+    case JSON_NUMBER:
+        return _json_msgpack_number(w, json_get_number_value(val));
+
+    case JSON_NULL:
+        return json_writer_write(w, "\xc0", 1);
+
+    case JSON_BOOLEAN:
+        return json_writer_write(w, val->value.jbool ? "\xc3" : "\xc2", 1);
+
+    case JSON_ARRAY: {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+
+        /* fixarray, array 16, array 32 */
+        _json_msgpack_head(w, 0x90, 15, 0, 0xdc, json_array_size(val));
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem))
+            json_msgpack_write(w, elem);
+
+        return w->error;
+    }
+    case JSON_OBJECT: {
+        struct json_object_iterator iter;
+        struct json_value *value;
+        const char *key;
+        size_t n;
+
+        /* fixmap, map 16, map 32 */
+        _json_msgpack_head(w, 0x80, 15, 0, 0xde, json_object_size(val));
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter, &key, &n, &value)) {
+            _json_msgpack_string(w, key, n);
+            json_msgpack_write(w, value);
+        }
+
+        return w->error;
+    }
+    }
+
+    return w->error;
+}
+
+char *json_msgpack_encode(const struct json_value *val, size_t *n)
+{
+    struct json_writer w;
+
+    json_writer_init_buffer(&w);
+    json_msgpack_write(&w, val);
+
+    return json_writer_detach(&w, n);
+}
+
+struct json_value *json_msgpack_decode(const char *buf,
+                                       size_t n,
+                                       size_t *used)
+{
+    struct json_binary_decoder dec;
+    struct json_value *val;
+
+    dec.buf = (const unsigned char *)buf;
+    dec.len = n;
+    dec.pos = 0;
+    dec.depth = 0;
+
+    if (((val = _json_msgpack_object(&dec)) != NULL) && (used != NULL))
+        *used = dec.pos;
+
+    return val;
+}
+
+/*
+ * Write a length in the shortest form: the fix variant for up to fixmax, then
+ * the 8 (if there is one), 16 and 32 bit variants, which always follow each
+ * other.
+ */
+static int _json_msgpack_head(struct json_writer *w,
+                              unsigned char fix,
+                              size_t fixmax,
+                              unsigned char lead8,
+                              unsigned char lead16,
+                              size_t n)
+{
+    if (n <= fixmax)
+        return _json_binary_put(w, fix | n, 0, 0);
+    else if (lead8 && (n <= UINT8_MAX))
+        return _json_binary_put(w, lead8, n, 1);
+    else if (n <= UINT16_MAX)
+        return _json_binary_put(w, lead16, n, 2);
+    else if ((uint64_t)n <= UINT32_MAX)
+        return _json_binary_put(w, lead16 + 1, n, 4);
+
+    /* Too long to be represented at all */
+    w->error = true;
+    return 1;
+}
+
+static int _json_msgpack_string(struct json_writer *w,
+                                const char *str,
+                                size_t n)
+{
+    /* fixstr, str 8, str 16, str 32 */
+    return _json_msgpack_head(w, 0xa0, 31, 0xd9, 0xda, n)
+        || json_writer_write(w, str, n);
+}
+
+static int _json_msgpack_number(struct json_writer *w, double d)
+{
+    union { double d; uint64_t u; } dbl;
+    union { float f; uint32_t u; } flt;
+
+    /* Integral values that fit into 64 bits (but not -0) are integers */
+    if (!signbit(d) && (d < 18446744073709551616.0)
+            && ((double)(uint64_t)d == d)) {
+        uint64_t u = (uint64_t)d;
+
+        if (u <= 0x7f)
+            return _json_binary_put(w, u, 0, 0);           /* fixint */
+        else if (u <= UINT8_MAX)
+            return _json_binary_put(w, 0xcc, u, 1);
+        else if (u <= UINT16_MAX)
+            return _json_binary_put(w, 0xcd, u, 2);
+        else if (u <= UINT32_MAX)
+            return _json_binary_put(w, 0xce, u, 4);
+        else
+            return _json_binary_put(w, 0xcf, u, 8);
+    }
+
+    if ((d < 0) && (d >= -9223372036854775808.0)
+            && ((double)(int64_t)d == d)) {
+        int64_t i = (int64_t)d;
+
+        if (i >= -32)
+            return _json_binary_put(w, (uint8_t)i, 0, 0); /* negative fixint */
+        else if (i >= INT8_MIN)
+            return _json_binary_put(w, 0xd0, (uint64_t)i, 1);
+        else if (i >= INT16_MIN)
+            return _json_binary_put(w, 0xd1, (uint64_t)i, 2);
+        else if (i >= INT32_MIN)
+            return _json_binary_put(w, 0xd2, (uint64_t)i, 4);
+        else
+            return _json_binary_put(w, 0xd3, (uint64_t)i, 8);
+    }
+
+    /* Single precision if that loses nothing */
+    if (isinf(d) || ((d >= -FLT_MAX) && (d <= FLT_MAX) && ((float)d == d))) {
+        flt.f = (float)d;
+        return _json_binary_put(w, 0xca, flt.u, 4);
+    }
+
+    dbl.d = d;
+    return _json_binary_put(w, 0xcb, dbl.u, 8);
+}
+
+static struct json_value *_json_msgpack_object(
+        struct json_binary_decoder *dec)
+{
+    struct json_value *val;
+    unsigned char b;
+    uint64_t arg;
+    uint64_t count;
+    bool map;
+
+    if (dec->pos >= dec->len)
+        return NULL;
+
+    b = dec->buf[dec->pos++];
+
+    /* The fix variants first */
+    if (b <= 0x7f)
+        return json_number_new(b);
+    else if (b >= 0xe0)
+        return json_number_new((int8_t)b);
+    else if ((b & 0xe0) == 0xa0)
+        return _json_msgpack_string_value(dec, b & 0x1f, true);
+
+    switch (b) {
+    case 0xc0: return json_null_new();
+    case 0xc2: return json_bool_new(false);
+    case 0xc3: return json_bool_new(true);
+
+    /* uint 8 - 64 */
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+        if (_json_binary_read(dec, 1 << (b - 0xcc), &arg))
+            return NULL;
+
+        return json_number_new((double)arg);
+
+    /* int 8 - 64, sign extended from their width */
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3: {
+        unsigned bits = 8 << (b - 0xd0);
+
+        if (_json_binary_read(dec, bits / 8, &arg))
+            return NULL;
+
+        if ((bits < 64) && (arg >> (bits - 1)))
+            arg |= ~(uint64_t)0 << bits;
+
+        return json_number_new((double)(int64_t)arg);
+    }
+    case 0xca: {
+        union { float f; uint32_t u; } flt;
+
+        if (_json_binary_read(dec, 4, &arg))
+            return NULL;
+
+        flt.u = arg;
+        return json_number_new(flt.f);
+    }
+    case 0xcb: {
+        union { double d; uint64_t u; } dbl;
+
+        if (_json_binary_read(dec, 8, &arg))
+            return NULL;
+
+        dbl.u = arg;
+        return json_number_new(dbl.d);
+    }
+
+    /* str 8 - 32 and bin 8 - 32 */
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+    case 0xc4:
+    case 0xc5:
+    case 0xc6: {
+        unsigned width = 1 << ((b >= 0xd9) ? b - 0xd9 : b - 0xc4);
+
+        if (_json_binary_read(dec, width, &arg))
+            return NULL;
+
+        return _json_msgpack_string_value(dec, arg, b >= 0xd9);
+    }
+
+    /* array 16, array 32, map 16, map 32 */
+    case 0xdc:
+    case 0xdd:
+    case 0xde:
+    case 0xdf:
+        map = b >= 0xde;
+
+        if (_json_binary_read(dec, (b & 1) ? 4 : 2, &count))
+            return NULL;
+
+        break;
+
+    default:
+        if ((b & 0xf0) == 0x90) {
+            map = false;
+            count = b & 0x0f;
+        } else if ((b & 0xf0) == 0x80) {
+            map = true;
+            count = b & 0x0f;
+        } else {
+            /* ext types and the unused 0xc1 */
+            return NULL;
+        }
+
+        break;
+    }
+
+    /* Every element takes up at least a byte, don't trust the count */
+    if ((count > dec->len - dec->pos) || (dec->depth >= JSON_MSGPACK_MAX_DEPTH))
+        return NULL;
+
+    dec->depth++;
+    val = map ? _json_msgpack_map(dec, count) : _json_msgpack_array(dec, count);
+    dec->depth--;
+
+    return val;
+}
+
+static struct json_value *_json_msgpack_array(struct json_binary_decoder *dec,
+                                              uint64_t count)
+{
+    struct json_value *arr = json_array_new();
+    struct list *tail = NULL;
+    uint64_t i;
+
+    for (i = 0; i < count; ++i) {
+        struct json_value *elem = _json_msgpack_object(dec);
+        struct list *link;
+
+        if (elem == NULL) {
+            json_free(arr);
+            return NULL;
+        }
+
+        link = list_new_with_data(elem);
+
+        if (tail != NULL) {
+            link->prev = tail;
+            tail->next = link;
+        } else {
+            arr->value.jarray = link;
+        }
+
+        tail = link;
+    }
+
+    return arr;
+}
+
+static struct json_value *_json_msgpack_map(struct json_binary_decoder *dec,
+                                            uint64_t count)
+{
+    struct json_value *obj = json_object_new();
+    uint64_t i;
+
+    for (i = 0; i < count; ++i) {
+        struct json_value *val;
+        char *key;
+
+        if (_json_msgpack_key(dec, &key))
+            goto exit_err;
+
+        if ((val = _json_msgpack_object(dec)) == NULL) {
+            free(key);
+            goto exit_err;
+        }
+
+        hashtable_insert(obj->value.jobject, key, val);
+    }
+
+    return obj;
+
+exit_err:
+    json_free(obj);
+    return NULL;
+}
+
+/*
+ * Copy the next n bytes into a new terminated string, which has to be UTF-8
+ * if it's text (str rather than bin)
+ */
+static char *_json_msgpack_str(struct json_binary_decoder *dec,
+                               uint64_t n,
+                               bool text)
+{
+    char *str;
+
+    if ((n > dec->len - dec->pos)
+            || (text && (utf8_validate(
+                    (const char *)dec->buf + dec->pos, n) != n)))
+        return NULL;
+
+    str = malloc(n + 1);
+    memcpy(str, dec->buf + dec->pos, n);
+    str[n] = '\0';
+
+    dec->pos += n;
+    return str;
+}
+
+static struct json_value *_json_msgpack_string_value(
+        struct json_binary_decoder *dec,
+        uint64_t n,
+        bool text)
+{
+    struct json_value *val;
+    char *str;
+
+    if ((str = _json_msgpack_str(dec, n, text)) == NULL)
+        return NULL;
+
+    val = json_value_new(JSON_STRING);
+    val->value.jstring = str;
+
+    return val;
+}
+
+/* Only string (or bin) keys make sense for JSON */
+static int _json_msgpack_key(struct json_binary_decoder *dec, char **key)
+{
+    unsigned char b;
+    uint64_t n;
+    bool text = true;
+
+    if (dec->pos >= dec->len)
+        return 1;
+
+    b = dec->buf[dec->pos++];
+
+    if ((b & 0xe0) == 0xa0) {
+        n = b & 0x1f;
+    } else if ((b >= 0xd9) && (b <= 0xdb)) {
+        if (_json_binary_read(dec, 1 << (b - 0xd9), &n))
+            return 1;
+    } else if ((b >= 0xc4) && (b <= 0xc6)) {
+        if (_json_binary_read(dec, 1 << (b - 0xc4), &n))
+            return 1;
+
+        text = false;
+    } else {
+        return 1;
+    }
+
+    return (*key = _json_msgpack_str(dec, n, text)) == NULL;
+}
@@ -0,0 +1,278 @@
+#include <libutil/json/ndjson.h>
+#include <libutil/json/parallel.h>
+
+#include <string.h>
+#include <ctype.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct json_ndjson_record
+{
+    size_t pos;
+    size_t len;
+    size_t line;
+
+    struct json_value *val;
+};
+
+struct json_ndjson_state
+{
+    unsigned nthreads;
+
+    json_ndjson_func fn;
+    void *ud;
+
+    size_t line; /* number of the next line */
+    bool stopped;
+
+    /* The current batch */
+    const char *input;
+    struct json_ndjson_record *records;
+    size_t nrecords;
+};
+
+struct json_ndjson_all
+{
+    struct json_value **vals;
+    size_t n;
+    size_t cap;
+};
+
+static size_t _json_ndjson_run(struct json_ndjson_state *st,
+                               const char *input,
+                               size_t n,
+                               bool final);
+
+static void _json_ndjson_parse_block(size_t i, void *ud);
+static bool _json_ndjson_blank(const char *line, size_t n);
+
+static int _json_ndjson_collect(size_t line, struct json_value *val, void *ud);
+
+
+int json_ndjson_parse(const char *input,
+                      size_t n,
+                      unsigned nthreads,
+                      json_ndjson_func fn,
+                      void *ud)
+{
+    struct json_ndjson_state st;
+
+    memset(&st, 0, sizeof(st));
+
+    st.nthreads = nthreads;
+    st.fn = fn;
+    st.ud = ud;
+    st.line = 1;
+    st.records = malloc(sizeof(*st.records) * JSON_NDJSON_BATCH);
+
+    _json_ndjson_run(&st, input, n, true);
+
+    free(st.records);
+    return st.stopped;
+}
+
+int json_ndjson_parse_file(const char *path,
+                           unsigned nthreads,
+                           json_ndjson_func fn,
+                           void *ud)
+{
+    struct json_ndjson_state st;
+    struct stat sb;
+    int fd;
+
+    char *buf = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    ssize_t n = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 1;
+
+    memset(&st, 0, sizeof(st));
+
+    st.nthreads = nthreads;
+    st.fn = fn;
+    st.ud = ud;
+    st.line = 1;
+    st.records = malloc(sizeof(*st.records) * JSON_NDJSON_BATCH);
+
+    if ((fstat(fd, &sb) == 0) && S_ISREG(sb.st_mode) && (sb.st_size > 0)) {
+        void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            posix_madvise(map, sb.st_size, POSIX_MADV_SEQUENTIAL);
+
+            _json_ndjson_run(&st, map, sb.st_size, true);
+            munmap(map, sb.st_size);
+
+            goto exit;
+        }
+    }
+
+    /*
+     * Not mappable, so read it in chunks. Whatever is left of an incomplete
+     * last line is moved to the front for the next round.
+     */
+    while (!st.stopped) {
+        size_t done;
+
+        if (cap - len < JSON_NDJSON_READSIZ) {
+            cap = len + JSON_NDJSON_READSIZ;
+            buf = realloc(buf, cap);
+        }
+
+        if ((n = read(fd, buf + len, cap - len)) <= 0)
+            break;
+
+        len += n;
+        done = _json_ndjson_run(&st, buf, len, false);
+
+        memmove(buf, buf + done, len - done);
+        len -= done;
+    }
+
+    if (n < 0)
+        st.stopped = true;
+    else if (!st.stopped)
+        _json_ndjson_run(&st, buf, len, true);
+
+exit:
+    free(buf);
+    free(st.records);
+    close(fd);
+
+    return st.stopped;
+}
+
+struct json_value **json_ndjson_parse_all(const char *input,
+                                          size_t n,
+                                          unsigned nthreads,
+                                          size_t *count)
+{
+    struct json_ndjson_all all;
+
+    memset(&all, 0, sizeof(all));
+
+    json_ndjson_parse(input, n, nthreads, _json_ndjson_collect, &all);
+
+    *count = all.n;
+    return all.vals;
+}
+
+/*
+ * Split off batches of complete lines from input, parse them in parallel
+ * and deliver them. Unless final is set, an unterminated last line is left
+ * alone. Returns the number of bytes consumed.
+ */
+static size_t _json_ndjson_run(struct json_ndjson_state *st,
+                               const char *input,
+                               size_t n,
+                               bool final)
+{
+    size_t pos = 0;
+    bool more = true;
+
+    st->input = input;
+
+    while (more && (pos < n) && !st->stopped) {
+        size_t nblocks;
+        size_t i;
+
+        st->nrecords = 0;
+
+        while ((st->nrecords < JSON_NDJSON_BATCH) && (pos < n)) {
+            const char *nl = memchr(input + pos, '\n', n - pos);
+            size_t end = (nl != NULL) ? (size_t)(nl - input) : n;
+
+            if ((nl == NULL) && !final) {
+                more = false;
+                break;
+            }
+
+            if (!_json_ndjson_blank(input + pos, end - pos)) {
+                struct json_ndjson_record *rec =
+                    &st->records[st->nrecords++];
+
+                rec->pos = pos;
+                rec->len = end - pos;
+                rec->line = st->line;
+                rec->val = NULL;
+            }
+
+            st->line++;
+            pos = (nl != NULL) ? end + 1 : n;
+        }
+
+        nblocks = (st->nrecords + JSON_NDJSON_BLOCK - 1) / JSON_NDJSON_BLOCK;
+        json_parallel_for(nblocks, st->nthreads, _json_ndjson_parse_block, st);
+
+        /* Hand them out in order, dropping the rest once told to stop */
+        for (i = 0; i < st->nrecords; ++i) {
+            struct json_ndjson_record *rec = &st->records[i];
+
+            if (st->stopped) {
+                if (rec->val != NULL)
+                    json_free(rec->val);
+            } else if (st->fn(rec->line, rec->val, st->ud)) {
+                st->stopped = true;
+            }
+        }
+    }
+
+    return pos;
+}
+
+static void _json_ndjson_parse_block(size_t i, void *ud)
+{
+    struct json_ndjson_state *st = ud;
+    size_t end = (i + 1) * JSON_NDJSON_BLOCK;
+    size_t j;
+
+    if (end > st->nrecords)
+        end = st->nrecords;
+
+    for (j = i * JSON_NDJSON_BLOCK; j < end; ++j) {
+        struct json_ndjson_record *rec = &st->records[j];
+        const char *line = st->input + rec->pos;
+        struct json_lexer_state lex;
+
+        json_lexer_init(&lex, line, rec->len);
+        rec->val = json_parse_value(&lex);
+
+        /* One value per line, and nothing else */
+        if ((rec->val != NULL)
+                && !_json_ndjson_blank(line + lex.pos, rec->len - lex.pos)) {
+            json_free(rec->val);
+            rec->val = NULL;
+        }
+    }
+}
+
+static bool _json_ndjson_blank(const char *line, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        if (!isspace((unsigned char)line[i]))
+            return false;
+
+    return true;
+}
+
+static int _json_ndjson_collect(size_t line, struct json_value *val, void *ud)
+{
+    struct json_ndjson_all *all = ud;
+
+    (void)line;
+
+    if (all->n == all->cap) {
+        all->cap = all->cap ? all->cap * 2 : 64;
+        all->vals = realloc(all->vals, sizeof(*all->vals) * all->cap);
+    }
+
+    all->vals[all->n++] = val;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef JSON_NDJSON_H
+#define JSON_NDJSON_H
+
+#include <libutil/json.h>
+
+#include <stdlib.h>
+
+/*
+ * Newline delimited JSON (NDJSON, JSON Lines): one value per line.
+ *
+ * Since JSON strings can't contain raw control characters, every newline byte
+ * in valid input ends a record, escaped newlines within strings being a
+ * backslash followed by an 'n'. Record boundaries are therefore found with a
+ * plain memchr(), after which batches of records are parsed on a number of
+ * threads (see json/parallel.h) and handed back in input order. One batch
+ * is split off, parsed and handed back before the next one is started, so
+ * the callback never runs alongside the parsing. Blank lines are skipped.
+ *
+ * Example usage:
+ *
+ *     static int on_record(size_t line, struct json_value *val, void *ud)
+ *     {
+ *         if (val == NULL) {
+ *             fprintf(stderr, "line %zu: parse error\n", line);
+ *             return 1;
+ *         }
+ *
+ *         [...]
+ *
+ *         json_free(val);
+ *         return 0;
+ *     }
+ *
+ *     json_ndjson_parse_file("events.ndjson", 0, on_record, NULL);
+ */
+
+#define JSON_NDJSON_BATCH   16384     /* records parsed per round        */
+#define JSON_NDJSON_BLOCK   64        /* records per unit of work        */
+#define JSON_NDJSON_READSIZ (1 << 22) /* read size for unmappable files  */
+
+/*
+ * Called for every record in order. line is the (1 based) line number, val
+ * the parsed value, which is the callback's to free, or NULL if the line is
+ * not valid JSON (or has anything but whitespace after the value). Returning
+ * anything but 0 stops parsing.
+ */
+typedef int (*json_ndjson_func)(size_t line, struct json_value *val, void *ud);
+
+/*
+ * Parse the n bytes of NDJSON at input using nthreads threads (0 for one per
+ * processor). Returns 0 if all of the input has been processed, 1 if the
+ * callback stopped it (or, for files, on read errors).
+ */
+int json_ndjson_parse(const char *input,
+                      size_t n,
+                      unsigned nthreads,
+                      json_ndjson_func fn,
+                      void *ud);
+
+/* Same for the file at path, which is mapped or otherwise read in chunks */
+int json_ndjson_parse_file(const char *path,
+                           unsigned nthreads,
+                           json_ndjson_func fn,
+                           void *ud);
+
+/*
+ * Parse all records into an array of *count values (NULL for invalid lines),
+ * to be freed by the caller along with its elements.
+ */
+struct json_value **json_ndjson_parse_all(const char *input,
+                                          size_t n,
+                                          unsigned nthreads,
+                                          size_t *count);
+
+#endif /* defined JSON_NDJSON_H */
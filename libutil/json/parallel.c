@@ -0,0 +1,662 @@
+#include <libutil/json/parallel.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+struct json_parallel_job
+{
+    atomic_size_t next;
+    size_t n;
+
+    json_parallel_func fn;
+    void *ud;
+};
+
+/* A value to be parsed on its own, and the placeholder it goes into */
+struct json_parallel_slice
+{
+    size_t pos;
+    size_t len;
+
+    struct json_value *slot;
+    struct json_value *val;
+};
+
+struct json_parallel_parse
+{
+    const char *input;
+
+    struct json_parallel_slice *slices;
+    size_t nslices;
+    size_t slicecap;
+
+    /* Index of the first slice of every block, plus one past the last */
+    size_t *blocks;
+    size_t nblocks;
+
+    /* Values replaced by duplicate keys, which may still hold slots */
+    struct list *orphans;
+};
+
+/* A value to be written on its own, after the text that goes before it */
+struct json_parallel_piece
+{
+    size_t glue; /* end of that text in json_parallel_output.glue */
+    const struct json_value *val; /* NULL for the text after the last value */
+};
+
+struct json_parallel_output
+{
+    /* Brackets, keys and separators of the containers split up, in order */
+    struct json_writer glue;
+
+    struct json_parallel_piece *pieces;
+    size_t npieces;
+    size_t piececap;
+
+    /* Index of the first piece of every block, plus one past the last */
+    size_t *blocks;
+    size_t nblocks;
+
+    /* What every block was written to */
+    struct json_writer *out;
+};
+
+static void *_json_parallel_worker(void *arg);
+
+static struct json_value *_json_parallel_scan(struct json_parallel_parse *pp,
+                                              struct json_lexer_state *lex,
+                                              size_t depth);
+
+static struct json_value *_json_parallel_scan_array(
+        struct json_parallel_parse *pp,
+        struct json_lexer_state *lex,
+        size_t depth);
+
+static struct json_value *_json_parallel_scan_object(
+        struct json_parallel_parse *pp,
+        struct json_lexer_state *lex,
+        size_t depth);
+
+static void _json_parallel_parse_block(size_t i, void *ud);
+
+static int _json_parallel_render(struct json_parallel_output *po,
+                                 const struct json_value *val,
+                                 size_t depth,
+                                 unsigned nthreads,
+                                 unsigned flags,
+                                 const char *number_format);
+
+static void _json_parallel_plan(struct json_parallel_output *po,
+                                const struct json_value *val,
+                                size_t depth);
+
+static void _json_parallel_piece(struct json_parallel_output *po,
+                                 const struct json_value *val);
+
+static void _json_parallel_write_block(size_t i, void *ud);
+static void _json_parallel_output_free(struct json_parallel_output *po);
+
+
+unsigned json_parallel_ncpu(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (n > 0) ? (unsigned)n : 1;
+}
+
+void json_parallel_for(size_t n,
+                       unsigned nthreads,
+                       json_parallel_func fn,
+                       void *ud)
+{
+    struct json_parallel_job job;
+    pthread_t *threads;
+    unsigned started = 0;
+    unsigned i;
+
+    if (nthreads == 0)
+        nthreads = json_parallel_ncpu();
+
+    /* No point in having threads wait for nothing */
+    if (nthreads > n)
+        nthreads = (unsigned)n;
+
+    atomic_init(&job.next, 0);
+    job.n = n;
+    job.fn = fn;
+    job.ud = ud;
+
+    threads = malloc(sizeof(*threads) * nthreads);
+
+    for (i = 0; i + 1 < nthreads; ++i) {
+        int err = pthread_create(
+            &threads[started], NULL, _json_parallel_worker, &job);
+
+        if (!err)
+            started++;
+    }
+
+    _json_parallel_worker(&job);
+
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
+
+static void *_json_parallel_worker(void *arg)
+{
+    struct json_parallel_job *job = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n)
+        job->fn(i, job->ud);
+
+    return NULL;
+}
+
+struct json_value *json_parallel_parse(const char *input,
+                                       size_t n,
+                                       size_t depth,
+                                       unsigned nthreads)
+{
+    struct json_parallel_parse pp;
+    struct json_lexer_state lex;
+    struct json_value *root;
+    bool error = false;
+    size_t size = 0;
+    size_t i;
+
+    memset(&pp, 0, sizeof(pp));
+    pp.input = input;
+
+    json_lexer_init(&lex, input, n);
+
+    if ((root = _json_parallel_scan(&pp, &lex, depth)) != NULL) {
+        /* Group small slices so every unit of work is worth the trouble */
+        pp.blocks = malloc(sizeof(*pp.blocks) * (pp.nslices + 1));
+
+        for (i = 0; i < pp.nslices; ++i) {
+            if (size == 0)
+                pp.blocks[pp.nblocks++] = i;
+
+            size += pp.slices[i].len;
+
+            if (size >= JSON_PARALLEL_BLOCKSIZ)
+                size = 0;
+        }
+
+        pp.blocks[pp.nblocks] = pp.nslices;
+
+        json_parallel_for(
+            pp.nblocks, nthreads, _json_parallel_parse_block, &pp);
+    }
+
+    /* Move the parsed values into their placeholders */
+    for (i = 0; i < pp.nslices; ++i) {
+        struct json_parallel_slice *s = &pp.slices[i];
+
+        if (s->val == NULL) {
+            error = true;
+        } else {
+            *s->slot = *s->val;
+            free(s->val);
+        }
+    }
+
+    list_free_all(pp.orphans, json_free_wrapper, NULL);
+    free(pp.slices);
+    free(pp.blocks);
+
+    if (error && (root != NULL)) {
+        json_free(root);
+        root = NULL;
+    }
+
+    return root;
+}
+
+/*
+ * Build the containers down to depth, leaving null placeholders where the
+ * values below them go.
+ */
+static struct json_value *_json_parallel_scan(struct json_parallel_parse *pp,
+                                              struct json_lexer_state *lex,
+                                              size_t depth)
+{
+    struct json_token tok;
+    size_t start = lex->pos;
+
+    if (depth == 0) {
+        struct json_parallel_slice *s;
+
+        if (json_lexer_skip_value(lex))
+            return NULL;
+
+        if (pp->nslices == pp->slicecap) {
+            pp->slicecap = pp->slicecap ? pp->slicecap * 2 : 64;
+            pp->slices = realloc(
+                pp->slices, sizeof(*pp->slices) * pp->slicecap);
+        }
+
+        s = &pp->slices[pp->nslices++];
+        s->pos = start;
+        s->len = lex->pos - start;
+        s->slot = json_null_new();
+        s->val = NULL;
+
+        return s->slot;
+    }
+
+    if (json_lexer_next_token(lex, &tok))
+        return NULL;
+
+    switch (tok.type) {
+    case TOK_SQUARE_BRACKET_OPEN:
+        return _json_parallel_scan_array(pp, lex, depth);
+
+    case TOK_BRACE_OPEN:
+        return _json_parallel_scan_object(pp, lex, depth);
+
+    default:
+        /* Nothing to split up */
+        lex->pos = start;
+        return json_parse_value(lex);
+    }
+}
+
+static struct json_value *_json_parallel_scan_array(
+        struct json_parallel_parse *pp,
+        struct json_lexer_state *lex,
+        size_t depth)
+{
+    struct json_value *arr = json_array_new();
+    struct list *tail = NULL;
+    struct json_token tok;
+    size_t oldpos = lex->pos;
+
+    for (;;) {
+        struct json_value *elem;
+        struct list *link;
+
+        /* Peek for the end, which may follow a comma as for json_parse() */
+        if (json_lexer_next_token(lex, &tok))
+            goto exit_err;
+
+        if (tok.type == TOK_SQUARE_BRACKET_CLOSE)
+            return arr;
+
+        lex->pos = oldpos;
+
+        if ((elem = _json_parallel_scan(pp, lex, depth - 1)) == NULL)
+            goto exit_err;
+
+        /* Link directly, list_append() would walk the whole list each time */
+        link = list_new_with_data(elem);
+
+        if (tail != NULL) {
+            link->prev = tail;
+            tail->next = link;
+        } else {
+            arr->value.jarray = link;
+        }
+
+        tail = link;
+
+        if (json_lexer_next_token(lex, &tok))
+            goto exit_err;
+
+        if (tok.type == TOK_SQUARE_BRACKET_CLOSE)
+            return arr;
+        else if (tok.type != TOK_COMMA)
+            goto exit_err;
+
+        oldpos = lex->pos;
+    }
+
+exit_err:
+    json_free(arr);
+    return NULL;
+}
+
+static struct json_value *_json_parallel_scan_object(
+        struct json_parallel_parse *pp,
+        struct json_lexer_state *lex,
+        size_t depth)
+{
+    struct json_value *obj = json_object_new();
+    struct hashtable *table = obj->value.jobject;
+    struct json_token tok;
+
+    for (;;) {
+        struct json_value *val;
+        struct json_value *prev;
+        char *key;
+
+        /* The end may follow a comma, as for json_parse() */
+        if (json_lexer_next_token(lex, &tok))
+            goto exit_err;
+
+        if (tok.type == TOK_BRACE_CLOSE)
+            return obj;
+
+        if ((tok.type != TOK_STRING)
+                || ((key = json_parse_string(lex, &tok)) == NULL))
+            goto exit_err;
+
+        if (json_lexer_next_token(lex, &tok) || (tok.type != TOK_COLON)) {
+            free(key);
+            goto exit_err;
+        }
+
+        if ((val = _json_parallel_scan(pp, lex, depth - 1)) == NULL) {
+            free(key);
+            goto exit_err;
+        }
+
+        if ((prev = hashtable_lookup(table, key)) != NULL) {
+            /*
+             * The last duplicate wins as usual, but slices may still refer to
+             * placeholders within the value it replaces, so that one has to
+             * stay around for now.
+             */
+            hashtable_delete_func free_value = table->free_value;
+
+            table->free_value = NULL;
+            hashtable_insert(table, key, val);
+            table->free_value = free_value;
+
+            pp->orphans = list_prepend(pp->orphans, prev);
+        } else {
+            hashtable_insert(table, key, val);
+        }
+
+        if (json_lexer_next_token(lex, &tok))
+            goto exit_err;
+
+        if (tok.type == TOK_BRACE_CLOSE)
+            return obj;
+        else if (tok.type != TOK_COMMA)
+            goto exit_err;
+    }
+
+exit_err:
+    json_free(obj);
+    return NULL;
+}
+
+static void _json_parallel_parse_block(size_t i, void *ud)
+{
+    struct json_parallel_parse *pp = ud;
+    size_t j;
+
+    for (j = pp->blocks[i]; j < pp->blocks[i + 1]; ++j) {
+        struct json_parallel_slice *s = &pp->slices[j];
+
+        s->val = json_parse_n(pp->input + s->pos, s->len);
+    }
+}
+
+int json_parallel_write(struct json_writer *w,
+                        const struct json_value *val,
+                        size_t depth,
+                        unsigned nthreads)
+{
+    struct json_parallel_output po;
+    size_t i;
+
+    if (w->error)
+        return 1;
+
+    if (_json_parallel_render(
+            &po, val, depth, nthreads, w->flags, w->number_format)) {
+        _json_parallel_output_free(&po);
+        return 1;
+    }
+
+    /* The first block holds the first value, so it's never empty */
+    json_writer_raw(w, po.out[0].buf, po.out[0].len);
+
+    for (i = 1; i < po.nblocks; ++i)
+        if (po.out[i].len > 0)
+            json_writer_write(w, po.out[i].buf, po.out[i].len);
+
+    _json_parallel_output_free(&po);
+
+    return w->error;
+}
+
+int json_parallel_write_fd(int fd,
+                           const struct json_value *val,
+                           size_t depth,
+                           unsigned nthreads,
+                           unsigned flags)
+{
+    struct json_parallel_output po;
+    struct iovec *iov;
+    size_t niov = 0;
+    size_t done = 0;
+    size_t i;
+
+    if (_json_parallel_render(&po, val, depth, nthreads, flags, NULL))
+        goto exit_err;
+
+    iov = malloc(sizeof(*iov) * po.nblocks);
+
+    for (i = 0; i < po.nblocks; ++i) {
+        if (po.out[i].len > 0) {
+            iov[niov].iov_base = po.out[i].buf;
+            iov[niov].iov_len = po.out[i].len;
+            niov++;
+        }
+    }
+
+    /* Short writes leave done on a partially written buffer */
+    while (done < niov) {
+        int count = (niov - done > IOV_MAX) ? IOV_MAX : (int)(niov - done);
+        ssize_t ret = writev(fd, iov + done, count);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            free(iov);
+            goto exit_err;
+        }
+
+        for (; (done < niov) && ((size_t)ret >= iov[done].iov_len); ++done)
+            ret -= iov[done].iov_len;
+
+        if (done < niov) {
+            iov[done].iov_base = (char *)iov[done].iov_base + ret;
+            iov[done].iov_len -= ret;
+        }
+    }
+
+    free(iov);
+    _json_parallel_output_free(&po);
+
+    return 0;
+
+exit_err:
+    _json_parallel_output_free(&po);
+    return 1;
+}
+
+/*
+ * Lay out val in pieces, then write them in blocks of consecutive pieces of
+ * about the same number. Returns 0 on success and 1 if anything failed to
+ * write, po has to be freed either way.
+ */
+static int _json_parallel_render(struct json_parallel_output *po,
+                                 const struct json_value *val,
+                                 size_t depth,
+                                 unsigned nthreads,
+                                 unsigned flags,
+                                 const char *number_format)
+{
+    size_t perblock;
+    size_t i;
+
+    memset(po, 0, sizeof(*po));
+
+    json_writer_init_buffer(&po->glue);
+    po->glue.flags = flags;
+    po->glue.number_format = number_format;
+
+    _json_parallel_plan(po, val, depth);
+    _json_parallel_piece(po, NULL);
+
+    if (po->glue.error)
+        return 1;
+
+    if (nthreads == 0)
+        nthreads = json_parallel_ncpu();
+
+    perblock = po->npieces / ((size_t)nthreads * JSON_PARALLEL_WRITE_BLOCKS);
+    perblock = (perblock > 0) ? perblock : 1;
+
+    po->blocks = malloc(
+        sizeof(*po->blocks) * (po->npieces / perblock + 2));
+
+    for (i = 0; i < po->npieces; i += perblock)
+        po->blocks[po->nblocks++] = i;
+
+    po->blocks[po->nblocks] = po->npieces;
+
+    po->out = malloc(sizeof(*po->out) * po->nblocks);
+
+    for (i = 0; i < po->nblocks; ++i) {
+        json_writer_init_buffer(&po->out[i]);
+        po->out[i].flags = flags;
+        po->out[i].number_format = number_format;
+    }
+
+    json_parallel_for(
+        po->nblocks, nthreads, _json_parallel_write_block, po);
+
+    for (i = 0; i < po->nblocks; ++i)
+        if (po->out[i].error)
+            return 1;
+
+    return 0;
+}
+
+/*
+ * Write the containers down to depth to the glue, adding a piece for every
+ * value below them
+ */
+static void _json_parallel_plan(struct json_parallel_output *po,
+                                const struct json_value *val,
+                                size_t depth)
+{
+    struct json_writer *g = &po->glue;
+
+    const char *comma = (g->flags & JSON_WRITER_SPACED) ? ", " : ",";
+    const char *colon = (g->flags & JSON_WRITER_SPACED) ? ": " : ":";
+    bool first = true;
+
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    /* Packed arrays only hold numbers, which aren't worth splitting up */
+    if ((depth == 0)
+            || ((val->type != JSON_ARRAY) && (val->type != JSON_OBJECT))
+            || (val->flags & JSON_VALUE_PACKED)) {
+        _json_parallel_piece(po, val);
+        return;
+    }
+
+    if (val->type == JSON_ARRAY) {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+
+        json_writer_write(g, "[", 1);
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem)) {
+            if (!first)
+                json_writer_write(g, comma, strlen(comma));
+
+            _json_parallel_plan(po, elem, depth - 1);
+            first = false;
+        }
+
+        json_writer_write(g, "]", 1);
+    } else {
+        struct json_object_iterator iter;
+        struct json_value *member;
+        const char *key;
+        size_t n;
+
+        json_writer_write(g, "{", 1);
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter, &key, &n, &member)) {
+            if (!first)
+                json_writer_write(g, comma, strlen(comma));
+
+            json_writer_string(g, key, n);
+            json_writer_write(g, colon, strlen(colon));
+
+            _json_parallel_plan(po, member, depth - 1);
+            first = false;
+        }
+
+        json_writer_write(g, "}", 1);
+    }
+}
+
+static void _json_parallel_piece(struct json_parallel_output *po,
+                                 const struct json_value *val)
+{
+    struct json_parallel_piece *p;
+
+    if (po->npieces == po->piececap) {
+        po->piececap = po->piececap ? po->piececap * 2 : 64;
+        po->pieces = realloc(
+            po->pieces, sizeof(*po->pieces) * po->piececap);
+    }
+
+    p = &po->pieces[po->npieces++];
+    p->glue = po->glue.len;
+    p->val = val;
+}
+
+static void _json_parallel_write_block(size_t i, void *ud)
+{
+    struct json_parallel_output *po = ud;
+    struct json_writer *w = &po->out[i];
+    size_t j;
+
+    for (j = po->blocks[i]; j < po->blocks[i + 1]; ++j) {
+        struct json_parallel_piece *p = &po->pieces[j];
+        size_t start = (j > 0) ? po->pieces[j - 1].glue : 0;
+
+        if (p->glue > start)
+            json_writer_write(w, po->glue.buf + start, p->glue - start);
+
+        if (p->val != NULL)
+            json_writer_value(w, p->val);
+    }
+}
+
+static void _json_parallel_output_free(struct json_parallel_output *po)
+{
+    size_t i;
+
+    for (i = 0; (po->out != NULL) && (i < po->nblocks); ++i)
+        json_writer_free(&po->out[i]);
+
+    json_writer_free(&po->glue);
+
+    free(po->out);
+    free(po->blocks);
+    free(po->pieces);
+}
@@ -0,0 +1,361 @@
+#include <libutil/json/pointer.h>
+
+#include <string.h>
+
+static void _json_pointer_token_init(struct json_pointer_token *tok);
+
+static size_t _json_pointer_hash(const char *str, size_t n);
+
+static bool _json_pointer_match(const struct json_pointer_token *tok,
+                                const char *key,
+                                size_t keylen,
+                                size_t hash);
+
+static const struct json_value *_json_pointer_step(
+        const struct json_value *val,
+        const struct json_pointer_token *tok,
+        struct json_value *tmp);
+
+static size_t _json_pointer_find_all(struct json_pointer *const *ptrs,
+                                     size_t *candidates,
+                                     size_t ncandidates,
+                                     size_t depth,
+                                     const struct json_cursor *cur,
+                                     struct json_cursor *out,
+                                     size_t *nfound,
+                                     bool finish);
+
+
+struct json_pointer *json_pointer_compile(const char *str)
+{
+    struct json_pointer *ptr;
+    const char *p;
+    size_t i;
+
+    /* Anything but the whole document starts with a slash */
+    if ((*str != '\0') && (*str != '/'))
+        return NULL;
+
+    ptr = malloc(sizeof(*ptr));
+    memset(ptr, 0, sizeof(*ptr));
+
+    for (p = str; *p; ++p)
+        if (*p == '/')
+            ptr->ntokens++;
+
+    if (ptr->ntokens > 0)
+        ptr->tokens = malloc(sizeof(*ptr->tokens) * ptr->ntokens);
+
+    for (i = 0, p = str; i < ptr->ntokens; ++i) {
+        struct json_pointer_token *tok = &ptr->tokens[i];
+        size_t len = strcspn(++p, "/");
+        size_t j;
+
+        /* The unescaped token can only ever be shorter */
+        tok->key = malloc(len + 1);
+        tok->len = 0;
+
+        for (j = 0; j < len; ++j) {
+            if (p[j] != '~') {
+                tok->key[tok->len++] = p[j];
+            } else if (p[j + 1] == '0') {
+                tok->key[tok->len++] = '~';
+                j++;
+            } else if (p[j + 1] == '1') {
+                tok->key[tok->len++] = '/';
+                j++;
+            } else {
+                /* Not a valid escape, clean up what we have so far */
+                ptr->ntokens = i + 1;
+                tok->key[tok->len] = '\0';
+
+                json_pointer_free(ptr);
+                return NULL;
+            }
+        }
+
+        tok->key[tok->len] = '\0';
+        _json_pointer_token_init(tok);
+
+        p += len;
+    }
+
+    return ptr;
+}
+
+void json_pointer_free(struct json_pointer *ptr)
+{
+    size_t i;
+
+    for (i = 0; i < ptr->ntokens; ++i)
+        free(ptr->tokens[i].key);
+
+    free(ptr->tokens);
+    free(ptr);
+}
+
+struct json_value *json_pointer_get(const struct json_pointer *ptr,
+                                    struct json_value *root)
+{
+    struct json_value *val = root;
+    size_t i;
+
+    for (i = 0; (i < ptr->ntokens) && (val != NULL); ++i) {
+        /* The result may be modified, so nothing on the way can be shared */
+        if (json_unshare(val))
+            return NULL;
+
+        /* Elements need addresses of their own */
+        if ((val->type == JSON_ARRAY) && json_array_unpack(val))
+            return NULL;
+
+        val = (struct json_value *)_json_pointer_step(
+            val, &ptr->tokens[i], NULL);
+    }
+
+    return val;
+}
+
+const struct json_value *json_pointer_get_const(const struct json_pointer *ptr,
+                                                const struct json_value *root,
+                                                struct json_value *tmp)
+{
+    const struct json_value *val = root;
+    size_t i;
+
+    for (i = 0; (i < ptr->ntokens) && (val != NULL); ++i) {
+        if (val->flags & JSON_VALUE_SHARED)
+            val = val->value.jshared;
+
+        val = _json_pointer_step(val, &ptr->tokens[i], tmp);
+    }
+
+    return val;
+}
+
+int json_pointer_find(const struct json_pointer *ptr,
+                      const struct json_cursor *doc,
+                      struct json_cursor *out)
+{
+    struct json_pointer *const ptrs[] = { (struct json_pointer *)ptr };
+
+    return json_pointer_find_all(ptrs, 1, doc, out) != 1;
+}
+
+size_t json_pointer_find_all(struct json_pointer *const *ptrs,
+                             size_t n,
+                             const struct json_cursor *doc,
+                             struct json_cursor *out)
+{
+    size_t *candidates = malloc(sizeof(*candidates) * n);
+    size_t nfound = 0;
+    size_t ncandidates = 0;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        if (ptrs[i]->ntokens > 0) {
+            out[i].input = NULL;
+            candidates[ncandidates++] = i;
+        } else {
+            /* Refers to the whole document */
+            out[i] = *doc;
+            nfound++;
+        }
+    }
+
+    if (ncandidates > 0)
+        _json_pointer_find_all(ptrs, candidates, ncandidates, 0,
+                               doc, out, &nfound, false);
+
+    free(candidates);
+    return nfound;
+}
+
+/*
+ * Resolve all candidate pointers (which all agree on the path up to cur) one
+ * level deeper by iterating cur once, only descending into the members or
+ * elements that are on one of the paths. Stops early once every candidate
+ * has been settled, unless finish is set: then the rest is skipped as well
+ * and the offset just past cur returned, so the caller can go on from there
+ * without going through cur once more. Returns 0 otherwise.
+ */
+static size_t _json_pointer_find_all(struct json_pointer *const *ptrs,
+                                     size_t *candidates,
+                                     size_t ncandidates,
+                                     size_t depth,
+                                     const struct json_cursor *cur,
+                                     struct json_cursor *out,
+                                     size_t *nfound,
+                                     bool finish)
+{
+    struct json_cursor_iterator iter;
+    struct json_cursor key;
+    struct json_cursor val;
+
+    size_t *matches = malloc(sizeof(*matches) * ncandidates);
+    size_t index = 0;
+    size_t end = 0;
+
+    if (!json_cursor_iterator_init(&iter, cur))
+        goto exit;
+
+    while ((ncandidates > 0) && json_cursor_iterator_next(&iter, &key, &val)) {
+        const char *raw = NULL;
+        char *decoded = NULL;
+        size_t rawlen = 0;
+        size_t hash = 0;
+        size_t nmatches = 0;
+        size_t i;
+
+        if (iter.type == JSON_OBJECT) {
+            /* Hash the key once, compare against all candidates */
+            raw = key.input + key.pos + 1;
+            rawlen = strcspn(raw, "\"\\");
+
+            if (raw[rawlen] == '\\') {
+                /* Has escapes, so compare the decoded version */
+                if ((decoded = json_cursor_get_string(&key)) == NULL)
+                    break;
+
+                raw = decoded;
+                rawlen = strlen(decoded);
+            }
+
+            hash = _json_pointer_hash(raw, rawlen);
+        }
+
+        for (i = 0; i < ncandidates; ) {
+            size_t c = candidates[i];
+            const struct json_pointer_token *tok = &ptrs[c]->tokens[depth];
+
+            if ((iter.type == JSON_OBJECT)
+                    ? !_json_pointer_match(tok, raw, rawlen, hash)
+                    : !(tok->is_index && (tok->index == index))) {
+                ++i;
+                continue;
+            }
+
+            if (depth + 1 == ptrs[c]->ntokens) {
+                out[c] = val;
+                (*nfound)++;
+            } else {
+                matches[nmatches++] = c;
+            }
+
+            /*
+             * Either way it's settled, even if it's not found further down
+             * (with duplicate keys, the first one wins).
+             */
+            candidates[i] = candidates[--ncandidates];
+        }
+
+        free(decoded);
+
+        /* Only containers are gone through, scalars are skipped as usual */
+        if ((nmatches > 0)
+                && ((end = _json_pointer_find_all(
+                        ptrs, matches, nmatches, depth + 1, &val, out,
+                        nfound, ncandidates > 0)) > 0))
+            json_cursor_iterator_consumed(&iter, end);
+
+        index++;
+    }
+
+    end = finish ? json_cursor_iterator_end(&iter) : 0;
+
+exit:
+    free(matches);
+    return end;
+}
+
+/*
+ * The member or element of val that tok refers to, or NULL if there is none.
+ * Numbers of packed arrays are copied into tmp, which is returned for them.
+ */
+static const struct json_value *_json_pointer_step(
+        const struct json_value *val,
+        const struct json_pointer_token *tok,
+        struct json_value *tmp)
+{
+    switch (val->type) {
+    case JSON_OBJECT: {
+        struct hashtable *obj = val->value.jobject;
+
+        /* The precalculated hash is only of use with the same function */
+        if (!(val->flags & JSON_VALUE_SHAPED) && (obj->key_hash == str_hash))
+            return hashtable_lookup_hashed(obj, tok->key, tok->hash);
+
+        return json_object_lookup_const(val, tok->key);
+    }
+    case JSON_ARRAY: {
+        struct list *elem;
+        size_t n;
+
+        if (!tok->is_index)
+            return NULL;
+
+        if (val->flags & JSON_VALUE_PACKED) {
+            const struct json_packed *packed = val->value.jpacked;
+
+            if (tok->index >= packed->len)
+                return NULL;
+
+            memset(tmp, 0, sizeof(*tmp));
+            tmp->type = JSON_NUMBER;
+            tmp->value.jnumber = packed->values[tok->index];
+
+            return tmp;
+        }
+
+        elem = val->value.jarray;
+
+        for (n = tok->index; (elem != NULL) && n; --n)
+            elem = elem->next;
+
+        return (elem != NULL) ? LIST_DATA(elem, struct json_value *) : NULL;
+    }
+    default:
+        /* Can't go deeper into a scalar */
+        return NULL;
+    }
+}
+
+static void _json_pointer_token_init(struct json_pointer_token *tok)
+{
+    size_t i;
+
+    tok->hash = _json_pointer_hash(tok->key, tok->len);
+    tok->index = 0;
+
+    /* Array indices are decimal numbers without leading zeroes */
+    tok->is_index = (tok->len > 0) && ((tok->key[0] != '0') || (tok->len == 1));
+
+    for (i = 0; (i < tok->len) && tok->is_index; ++i) {
+        if ((tok->key[i] < '0') || (tok->key[i] > '9'))
+            tok->is_index = false;
+        else
+            tok->index = tok->index * 10 + (tok->key[i] - '0');
+    }
+}
+
+/* Same as str_hash(), but on a string of known length */
+static size_t _json_pointer_hash(const char *str, size_t n)
+{
+    size_t hash = 5381;
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        hash = ((hash << 5) + hash) + str[i];
+
+    return hash;
+}
+
+static bool _json_pointer_match(const struct json_pointer_token *tok,
+                                const char *key,
+                                size_t keylen,
+                                size_t hash)
+{
+    return (tok->hash == hash)
+        && (tok->len == keylen)
+        && !memcmp(tok->key, key, keylen);
+}
@@ -0,0 +1,90 @@
+#ifndef JSON_POINTER_H
+#define JSON_POINTER_H
+
+#include <libutil/json.h>
+#include <libutil/json/cursor.h>
+
+#include <stdlib.h>
+
+/*
+ * Precompiled JSON Pointers (RFC 6901), e.g. "/USD/15m".
+ *
+ * Compiling splits the pointer into its reference tokens once, unescaping
+ * them and precalculating the hash of every key and the index of every token
+ * that can be used to index an array. The compiled pointer can then be
+ * evaluated against any number of documents, either against a parsed tree or
+ * directly against the document text, in which case everything that's not on
+ * the path is skipped over without being parsed.
+ *
+ * Example usage:
+ *
+ *     struct json_pointer *ptr = json_pointer_compile("/USD/15m");
+ *
+ *     for (each document) {
+ *         struct json_value *last = json_pointer_get(ptr, document);
+ *         [...]
+ *     }
+ *
+ *     json_pointer_free(ptr);
+ */
+
+struct json_pointer_token
+{
+    char *key;    /* unescaped reference token */
+    size_t len;
+    size_t hash;  /* str_hash(key), as used by objects */
+
+    size_t index; /* array index, if the token is one */
+    bool is_index;
+};
+
+struct json_pointer
+{
+    size_t ntokens;
+    struct json_pointer_token *tokens;
+};
+
+/*
+ * Compiles the pointer ptr. The empty string refers to the whole document.
+ * Returns NULL if ptr is not a valid JSON Pointer.
+ */
+struct json_pointer *json_pointer_compile(const char *ptr);
+void json_pointer_free(struct json_pointer *ptr);
+
+/*
+ * Returns the value ptr refers to within root, or NULL if there is none. The
+ * containers on the way are unshared (see json_clone()) and packed arrays
+ * unpacked, so the result may be modified.
+ */
+struct json_value *json_pointer_get(const struct json_pointer *ptr,
+                                    struct json_value *root);
+
+/*
+ * Same for reading only, leaving everything as it is. Numbers in packed
+ * arrays have no value of their own, so they are copied into tmp, which is
+ * returned in their place.
+ */
+const struct json_value *json_pointer_get_const(const struct json_pointer *ptr,
+                                                const struct json_value *root,
+                                                struct json_value *tmp);
+
+/*
+ * Same, but working on the unparsed document at doc. Returns 0 and points out
+ * at the value on success, 1 if there is no such value.
+ */
+int json_pointer_find(const struct json_pointer *ptr,
+                      const struct json_cursor *doc,
+                      struct json_cursor *out);
+
+/*
+ * Resolves n pointers at once, walking the document only once. The cursor
+ * for the value of ptrs[i] is stored in out[i], pointers that don't refer to
+ * anything get a cursor with a NULL input. Returns the number of pointers
+ * that were resolved.
+ */
+size_t json_pointer_find_all(struct json_pointer *const *ptrs,
+                             size_t n,
+                             const struct json_cursor *doc,
+                             struct json_cursor *out);
+
+#endif /* defined JSON_POINTER_H */
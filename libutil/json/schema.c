@@ -0,0 +1,597 @@
+#include <libutil/json/schema.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+static size_t _json_schema_hash(const char *key, size_t n);
+
+static size_t _json_schema_size(enum json_field_type type,
+                                const struct json_schema *schema);
+
+static const struct json_field *_json_schema_field(
+        const struct json_schema *schema,
+        const char *key,
+        size_t n,
+        size_t *hint);
+
+static int _json_schema_decode_members(const struct json_schema *schema,
+                                       struct json_lexer_state *lex,
+                                       size_t depth,
+                                       void *obj);
+
+static int _json_schema_decode_value(struct json_lexer_state *lex,
+                                     size_t depth,
+                                     enum json_field_type type,
+                                     const struct json_field *field,
+                                     void *ptr);
+
+static int _json_schema_decode_array(struct json_lexer_state *lex,
+                                     size_t depth,
+                                     const struct json_field *field,
+                                     struct json_schema_array *arr);
+
+static int _json_schema_decode_integer(struct json_lexer_state *lex,
+                                       const struct json_token *tok,
+                                       long min,
+                                       long max,
+                                       long *out);
+
+static void _json_schema_free_value(enum json_field_type type,
+                                    const struct json_field *field,
+                                    void *ptr);
+
+static int _json_schema_write_value(struct json_writer *w,
+                                    enum json_field_type type,
+                                    const struct json_field *field,
+                                    const void *ptr);
+
+static int _json_schema_write_long(struct json_writer *w, long l);
+
+
+int json_schema_init(struct json_schema *schema)
+{
+    size_t i;
+
+    /* Set early, schemas may refer to themselves through arrays */
+    schema->ready = true;
+
+    for (i = 0; schema->fields[i].name != NULL; ++i) {
+        struct json_field *f = &schema->fields[i];
+        enum json_field_type type =
+            (f->type == JSON_FIELD_ARRAY) ? f->elem : f->type;
+
+        f->len = strlen(f->name);
+        f->hash = _json_schema_hash(f->name, f->len);
+
+        if (type == JSON_FIELD_ARRAY)
+            goto exit_err;
+
+        if (type == JSON_FIELD_OBJECT) {
+            if (f->schema == NULL)
+                goto exit_err;
+
+            if (!f->schema->ready
+                    && json_schema_init((struct json_schema *)f->schema))
+                goto exit_err;
+        }
+    }
+
+    schema->nfields = i;
+    return 0;
+
+exit_err:
+    schema->ready = false;
+    return 1;
+}
+
+int json_schema_decode(const struct json_schema *schema,
+                       const char *input,
+                       size_t n,
+                       void *out)
+{
+    struct json_lexer_state lex;
+    struct json_token tok;
+
+    json_lexer_init(&lex, input, n);
+
+    if (json_schema_decode_lexer(schema, &lex, out))
+        return 1;
+
+    /*
+     * Nothing but whitespace may follow, up to the end (or a NUL byte). Bad
+     * tokens are errors too, which leave tok.i short of the end.
+     */
+    if (!json_lexer_next_token(&lex, &tok)
+            || ((tok.i < n) && (input[tok.i] != '\0'))) {
+        json_schema_free(schema, out);
+        return 1;
+    }
+
+    return 0;
+}
+
+int json_schema_decode_lexer(const struct json_schema *schema,
+                             struct json_lexer_state *lex,
+                             void *out)
+{
+    struct json_token tok;
+
+    if (!schema->ready
+            || (lex->max_depth == 0)
+            || json_lexer_next_token(lex, &tok)
+            || (tok.type != TOK_BRACE_OPEN))
+        return 1;
+
+    if (_json_schema_decode_members(schema, lex, 1, out)) {
+        json_schema_free(schema, out);
+        return 1;
+    }
+
+    return 0;
+}
+
+void json_schema_free(const struct json_schema *schema, void *obj)
+{
+    size_t i;
+
+    for (i = 0; i < schema->nfields; ++i) {
+        const struct json_field *f = &schema->fields[i];
+
+        _json_schema_free_value(f->type, f, (char *)obj + f->offset);
+    }
+}
+
+int json_schema_write(struct json_writer *w,
+                      const struct json_schema *schema,
+                      const void *obj)
+{
+    size_t i;
+
+    json_writer_begin_object(w);
+
+    for (i = 0; i < schema->nfields; ++i) {
+        const struct json_field *f = &schema->fields[i];
+
+        json_writer_key(w, f->name);
+        _json_schema_write_value(w, f->type, f, (const char *)obj + f->offset);
+    }
+
+    json_writer_end_object(w);
+
+    return w->error;
+}
+
+char *json_schema_encode(const struct json_schema *schema,
+                         const void *obj,
+                         size_t *n)
+{
+    struct json_writer w;
+    char *buf = NULL;
+
+    json_writer_init_buffer(&w);
+
+    if (!json_schema_write(&w, schema, obj))
+        buf = json_writer_detach(&w, n);
+
+    /* Still holds the nesting stack */
+    json_writer_free(&w);
+
+    return buf;
+}
+
+/* djb2, over exactly n bytes */
+static size_t _json_schema_hash(const char *key, size_t n)
+{
+    size_t hash = 5381;
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        hash = ((hash << 5) + hash) + (unsigned char)key[i];
+
+    return hash;
+}
+
+static size_t _json_schema_size(enum json_field_type type,
+                                const struct json_schema *schema)
+{
+    switch (type) {
+    case JSON_FIELD_STRING:
+        return sizeof(char *);
+    case JSON_FIELD_DOUBLE:
+        return sizeof(double);
+    case JSON_FIELD_FLOAT:
+        return sizeof(float);
+    case JSON_FIELD_INT:
+        return sizeof(int);
+    case JSON_FIELD_LONG:
+        return sizeof(long);
+    case JSON_FIELD_BOOL:
+        return sizeof(bool);
+    case JSON_FIELD_OBJECT:
+        return schema->size;
+    case JSON_FIELD_ARRAY:
+        return sizeof(struct json_schema_array);
+    }
+
+    return 0;
+}
+
+/*
+ * Keys tend to come in the order they were declared in, so the search starts
+ * right after the last field found.
+ */
+static const struct json_field *_json_schema_field(
+        const struct json_schema *schema,
+        const char *key,
+        size_t n,
+        size_t *hint)
+{
+    size_t hash = _json_schema_hash(key, n);
+    size_t i;
+
+    for (i = 0; i < schema->nfields; ++i) {
+        size_t j = (*hint + i) % schema->nfields;
+        const struct json_field *f = &schema->fields[j];
+
+        if ((f->hash == hash) && (f->len == n) && !memcmp(f->name, key, n)) {
+            *hint = j + 1;
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Decodes everything following the opening brace of an object, which is
+ * nested in depth - 1 others. Schemas may refer to themselves, so anything
+ * deeper than lex->max_depth is an error, as with json_parse_value().
+ */
+static int _json_schema_decode_members(const struct json_schema *schema,
+                                       struct json_lexer_state *lex,
+                                       size_t depth,
+                                       void *obj)
+{
+    struct json_token tok;
+    size_t hint = 0;
+
+    for (;;) {
+        const struct json_field *f;
+        const char *key;
+        size_t n;
+        char *tmp = NULL;
+
+        if (json_lexer_next_token(lex, &tok))
+            return 1;
+
+        /* Empty object (or a trailing comma, like json_parse() allows) */
+        if (tok.type == TOK_BRACE_CLOSE)
+            return 0;
+
+        if (tok.type != TOK_STRING)
+            return 1;
+
+        key = lex->input + tok.i + 1;
+        n = tok.j - tok.i - 2;
+
+        if (memchr(key, '\\', n) != NULL) {
+            if ((key = tmp = json_parse_string(lex, &tok)) == NULL)
+                return 1;
+
+            n = strlen(tmp);
+        }
+
+        f = _json_schema_field(schema, key, n, &hint);
+        free(tmp);
+
+        if (json_lexer_next_token(lex, &tok) || (tok.type != TOK_COLON))
+            return 1;
+
+        if (f == NULL) {
+            if (json_lexer_skip_value(lex))
+                return 1;
+        } else if (_json_schema_decode_value(lex,
+                                             depth,
+                                             f->type,
+                                             f,
+                                             (char *)obj + f->offset)) {
+            return 1;
+        }
+
+        if (json_lexer_next_token(lex, &tok))
+            return 1;
+
+        if (tok.type == TOK_BRACE_CLOSE)
+            return 0;
+        else if (tok.type != TOK_COMMA)
+            return 1;
+    }
+}
+
+static int _json_schema_decode_value(struct json_lexer_state *lex,
+                                     size_t depth,
+                                     enum json_field_type type,
+                                     const struct json_field *field,
+                                     void *ptr)
+{
+    struct json_token tok;
+    double d;
+    long l;
+
+    if (json_lexer_next_token(lex, &tok))
+        return 1;
+
+    if (tok.type == TOK_NULL) {
+        if ((type == JSON_FIELD_STRING) || (type == JSON_FIELD_ARRAY))
+            _json_schema_free_value(type, field, ptr);
+
+        return 0;
+    }
+
+    switch (type) {
+    case JSON_FIELD_STRING: {
+        char *str;
+
+        if ((tok.type != TOK_STRING)
+                || ((str = json_parse_string(lex, &tok)) == NULL))
+            return 1;
+
+        free(*(char **)ptr);
+        *(char **)ptr = str;
+
+        return 0;
+    }
+    case JSON_FIELD_DOUBLE:
+    case JSON_FIELD_FLOAT:
+        if ((tok.type != TOK_NUMBER)
+                || json_parse_number(lex->input + tok.i, tok.j - tok.i, &d))
+            return 1;
+
+        if (type == JSON_FIELD_DOUBLE)
+            *(double *)ptr = d;
+        else
+            *(float *)ptr = d;
+
+        return 0;
+
+    case JSON_FIELD_INT:
+        if (_json_schema_decode_integer(lex, &tok, INT_MIN, INT_MAX, &l))
+            return 1;
+
+        *(int *)ptr = l;
+        return 0;
+
+    case JSON_FIELD_LONG:
+        if (_json_schema_decode_integer(lex, &tok, LONG_MIN, LONG_MAX, &l))
+            return 1;
+
+        *(long *)ptr = l;
+        return 0;
+
+    case JSON_FIELD_BOOL:
+        if ((tok.type != TOK_TRUE) && (tok.type != TOK_FALSE))
+            return 1;
+
+        *(bool *)ptr = (tok.type == TOK_TRUE);
+        return 0;
+
+    case JSON_FIELD_OBJECT:
+        if ((tok.type != TOK_BRACE_OPEN) || (depth == lex->max_depth))
+            return 1;
+
+        return _json_schema_decode_members(field->schema, lex, depth + 1, ptr);
+
+    case JSON_FIELD_ARRAY:
+        if ((tok.type != TOK_SQUARE_BRACKET_OPEN)
+                || (depth == lex->max_depth))
+            return 1;
+
+        return _json_schema_decode_array(lex, depth + 1, field, ptr);
+    }
+
+    return 1;
+}
+
+/*
+ * Decodes everything following the opening bracket of an array, straight
+ * into arr so everything decoded so far is freed along with it on errors.
+ */
+static int _json_schema_decode_array(struct json_lexer_state *lex,
+                                     size_t depth,
+                                     const struct json_field *field,
+                                     struct json_schema_array *arr)
+{
+    size_t size = _json_schema_size(field->elem, field->schema);
+    size_t cap = 0;
+    struct json_token tok;
+
+    _json_schema_free_value(JSON_FIELD_ARRAY, field, arr);
+
+    for (;;) {
+        size_t oldpos = lex->pos;
+        void *item;
+
+        if (json_lexer_next_token(lex, &tok))
+            return 1;
+
+        /* Empty array, or a trailing comma */
+        if (tok.type == TOK_SQUARE_BRACKET_CLOSE)
+            return 0;
+
+        lex->pos = oldpos;
+
+        if (arr->count == cap) {
+            void *items;
+
+            cap = cap ? cap * 2 : 8;
+
+            if ((items = realloc(arr->items, cap * size)) == NULL)
+                return 1;
+
+            arr->items = items;
+        }
+
+        item = (char *)arr->items + arr->count++ * size;
+        memset(item, 0, size);
+
+        if (_json_schema_decode_value(lex, depth, field->elem, field, item))
+            return 1;
+
+        if (json_lexer_next_token(lex, &tok))
+            return 1;
+
+        if (tok.type == TOK_SQUARE_BRACKET_CLOSE)
+            return 0;
+        else if (tok.type != TOK_COMMA)
+            return 1;
+    }
+}
+
+/*
+ * The number token tok as an integer in [min, max]. Digits are taken exactly,
+ * rather than rounded to a double first, fractions and exponents only have
+ * to leave a whole number.
+ */
+static int _json_schema_decode_integer(struct json_lexer_state *lex,
+                                       const struct json_token *tok,
+                                       long min,
+                                       long max,
+                                       long *out)
+{
+    const char *text = lex->input + tok->i;
+    size_t n = tok->j - tok->i;
+    char buf[24];
+    char *end;
+    long long ll;
+    double d;
+
+    if (tok->type != TOK_NUMBER)
+        return 1;
+
+    if ((memchr(text, '.', n) != NULL) || (memchr(text, 'e', n) != NULL)
+            || (memchr(text, 'E', n) != NULL)) {
+        if (json_parse_number(text, n, &d))
+            return 1;
+
+        /*
+         * In range first, converting is undefined otherwise. max + 1 is
+         * -min, a power of two and so exact as a double where max isn't.
+         */
+        if (!((d >= min) && (d < -(double)min)) || ((long)d != d))
+            return 1;
+
+        *out = d;
+        return 0;
+    }
+
+    /* The input needn't be terminated, and longer is out of range anyway */
+    if (n >= sizeof(buf))
+        return 1;
+
+    memcpy(buf, text, n);
+    buf[n] = '\0';
+
+    errno = 0;
+    ll = strtoll(buf, &end, 10);
+
+    if ((errno != 0) || (*end != '\0') || (ll < min) || (ll > max))
+        return 1;
+
+    *out = ll;
+    return 0;
+}
+
+static void _json_schema_free_value(enum json_field_type type,
+                                    const struct json_field *field,
+                                    void *ptr)
+{
+    switch (type) {
+    case JSON_FIELD_STRING:
+        free(*(char **)ptr);
+        *(char **)ptr = NULL;
+        break;
+
+    case JSON_FIELD_OBJECT:
+        json_schema_free(field->schema, ptr);
+        break;
+
+    case JSON_FIELD_ARRAY: {
+        struct json_schema_array *arr = ptr;
+        size_t size = _json_schema_size(field->elem, field->schema);
+        size_t i;
+
+        if ((field->elem == JSON_FIELD_STRING)
+                || (field->elem == JSON_FIELD_OBJECT))
+            for (i = 0; i < arr->count; ++i)
+                _json_schema_free_value(field->elem,
+                                        field,
+                                        (char *)arr->items + i * size);
+
+        free(arr->items);
+
+        arr->items = NULL;
+        arr->count = 0;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static int _json_schema_write_value(struct json_writer *w,
+                                    enum json_field_type type,
+                                    const struct json_field *field,
+                                    const void *ptr)
+{
+    switch (type) {
+    case JSON_FIELD_STRING: {
+        const char *str = *(char * const *)ptr;
+
+        return (str != NULL)
+            ? json_writer_string(w, str, strlen(str))
+            : json_writer_null(w);
+    }
+    case JSON_FIELD_DOUBLE:
+        return json_writer_number(w, *(const double *)ptr);
+    case JSON_FIELD_FLOAT:
+        return json_writer_number(w, *(const float *)ptr);
+    case JSON_FIELD_INT:
+        return _json_schema_write_long(w, *(const int *)ptr);
+    case JSON_FIELD_LONG:
+        return _json_schema_write_long(w, *(const long *)ptr);
+    case JSON_FIELD_BOOL:
+        return json_writer_bool(w, *(const bool *)ptr);
+
+    case JSON_FIELD_OBJECT:
+        return json_schema_write(w, field->schema, ptr);
+
+    case JSON_FIELD_ARRAY: {
+        const struct json_schema_array *arr = ptr;
+        size_t size = _json_schema_size(field->elem, field->schema);
+        size_t i;
+
+        json_writer_begin_array(w);
+
+        for (i = 0; i < arr->count; ++i)
+            _json_schema_write_value(w,
+                                     field->elem,
+                                     field,
+                                     (const char *)arr->items + i * size);
+
+        return json_writer_end_array(w);
+    }
+    }
+
+    return 1;
+}
+
+/* Exactly, doubles can't hold every long */
+static int _json_schema_write_long(struct json_writer *w, long l)
+{
+    char buf[24];
+    int n = snprintf(buf, sizeof(buf), "%ld", l);
+
+    return json_writer_raw(w, buf, n);
+}
@@ -0,0 +1,516 @@
+#include <libutil/json/stream.h>
+#include <libutil/utf8.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define JSON_PARSER_INIT_STACK 8
+#define JSON_PARSER_INIT_TOKEN 64
+
+/* What the lexer is in the middle of */
+enum
+{
+    LEX_NONE,
+    LEX_STRING,
+    LEX_STRING_ESCAPE,
+    LEX_NUMBER,
+    LEX_LITERAL
+};
+
+/* What the innermost open container expects next */
+enum
+{
+    EXPECT_ARRAY_FIRST,   /* value or ']' */
+    EXPECT_ARRAY_VALUE,   /* value or ']' (a trailing comma) */
+    EXPECT_ARRAY_NEXT,    /* ',' or ']' */
+    EXPECT_OBJECT_FIRST,  /* key or '}' */
+    EXPECT_OBJECT_KEY,    /* key or '}' (a trailing comma) */
+    EXPECT_OBJECT_COLON,  /* ':' */
+    EXPECT_OBJECT_VALUE,  /* value */
+    EXPECT_OBJECT_NEXT    /* ',' or '}' */
+};
+
+static void _json_parser_tok_append(struct json_parser *p,
+                                    const char *buf,
+                                    size_t n);
+
+static void _json_parser_token(struct json_parser *p,
+                               enum json_token_type type);
+
+static void _json_parser_value(struct json_parser *p,
+                               enum json_token_type type);
+
+static int _json_parser_attach(struct json_parser *p, struct json_value *val);
+static int _json_parser_push(struct json_parser *p,
+                             struct json_value *container,
+                             int state);
+static void _json_parser_pop(struct json_parser *p);
+
+static int _json_parser_is_number(unsigned char c);
+
+
+struct json_parser *json_parser_new(void)
+{
+    struct json_parser *p = malloc(sizeof(*p));
+
+    memset(p, 0, sizeof(*p));
+
+    p->status = JSON_PARSER_CONTINUE;
+    p->lexstate = LEX_NONE;
+
+    return p;
+}
+
+void json_parser_free(struct json_parser *p)
+{
+    json_parser_reset(p);
+
+    free(p->tok);
+    free(p->stack);
+    free(p);
+}
+
+void json_parser_reset(struct json_parser *p)
+{
+    size_t i;
+
+    for (i = 0; i < p->depth; ++i)
+        free(p->stack[i].key);
+
+    /* Containers are attached as soon as they're opened, freeing root is enough */
+    if (p->root != NULL)
+        json_free(p->root);
+
+    p->root = NULL;
+    p->depth = 0;
+    p->toklen = 0;
+    p->tokpos = 0;
+    p->offset = 0;
+    p->lexstate = LEX_NONE;
+    p->status = JSON_PARSER_CONTINUE;
+}
+
+enum json_parser_status json_parser_feed(struct json_parser *p,
+                                         const char *buf,
+                                         size_t n)
+{
+    size_t i = 0;
+
+    while ((i < n) && (p->status == JSON_PARSER_CONTINUE)) {
+        unsigned char c = buf[i];
+
+        switch (p->lexstate) {
+        case LEX_STRING: {
+            /* Copy everything up to the next quote or backslash in one go */
+            size_t j = i;
+
+            while ((j < n) && (buf[j] != '"') && (buf[j] != '\\'))
+                ++j;
+
+            _json_parser_tok_append(p, buf + i, j - i);
+            i = j;
+
+            if (i < n) {
+                _json_parser_tok_append(p, buf + i, 1);
+
+                if (buf[i++] == '\\') {
+                    p->lexstate = LEX_STRING_ESCAPE;
+                } else {
+                    p->lexstate = LEX_NONE;
+                    _json_parser_token(p, TOK_STRING);
+                }
+            }
+
+            break;
+        }
+        case LEX_STRING_ESCAPE:
+            /* Taken as is, json_parse_string() validates escapes later on */
+            _json_parser_tok_append(p, buf + i++, 1);
+            p->lexstate = LEX_STRING;
+            break;
+
+        case LEX_NUMBER:
+            if (_json_parser_is_number(c)) {
+                _json_parser_tok_append(p, buf + i++, 1);
+            } else {
+                /* Leave the terminating character for the next round */
+                p->lexstate = LEX_NONE;
+                _json_parser_token(p, TOK_NUMBER);
+            }
+
+            break;
+
+        case LEX_LITERAL:
+            if (isalpha(c)) {
+                _json_parser_tok_append(p, buf + i++, 1);
+            } else {
+                p->lexstate = LEX_NONE;
+                _json_parser_token(p, TOK_MAX);
+            }
+
+            break;
+
+        case LEX_NONE:
+            p->toklen = 0;
+            p->tokpos = p->offset + i;
+
+            switch (c) {
+            case '{': ++i; _json_parser_token(p, TOK_BRACE_OPEN);           break;
+            case '}': ++i; _json_parser_token(p, TOK_BRACE_CLOSE);          break;
+            case '[': ++i; _json_parser_token(p, TOK_SQUARE_BRACKET_OPEN);  break;
+            case ']': ++i; _json_parser_token(p, TOK_SQUARE_BRACKET_CLOSE); break;
+            case ':': ++i; _json_parser_token(p, TOK_COLON);                break;
+            case ',': ++i; _json_parser_token(p, TOK_COMMA);                break;
+            case '"':
+                _json_parser_tok_append(p, buf + i++, 1);
+                p->lexstate = LEX_STRING;
+                break;
+
+            default:
+                if (isspace(c) || iscntrl(c)) {
+                    ++i;
+                } else if (isdigit(c) || (c == '+') || (c == '-')) {
+                    _json_parser_tok_append(p, buf + i++, 1);
+                    p->lexstate = LEX_NUMBER;
+                } else if (isalpha(c)) {
+                    _json_parser_tok_append(p, buf + i++, 1);
+                    p->lexstate = LEX_LITERAL;
+                } else {
+                    p->status = JSON_PARSER_ERROR;
+                }
+            }
+
+            break;
+        }
+    }
+
+    /*
+     * Only whitespace may follow a complete value, whether in this chunk or
+     * in any of the next ones
+     */
+    if (p->status == JSON_PARSER_DONE) {
+        for (; i < n; ++i) {
+            if (!isspace((unsigned char)buf[i])) {
+                p->status = JSON_PARSER_ERROR;
+                p->tokpos = p->offset + i;
+                break;
+            }
+        }
+    }
+
+    /* Errors are reported where the token began, maybe in an earlier chunk */
+    p->offset = (p->status == JSON_PARSER_ERROR) ? p->tokpos : p->offset + i;
+    return p->status;
+}
+
+struct json_value *json_parser_finish(struct json_parser *p)
+{
+    struct json_value *val;
+
+    if (p->status == JSON_PARSER_CONTINUE) {
+        /* Numbers and literals only end with the next character or EOF */
+        int pending = p->lexstate;
+
+        p->lexstate = LEX_NONE;
+
+        if (pending == LEX_NUMBER)
+            _json_parser_token(p, TOK_NUMBER);
+        else if (pending == LEX_LITERAL)
+            _json_parser_token(p, TOK_MAX);
+
+        if (p->status == JSON_PARSER_ERROR)
+            p->offset = p->tokpos;
+    }
+
+    if (p->status != JSON_PARSER_DONE)
+        return NULL;
+
+    val = p->root;
+    p->root = NULL;
+
+    return val;
+}
+
+static void _json_parser_tok_append(struct json_parser *p,
+                                    const char *buf,
+                                    size_t n)
+{
+    /* Always leave room for a terminator */
+    if (p->toklen + n + 1 > p->tokcap) {
+        size_t newcap = p->tokcap ? p->tokcap : JSON_PARSER_INIT_TOKEN;
+
+        while (p->toklen + n + 1 > newcap)
+            newcap *= 2;
+
+        p->tok = realloc(p->tok, newcap);
+        p->tokcap = newcap;
+    }
+
+    memcpy(p->tok + p->toklen, buf, n);
+    p->toklen += n;
+    p->tok[p->toklen] = '\0';
+}
+
+/*
+ * Handle a complete token. Literals are passed as TOK_MAX and resolved here
+ * since the lexer doesn't know where they end until it sees the next byte.
+ */
+static void _json_parser_token(struct json_parser *p,
+                               enum json_token_type type)
+{
+    struct json_parser_frame *top = p->depth ? &p->stack[p->depth - 1] : NULL;
+
+    if (type == TOK_MAX) {
+        if ((p->toklen == 4) && !memcmp(p->tok, "null", 4))
+            type = TOK_NULL;
+        else if ((p->toklen == 4) && !memcmp(p->tok, "true", 4))
+            type = TOK_TRUE;
+        else if ((p->toklen == 5) && !memcmp(p->tok, "false", 5))
+            type = TOK_FALSE;
+        else
+            goto exit_err;
+    } else if ((type == TOK_STRING)
+            && (utf8_validate(p->tok, p->toklen) != p->toklen)) {
+        /* Escapes are checked by json_parse_string(), the encoding here */
+        goto exit_err;
+    }
+
+    if (top == NULL) {
+        _json_parser_value(p, type);
+        return;
+    }
+
+    /* Trailing commas are fine, as they are with json_parse() */
+    switch (top->state) {
+    case EXPECT_ARRAY_FIRST:
+    case EXPECT_ARRAY_VALUE:
+        if (type == TOK_SQUARE_BRACKET_CLOSE)
+            _json_parser_pop(p);
+        else
+            _json_parser_value(p, type);
+
+        return;
+
+    case EXPECT_ARRAY_NEXT:
+        if (type == TOK_COMMA)
+            top->state = EXPECT_ARRAY_VALUE;
+        else if (type == TOK_SQUARE_BRACKET_CLOSE)
+            _json_parser_pop(p);
+        else
+            goto exit_err;
+
+        return;
+
+    case EXPECT_OBJECT_FIRST:
+    case EXPECT_OBJECT_KEY: {
+        struct json_lexer_state lex;
+        struct json_token tok;
+
+        if (type == TOK_BRACE_CLOSE) {
+            _json_parser_pop(p);
+            return;
+        }
+
+        if (type != TOK_STRING)
+            goto exit_err;
+
+        json_lexer_init(&lex, p->tok, p->toklen);
+
+        tok.type = TOK_STRING;
+        tok.i = 0;
+        tok.j = p->toklen;
+
+        if ((top->key = json_parse_string(&lex, &tok)) == NULL)
+            goto exit_err;
+
+        top->state = EXPECT_OBJECT_COLON;
+        return;
+    }
+    case EXPECT_OBJECT_COLON:
+        if (type != TOK_COLON)
+            goto exit_err;
+
+        top->state = EXPECT_OBJECT_VALUE;
+        return;
+
+    case EXPECT_OBJECT_NEXT:
+        if (type == TOK_COMMA)
+            top->state = EXPECT_OBJECT_KEY;
+        else if (type == TOK_BRACE_CLOSE)
+            _json_parser_pop(p);
+        else
+            goto exit_err;
+
+        return;
+
+    default:
+        /* EXPECT_OBJECT_VALUE */
+        _json_parser_value(p, type);
+        return;
+    }
+
+exit_err:
+    p->status = JSON_PARSER_ERROR;
+}
+
+/* Handle a token in a position where a value is expected */
+static void _json_parser_value(struct json_parser *p,
+                               enum json_token_type type)
+{
+    struct json_value *val = NULL;
+
+    switch (type) {
+    case TOK_BRACE_OPEN:
+    case TOK_SQUARE_BRACKET_OPEN:
+        /* The stack is our own, but nesting is limited as with json_parse() */
+        if (p->depth == JSON_PARSE_MAX_DEPTH)
+            break;
+
+        val = (type == TOK_BRACE_OPEN) ? json_object_new() : json_array_new();
+
+        /* Once attached, val is freed along with the rest on errors */
+        if (_json_parser_attach(p, val)
+                && _json_parser_push(p, val, (type == TOK_BRACE_OPEN)
+                                             ? EXPECT_OBJECT_FIRST
+                                             : EXPECT_ARRAY_FIRST))
+            p->status = JSON_PARSER_ERROR;
+
+        return;
+
+    case TOK_STRING: {
+        struct json_lexer_state lex;
+        struct json_token tok;
+        char *str;
+
+        json_lexer_init(&lex, p->tok, p->toklen);
+
+        tok.type = TOK_STRING;
+        tok.i = 0;
+        tok.j = p->toklen;
+
+        if ((str = json_parse_string(&lex, &tok)) == NULL)
+            break;
+
+        val = json_value_new(JSON_STRING);
+        val->value.jstring = str;
+        break;
+    }
+    case TOK_NUMBER: {
+        double d;
+
+        if (json_parse_number(p->tok, p->toklen, &d))
+            break;
+
+        val = json_number_new(d);
+        break;
+    }
+    case TOK_TRUE:
+        val = json_bool_new(true);
+        break;
+
+    case TOK_FALSE:
+        val = json_bool_new(false);
+        break;
+
+    case TOK_NULL:
+        val = json_null_new();
+        break;
+
+    default:
+        break;
+    }
+
+    if (val == NULL) {
+        p->status = JSON_PARSER_ERROR;
+        return;
+    }
+
+    if (_json_parser_attach(p, val) && (p->depth == 0))
+        p->status = JSON_PARSER_DONE; /* Top level scalar */
+}
+
+/*
+ * Hook a new value into the innermost open container (or make it the root).
+ * Returns 1 if val is now owned by the tree, 0 if it had to be dropped.
+ */
+static int _json_parser_attach(struct json_parser *p, struct json_value *val)
+{
+    struct json_parser_frame *top;
+
+    if (p->depth == 0) {
+        p->root = val;
+        return 1;
+    }
+
+    top = &p->stack[p->depth - 1];
+
+    if (top->state == EXPECT_OBJECT_VALUE) {
+        hashtable_insert(top->container->value.jobject, top->key, val);
+
+        top->key = NULL;
+        top->state = EXPECT_OBJECT_NEXT;
+    } else if ((top->state == EXPECT_ARRAY_FIRST)
+            || (top->state == EXPECT_ARRAY_VALUE)) {
+        /* list_append() walks the whole list, so link the node directly */
+        struct list *link = list_new_with_data(val);
+
+        if (top->tail != NULL) {
+            link->prev = top->tail;
+            top->tail->next = link;
+        } else {
+            top->container->value.jarray = link;
+        }
+
+        top->tail = link;
+        top->state = EXPECT_ARRAY_NEXT;
+    } else {
+        json_free(val);
+        p->status = JSON_PARSER_ERROR;
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Returns 0 on success and 1 if out of memory */
+static int _json_parser_push(struct json_parser *p,
+                             struct json_value *container,
+                             int state)
+{
+    struct json_parser_frame *top;
+
+    if (p->depth >= p->stacksize) {
+        size_t size = p->stacksize ? p->stacksize * 2 : JSON_PARSER_INIT_STACK;
+        struct json_parser_frame *stack =
+            realloc(p->stack, sizeof(*p->stack) * size);
+
+        if (stack == NULL)
+            return 1;
+
+        p->stack = stack;
+        p->stacksize = size;
+    }
+
+    top = &p->stack[p->depth++];
+
+    top->container = container;
+    top->tail = NULL;
+    top->key = NULL;
+    top->state = state;
+
+    return 0;
+}
+
+static void _json_parser_pop(struct json_parser *p)
+{
+    if (--p->depth == 0)
+        p->status = JSON_PARSER_DONE;
+}
+
+static int _json_parser_is_number(unsigned char c)
+{
+    return isdigit(c) || (c == '+') || (c == '-') || (c == '.')
+        || (c == 'e') || (c == 'E');
+}
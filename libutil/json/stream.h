@@ -0,0 +1,102 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <libutil/json.h>
+
+#include <stdlib.h>
+
+/*
+ * Incremental (push) JSON parser. Instead of handing json_parse() the whole
+ * document at once, input is fed in arbitrarily sized chunks as it arrives,
+ * for example straight out of fread() or recv(). Lexer and nesting state are
+ * kept across chunk boundaries, so a chunk may end anywhere, including in the
+ * middle of a string, an escape sequence or a number. Only the token currently
+ * being lexed is buffered, never the document text itself. What is accepted
+ * is the same as with json_parse(), trailing commas and nesting up to
+ * JSON_PARSE_MAX_DEPTH included.
+ *
+ * Example usage:
+ *
+ *     struct json_parser *p = json_parser_new();
+ *
+ *     while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+ *         if (json_parser_feed(p, buf, n) == JSON_PARSER_ERROR)
+ *             break;
+ *
+ *     // NULL if the input was malformed or incomplete
+ *     val = json_parser_finish(p);
+ *     json_parser_free(p);
+ */
+
+enum json_parser_status
+{
+    JSON_PARSER_CONTINUE, /* no complete value yet, feed more input */
+    JSON_PARSER_DONE,     /* a complete value has been parsed */
+    JSON_PARSER_ERROR     /* malformed input, see json_parser.offset */
+};
+
+/* One level of nesting, i.e. an open array or object */
+struct json_parser_frame
+{
+    struct json_value *container;
+    struct list *tail; /* last array element, for constant time appends */
+    char *key;         /* object key waiting for its value */
+
+    int state;
+};
+
+struct json_parser
+{
+    enum json_parser_status status;
+
+    /*
+     * Total number of bytes consumed so far. On error, this is the position
+     * of the offending token (or byte, after the value), once done it covers
+     * the parsed value and any whitespace fed after it.
+     */
+    size_t offset;
+
+    /* Lexer state and the text of the partial token */
+    int lexstate;
+
+    char *tok;
+    size_t toklen;
+    size_t tokcap;
+    size_t tokpos; /* where it started, counting like offset */
+
+    /* Parser state */
+    struct json_value *root;
+
+    struct json_parser_frame *stack;
+    size_t depth;
+    size_t stacksize;
+};
+
+struct json_parser *json_parser_new(void);
+void json_parser_free(struct json_parser *p);
+
+/*
+ * Forget everything parsed so far (including an unclaimed result) so the
+ * parser can be reused for the next document.
+ */
+void json_parser_reset(struct json_parser *p);
+
+/*
+ * Feed the next n bytes of input. Parsing stops with the first complete value
+ * (JSON_PARSER_DONE), after which only whitespace may follow: anything else
+ * is an error, no matter if it's fed along with the value or later on. To
+ * have all of the input checked, keep feeding until it ends or there's an
+ * error.
+ */
+enum json_parser_status json_parser_feed(struct json_parser *p,
+                                         const char *buf,
+                                         size_t n);
+
+/*
+ * Signal the end of input (which terminates a pending top level number or
+ * literal) and hand over the parsed value to the caller. Returns NULL if the
+ * input was malformed or ended prematurely.
+ */
+struct json_value *json_parser_finish(struct json_parser *p);
+
+#endif /* defined JSON_STREAM_H */
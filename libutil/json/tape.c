@@ -0,0 +1,677 @@
+#include <libutil/json/tape.h>
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define JSON_TAPE_BYTEORDER 0x01020304
+
+/* The first word of every record: type in the low byte, then the payload */
+#define TAPE_TYPE(word)    ((enum json_value_type)((word) & 0xff))
+#define TAPE_PAYLOAD(word) ((word) >> 8)
+#define TAPE_WORD(type, payload) ((uint64_t)(type) | ((uint64_t)(payload) << 8))
+
+struct json_tape_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+};
+
+struct json_tape_trailer
+{
+    uint64_t root;
+    char magic[8];
+};
+
+struct json_tape_writer
+{
+    struct json_writer *w;
+    size_t base;
+
+    /* Keys written so far, mapped to their offset */
+    struct hashtable *keys;
+};
+
+/* An object member while writing, to be sorted by key */
+struct json_tape_member
+{
+    const char *key;
+    size_t keylen;
+    char *tmp;
+
+    uint64_t val;
+};
+
+static const char _json_tape_magic[8] = {
+    'J', 'S', 'O', 'N', 'T', 'A', 'P', 'E'
+};
+
+static uint64_t _json_tape_put(struct json_tape_writer *tw,
+                               const struct json_value *val);
+
+static uint64_t _json_tape_put_string(struct json_tape_writer *tw,
+                                      const char *str,
+                                      size_t n);
+
+static uint64_t _json_tape_put_key(struct json_tape_writer *tw,
+                                   const char *key,
+                                   size_t n);
+
+static uint64_t _json_tape_put_words(struct json_tape_writer *tw,
+                                     const uint64_t *words,
+                                     size_t n);
+
+static int _json_tape_member_cmp(const void *a, const void *b);
+
+static int _json_tape_compare(const char *a,
+                              size_t na,
+                              const char *b,
+                              size_t nb);
+
+static const uint64_t *_json_tape_record(const struct json_tape_node *node,
+                                         enum json_value_type type,
+                                         size_t nwords);
+
+static int _json_tape_child(const struct json_tape_node *parent,
+                            uint64_t pos,
+                            struct json_tape_node *out);
+
+
+int json_tape_write(struct json_writer *w, const struct json_value *val)
+{
+    struct json_tape_writer tw;
+    struct json_tape_header hdr;
+    struct json_tape_trailer trl;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&trl, 0, sizeof(trl));
+
+    memcpy(hdr.magic, _json_tape_magic, sizeof(hdr.magic));
+    hdr.version = JSON_TAPE_VERSION;
+    hdr.byteorder = JSON_TAPE_BYTEORDER;
+
+    tw.w = w;
+    tw.base = w->total;
+    tw.keys = hashtable_new_with_free(str_hash, str_equal, free, NULL);
+
+    json_writer_write(w, (const char *)&hdr, sizeof(hdr));
+
+    /* Children come before their parents, so the root is last */
+    trl.root = _json_tape_put(&tw, val);
+    memcpy(trl.magic, _json_tape_magic, sizeof(trl.magic));
+
+    json_writer_write(w, (const char *)&trl, sizeof(trl));
+
+    hashtable_free(tw.keys);
+    return w->error;
+}
+
+char *json_tape_encode(const struct json_value *val, size_t *n)
+{
+    struct json_writer w;
+
+    json_writer_init_buffer(&w);
+    json_tape_write(&w, val);
+
+    return json_writer_detach(&w, n);
+}
+
+int json_tape_save(const char *path, const struct json_value *val)
+{
+    struct json_writer w;
+    FILE *f;
+    int err;
+
+    if ((f = fopen(path, "wb")) == NULL)
+        return 1;
+
+    json_writer_init_file(&w, f);
+
+    err = json_tape_write(&w, val) || json_writer_flush(&w);
+    json_writer_free(&w);
+
+    return (fclose(f) != 0) || err;
+}
+
+int json_tape_open(struct json_tape *tape, const char *path)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 1;
+
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+        close(fd);
+        return 1;
+    }
+
+    /* Shared, so every process using the tape uses the same pages */
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return 1;
+
+    if (json_tape_init(tape, map, st.st_size)) {
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    tape->mapped = true;
+    return 0;
+}
+
+int json_tape_init(struct json_tape *tape, const char *buf, size_t n)
+{
+    struct json_tape_header hdr;
+    struct json_tape_trailer trl;
+    struct json_tape_node root;
+
+    if ((n < sizeof(hdr) + sizeof(trl)) || ((uintptr_t)buf % 8 != 0))
+        return 1;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    memcpy(&trl, buf + n - sizeof(trl), sizeof(trl));
+
+    if (memcmp(hdr.magic, _json_tape_magic, sizeof(hdr.magic))
+            || memcmp(trl.magic, _json_tape_magic, sizeof(trl.magic))
+            || (hdr.version != JSON_TAPE_VERSION)
+            || (hdr.byteorder != JSON_TAPE_BYTEORDER))
+        return 1;
+
+    tape->base = buf;
+    tape->len = n - sizeof(trl);
+    tape->root = trl.root;
+    tape->mapped = false;
+
+    /* At least the root has to be in there */
+    root = json_tape_root(tape);
+
+    if (_json_tape_record(&root, json_tape_type(&root), 1) == NULL)
+        return 1;
+
+    return 0;
+}
+
+void json_tape_close(struct json_tape *tape)
+{
+    struct json_tape_trailer trl;
+
+    if (tape->mapped)
+        munmap((void *)tape->base, tape->len + sizeof(trl));
+
+    memset(tape, 0, sizeof(*tape));
+}
+
+struct json_tape_node json_tape_root(const struct json_tape *tape)
+{
+    struct json_tape_node root;
+
+    root.tape = tape;
+    root.pos = tape->root;
+
+    return root;
+}
+
+enum json_value_type json_tape_type(const struct json_tape_node *node)
+{
+    const struct json_tape *tape = node->tape;
+    uint64_t word;
+
+    if ((node->pos % 8 != 0) || (node->pos + 8 > tape->len))
+        return JSON_NULL;
+
+    memcpy(&word, tape->base + node->pos, sizeof(word));
+    return TAPE_TYPE(word);
+}
+
+bool json_tape_is_null(const struct json_tape_node *node)
+{
+    return json_tape_type(node) == JSON_NULL;
+}
+
+const char *json_tape_get_string(const struct json_tape_node *node, size_t *n)
+{
+    const uint64_t *rec = _json_tape_record(node, JSON_STRING, 1);
+    size_t len;
+
+    if (rec == NULL)
+        return NULL;
+
+    len = TAPE_PAYLOAD(rec[0]);
+
+    /* Text and terminator */
+    if (len >= node->tape->len - node->pos - 8)
+        return NULL;
+
+    if (n != NULL)
+        *n = len;
+
+    return (const char *)(rec + 1);
+}
+
+const double *json_tape_get_number(const struct json_tape_node *node)
+{
+    const uint64_t *rec = _json_tape_record(node, JSON_NUMBER, 2);
+
+    return (rec != NULL) ? (const double *)(rec + 1) : NULL;
+}
+
+const bool *json_tape_get_bool(const struct json_tape_node *node)
+{
+    const uint64_t *rec = _json_tape_record(node, JSON_BOOLEAN, 2);
+
+    return (rec != NULL) ? (const bool *)(rec + 1) : NULL;
+}
+
+size_t json_tape_length(const struct json_tape_node *node)
+{
+    enum json_value_type type = json_tape_type(node);
+    const uint64_t *rec = _json_tape_record(node, type, 1);
+
+    if ((rec == NULL) || ((type != JSON_ARRAY) && (type != JSON_OBJECT)))
+        return 0;
+
+    return TAPE_PAYLOAD(rec[0]);
+}
+
+int json_tape_index(const struct json_tape_node *arr,
+                    size_t i,
+                    struct json_tape_node *out)
+{
+    const uint64_t *rec = _json_tape_record(arr, JSON_ARRAY, 1);
+
+    if ((rec == NULL) || (i >= TAPE_PAYLOAD(rec[0])))
+        return 1;
+
+    if ((rec = _json_tape_record(arr, JSON_ARRAY, 2 + i)) == NULL)
+        return 1;
+
+    return _json_tape_child(arr, rec[1 + i], out);
+}
+
+int json_tape_lookup(const struct json_tape_node *obj,
+                     const char *key,
+                     struct json_tape_node *out)
+{
+    const uint64_t *rec = _json_tape_record(obj, JSON_OBJECT, 1);
+    size_t keylen = strlen(key);
+    size_t lo = 0;
+    size_t hi;
+
+    if (rec == NULL)
+        return 1;
+
+    hi = TAPE_PAYLOAD(rec[0]);
+
+    if ((rec = _json_tape_record(obj, JSON_OBJECT, 1 + hi * 2)) == NULL)
+        return 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        struct json_tape_node k;
+        const char *str;
+        size_t n;
+        int cmp;
+
+        if (_json_tape_child(obj, rec[1 + mid * 2], &k)
+                || ((str = json_tape_get_string(&k, &n)) == NULL))
+            return 1;
+
+        if ((cmp = _json_tape_compare(key, keylen, str, n)) == 0) {
+            return _json_tape_child(obj, rec[2 + mid * 2], out);
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return 1;
+}
+
+int json_tape_member(const struct json_tape_node *obj,
+                     size_t i,
+                     struct json_tape_node *key,
+                     struct json_tape_node *val)
+{
+    const uint64_t *rec = _json_tape_record(obj, JSON_OBJECT, 1);
+
+    if ((rec == NULL) || (i >= TAPE_PAYLOAD(rec[0])))
+        return 1;
+
+    if ((rec = _json_tape_record(obj, JSON_OBJECT, 3 + i * 2)) == NULL)
+        return 1;
+
+    if ((key != NULL) && _json_tape_child(obj, rec[1 + i * 2], key))
+        return 1;
+
+    if ((val != NULL) && _json_tape_child(obj, rec[2 + i * 2], val))
+        return 1;
+
+    return 0;
+}
+
+struct json_value *json_tape_value(const struct json_tape_node *node)
+{
+    switch (json_tape_type(node)) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_tape_get_string(node, &n);
+
+        return (str != NULL) ? json_string_new_n(str, n) : NULL;
+    }
+    case JSON_NUMBER: {
+        const double *d = json_tape_get_number(node);
+
+        return (d != NULL) ? json_number_new(*d) : NULL;
+    }
+    case JSON_BOOLEAN: {
+        const bool *b = json_tape_get_bool(node);
+
+        return (b != NULL) ? json_bool_new(*b) : NULL;
+    }
+    case JSON_NULL:
+        return json_null_new();
+
+    case JSON_ARRAY: {
+        struct json_value *arr = json_array_new();
+        struct list *tail = NULL;
+        struct json_tape_node elem;
+        size_t n = json_tape_length(node);
+        size_t i;
+
+        for (i = 0; i < n; ++i) {
+            struct json_value *val = json_tape_index(node, i, &elem)
+                                     ? NULL : json_tape_value(&elem);
+            struct list *link;
+
+            if (val == NULL) {
+                json_free(arr);
+                return NULL;
+            }
+
+            link = list_new_with_data(val);
+
+            if (tail != NULL) {
+                link->prev = tail;
+                tail->next = link;
+            } else {
+                arr->value.jarray = link;
+            }
+
+            tail = link;
+        }
+
+        return arr;
+    }
+    case JSON_OBJECT: {
+        struct json_value *obj = json_object_new();
+        struct json_tape_node key;
+        struct json_tape_node val;
+        size_t len = json_tape_length(node);
+        size_t i;
+
+        for (i = 0; i < len; ++i) {
+            size_t n;
+            const char *str = json_tape_member(node, i, &key, &val)
+                              ? NULL : json_tape_get_string(&key, &n);
+            struct json_value *v = (str != NULL) ? json_tape_value(&val) : NULL;
+            char *copy = (v != NULL) ? malloc(n + 1) : NULL;
+
+            if (copy == NULL) {
+                if (v != NULL)
+                    json_free(v);
+
+                json_free(obj);
+                return NULL;
+            }
+
+            /* All of it, keys may contain U+0000 */
+            memcpy(copy, str, n);
+            copy[n] = '\0';
+
+            hashtable_insert(obj->value.jobject, copy, v);
+        }
+
+        return obj;
+    }
+    }
+
+    return NULL;
+}
+
+/* Write the record for val (after those of its children), return its offset */
+static uint64_t _json_tape_put(struct json_tape_writer *tw,
+                               const struct json_value *val)
+{
+    uint64_t words[2];
+
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    switch (val->type) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_get_string_n(val, &n);
+
+        return _json_tape_put_string(tw, str, n);
+    }
+    case JSON_NUMBER: {
+        double d = json_get_number_value(val);
+
+        words[0] = TAPE_WORD(JSON_NUMBER, 0);
+        memcpy(&words[1], &d, sizeof(double));
+
+        return _json_tape_put_words(tw, words, 2);
+    }
+
+    case JSON_BOOLEAN:
+        words[0] = TAPE_WORD(JSON_BOOLEAN, 0);
+        words[1] = 0;
+        memcpy(&words[1], &val->value.jbool, sizeof(bool));
+
+        return _json_tape_put_words(tw, words, 2);
+
+    case JSON_NULL:
+        words[0] = TAPE_WORD(JSON_NULL, 0);
+
+        return _json_tape_put_words(tw, words, 1);
+
+    case JSON_ARRAY: {
+        size_t n = json_array_size(val);
+        uint64_t *rec = malloc(sizeof(*rec) * (n + 1));
+        struct json_array_iterator iter;
+        struct json_value *elem;
+        uint64_t pos;
+        size_t i = 1;
+
+        if (rec == NULL) {
+            tw->w->error = true;
+            return 0;
+        }
+
+        rec[0] = TAPE_WORD(JSON_ARRAY, n);
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem))
+            rec[i++] = _json_tape_put(tw, elem);
+
+        pos = _json_tape_put_words(tw, rec, n + 1);
+
+        free(rec);
+        return pos;
+    }
+    case JSON_OBJECT: {
+        size_t n = json_object_size(val);
+        struct json_tape_member *members = malloc(sizeof(*members) * (n + 1));
+        uint64_t *rec = malloc(sizeof(*rec) * (n * 2 + 1));
+        struct json_object_iterator iter;
+        struct json_value *value;
+        uint64_t pos;
+        size_t i = 0;
+
+        if ((members == NULL) || (rec == NULL)) {
+            free(members);
+            free(rec);
+
+            tw->w->error = true;
+            return 0;
+        }
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter,
+                                         &members[i].key,
+                                         &members[i].keylen,
+                                         &value)) {
+            struct json_tape_member *m = &members[i++];
+
+            /* Decoded keys have to stay around until they are sorted */
+            m->tmp = iter.tmp;
+            iter.tmp = NULL;
+
+            m->val = _json_tape_put(tw, value);
+        }
+
+        qsort(members, n, sizeof(*members), _json_tape_member_cmp);
+
+        rec[0] = TAPE_WORD(JSON_OBJECT, n);
+
+        for (i = 0; i < n; ++i) {
+            struct json_tape_member *m = &members[i];
+
+            rec[1 + i * 2] = _json_tape_put_key(tw, m->key, m->keylen);
+            rec[2 + i * 2] = m->val;
+
+            free(m->tmp);
+        }
+
+        pos = _json_tape_put_words(tw, rec, n * 2 + 1);
+
+        free(members);
+        free(rec);
+        return pos;
+    }
+    }
+
+    return 0;
+}
+
+static uint64_t _json_tape_put_string(struct json_tape_writer *tw,
+                                      const char *str,
+                                      size_t n)
+{
+    static const char zeroes[8] = { 0 };
+
+    uint64_t word = TAPE_WORD(JSON_STRING, n);
+    uint64_t pos = tw->w->total - tw->base;
+
+    json_writer_write(tw->w, (const char *)&word, sizeof(word));
+    json_writer_write(tw->w, str, n);
+
+    /* Terminator, and padding up to the next word */
+    json_writer_write(tw->w, zeroes, 8 - n % 8);
+
+    return pos;
+}
+
+/* Keys are written only once, every later use refers to the first one */
+static uint64_t _json_tape_put_key(struct json_tape_writer *tw,
+                                   const char *key,
+                                   size_t n)
+{
+    char *copy;
+    void *pos;
+
+    /* Keys with U+0000 in them would look the same as their start here */
+    if (memchr(key, '\0', n) != NULL)
+        return _json_tape_put_string(tw, key, n);
+
+    copy = strndup(key, n);
+
+    if ((pos = hashtable_lookup(tw->keys, copy)) != NULL) {
+        free(copy);
+        return (uintptr_t)pos;
+    }
+
+    /* Never 0, the header comes first */
+    pos = (void *)(uintptr_t)_json_tape_put_string(tw, key, n);
+    hashtable_insert(tw->keys, copy, pos);
+
+    return (uintptr_t)pos;
+}
+
+static uint64_t _json_tape_put_words(struct json_tape_writer *tw,
+                                     const uint64_t *words,
+                                     size_t n)
+{
+    uint64_t pos = tw->w->total - tw->base;
+
+    json_writer_write(tw->w, (const char *)words, sizeof(*words) * n);
+    return pos;
+}
+
+static int _json_tape_member_cmp(const void *a, const void *b)
+{
+    const struct json_tape_member *ma = a;
+    const struct json_tape_member *mb = b;
+
+    return _json_tape_compare(ma->key, ma->keylen, mb->key, mb->keylen);
+}
+
+/* Bytewise, shorter strings first if one is the prefix of the other */
+static int _json_tape_compare(const char *a,
+                              size_t na,
+                              const char *b,
+                              size_t nb)
+{
+    int cmp = memcmp(a, b, (na < nb) ? na : nb);
+
+    if (cmp != 0)
+        return cmp;
+
+    return (na > nb) - (na < nb);
+}
+
+/*
+ * The record of node, if it is of the given type and at least nwords long
+ * and in bounds. NULL otherwise.
+ */
+static const uint64_t *_json_tape_record(const struct json_tape_node *node,
+                                         enum json_value_type type,
+                                         size_t nwords)
+{
+    const struct json_tape *tape = node->tape;
+
+    if ((node->pos % 8 != 0) || (node->pos > tape->len)
+            || (nwords > (tape->len - node->pos) / 8))
+        return NULL;
+
+    if (json_tape_type(node) != type)
+        return NULL;
+
+    return (const uint64_t *)(tape->base + node->pos);
+}
+
+/*
+ * Point out at the child of parent at pos. Children are always written before
+ * their parents, anything else (a cycle, say) is a broken tape.
+ */
+static int _json_tape_child(const struct json_tape_node *parent,
+                            uint64_t pos,
+                            struct json_tape_node *out)
+{
+    if (pos >= parent->pos)
+        return 1;
+
+    out->tape = parent->tape;
+    out->pos = pos;
+
+    return 0;
+}
@@ -0,0 +1,644 @@
+#include <libutil/json/writer.h>
+#include <libutil/utf8.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+    #define JSON_WRITER_SSE2
+    #include <emmintrin.h>
+#endif
+
+#define JSON_WRITER_INIT_STACK 8
+#define JSON_WRITER_NUMBUFSIZ 64
+
+static int _json_writer_overflow(struct json_writer *w,
+                                 const char *ptr,
+                                 size_t n);
+
+static int _json_writer_separator(struct json_writer *w);
+static int _json_writer_push(struct json_writer *w);
+
+static int _json_writer_tree(struct json_writer *w,
+                             const struct json_value *val);
+
+static int _json_writer_put_string(struct json_writer *w,
+                                   const char *str,
+                                   size_t n);
+
+static int _json_writer_put_number(struct json_writer *w, double d);
+static int _json_writer_put_escape(struct json_writer *w, unsigned code);
+
+static size_t _json_writer_scan(const char *str, size_t n, bool ascii);
+
+static int _json_writer_file_sink(const char *buf, size_t n, void *ud);
+static int _json_writer_fd_sink(const char *buf, size_t n, void *ud);
+
+/*
+ * What a byte has to be written as inside a string: 0 if it can be copied as
+ * is, otherwise the character following the backslash, with 'u' meaning
+ * \u00XX.
+ */
+static const char _json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+    /* The rest, 0x60 to 0xff, is all zeroes */
+};
+
+static const char _json_hex[] = "0123456789abcdef";
+
+
+void json_writer_init_buffer(struct json_writer *w)
+{
+    memset(w, 0, sizeof(*w));
+
+    w->sink = JSON_WRITER_BUFFER;
+}
+
+void json_writer_init_fixed(struct json_writer *w, char *out, size_t nout)
+{
+    memset(w, 0, sizeof(*w));
+
+    /*
+     * Like snprintf(), keep space for the terminator and never touch out if
+     * there's no space at all
+     */
+    w->sink = JSON_WRITER_FIXED;
+    w->buf = (nout > 0) ? out : NULL;
+    w->cap = (nout > 0) ? nout - 1 : 0;
+}
+
+void json_writer_init_callback(struct json_writer *w,
+                               json_writer_func fn,
+                               void *ud)
+{
+    memset(w, 0, sizeof(*w));
+
+    w->sink = JSON_WRITER_CALLBACK;
+    w->fn = fn;
+    w->ud = ud;
+
+    w->buf = malloc(JSON_WRITER_BUFSIZ);
+    w->cap = JSON_WRITER_BUFSIZ;
+}
+
+void json_writer_init_file(struct json_writer *w, FILE *f)
+{
+    json_writer_init_callback(w, _json_writer_file_sink, f);
+}
+
+void json_writer_init_fd(struct json_writer *w, int fd)
+{
+    /* The descriptor itself is stored in the user data pointer */
+    json_writer_init_callback(w, _json_writer_fd_sink, (void *)(long)fd);
+}
+
+int json_writer_flush(struct json_writer *w)
+{
+    switch (w->sink) {
+    case JSON_WRITER_FIXED:
+        if (w->buf != NULL)
+            w->buf[w->len] = '\0';
+        break;
+
+    case JSON_WRITER_CALLBACK:
+        if (!w->error && (w->len > 0) && w->fn(w->buf, w->len, w->ud))
+            w->error = true;
+
+        w->len = 0;
+        break;
+
+    default:
+        break;
+    }
+
+    return w->error;
+}
+
+void json_writer_free(struct json_writer *w)
+{
+    if (w->sink != JSON_WRITER_FIXED)
+        free(w->buf);
+
+    free(w->stack);
+
+    w->buf = NULL;
+    w->stack = NULL;
+}
+
+char *json_writer_detach(struct json_writer *w, size_t *n)
+{
+    char *buf;
+
+    if (w->sink != JSON_WRITER_BUFFER)
+        return NULL;
+
+    /* There's always room for the terminator, see _json_writer_overflow() */
+    buf = (w->buf != NULL) ? w->buf : malloc(1);
+    buf[w->len] = '\0';
+
+    if (n != NULL)
+        *n = w->len;
+
+    w->buf = NULL;
+    w->len = 0;
+    w->cap = 0;
+
+    return buf;
+}
+
+int json_writer_write(struct json_writer *w, const char *ptr, size_t n)
+{
+    if (w->error)
+        return 1;
+
+    w->total += n;
+
+    if (w->len + n <= w->cap) {
+        memcpy(w->buf + w->len, ptr, n);
+        w->len += n;
+
+        return 0;
+    }
+
+    return _json_writer_overflow(w, ptr, n);
+}
+
+int json_writer_value(struct json_writer *w, const struct json_value *val)
+{
+    return _json_writer_separator(w) || _json_writer_tree(w, val);
+}
+
+int json_writer_begin_object(struct json_writer *w)
+{
+    return _json_writer_separator(w)
+        || _json_writer_push(w)
+        || json_writer_write(w, "{", 1);
+}
+
+int json_writer_end_object(struct json_writer *w)
+{
+    if (w->depth > 0)
+        w->depth--;
+
+    return json_writer_write(w, "}", 1);
+}
+
+int json_writer_begin_array(struct json_writer *w)
+{
+    return _json_writer_separator(w)
+        || _json_writer_push(w)
+        || json_writer_write(w, "[", 1);
+}
+
+int json_writer_end_array(struct json_writer *w)
+{
+    if (w->depth > 0)
+        w->depth--;
+
+    return json_writer_write(w, "]", 1);
+}
+
+int json_writer_key(struct json_writer *w, const char *key)
+{
+    return json_writer_key_n(w, key, strlen(key));
+}
+
+int json_writer_key_n(struct json_writer *w, const char *key, size_t n)
+{
+    const char *colon = (w->flags & JSON_WRITER_SPACED) ? ": " : ":";
+
+    if (_json_writer_separator(w)
+            || _json_writer_put_string(w, key, n)
+            || json_writer_write(w, colon, strlen(colon)))
+        return 1;
+
+    /* No separator between key and value */
+    w->after_key = true;
+    return 0;
+}
+
+int json_writer_string(struct json_writer *w, const char *str, size_t n)
+{
+    return _json_writer_separator(w) || _json_writer_put_string(w, str, n);
+}
+
+int json_writer_number(struct json_writer *w, double n)
+{
+    return _json_writer_separator(w) || _json_writer_put_number(w, n);
+}
+
+int json_writer_bool(struct json_writer *w, bool b)
+{
+    return _json_writer_separator(w)
+        || (b ? json_writer_write(w, "true", 4)
+              : json_writer_write(w, "false", 5));
+}
+
+int json_writer_null(struct json_writer *w)
+{
+    return _json_writer_separator(w) || json_writer_write(w, "null", 4);
+}
+
+int json_writer_raw(struct json_writer *w, const char *json, size_t n)
+{
+    return _json_writer_separator(w) || json_writer_write(w, json, n);
+}
+
+/* Slow path of json_writer_write(), for when the buffer is full */
+static int _json_writer_overflow(struct json_writer *w,
+                                 const char *ptr,
+                                 size_t n)
+{
+    switch (w->sink) {
+    case JSON_WRITER_BUFFER: {
+        size_t newcap = w->cap ? w->cap * 2 : JSON_WRITER_BUFSIZ;
+
+        while (newcap < w->len + n)
+            newcap *= 2;
+
+        /* One more for json_writer_detach() to put the terminator */
+        w->buf = realloc(w->buf, newcap + 1);
+        w->cap = newcap;
+
+        memcpy(w->buf + w->len, ptr, n);
+        w->len += n;
+        break;
+    }
+    case JSON_WRITER_FIXED:
+        /* Keep what fits, drop the rest (it has been counted already) */
+        if (w->buf != NULL)
+            memcpy(w->buf + w->len, ptr, w->cap - w->len);
+
+        w->len = w->cap;
+        break;
+
+    case JSON_WRITER_CALLBACK:
+        if (json_writer_flush(w))
+            return 1;
+
+        if (n >= w->cap) {
+            /* Not worth buffering, pass it right through */
+            if (w->fn(ptr, n, w->ud))
+                w->error = true;
+        } else {
+            memcpy(w->buf, ptr, n);
+            w->len = n;
+        }
+
+        break;
+    }
+
+    return w->error;
+}
+
+/* Emit a comma, unless this is the first value in a container or a member */
+static int _json_writer_separator(struct json_writer *w)
+{
+    const char *comma = (w->flags & JSON_WRITER_SPACED) ? ", " : ",";
+
+    if (w->after_key) {
+        w->after_key = false;
+        return 0;
+    }
+
+    if (w->depth == 0)
+        return 0;
+
+    if (w->stack[w->depth - 1])
+        return json_writer_write(w, comma, strlen(comma));
+
+    w->stack[w->depth - 1] = 1;
+    return 0;
+}
+
+static int _json_writer_push(struct json_writer *w)
+{
+    if (w->depth >= w->stacksize) {
+        w->stacksize = w->stacksize ? w->stacksize * 2 : JSON_WRITER_INIT_STACK;
+        w->stack = realloc(w->stack, w->stacksize);
+    }
+
+    w->stack[w->depth++] = 0;
+    return 0;
+}
+
+static int _json_writer_tree(struct json_writer *w,
+                             const struct json_value *val)
+{
+    const char *comma = (w->flags & JSON_WRITER_SPACED) ? ", " : ",";
+    const char *colon = (w->flags & JSON_WRITER_SPACED) ? ": " : ":";
+
+    size_t ncomma = strlen(comma);
+    size_t ncolon = strlen(colon);
+
+    /* Clones only refer to their contents */
+    if (val->flags & JSON_VALUE_SHARED)
+        val = val->value.jshared;
+
+    switch (val->type) {
+    case JSON_STRING: {
+        size_t n;
+        const char *str = json_get_string_n(val, &n);
+
+        return _json_writer_put_string(w, str, n);
+    }
+
+    case JSON_NUMBER: {
+        size_t n;
+        const char *text = json_get_number_text(val, &n);
+
+        /* Numbers that were never converted are copied exactly */
+        if (text != NULL)
+            return json_writer_write(w, text, n);
+
+        return _json_writer_put_number(w, json_get_number_value(val));
+    }
+
+    case JSON_NULL:
+        return json_writer_write(w, "null", 4);
+
+    case JSON_BOOLEAN:
+        return val->value.jbool
+            ? json_writer_write(w, "true", 4)
+            : json_writer_write(w, "false", 5);
+
+    case JSON_ARRAY: {
+        struct json_array_iterator iter;
+        struct json_value *elem;
+        bool first = true;
+
+        json_writer_write(w, "[", 1);
+
+        json_array_iterator_init(&iter, val);
+        while (json_array_iterator_next(&iter, &elem)) {
+            if (!first)
+                json_writer_write(w, comma, ncomma);
+
+            _json_writer_tree(w, elem);
+            first = false;
+        }
+
+        return json_writer_write(w, "]", 1);
+    }
+    case JSON_OBJECT: {
+        struct json_object_iterator iter;
+        bool first = true;
+
+        struct json_value *value;
+        const char *key;
+        size_t n;
+
+        json_writer_write(w, "{", 1);
+
+        json_object_iterator_init(&iter, val);
+        while (json_object_iterator_next(&iter, &key, &n, &value)) {
+            if (!first)
+                json_writer_write(w, comma, ncomma);
+
+            _json_writer_put_string(w, key, n);
+
+            json_writer_write(w, colon, ncolon);
+            _json_writer_tree(w, value);
+
+            first = false;
+        }
+
+        return json_writer_write(w, "}", 1);
+    }
+    }
+
+    return w->error;
+}
+
+/*
+ * Copy runs of bytes that need no escaping in one go, and only look up the
+ * others in the escape table.
+ */
+static int _json_writer_put_string(struct json_writer *w,
+                                   const char *str,
+                                   size_t n)
+{
+    bool ascii = (w->flags & JSON_WRITER_ASCII) != 0;
+
+    json_writer_write(w, "\"", 1);
+
+    while (n > 0) {
+        size_t run = _json_writer_scan(str, n, ascii);
+        unsigned char c;
+
+        json_writer_write(w, str, run);
+
+        str += run;
+        n -= run;
+
+        if (n == 0)
+            break;
+
+        c = *str;
+
+        if (c < 0x80) {
+            char esc = _json_escape[c];
+            char seq[2] = { '\\', esc };
+
+            if (esc == 'u')
+                _json_writer_put_escape(w, c);
+            else
+                json_writer_write(w, seq, 2);
+
+            str++;
+            n--;
+        } else {
+            /* Only in ASCII mode, escape the whole UTF-8 sequence */
+            char32_t code;
+            int len = utf8_decode(str, n, &code);
+
+            if ((len <= 0) || (code > 0x10ffff)) {
+                code = 0xfffd; /* replacement character */
+                len = 1;
+            }
+
+            if (code >= 0x10000) {
+                /* Needs a surrogate pair */
+                code -= 0x10000;
+
+                _json_writer_put_escape(w, 0xd800 | (code >> 10));
+                _json_writer_put_escape(w, 0xdc00 | (code & 0x3ff));
+            } else {
+                _json_writer_put_escape(w, code);
+            }
+
+            str += len;
+            n -= len;
+        }
+    }
+
+    return json_writer_write(w, "\"", 1);
+}
+
+/* Write code as \uXXXX */
+static int _json_writer_put_escape(struct json_writer *w, unsigned code)
+{
+    char seq[6] = { '\\', 'u' };
+
+    seq[2] = _json_hex[(code >> 12) & 0xf];
+    seq[3] = _json_hex[(code >> 8) & 0xf];
+    seq[4] = _json_hex[(code >> 4) & 0xf];
+    seq[5] = _json_hex[code & 0xf];
+
+    return json_writer_write(w, seq, 6);
+}
+
+/*
+ * Returns the length of the leading run of str that can be written as is,
+ * i.e. doesn't contain quotes, backslashes, control characters or (if ascii
+ * is set) anything outside of ASCII. Looks at 16 bytes at a time with SSE2,
+ * or at 8 bytes at a time using plain integer arithmetic otherwise.
+ */
+static size_t _json_writer_scan(const char *str, size_t n, bool ascii)
+{
+    size_t i = 0;
+
+#ifdef JSON_WRITER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+
+        /* max(v, 0x1f) == 0x1f is an unsigned v <= 0x1f */
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+
+        /* The high bits are exactly the non-ASCII bytes */
+        int mask = _mm_movemask_epi8(m) | (ascii ? _mm_movemask_epi8(v) : 0);
+
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#else
+    #define ONES  ((uint64_t)0x0101010101010101ULL)
+    #define HIGHS ((uint64_t)0x8080808080808080ULL)
+
+    /*
+     * Zero bytes in x light up in (x - ONES) & ~x & HIGHS, bytes below 0x20 in
+     * (x - 0x20 * ONES) & ~x & HIGHS. Either may give false positives above a
+     * true match, which doesn't matter since the exact position is determined
+     * bytewise below.
+     */
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        uint64_t q;
+        uint64_t b;
+
+        memcpy(&x, str + i, sizeof(x));
+
+        q = x ^ (ONES * '"');
+        b = x ^ (ONES * '\\');
+
+        if ((((x - ONES * 0x20) | (q - ONES) | (b - ONES)) & ~x & HIGHS)
+                || (ascii && (x & HIGHS)))
+            break;
+    }
+
+    #undef ONES
+    #undef HIGHS
+#endif
+
+    for (; i < n; ++i) {
+        unsigned char c = str[i];
+
+        if (_json_escape[c] || (ascii && (c >= 0x80)))
+            return i;
+    }
+
+    return n;
+}
+
+static int _json_writer_put_number(struct json_writer *w, double d)
+{
+    char buf[JSON_WRITER_NUMBUFSIZ];
+    int n;
+
+    if (w->number_format != NULL) {
+        n = snprintf(buf, sizeof(buf), w->number_format, d);
+
+        if ((size_t)n >= sizeof(buf)) {
+            /* Think "%f" and 1e300 */
+            char *tmp = malloc(n + 1);
+            int ret;
+
+            snprintf(tmp, n + 1, w->number_format, d);
+            ret = json_writer_write(w, tmp, n);
+
+            free(tmp);
+            return ret;
+        }
+    } else if ((d != d) || (d - d != 0)) {
+        /* NaN and infinities have no representation in JSON */
+        return json_writer_write(w, "null", 4);
+    } else if ((d > -1e15) && (d < 1e15) && (d == (double)(long long)d)
+            && ((d != 0) || !signbit(d))) {
+        /* Integers are common enough to skip printf for, but not -0 */
+        unsigned long long u = (d < 0) ? -(long long)d : (long long)d;
+        char *p = buf + sizeof(buf);
+
+        do {
+            *--p = '0' + (u % 10);
+        } while (u /= 10);
+
+        if (d < 0)
+            *--p = '-';
+
+        return json_writer_write(w, p, buf + sizeof(buf) - p);
+    } else {
+        /* Shortest precision that reads back as the same number */
+        const char *formats[] = { "%.15g", "%.16g", "%.17g" };
+        size_t i;
+
+        for (i = 0; i < sizeof(formats) / sizeof(*formats); ++i) {
+            n = snprintf(buf, sizeof(buf), formats[i], d);
+
+            if (strtod(buf, NULL) == d)
+                break;
+        }
+    }
+
+    return json_writer_write(w, buf, n);
+}
+
+static int _json_writer_file_sink(const char *buf, size_t n, void *ud)
+{
+    return fwrite(buf, 1, n, (FILE *)ud) != n;
+}
+
+static int _json_writer_fd_sink(const char *buf, size_t n, void *ud)
+{
+    int fd = (int)(long)ud;
+
+    while (n > 0) {
+        ssize_t ret = write(fd, buf, n);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return 1;
+        }
+
+        buf += ret;
+        n -= ret;
+    }
+
+    return 0;
+}
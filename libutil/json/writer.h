@@ -0,0 +1,140 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <libutil/json.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Streaming JSON serialization. Output is collected in an internal buffer
+ * (using plain memcpy for everything but numbers) and handed to a sink
+ * whenever the buffer fills up, so documents of any size are written in one
+ * pass without having to size them first.
+ *
+ * Sinks:
+ *   - a growable buffer, from which the result is taken with
+ *     json_writer_detach()
+ *   - a fixed size buffer, with snprintf() semantics (output that doesn't fit
+ *     is dropped but still counted, see json_writer.total)
+ *   - a user callback, which gets the output in chunks of up to
+ *     JSON_WRITER_BUFSIZ bytes
+ *   - a FILE * or a file descriptor, on top of the callback sink
+ *
+ * Besides whole trees (json_writer_value()), documents can also be written
+ * piece by piece, with the writer taking care of separators:
+ *
+ *     json_writer_init_fd(&w, STDOUT_FILENO);
+ *
+ *     json_writer_begin_object(&w);
+ *     json_writer_key(&w, "rows");
+ *     json_writer_begin_array(&w);
+ *
+ *     while (row = next_row())
+ *         json_writer_value(&w, row);
+ *
+ *     json_writer_end_array(&w);
+ *     json_writer_end_object(&w);
+ *
+ *     json_writer_flush(&w);
+ *     json_writer_free(&w);
+ *
+ * All writing functions return 0 on success and 1 once a sink has failed, in
+ * which case everything after that is dropped.
+ */
+
+#define JSON_WRITER_BUFSIZ 65536 /* buffer size for callback based sinks */
+
+#define JSON_WRITER_SPACED 0x01 /* ", " and ": " instead of "," and ":"     */
+#define JSON_WRITER_ASCII  0x02 /* escape anything outside of ASCII as \uXXXX */
+
+/* Returns 0 on success, 1 on error */
+typedef int (*json_writer_func)(const char *buf, size_t n, void *ud);
+
+enum json_writer_sink
+{
+    JSON_WRITER_BUFFER,
+    JSON_WRITER_FIXED,
+    JSON_WRITER_CALLBACK
+};
+
+struct json_writer
+{
+    enum json_writer_sink sink;
+
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    size_t total; /* number of bytes written so far */
+
+    json_writer_func fn;
+    void *ud;
+
+    unsigned flags;
+
+    /*
+     * printf() format used for numbers. If NULL (the default), numbers are
+     * written in the shortest form that reads back as the same double.
+     * Numbers parsed with JSON_PARSE_LAZY and never converted are copied
+     * as they were in the input either way.
+     */
+    const char *number_format;
+
+    /* Nesting for piecewise writing, whether each level has elements yet */
+    unsigned char *stack;
+    size_t depth;
+    size_t stacksize;
+    bool after_key;
+
+    bool error;
+};
+
+void json_writer_init_buffer(struct json_writer *w);
+void json_writer_init_fixed(struct json_writer *w, char *out, size_t nout);
+void json_writer_init_callback(struct json_writer *w,
+                               json_writer_func fn,
+                               void *ud);
+void json_writer_init_file(struct json_writer *w, FILE *f);
+void json_writer_init_fd(struct json_writer *w, int fd);
+
+/*
+ * Push buffered output to the sink. Fixed buffers are zero terminated (space
+ * permitting). Does not flush the FILE * itself.
+ */
+int json_writer_flush(struct json_writer *w);
+
+/* Frees the writer's buffer, without flushing it */
+void json_writer_free(struct json_writer *w);
+
+/*
+ * Only for the growable buffer sink: returns the zero terminated output (to
+ * be freed by the caller) and stores its length in n unless n is NULL. The
+ * writer is empty afterwards.
+ */
+char *json_writer_detach(struct json_writer *w, size_t *n);
+
+int json_writer_value(struct json_writer *w, const struct json_value *val);
+
+int json_writer_begin_object(struct json_writer *w);
+int json_writer_end_object(struct json_writer *w);
+int json_writer_begin_array(struct json_writer *w);
+int json_writer_end_array(struct json_writer *w);
+
+int json_writer_key(struct json_writer *w, const char *key);
+int json_writer_key_n(struct json_writer *w, const char *key, size_t n);
+int json_writer_string(struct json_writer *w, const char *str, size_t n);
+int json_writer_number(struct json_writer *w, double n);
+int json_writer_bool(struct json_writer *w, bool b);
+int json_writer_null(struct json_writer *w);
+
+/* Writes n bytes of already serialized JSON as a value */
+int json_writer_raw(struct json_writer *w, const char *json, size_t n);
+
+/*
+ * Writes n bytes at ptr. This is the lowest level, it bypasses separator
+ * handling altogether.
+ */
+int json_writer_write(struct json_writer *w, const char *ptr, size_t n);
+
+#endif /* defined JSON_WRITER_H */
@@ -137,6 +137,84 @@ long utf8_strlen_s(const char *str)
     return len;
 }
 
+int utf8_validate_char(const char *buf, size_t bufsiz)
+{
+    const unsigned char *s = (const unsigned char *)buf;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+    unsigned w;
+    unsigned i;
+
+    if (bufsiz < 1)
+        return 0;
+
+    /*
+     * The second byte is restricted further for some headers, to rule out
+     * overlong forms (e0, f0), surrogates (ed) and values beyond U+10FFFF (f4)
+     */
+    if (s[0] < 0x80)
+        return 1;
+    else if (s[0] < 0xc2)
+        return 0;
+    else if (s[0] < 0xe0)
+        w = 2;
+    else if (s[0] < 0xf0)
+        w = 3;
+    else if (s[0] < 0xf5)
+        w = 4;
+    else
+        return 0;
+
+    if (s[0] == 0xe0)
+        lo = 0xa0;
+    else if (s[0] == 0xed)
+        hi = 0x9f;
+    else if (s[0] == 0xf0)
+        lo = 0x90;
+    else if (s[0] == 0xf4)
+        hi = 0x8f;
+
+    if (bufsiz < w)
+        return 0;
+
+    if ((s[1] < lo) || (s[1] > hi))
+        return 0;
+
+    for (i = 2; i < w; ++i)
+        if (!_utf8_is_continuation(s[i]))
+            return 0;
+
+    return w;
+}
+
+size_t utf8_validate(const char *buf, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n) {
+        int w;
+
+        /* Skip over plain ASCII eight bytes at a time */
+        if (i + 8 <= n) {
+            unsigned long long x;
+
+            memcpy(&x, buf + i, sizeof(x));
+
+            if (!(x & 0x8080808080808080ULL)) {
+                i += 8;
+                continue;
+            }
+        }
+
+        if (!(w = utf8_validate_char(buf + i, n - i)))
+            break;
+
+        i += w;
+    }
+
+    return i;
+}
+
 static unsigned _utf8_shiftpos(unsigned w, unsigned n)
 {
     return 6 * (w - 1 - n);
@@ -163,8 +241,9 @@ static unsigned _utf8_encoding_width(char32_t codepoint)
 
 static char _utf8_header_byte(char32_t codepoint, unsigned w)
 {
-    unsigned char pattern = ~0 << (8 - w);
-    unsigned char valmask = ~0 >> (7 - w);
+    /* w leading ones, a zero, then the value as in _utf8_header_value() */
+    unsigned char pattern = (unsigned char)(0xff << (8 - w));
+    unsigned char valmask = 0x7f >> w;
 
     return pattern | (char)(codepoint >> _utf8_shiftpos(w, 0) & valmask);
 }
@@ -194,7 +273,8 @@ static unsigned _utf8_decoding_width(unsigned char header)
 
 static char32_t _utf8_header_value(unsigned char header, unsigned w)
 {
-    return (header & ((unsigned char)~0 >> (7 - w))) << _utf8_shiftpos(w, 0);
+    /* The header has w + 1 leading bits that aren't part of the value */
+    return (header & (0x7f >> w)) << _utf8_shiftpos(w, 0);
 }
 
 static char32_t _utf8_continuation_value(unsigned char cont,
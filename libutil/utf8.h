@@ -60,4 +60,18 @@ long utf8_strlen(const char *str);
  */
 long utf8_strlen_s(const char *str);
 
+/*
+ * Strictly checks the sequence at the start of buf as defined by RFC 3629,
+ * rejecting overlong encodings, surrogates and anything above U+10FFFF.
+ * Returns the length of the sequence, or zero if it's invalid or doesn't fit
+ * into bufsiz bytes.
+ */
+int utf8_validate_char(const char *buf, size_t bufsiz);
+
+/*
+ * Returns the length of the longest prefix of the n bytes at buf that is
+ * valid UTF-8 by the rules of utf8_validate_char, n if all of it is.
+ */
+size_t utf8_validate(const char *buf, size_t n);
+
 #endif /* defined UTF8_H */
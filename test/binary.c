@@ -0,0 +1,223 @@
+#include <libutil/json.h>
+#include <libutil/json/cbor.h>
+#include <libutil/json/msgpack.h>
+
+#include "test.h"
+
+struct test_format
+{
+    char *(*encode)(const struct json_value *val, size_t *n);
+    struct json_value *(*decode)(const char *buf, size_t n, size_t *used);
+};
+
+static const struct test_format cbor = {
+    json_cbor_encode, json_cbor_decode
+};
+
+static const struct test_format msgpack = {
+    json_msgpack_encode, json_msgpack_decode
+};
+
+/* Encoding boundaries: small, 1, 2, 4 and 8 byte integers, both signs */
+static const char doc[] =
+    "{\"ints\": [0, 1, 23, 24, 127, 128, 255, 256, 65535, 65536,"
+    " 4294967295, 4294967296, 9007199254740992, -1, -24, -25, -32, -33,"
+    " -128, -129, -32768, -32769, -2147483648, -2147483649,"
+    " -9007199254740992],"
+    " \"floats\": [0.5, -1.25, 0.1, 1e300, -3.4028234663852886e38, 1e-310],"
+    " \"strings\": [\"\", \"a\", \"abcdefghijklmnopqrstuvw\","
+    " \"abcdefghijklmnopqrstuvwx\", \"\\u00e9\\ud83d\\ude00\", \"a\\u0000b\"],"
+    " \"empty\": [[], {}, [[]]], \"other\": [true, false, null],"
+    " \"\": {\"nested\": {\"deeper\": [1, {\"x\": \"y\"}]}}}";
+
+/* Round trips, at a few sizes for the length prefixes, and truncations */
+static void test_format(const struct test_format *fmt);
+
+static void test_round_trip(const struct test_format *fmt,
+                            const struct json_value *val);
+
+/* Whether the n bytes at buf decode at all */
+static bool test_decodes(const struct test_format *fmt,
+                         const char *buf,
+                         size_t n);
+
+
+int main(void)
+{
+    char *nested;
+    size_t i;
+
+    test_format(&cbor);
+    test_format(&msgpack);
+
+    /* Text must be UTF-8, bytes can be anything */
+    CHECK(test_decodes(&cbor, "\x62\xc3\xa9", 3));
+    CHECK(!test_decodes(&cbor, "\x62\xc3\x28", 3));
+    CHECK(!test_decodes(&cbor, "\xa1\x62\xc3\x28\x01", 5));
+    CHECK(test_decodes(&cbor, "\x42\xc3\x28", 3));
+
+    CHECK(test_decodes(&msgpack, "\xa2\xc3\xa9", 3));
+    CHECK(!test_decodes(&msgpack, "\xa2\xc3\x28", 3));
+    CHECK(!test_decodes(&msgpack, "\x81\xa2\xc3\x28\x01", 5));
+    CHECK(test_decodes(&msgpack, "\xc4\x02\xc3\x28", 4));
+
+    /* Map keys are strings */
+    CHECK(!test_decodes(&cbor, "\xa1\x01\x01", 3));
+    CHECK(!test_decodes(&msgpack, "\x81\x01\x01", 3));
+
+    /* Tags are skipped, undefined is null, ext is no JSON */
+    CHECK(test_decodes(&cbor, "\xc1\x01", 2));
+    CHECK(test_decodes(&cbor, "\xf7", 1));
+    CHECK(!test_decodes(&msgpack, "\xd4\x01\x00", 3));
+
+    /* Reserved and unused lead bytes */
+    CHECK(!test_decodes(&cbor, "\x1c", 1));
+    CHECK(!test_decodes(&cbor, "\xff", 1));
+    CHECK(!test_decodes(&msgpack, "\xc1", 1));
+
+    /* Lengths beyond the input */
+    CHECK(!test_decodes(&cbor, "\x9b\xff\xff\xff\xff\xff\xff\xff\xff", 9));
+    CHECK(!test_decodes(&cbor, "\x7a\xff\xff\xff\xff", 5));
+    CHECK(!test_decodes(&msgpack, "\xdd\xff\xff\xff\xff", 5));
+    CHECK(!test_decodes(&msgpack, "\xdb\xff\xff\xff\xff", 5));
+
+    /* Up to the maximum depth of containers, one more is too many */
+    nested = malloc(JSON_CBOR_MAX_DEPTH + 1);
+
+    if (nested != NULL) {
+        memset(nested, '\x81', JSON_CBOR_MAX_DEPTH);
+        nested[JSON_CBOR_MAX_DEPTH] = '\x80';
+
+        CHECK(test_decodes(&cbor, nested + 1, JSON_CBOR_MAX_DEPTH));
+        CHECK(!test_decodes(&cbor, nested, JSON_CBOR_MAX_DEPTH + 1));
+
+        for (i = 0; i < JSON_MSGPACK_MAX_DEPTH; ++i)
+            nested[i] = '\x91';
+
+        nested[JSON_MSGPACK_MAX_DEPTH] = '\x90';
+
+        CHECK(test_decodes(&msgpack, nested + 1, JSON_MSGPACK_MAX_DEPTH));
+        CHECK(!test_decodes(&msgpack, nested, JSON_MSGPACK_MAX_DEPTH + 1));
+
+        free(nested);
+    }
+
+    return TEST_RESULT();
+}
+
+static void test_format(const struct test_format *fmt)
+{
+    struct json_value *val = json_parse(doc);
+    struct json_value *arr;
+    char *buf;
+    char *two;
+    size_t n;
+    size_t used;
+    size_t i;
+
+    CHECK(val != NULL);
+
+    if (val == NULL)
+        return;
+
+    test_round_trip(fmt, val);
+
+    /* Every prefix is missing something */
+    if ((buf = fmt->encode(val, &n)) != NULL) {
+        for (i = 0; i < n; ++i)
+            CHECK(!test_decodes(fmt, buf, i));
+
+        /* Items one after the other */
+        if ((two = malloc(2 * n)) != NULL) {
+            struct json_value *first;
+            struct json_value *second;
+
+            memcpy(two, buf, n);
+            memcpy(two + n, buf, n);
+
+            first = fmt->decode(two, 2 * n, &used);
+            CHECK((first != NULL) && (used == n));
+
+            second = fmt->decode(two + n, n, &used);
+            CHECK((second != NULL) && (used == n));
+
+            CHECK(test_equal(first, val) && test_equal(second, val));
+
+            if (first != NULL)
+                json_free(first);
+
+            if (second != NULL)
+                json_free(second);
+
+            free(two);
+        }
+
+        free(buf);
+    }
+
+    json_free(val);
+
+    /* Containers and strings past the one and two byte length prefixes */
+    buf = malloc(70000 * 2 + 1);
+
+    if (buf != NULL) {
+        /* Parsed, appending one at a time would walk the list every time */
+        for (i = 0; i < 70000; ++i) {
+            buf[i * 2] = (i == 0) ? '[' : ',';
+            buf[i * 2 + 1] = '0' + i % 3;
+        }
+
+        buf[70000 * 2] = ']';
+
+        CHECK((arr = json_parse_n(buf, 70000 * 2 + 1)) != NULL);
+
+        if (arr != NULL) {
+            CHECK(json_array_size(arr) == 70000);
+            test_round_trip(fmt, arr);
+            json_free(arr);
+        }
+
+        memset(buf, 'x', 70000);
+        buf[70000] = '\0';
+
+        val = json_string_new(buf);
+        test_round_trip(fmt, val);
+        json_free(val);
+
+        free(buf);
+    }
+}
+
+static void test_round_trip(const struct test_format *fmt,
+                            const struct json_value *val)
+{
+    struct json_value *out = NULL;
+    char *buf;
+    size_t n;
+    size_t used;
+
+    CHECK((buf = fmt->encode(val, &n)) != NULL);
+
+    if (buf != NULL)
+        CHECK(((out = fmt->decode(buf, n, &used)) != NULL) && (used == n));
+
+    CHECK(test_equal(out, val));
+
+    if (out != NULL)
+        json_free(out);
+
+    free(buf);
+}
+
+static bool test_decodes(const struct test_format *fmt,
+                         const char *buf,
+                         size_t n)
+{
+    struct json_value *val = fmt->decode(buf, n, NULL);
+
+    if (val == NULL)
+        return false;
+
+    json_free(val);
+    return true;
+}
@@ -0,0 +1,228 @@
+#include <libutil/json.h>
+#include <libutil/json/cache.h>
+#include <libutil/json/writer.h>
+#include <libutil/container/hashtable.h>
+
+#include <pthread.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"user\": {\"name\": \"ann\", \"tags\": [\"a\", \"b\"]},"
+    " \"items\": [1, 2, {\"x\": []}], \"count\": 3}";
+
+/* Whether val still comes out as text */
+static bool test_dumps_as(const struct json_value *val, const char *text);
+
+/* Whether val is the same as what text parses to */
+static bool test_parses_as(const struct json_value *val, const char *text);
+
+/* What val looks like written through cache into a new string */
+static char *test_cached_dump(struct json_cache *cache,
+                              struct json_value *val);
+
+/* Frees clones of parts of one shaped document on two threads at once */
+static void test_threads(void);
+
+static void *test_free_thread(void *val);
+
+
+int main(void)
+{
+    struct json_value *val = json_parse(doc);
+    struct json_value *copy;
+    struct json_value *third;
+    struct json_value *user;
+    struct json_value *str;
+    struct json_cache cache;
+    char *orig;
+    char *text;
+
+    CHECK(val != NULL);
+
+    if (val == NULL)
+        return TEST_RESULT();
+
+    orig = test_dump(val);
+
+    /* Copies are the same and share everything */
+    CHECK((copy = json_clone(val)) != NULL);
+
+    if (copy == NULL)
+        goto exit;
+
+    CHECK(test_equal(copy, val));
+    CHECK((val->flags & JSON_VALUE_SHARED)
+          && (copy->flags & JSON_VALUE_SHARED));
+    CHECK(copy->value.jshared == val->value.jshared);
+
+    /* Whatever one of them changes is its own */
+    CHECK((user = json_object_lookup(copy, "user")) != NULL);
+    json_set_string(json_object_lookup(user, "name"), "bob");
+    json_array_append(json_object_lookup(user, "tags"), json_string_new("c"));
+    json_array_append(json_object_lookup(copy, "items"), json_null_new());
+
+    CHECK(test_dumps_as(val, orig));
+    CHECK(test_parses_as(copy, "{\"user\": {\"name\": \"bob\", \"tags\":"
+                         " [\"a\", \"b\", \"c\"]}, \"items\": [1, 2,"
+                         " {\"x\": []}, null], \"count\": 3}"));
+
+    /* Either can go first */
+    CHECK((third = json_clone(copy)) != NULL);
+    json_free(copy);
+    copy = NULL;
+
+    CHECK(third != NULL);
+
+    if (third != NULL) {
+        CHECK(!json_unshare(third));
+        CHECK(!(third->flags & JSON_VALUE_SHARED));
+        CHECK(json_object_size(third) == 3);
+
+        hashtable_remove(json_get_object(third), "count");
+
+        CHECK(json_object_size(third) == 2);
+        CHECK(test_dumps_as(val, orig));
+
+        json_free(third);
+    }
+
+    /* Strings, too */
+    str = json_string_new("same");
+    copy = json_clone(str);
+
+    CHECK(copy != NULL);
+
+    if (copy != NULL) {
+        json_set_string(copy, "different");
+
+        CHECK(!strcmp(json_get_string(str), "same"));
+        CHECK(!strcmp(json_get_string(copy), "different"));
+
+        json_free(copy);
+        copy = NULL;
+    }
+
+    json_free(str);
+
+    /* A cached document and a clone of it don't get each other's text */
+    json_cache_init(&cache);
+
+    text = test_cached_dump(&cache, val);
+    CHECK((text != NULL) && !strcmp(text, orig));
+    free(text);
+
+    copy = json_clone(val);
+
+    CHECK(copy != NULL);
+
+    if (copy != NULL) {
+        json_set_string(json_object_lookup(json_object_lookup(copy, "user"),
+                                           "name"),
+                        "cy");
+
+        text = test_cached_dump(&cache, val);
+        CHECK((text != NULL) && !strcmp(text, orig));
+        free(text);
+
+        text = test_cached_dump(&cache, copy);
+        CHECK((text != NULL) && strstr(text, "\"cy\"")
+              && !strstr(text, "ann"));
+        free(text);
+
+        json_free(copy);
+        copy = NULL;
+    }
+
+    json_cache_free(&cache);
+
+    test_threads();
+
+exit:
+    if (copy != NULL)
+        json_free(copy);
+
+    free(orig);
+    json_free(val);
+
+    return TEST_RESULT();
+}
+
+static bool test_dumps_as(const struct json_value *val, const char *text)
+{
+    char *out = test_dump(val);
+    bool same = (out != NULL) && !strcmp(out, text);
+
+    free(out);
+    return same;
+}
+
+static bool test_parses_as(const struct json_value *val, const char *text)
+{
+    struct json_value *expected = json_parse(text);
+    bool same = (expected != NULL) && test_equal(val, expected);
+
+    if (expected != NULL)
+        json_free(expected);
+
+    return same;
+}
+
+static char *test_cached_dump(struct json_cache *cache,
+                              struct json_value *val)
+{
+    struct json_writer w;
+    char *out;
+
+    json_writer_init_buffer(&w);
+    json_cache_write(cache, &w, val);
+
+    out = json_writer_detach(&w, NULL);
+    json_writer_free(&w);
+
+    return out;
+}
+
+static void test_threads(void)
+{
+    static const char shaped[] =
+        "[[{\"a\": 1}, {\"a\": 1, \"b\": 2}, {\"a\": 1, \"c\": 3}],"
+        " [{\"a\": 1}, {\"a\": 1, \"b\": 2}, {\"a\": 1, \"d\": 4}]]";
+    int round;
+
+    for (round = 0; round < 200; ++round) {
+        struct json_value *val;
+        struct json_value *parts[2];
+        struct json_value *part;
+        struct json_array_iterator iter;
+        pthread_t threads[2];
+        int i;
+
+        val = json_parse_ex(shaped, sizeof(shaped) - 1, JSON_PARSE_SHAPES);
+        CHECK(val != NULL);
+
+        if (val == NULL)
+            return;
+
+        /* Clones of different objects, all of them using the same shapes */
+        json_array_iterator_init(&iter, val);
+
+        for (i = 0; json_array_iterator_next(&iter, &part); ++i)
+            CHECK((parts[i] = json_clone(part)) != NULL);
+
+        json_free(val);
+
+        for (i = 0; i < 2; ++i)
+            CHECK(!pthread_create(&threads[i], NULL,
+                                  test_free_thread, parts[i]));
+
+        for (i = 0; i < 2; ++i)
+            pthread_join(threads[i], NULL);
+    }
+}
+
+static void *test_free_thread(void *val)
+{
+    json_free(val);
+    return NULL;
+}
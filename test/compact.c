@@ -0,0 +1,208 @@
+#include <libutil/json.h>
+#include <libutil/json/compact.h>
+
+#include <math.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"name\": \"r\\u00e9c\", \"n\": [0, -0, 7, -2147483648, 2147483648,"
+    " 1.5, 1e300], \"ok\": true, \"no\": false, \"z\": null,"
+    " \"list\": [{\"a\": 1}, {\"a\": 2}, {\"a\\u0000b\": 3, \"a\": 4}],"
+    " \"empty\": {}, \"none\": [], \"dup\": 1, \"dup\": 2}";
+
+/* Whether box is the number d (of the same sign, should it be 0) */
+static bool test_number(json_box box, double d);
+
+/* What box looks like written into a new string */
+static char *test_compact_dump(json_box box);
+
+
+int main(void)
+{
+    struct json_compact c;
+    struct json_compact from;
+    struct json_value *val;
+    struct json_value *copy;
+    json_box box;
+    json_box list;
+    json_box elem;
+    json_box first;
+    double d;
+    bool b;
+    const char *str;
+    const char *key;
+    char *buf;
+    char *out;
+    size_t n;
+    size_t i;
+
+    CHECK(!json_compact_parse(&c, doc, strlen(doc)));
+    CHECK(json_compact_type(c.root) == JSON_OBJECT);
+
+    /* Every kind of value, looked up and read */
+    CHECK(!json_compact_lookup(c.root, "name", &box)
+          && ((str = json_compact_get_string(box, &n)) != NULL)
+          && (n == 4) && !strcmp(str, "r\xc3\xa9" "c"));
+
+    CHECK(!json_compact_lookup(c.root, "n", &box)
+          && (json_compact_length(box) == 7));
+    CHECK(!json_compact_index(box, 0, &elem) && test_number(elem, 0));
+    CHECK(!json_compact_index(box, 1, &elem) && test_number(elem, -0.0));
+    CHECK(!json_compact_index(box, 2, &elem) && test_number(elem, 7));
+    CHECK(!json_compact_index(box, 3, &elem)
+          && test_number(elem, -2147483648.0));
+    CHECK(!json_compact_index(box, 4, &elem)
+          && test_number(elem, 2147483648.0));
+    CHECK(!json_compact_index(box, 5, &elem) && test_number(elem, 1.5));
+    CHECK(!json_compact_index(box, 6, &elem) && test_number(elem, 1e300));
+    CHECK(json_compact_index(box, 7, &elem));
+
+    CHECK(!json_compact_lookup(c.root, "ok", &box)
+          && !json_compact_get_bool(box, &b) && b);
+    CHECK(!json_compact_lookup(c.root, "z", &box) && json_compact_is_null(box));
+    CHECK(json_compact_get_string(box, NULL) == NULL);
+    CHECK(json_compact_get_number(box, &d));
+
+    CHECK(!json_compact_lookup(c.root, "empty", &box)
+          && (json_compact_type(box) == JSON_OBJECT)
+          && (json_compact_length(box) == 0));
+    CHECK(!json_compact_lookup(c.root, "none", &box)
+          && (json_compact_type(box) == JSON_ARRAY)
+          && (json_compact_length(box) == 0));
+
+    CHECK(json_compact_lookup(c.root, "missing", &box));
+    CHECK(json_compact_lookup(c.root, "nam", &box));
+
+    /* The later of duplicate keys wins, as in regular objects */
+    CHECK(!json_compact_lookup(c.root, "dup", &box) && test_number(box, 2));
+
+    /* Keys are stored once, and U+0000 is part of them */
+    CHECK(!json_compact_lookup(c.root, "list", &list));
+    CHECK(!json_compact_index(list, 0, &elem)
+          && !json_compact_member(elem, 0, &key, NULL, &box));
+
+    str = key;
+
+    for (i = 1; !json_compact_index(list, i, &elem); ++i) {
+        CHECK(!json_compact_lookup(elem, "a", &box)
+              && test_number(box, (i == 1) ? 2 : 4));
+        CHECK(!json_compact_member(elem, (i == 1) ? 0 : 1, &key, &n, &box)
+              && (key == str) && (n == 1));
+    }
+
+    CHECK(i == 3);
+    CHECK(!json_compact_index(list, 2, &elem)
+          && !json_compact_member(elem, 0, &key, &n, &box)
+          && (n == 3) && !memcmp(key, "a\0b", 4) && test_number(box, 3));
+
+    /* Written as json_writer_value() would, U+0000 included */
+    out = test_compact_dump(list);
+    CHECK((out != NULL)
+          && !strcmp(out, "[{\"a\":1},{\"a\":2},{\"a\\u0000b\":3,\"a\":4}]"));
+    free(out);
+
+    json_compact_lookup(c.root, "n", &box);
+
+    out = test_compact_dump(box);
+    CHECK((out != NULL)
+          && !strcmp(out, "[0,-0,7,-2147483648,2147483648,1.5,1e+300]"));
+    free(out);
+
+    /* Into a regular tree, which is the same as the one parsed directly */
+    val = json_parse(doc);
+    copy = json_compact_value(c.root);
+
+    CHECK((val != NULL) && (copy != NULL) && test_equal(copy, val));
+
+    /* And back, with the same text */
+    if (copy != NULL) {
+        char *a;
+        char *b;
+
+        CHECK(!json_compact_from_value(&from, copy));
+
+        a = test_compact_dump(from.root);
+        b = test_dump(copy);
+        CHECK((a != NULL) && (b != NULL) && !strcmp(a, b));
+        free(a);
+        free(b);
+
+        json_compact_free(&from);
+        json_free(copy);
+    }
+
+    if (val != NULL)
+        json_free(val);
+
+    json_compact_free(&c);
+    CHECK((c.root == 0) && (c.keys == NULL));
+
+    /* From views, whose keys aren't terminated in the input */
+    buf = malloc(strlen(doc));
+
+    if (buf != NULL) {
+        memcpy(buf, doc, strlen(doc));
+
+        val = json_parse_ex(buf, strlen(doc), JSON_PARSE_VIEW);
+        CHECK((val != NULL) && (val->flags & JSON_VALUE_VIEW));
+
+        if (val != NULL) {
+            CHECK(!json_compact_from_value(&from, val));
+
+            CHECK(!json_compact_lookup(from.root, "list", &list)
+                  && !json_compact_index(list, 0, &elem)
+                  && !json_compact_member(elem, 0, &str, NULL, &box)
+                  && !json_compact_index(list, 1, &elem)
+                  && !json_compact_member(elem, 0, &key, NULL, &first)
+                  && (key == str) && test_number(first, 2));
+
+            /* Keys of views may contain U+0000, regular keys can't */
+            CHECK(!json_compact_index(list, 2, &elem)
+                  && (json_compact_length(elem) == 2)
+                  && !json_compact_lookup(elem, "a", &box)
+                  && test_number(box, 4));
+
+            for (i = 0; !json_compact_member(elem, i, &key, &n, &box); ++i)
+                CHECK(((n == 1) && !strcmp(key, "a") && test_number(box, 4))
+                      || ((n == 3) && !memcmp(key, "a\0b", 4)
+                          && test_number(box, 3)));
+
+            json_compact_free(&from);
+            json_free(val);
+        }
+
+        free(buf);
+    }
+
+    /* Errors leave the document empty */
+    CHECK(json_compact_parse(&c, "[1, {\"a\": [2, {\"b\": ", 19));
+    CHECK((c.root == 0) && (c.keys == NULL));
+    CHECK(json_compact_parse(&c, "[1, 2} ", 7));
+    CHECK(json_compact_parse(&c, "{\"a\" 1}", 7));
+    CHECK(json_compact_parse(&c, "", 0));
+
+    return TEST_RESULT();
+}
+
+static bool test_number(json_box box, double d)
+{
+    double out;
+
+    return !json_compact_get_number(box, &out) && (out == d)
+        && (!signbit(out) == !signbit(d));
+}
+
+static char *test_compact_dump(json_box box)
+{
+    struct json_writer w;
+    char *out = NULL;
+
+    json_writer_init_buffer(&w);
+
+    if (!json_compact_write(&w, box))
+        out = json_writer_detach(&w, NULL);
+
+    json_writer_free(&w);
+    return out;
+}
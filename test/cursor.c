@@ -0,0 +1,155 @@
+#include <libutil/json.h>
+#include <libutil/json/cursor.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"a\": {\"b\": [1, \"two\", {\"c\": null}], \"d\": \"x\\\"y\\u00e9\"},"
+    " \"n\": -1.5e2, \"t\": true, \"e\": [], \"a\": 2}";
+
+/* What a.b looks like in doc */
+static const char braw[] = "[1, \"two\", {\"c\": null}]";
+
+/* Every value reachable from cur comes out the same as parsing its text */
+static void test_values(const struct json_cursor *cur);
+
+
+int main(void)
+{
+    struct json_cursor root;
+    struct json_cursor a;
+    struct json_cursor b;
+    struct json_cursor cur;
+    struct json_cursor key;
+    struct json_cursor_iterator iter;
+    const char *raw;
+    double d;
+    bool t;
+    char *str;
+    size_t n;
+
+    CHECK(!json_cursor_init(&root, doc, strlen(doc)));
+    CHECK(json_cursor_type(&root) == JSON_OBJECT);
+
+    /* The first of duplicate keys */
+    CHECK(!json_cursor_lookup(&root, "a", &a)
+          && (json_cursor_type(&a) == JSON_OBJECT));
+
+    CHECK(!json_cursor_lookup(&a, "b", &b)
+          && (json_cursor_type(&b) == JSON_ARRAY));
+
+    CHECK(!json_cursor_index(&b, 0, &cur)
+          && !json_cursor_get_number(&cur, &d) && (d == 1));
+
+    CHECK(!json_cursor_index(&b, 2, &cur)
+          && !json_cursor_lookup(&cur, "c", &cur)
+          && json_cursor_is_null(&cur));
+
+    CHECK(json_cursor_index(&b, 3, &cur));
+    CHECK(json_cursor_lookup(&b, "b", &cur));
+    CHECK(json_cursor_lookup(&root, "missing", &cur));
+
+    /* Escapes are compared and decoded */
+    CHECK(!json_cursor_lookup(&a, "d", &cur)
+          && json_cursor_string_equal(&cur, "x\"y\xc3\xa9")
+          && !json_cursor_string_equal(&cur, "x\"y"));
+
+    CHECK(((str = json_cursor_get_string(&cur)) != NULL)
+          && !strcmp(str, "x\"y\xc3\xa9"));
+    free(str);
+
+    CHECK(!json_cursor_lookup(&root, "n", &cur)
+          && !json_cursor_get_number(&cur, &d) && (d == -150));
+    CHECK(json_cursor_get_bool(&cur, &t));
+    CHECK(json_cursor_get_string(&cur) == NULL);
+
+    CHECK(!json_cursor_lookup(&root, "t", &cur)
+          && !json_cursor_get_bool(&cur, &t) && t);
+
+    /* Raw text is exactly the value */
+    CHECK(((n = json_cursor_raw(&b, &raw)) == strlen(braw))
+          && !strncmp(raw, braw, n));
+
+    /* Members in order, duplicates and all */
+    n = 0;
+
+    if (json_cursor_iterator_init(&iter, &root)) {
+        const char *keys[] = { "a", "n", "t", "e", "a" };
+
+        while (json_cursor_iterator_next(&iter, &key, &cur)) {
+            CHECK((n < 5) && json_cursor_string_equal(&key, keys[n]));
+            n++;
+        }
+
+        CHECK(!iter.error);
+    }
+
+    CHECK(n == 5);
+
+    /* Stopping early, then skipping the rest */
+    CHECK(json_cursor_iterator_init(&iter, &b)
+          && json_cursor_iterator_next(&iter, NULL, &cur)
+          && (json_cursor_iterator_end(&iter) == b.pos + strlen(braw)));
+
+    CHECK(!json_cursor_lookup(&root, "e", &cur)
+          && json_cursor_iterator_init(&iter, &cur)
+          && !json_cursor_iterator_next(&iter, NULL, &cur) && !iter.error);
+
+    /* Values already returned stand, the iteration stops at the mistake */
+    CHECK(!json_cursor_init(&root, "[1, 2 3]", 8));
+
+    n = 0;
+
+    if (json_cursor_iterator_init(&iter, &root))
+        while (json_cursor_iterator_next(&iter, NULL, &cur))
+            n++;
+
+    CHECK((n == 2) && iter.error);
+
+    /* Nor does a trailing comma or a missing value make one */
+    CHECK(!json_cursor_init(&root, "[1, ]", 5));
+
+    n = 0;
+
+    if (json_cursor_iterator_init(&iter, &root))
+        while (json_cursor_iterator_next(&iter, NULL, &cur))
+            n++;
+
+    CHECK((n == 1) && iter.error);
+
+    CHECK(!json_cursor_init(&root, "{\"a\": }", 7)
+          && json_cursor_iterator_init(&iter, &root)
+          && !json_cursor_iterator_next(&iter, &key, &cur) && iter.error);
+
+    CHECK(json_cursor_init(&root, "  ", 2));
+
+    CHECK(!json_cursor_init(&root, doc, strlen(doc)));
+    test_values(&root);
+
+    return TEST_RESULT();
+}
+
+static void test_values(const struct json_cursor *cur)
+{
+    struct json_cursor_iterator iter;
+    struct json_cursor val;
+    struct json_value *parsed;
+    struct json_value *expected;
+    const char *raw;
+    size_t n;
+
+    CHECK((n = json_cursor_raw(cur, &raw)) > 0);
+    CHECK((expected = json_parse_n(raw, n)) != NULL);
+    CHECK((parsed = json_cursor_value(cur)) != NULL);
+    CHECK(test_equal(parsed, expected));
+
+    if (parsed != NULL)
+        json_free(parsed);
+
+    if (expected != NULL)
+        json_free(expected);
+
+    if (json_cursor_iterator_init(&iter, cur))
+        while (json_cursor_iterator_next(&iter, NULL, &val))
+            test_values(&val);
+}
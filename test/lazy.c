@@ -0,0 +1,136 @@
+#include <libutil/json.h>
+
+#include <stdint.h>
+
+#include "test.h"
+
+/* Number text and the integer it holds, if it's one that fits */
+struct test_int
+{
+    const char *text;
+    int result;
+    int64_t value;
+};
+
+static const struct test_int ints[] = {
+    { "0", 0, 0 },
+    { "-0", 0, 0 },
+    { "9007199254740993", 0, INT64_C(9007199254740993) },
+    { "-9007199254740993", 0, -INT64_C(9007199254740993) },
+    { "9223372036854775807", 0, INT64_MAX },
+    { "-9223372036854775808", 0, INT64_MIN },
+    { "9223372036854775808", 1, 0 },
+    { "-9223372036854775809", 1, 0 },
+    { "1e2", 0, 100 },
+    { "100E-2", 0, 1 },
+    { "1.0", 0, 1 },
+    { "1.5", 1, 0 },
+    { "1e-5", 1, 0 },
+    { "1e400", 1, 0 },
+};
+
+
+int main(void)
+{
+    static const char doc[] =
+        "{\"a\": [1.50, -0, 1E+2, 0.000001e-3], \"b\": 9007199254740993}";
+    struct json_value *val;
+    struct json_value *b;
+    struct json_value *arr;
+    struct json_value *elem;
+    struct json_array_iterator iter;
+    const char *text;
+    char *out;
+    int64_t i64;
+    double *d;
+    size_t n;
+    size_t i;
+
+    for (i = 0; i < sizeof(ints) / sizeof(*ints); ++i) {
+        val = json_parse_ex(ints[i].text, strlen(ints[i].text),
+                            JSON_PARSE_LAZY);
+
+        CHECK(val != NULL);
+
+        if (val == NULL)
+            continue;
+
+        i64 = 0;
+
+        CHECK(val->flags & JSON_VALUE_RAW);
+        CHECK(json_get_int64(val, &i64) == ints[i].result);
+        CHECK(i64 == ints[i].value);
+        CHECK(val->flags & JSON_VALUE_RAW);
+
+        json_free(val);
+    }
+
+    /* Numbers are written out exactly as they came in */
+    val = json_parse_ex(doc, strlen(doc), JSON_PARSE_LAZY);
+
+    CHECK(val != NULL);
+
+    if (val == NULL)
+        return TEST_RESULT();
+
+    out = test_dump(json_object_lookup_const(val, "a"));
+    CHECK((out != NULL) && !strcmp(out, "[1.50,-0,1E+2,0.000001e-3]"));
+    free(out);
+
+    CHECK((b = json_object_lookup(val, "b")) != NULL);
+
+    CHECK(((text = json_get_number_text(b, &n)) != NULL)
+          && (n == 16) && !memcmp(text, "9007199254740993", n));
+
+    /* Reading them const leaves them be, the regular way converts */
+    CHECK(json_get_number_value(b) == 9007199254740992.0);
+    CHECK(b->flags & JSON_VALUE_RAW);
+
+    CHECK(((d = json_get_number(b)) != NULL) && (*d == 9007199254740992.0));
+    CHECK(!(b->flags & JSON_VALUE_RAW));
+    CHECK(json_get_number_text(b, &n) == NULL);
+
+    /* After which the value is all there is */
+    CHECK(!json_get_int64(b, &i64) && (i64 == INT64_C(9007199254740992)));
+
+    out = test_dump(b);
+    CHECK((out != NULL) && !strcmp(out, "9007199254740992"));
+    free(out);
+
+    /* Including its sign, should it be -0 */
+    arr = json_object_lookup(val, "a");
+
+    json_array_iterator_init(&iter, arr);
+
+    while (json_array_iterator_next(&iter, &elem))
+        json_get_number(elem);
+
+    out = test_dump(arr);
+    CHECK((out != NULL) && !strcmp(out, "[1.5,-0,100,1e-09]"));
+    free(out);
+
+    json_free(val);
+
+    /* Views of the input, then */
+    val = json_parse_ex(doc, strlen(doc), JSON_PARSE_LAZY | JSON_PARSE_VIEW);
+
+    CHECK((val != NULL)
+          && ((text = json_get_number_text(json_object_lookup(val, "b"), &n))
+              != NULL)
+          && (text == strstr(doc, "9007199254740993")) && (n == 16));
+
+    if (val != NULL)
+        json_free(val);
+
+    /* And not without JSON_PARSE_LAZY */
+    val = json_parse(doc);
+
+    CHECK((val != NULL)
+          && !(json_object_lookup(val, "b")->flags & JSON_VALUE_RAW)
+          && (json_get_number_text(json_object_lookup(val, "b"), &n) == NULL));
+
+    if (val != NULL)
+        json_free(val);
+
+    return TEST_RESULT();
+}
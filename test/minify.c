@@ -0,0 +1,125 @@
+#include <libutil/json.h>
+
+#include "test.h"
+
+static const char doc[] =
+    " {\"a\" : [ 1,\t{ \"b\":\"x y\\\" z\" } ],\n\"c\": [ ], \"d\" :{},"
+    " \"e\": \"[ \\\\\", \"f\": -1.5e3 } ";
+
+static const char minified[] =
+    "{\"a\":[1,{\"b\":\"x y\\\" z\"}],\"c\":[],\"d\":{},"
+    "\"e\":\"[ \\\\\",\"f\":-1.5e3}";
+
+static const char reformatted[] =
+    "{\n"
+    "  \"a\": [\n"
+    "    1,\n"
+    "    {\n"
+    "      \"b\": \"x y\\\" z\"\n"
+    "    }\n"
+    "  ],\n"
+    "  \"c\": [],\n"
+    "  \"d\": {},\n"
+    "  \"e\": \"[ \\\\\",\n"
+    "  \"f\": -1.5e3\n"
+    "}";
+
+/* The minified text of input, zero terminated */
+static char *test_minify(const char *input);
+
+/* The reformatted text of input, after checking how long it said it'd be */
+static char *test_reformat(const char *input, unsigned indent);
+
+
+int main(void)
+{
+    char *out;
+    char *again;
+    char small[8];
+    size_t n;
+
+    /* Whitespace goes, except in strings */
+    out = test_minify(doc);
+    CHECK((out != NULL) && !strcmp(out, minified));
+    free(out);
+
+    out = test_minify("  42 ");
+    CHECK((out != NULL) && !strcmp(out, "42"));
+    free(out);
+
+    out = test_minify("\"  \"");
+    CHECK((out != NULL) && !strcmp(out, "\"  \""));
+    free(out);
+
+    /* Only JSON whitespace, however long the run (control bytes stay) */
+    out = test_minify("[1,  \x01\x02 \t\n\r                 \x1f 2]");
+    CHECK((out != NULL) && !strcmp(out, "[1,\x01\x02\x1f" "2]"));
+    free(out);
+
+    /* Right where it is */
+    out = strdup(doc);
+
+    if (out != NULL) {
+        n = json_minify(out, out, strlen(out));
+        CHECK((n == strlen(minified)) && !memcmp(out, minified, n));
+        free(out);
+    }
+
+    /* One member or element per line */
+    out = test_reformat(doc, 2);
+    CHECK((out != NULL) && !strcmp(out, reformatted));
+
+    /* Either way and back again */
+    again = (out != NULL) ? test_minify(out) : NULL;
+    CHECK((again != NULL) && !strcmp(again, minified));
+    free(again);
+
+    again = (out != NULL) ? test_reformat(out, 2) : NULL;
+    CHECK((again != NULL) && !strcmp(again, reformatted));
+    free(again);
+
+    free(out);
+
+    out = test_reformat("[ ]", 4);
+    CHECK((out != NULL) && !strcmp(out, "[]"));
+    free(out);
+
+    out = test_reformat("[[1]]", 0);
+    CHECK((out != NULL) && !strcmp(out, "[\n[\n1\n]\n]"));
+    free(out);
+
+    /* Whatever fits, always terminated */
+    n = json_reformat(small, sizeof(small), doc, strlen(doc), 2);
+    CHECK((n == strlen(reformatted)) && (strlen(small) == sizeof(small) - 1)
+          && !strncmp(small, reformatted, sizeof(small) - 1));
+
+    CHECK(json_reformat(NULL, 0, doc, strlen(doc), 2) == strlen(reformatted));
+
+    return TEST_RESULT();
+}
+
+static char *test_minify(const char *input)
+{
+    size_t n = strlen(input);
+    char *out = malloc(n + 1);
+
+    if (out != NULL)
+        out[json_minify(out, input, n)] = '\0';
+
+    return out;
+}
+
+static char *test_reformat(const char *input, unsigned indent)
+{
+    size_t len = strlen(input);
+    size_t n = json_reformat(NULL, 0, input, len, indent);
+    char *out = malloc(n + 1);
+
+    if ((out != NULL)
+            && (json_reformat(out, n + 1, input, len, indent) != n)) {
+        free(out);
+        return NULL;
+    }
+
+    return out;
+}
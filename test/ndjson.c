@@ -0,0 +1,308 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <libutil/json.h>
+#include <libutil/json/ndjson.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+
+/* Enough for a few batches of JSON_NDJSON_BATCH records */
+#define TEST_LINES 40000
+
+/* A record that should be handed over, parsed serially */
+struct test_record
+{
+    size_t line;
+    struct json_value *val; /* NULL for lines that aren't valid */
+};
+
+/* The records expected, and how far the callback got through them */
+struct test_run
+{
+    const struct test_record *records;
+    size_t n;
+
+    size_t next;
+    size_t stop;  /* line to stop at, 0 for none */
+    bool same;
+};
+
+/* A FIFO and what to write to it */
+struct test_fifo
+{
+    char path[64];
+    const char *input;
+    size_t n;
+};
+
+/*
+ * Lines of all kinds: valid ones, blank ones, broken ones and ones with
+ * something after the value, the last one unterminated. The records that
+ * should come out of it are stored in records, n of them.
+ */
+static char *test_input(size_t *len, struct test_record **records, size_t *n);
+
+/* Whether the callback saw exactly the records of run, up to its stop */
+static bool test_run(struct test_run *run,
+                     int (*parse)(const char *input,
+                                  size_t n,
+                                  unsigned nthreads,
+                                  json_ndjson_func fn,
+                                  void *ud),
+                     const char *input,
+                     size_t n,
+                     unsigned nthreads);
+
+static int test_check(size_t line, struct json_value *val, void *ud);
+
+/* Parses the file at input (of length n) instead of the input itself */
+static int test_parse_file(const char *input,
+                           size_t n,
+                           unsigned nthreads,
+                           json_ndjson_func fn,
+                           void *ud);
+
+/* Parses input written to a FIFO, so it's read in chunks */
+static int test_parse_fifo(const char *input,
+                           size_t n,
+                           unsigned nthreads,
+                           json_ndjson_func fn,
+                           void *ud);
+
+static void *test_fifo_thread(void *fifo);
+
+
+int main(void)
+{
+    static const unsigned threads[] = { 1, 4, 0 };
+    struct test_record *records;
+    struct test_run run;
+    struct json_value **vals;
+    char *input;
+    size_t len;
+    size_t n;
+    size_t i;
+
+    input = test_input(&len, &records, &n);
+
+    if (input == NULL)
+        return 1;
+
+    memset(&run, 0, sizeof(run));
+    run.records = records;
+    run.n = n;
+
+    /* The same as parsing one line after the other, however many threads */
+    for (i = 0; i < sizeof(threads) / sizeof(*threads); ++i)
+        CHECK(test_run(&run, json_ndjson_parse, input, len, threads[i]));
+
+    CHECK(test_run(&run, test_parse_file, input, len, 4));
+    CHECK(test_run(&run, test_parse_fifo, input, len, 4));
+
+    vals = json_ndjson_parse_all(input, len, 4, &i);
+    CHECK(i == n);
+
+    for (i = 0; (vals != NULL) && (i < n); ++i) {
+        CHECK(test_equal(vals[i], records[i].val));
+
+        if (vals[i] != NULL)
+            json_free(vals[i]);
+    }
+
+    free(vals);
+
+    /* Nothing more once the callback says so, in the middle of a batch */
+    run.stop = records[n / 2].line;
+    CHECK(test_run(&run, json_ndjson_parse, input, len, 4));
+
+    run.stop = 0;
+
+    /* No records in no input, or in nothing but blank lines */
+    run.n = 0;
+
+    CHECK(test_run(&run, json_ndjson_parse, "", 0, 4));
+    CHECK(test_run(&run, json_ndjson_parse, "\n \n\t\r\n", 6, 4));
+    CHECK(test_run(&run, test_parse_fifo, "", 0, 4));
+
+    vals = json_ndjson_parse_all("", 0, 4, &i);
+    CHECK(i == 0);
+    free(vals);
+
+    for (i = 0; i < n; ++i)
+        if (records[i].val != NULL)
+            json_free(records[i].val);
+
+    free(records);
+    free(input);
+
+    return TEST_RESULT();
+}
+
+static char *test_input(size_t *len, struct test_record **records, size_t *n)
+{
+    char *input = malloc(TEST_LINES * 80);
+    size_t i;
+
+    *records = malloc(sizeof(**records) * TEST_LINES);
+    *len = 0;
+    *n = 0;
+
+    if ((input == NULL) || (*records == NULL)) {
+        free(input);
+        free(*records);
+
+        return NULL;
+    }
+
+    for (i = 0; i < TEST_LINES; ++i) {
+        char *line = input + *len;
+        bool valid = true;
+        int k;
+
+        if (i % 1000 == 999) {
+            k = sprintf(line, " \t");
+        } else if (i % 777 == 776) {
+            k = sprintf(line, "{\"a\": }");
+            valid = false;
+        } else if (i % 555 == 554) {
+            k = sprintf(line, "[%zu] x", i);
+            valid = false;
+        } else if (i % 3 == 0) {
+            k = sprintf(line, "{\"i\": %zu, \"s\": \"a\\nb \\u00e9\","
+                        " \"dup\": 0, \"dup\": %zu}", i, i);
+        } else if (i % 3 == 1) {
+            k = sprintf(line, "  [%zu, -1.5e3, true, null, {\"x\": []}]", i);
+        } else {
+            k = sprintf(line, "\"%zu\"\r", i);
+        }
+
+        /* Line numbers are 1 based, blank lines are counted but skipped */
+        if (i % 1000 != 999) {
+            (*records)[*n].line = i + 1;
+            (*records)[*n].val = valid ? json_parse_n(line, k) : NULL;
+            (*n)++;
+        }
+
+        *len += k;
+
+        if (i + 1 < TEST_LINES)
+            input[(*len)++] = '\n';
+    }
+
+    return input;
+}
+
+static bool test_run(struct test_run *run,
+                     int (*parse)(const char *input,
+                                  size_t n,
+                                  unsigned nthreads,
+                                  json_ndjson_func fn,
+                                  void *ud),
+                     const char *input,
+                     size_t n,
+                     unsigned nthreads)
+{
+    int res;
+
+    run->next = 0;
+    run->same = true;
+
+    res = parse(input, n, nthreads, test_check, run);
+
+    if (run->stop != 0)
+        return (res == 1) && run->same && (run->next > 0)
+            && (run->records[run->next - 1].line == run->stop);
+
+    return (res == 0) && run->same && (run->next == run->n);
+}
+
+static int test_check(size_t line, struct json_value *val, void *ud)
+{
+    struct test_run *run = ud;
+
+    if ((run->next >= run->n)
+            || (run->records[run->next].line != line)
+            || !test_equal(val, run->records[run->next].val))
+        run->same = false;
+
+    if (val != NULL)
+        json_free(val);
+
+    run->next++;
+    return line == run->stop;
+}
+
+static int test_parse_file(const char *input,
+                           size_t n,
+                           unsigned nthreads,
+                           json_ndjson_func fn,
+                           void *ud)
+{
+    char path[] = "/tmp/json-ndjson-XXXXXX";
+    int fd = mkstemp(path);
+    int res = 1;
+
+    if (fd < 0)
+        return 1;
+
+    if (write(fd, input, n) == (ssize_t)n)
+        res = json_ndjson_parse_file(path, nthreads, fn, ud);
+
+    close(fd);
+    unlink(path);
+
+    return res;
+}
+
+static int test_parse_fifo(const char *input,
+                           size_t n,
+                           unsigned nthreads,
+                           json_ndjson_func fn,
+                           void *ud)
+{
+    char dir[] = "/tmp/json-ndjson-XXXXXX";
+    struct test_fifo fifo;
+    pthread_t thread;
+    int res = 1;
+
+    if (mkdtemp(dir) == NULL)
+        return 1;
+
+    fifo.input = input;
+    fifo.n = n;
+    snprintf(fifo.path, sizeof(fifo.path), "%s/fifo", dir);
+
+    /* Opening either end waits for the other one */
+    if (!mkfifo(fifo.path, 0600)
+            && !pthread_create(&thread, NULL, test_fifo_thread, &fifo)) {
+        res = json_ndjson_parse_file(fifo.path, nthreads, fn, ud);
+        pthread_join(thread, NULL);
+    }
+
+    unlink(fifo.path);
+    rmdir(dir);
+
+    return res;
+}
+
+static void *test_fifo_thread(void *fifo)
+{
+    const struct test_fifo *f = fifo;
+    int fd = open(f->path, O_WRONLY);
+    size_t done = 0;
+    ssize_t n;
+
+    if (fd < 0)
+        return NULL;
+
+    /* As much as the pipe takes at a time */
+    while ((done < f->n) && ((n = write(fd, f->input + done, f->n - done)) > 0))
+        done += n;
+
+    close(fd);
+    return NULL;
+}
@@ -0,0 +1,160 @@
+#include <libutil/json.h>
+#include <libutil/json/cbor.h>
+#include <libutil/json/msgpack.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"a\": [1, -2.5, 3e2], \"b\": [1, \"x\"], \"c\": [],"
+    " \"d\": [[1], [2, 3]], \"e\": [0.1]}";
+
+/* Whether arr is a packed array of n numbers */
+static bool test_packed(struct json_value *arr, size_t n);
+
+/* Whether a and b encode to the same bytes */
+static bool test_same_encoding(const struct json_value *a,
+                               const struct json_value *b,
+                               char *(*encode)(const struct json_value *val,
+                                               size_t *n));
+
+
+int main(void)
+{
+    struct json_value *plain = json_parse(doc);
+    struct json_value *val;
+    struct json_value *copy;
+    struct json_value *arr;
+    struct json_value *elem;
+    struct json_array_iterator iter;
+    double *d;
+    char *a;
+    char *b;
+    size_t n;
+    size_t i;
+
+    val = json_parse_ex(doc, strlen(doc), JSON_PARSE_PACKED | JSON_PARSE_LAZY);
+
+    CHECK((plain != NULL) && (val != NULL));
+
+    if ((plain == NULL) || (val == NULL))
+        goto exit;
+
+    /* Arrays of nothing but (at least one) number */
+    CHECK(test_packed(json_object_lookup(val, "a"), 3));
+    CHECK(!test_packed(json_object_lookup(val, "b"), 2));
+    CHECK(!test_packed(json_object_lookup(val, "c"), 0));
+    CHECK(!test_packed(json_object_lookup(val, "d"), 2));
+
+    /* They are numbers as any others, and converted */
+    CHECK(test_equal(val, plain));
+
+    a = test_dump(val);
+    b = test_dump(plain);
+    CHECK((a != NULL) && (b != NULL) && !strcmp(a, b));
+    free(a);
+    free(b);
+
+    CHECK(test_same_encoding(val, plain, json_cbor_encode));
+    CHECK(test_same_encoding(val, plain, json_msgpack_encode));
+
+    arr = json_object_lookup(val, "a");
+    json_array_iterator_init(&iter, arr);
+
+    for (i = 0; json_array_iterator_next(&iter, &elem); ++i)
+        CHECK((elem->type == JSON_NUMBER) && !(elem->flags & JSON_VALUE_RAW));
+
+    CHECK(i == 3);
+
+    /* Modified in place, appended to while they're numbers */
+    CHECK(((d = json_get_packed(arr, &n)) != NULL) && (n == 3));
+
+    if (d != NULL)
+        d[1] = 4;
+
+    CHECK(!json_array_append(arr, json_number_new(5)));
+    CHECK(test_packed(arr, 4));
+
+    a = test_dump(arr);
+    CHECK((a != NULL) && !strcmp(a, "[1,4,300,5]"));
+    free(a);
+
+    /* Clones get their own block */
+    CHECK((copy = json_clone(arr)) != NULL);
+
+    if (copy != NULL) {
+        CHECK(((d = json_get_packed(copy, &n)) != NULL) && (n == 4));
+
+        if (d != NULL)
+            d[0] = 7;
+
+        CHECK(((d = json_get_packed(arr, &n)) != NULL) && (d[0] == 1));
+
+        json_free(copy);
+    }
+
+    /* Anything else makes them regular arrays, elements and all */
+    CHECK(!json_array_append(arr, json_string_new("y")));
+    CHECK(!test_packed(arr, 5) && (json_array_size(arr) == 5));
+
+    a = test_dump(arr);
+    CHECK((a != NULL) && !strcmp(a, "[1,4,300,5,\"y\"]"));
+    free(a);
+
+    CHECK(json_get_packed(arr, &n) == NULL);
+
+    arr = json_object_lookup(val, "e");
+
+    CHECK(test_packed(arr, 1));
+    CHECK(!json_array_unpack(arr) && !test_packed(arr, 1));
+    CHECK(!json_array_unpack(arr));
+    CHECK(json_array_size(arr) == 1);
+
+    /* json_get_array() unpacks */
+    json_array_iterator_init(&iter, json_object_lookup(val, "d"));
+
+    while (json_array_iterator_next(&iter, &elem)) {
+        CHECK(elem->flags & JSON_VALUE_PACKED);
+        CHECK(json_get_array(elem) != NULL);
+        CHECK(!(elem->flags & JSON_VALUE_PACKED));
+    }
+
+    /* Regular arrays are left as they are */
+    CHECK(!json_array_unpack(json_object_lookup(val, "b")));
+    CHECK(json_array_size(json_object_lookup(val, "b")) == 2);
+
+exit:
+    if (val != NULL)
+        json_free(val);
+
+    if (plain != NULL)
+        json_free(plain);
+
+    return TEST_RESULT();
+}
+
+static bool test_packed(struct json_value *arr, size_t n)
+{
+    size_t len;
+
+    return (arr != NULL) && (arr->flags & JSON_VALUE_PACKED)
+        && (json_get_packed(arr, &len) != NULL) && (len == n)
+        && (json_array_size(arr) == n);
+}
+
+static bool test_same_encoding(const struct json_value *a,
+                               const struct json_value *b,
+                               char *(*encode)(const struct json_value *val,
+                                               size_t *n))
+{
+    size_t na;
+    size_t nb;
+    char *ea = encode(a, &na);
+    char *eb = encode(b, &nb);
+    bool same = (ea != NULL) && (eb != NULL) && (na == nb)
+                && !memcmp(ea, eb, na);
+
+    free(ea);
+    free(eb);
+
+    return same;
+}
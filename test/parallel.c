@@ -0,0 +1,388 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <libutil/json.h>
+#include <libutil/json/parallel.h>
+#include <libutil/json/writer.h>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/* Enough rows for a good number of JSON_PARALLEL_BLOCKSIZ blocks */
+#define TEST_ROWS 10000
+
+/* No row is broken */
+#define TEST_VALID TEST_ROWS
+
+/* For test_write_buffer(), json_writer_value() instead */
+#define TEST_SERIAL SIZE_MAX
+
+/* How a writer is set up */
+struct test_format
+{
+    unsigned flags;
+    const char *number_format;
+};
+
+static const struct test_format formats[] = {
+    { 0, NULL },
+    { JSON_WRITER_SPACED | JSON_WRITER_ASCII, NULL },
+    { JSON_WRITER_SPACED, "%.2f" },
+};
+
+static const char *const docs[] = {
+    "[]",
+    "{}",
+    " [ ] ",
+    "[[], {}, [[]]]",
+    "42",
+    " \"just a string\" ",
+    "[1, 2, 3,]",
+    "[1] x", /* whatever follows is left alone, as by json_parse_n() */
+    "{\"a\": 1, \"b\": [true, null], \"a\": {\"c\": [2]}, \"a\": [3, 4]}",
+    "{\"a\": [1, [2, [3]]], \"a\": {\"b\": {\"c\": 1}}, \"d\": {}}",
+};
+
+static const char *const broken[] = {
+    "",
+    " \n\t",
+    "[",
+    "[1, 2",
+    "[1,, 2]",
+    "{\"a\": 1,",
+    "{\"a\" 1}",
+    "{1: 2}",
+    "[{\"a\": }]",
+    "{\"a\": [1, [2, }]}",
+};
+
+/*
+ * TEST_ROWS values of all kinds between prefix and suffix, separated by
+ * commas and each after a key if keyed. Every thousandth key is used over
+ * and over, and row number broken (if any) isn't valid JSON.
+ */
+static char *test_doc(const char *prefix,
+                      const char *suffix,
+                      bool keyed,
+                      size_t broken,
+                      size_t *len);
+
+/*
+ * Whether json_parallel_parse() returns the same as json_parse_n() for
+ * input, whatever the depth and number of threads, and whether that's a
+ * value as expected
+ */
+static bool test_parse(const char *input, size_t n, bool valid);
+
+/*
+ * Whether json_parallel_write() and json_parallel_write_fd() write what
+ * input parses to just like json_writer_value() does, with numbers parsed
+ * both right away and lazily
+ */
+static bool test_write(const char *input, size_t n);
+
+/* Same for val written with format, whatever the depth and threads */
+static bool test_write_value(const struct json_value *val,
+                             const struct test_format *format);
+
+/*
+ * val written twice into an array with format, to see the separators come
+ * out right, by json_parallel_write() unless depth is TEST_SERIAL
+ */
+static char *test_write_buffer(const struct json_value *val,
+                               const struct test_format *format,
+                               size_t depth,
+                               unsigned nthreads,
+                               size_t *n);
+
+/* What json_parallel_write_fd() writes to a file */
+static char *test_write_fd(const struct json_value *val,
+                           unsigned flags,
+                           size_t depth,
+                           unsigned nthreads,
+                           size_t *n);
+
+
+int main(void)
+{
+    char *input;
+    size_t len;
+    size_t i;
+
+    for (i = 0; i < sizeof(docs) / sizeof(*docs); ++i) {
+        CHECK(test_parse(docs[i], strlen(docs[i]), true));
+        CHECK(test_write(docs[i], strlen(docs[i])));
+    }
+
+    for (i = 0; i < sizeof(broken) / sizeof(*broken); ++i)
+        CHECK(test_parse(broken[i], strlen(broken[i]), false));
+
+    /* Split up into many blocks, at the top or one level down */
+    if ((input = test_doc("[", "]", false, TEST_VALID, &len)) != NULL) {
+        CHECK(len > 4 * JSON_PARALLEL_BLOCKSIZ);
+        CHECK(test_parse(input, len, true));
+        CHECK(test_write(input, len));
+        free(input);
+    }
+
+    if ((input = test_doc("{", "}\n", true, TEST_VALID, &len)) != NULL) {
+        CHECK(test_parse(input, len, true));
+        CHECK(test_write(input, len));
+        free(input);
+    }
+
+    /* The first of the two gets replaced after it's been split up */
+    input = test_doc("{\"rows\": {\"a\": 1}, \"rows\": [", "], \"n\": 1}",
+                     false, TEST_VALID, &len);
+
+    if (input != NULL) {
+        CHECK(test_parse(input, len, true));
+        CHECK(test_write(input, len));
+        free(input);
+    }
+
+    input = test_doc("{\"rows\": {", "}, \"rows\": [1, 2]}",
+                     true, TEST_VALID, &len);
+
+    if (input != NULL) {
+        CHECK(test_parse(input, len, true));
+        CHECK(test_write(input, len));
+        free(input);
+    }
+
+    /* One bad row anywhere and nothing comes out of it */
+    if ((input = test_doc("[", "]", false, TEST_ROWS / 2, &len)) != NULL) {
+        CHECK(test_parse(input, len, false));
+        free(input);
+    }
+
+    input = test_doc("{\"rows\": [", "]}", false, TEST_ROWS - 1, &len);
+
+    if (input != NULL) {
+        CHECK(test_parse(input, len, false));
+        free(input);
+    }
+
+    return TEST_RESULT();
+}
+
+static char *test_doc(const char *prefix,
+                      const char *suffix,
+                      bool keyed,
+                      size_t broken,
+                      size_t *len)
+{
+    char *input = malloc(strlen(prefix) + strlen(suffix) + TEST_ROWS * 100);
+    size_t i;
+
+    if (input == NULL)
+        return NULL;
+
+    *len = sprintf(input, "%s", prefix);
+
+    for (i = 0; i < TEST_ROWS; ++i) {
+        char *row;
+
+        if (i > 0)
+            *len += sprintf(input + *len, ", ");
+
+        if (keyed)
+            *len += sprintf(input + *len, "\"k%zu\": ", i % 1000);
+
+        row = input + *len;
+
+        if (i == broken) {
+            *len += sprintf(row, "{\"a\": }");
+        } else if (i % 4 == 0) {
+            *len += sprintf(row, "{\"id\": %zu, \"s\": \"row \\u00e9\","
+                            " \"dup\": [%zu], \"dup\": {\"i\": %zu}}",
+                            i, i, i);
+        } else if (i % 4 == 1) {
+            *len += sprintf(row, "[%zu, -1.5e3, true, null, {\"x\": []}]", i);
+        } else if (i % 4 == 2) {
+            *len += sprintf(row, "\"%zu\"", i);
+        } else {
+            *len += sprintf(row, "[[], {}]");
+        }
+    }
+
+    *len += sprintf(input + *len, "%s", suffix);
+
+    return input;
+}
+
+static bool test_parse(const char *input, size_t n, bool valid)
+{
+    static const unsigned threads[] = { 1, 4, 0 };
+    struct json_value *expected = json_parse_n(input, n);
+    bool same = (expected != NULL) == valid;
+    size_t depth;
+    size_t i;
+
+    for (depth = 0; depth <= 3; ++depth) {
+        for (i = 0; i < sizeof(threads) / sizeof(*threads); ++i) {
+            struct json_value *val;
+
+            val = json_parallel_parse(input, n, depth, threads[i]);
+
+            if (!test_equal(val, expected)) {
+                fprintf(stderr, "depth %zu, %u threads: %.40s\n",
+                        depth, threads[i], input);
+                same = false;
+            }
+
+            if (val != NULL)
+                json_free(val);
+        }
+    }
+
+    if (expected != NULL)
+        json_free(expected);
+
+    return same;
+}
+
+static bool test_write(const char *input, size_t n)
+{
+    struct json_value *vals[2];
+    bool same = true;
+    size_t i;
+    size_t j;
+
+    vals[0] = json_parse_n(input, n);
+    vals[1] = json_parse_ex(input, n, JSON_PARSE_LAZY);
+
+    for (i = 0; i < 2; ++i) {
+        if (vals[i] == NULL) {
+            same = false;
+            continue;
+        }
+
+        for (j = 0; j < sizeof(formats) / sizeof(*formats); ++j) {
+            if (!test_write_value(vals[i], &formats[j])) {
+                fprintf(stderr, "format %zu%s: %.40s\n",
+                        j, i ? " (lazy)" : "", input);
+                same = false;
+            }
+        }
+
+        json_free(vals[i]);
+    }
+
+    return same;
+}
+
+static bool test_write_value(const struct json_value *val,
+                             const struct test_format *format)
+{
+    static const unsigned threads[] = { 1, 4, 0 };
+    struct json_writer w;
+    char *expected;
+    char *single;
+    char *out;
+    size_t nexpected;
+    size_t nsingle;
+    size_t n;
+    size_t depth;
+    size_t i;
+    bool same;
+
+    expected = test_write_buffer(val, format, TEST_SERIAL, 0, &nexpected);
+
+    json_writer_init_buffer(&w);
+    w.flags = format->flags;
+    json_writer_value(&w, val);
+
+    single = json_writer_detach(&w, &nsingle);
+    json_writer_free(&w);
+
+    same = (expected != NULL) && (single != NULL);
+
+    for (depth = 0; same && (depth <= 3); ++depth) {
+        for (i = 0; same && (i < sizeof(threads) / sizeof(*threads)); ++i) {
+            out = test_write_buffer(val, format, depth, threads[i], &n);
+            same = (out != NULL) && (n == nexpected)
+                && !memcmp(out, expected, n);
+            free(out);
+
+            /* That one always writes numbers in their shortest form */
+            if (!same || (format->number_format != NULL))
+                continue;
+
+            out = test_write_fd(val, format->flags, depth, threads[i], &n);
+            same = (out != NULL) && (n == nsingle) && !memcmp(out, single, n);
+            free(out);
+        }
+    }
+
+    free(expected);
+    free(single);
+
+    return same;
+}
+
+static char *test_write_buffer(const struct json_value *val,
+                               const struct test_format *format,
+                               size_t depth,
+                               unsigned nthreads,
+                               size_t *n)
+{
+    struct json_writer w;
+    char *out;
+    int i;
+
+    json_writer_init_buffer(&w);
+    w.flags = format->flags;
+    w.number_format = format->number_format;
+
+    json_writer_begin_array(&w);
+
+    for (i = 0; i < 2; ++i) {
+        if (depth == TEST_SERIAL)
+            json_writer_value(&w, val);
+        else if (json_parallel_write(&w, val, depth, nthreads))
+            w.error = true;
+    }
+
+    json_writer_end_array(&w);
+
+    out = w.error ? NULL : json_writer_detach(&w, n);
+    json_writer_free(&w);
+
+    return out;
+}
+
+static char *test_write_fd(const struct json_value *val,
+                           unsigned flags,
+                           size_t depth,
+                           unsigned nthreads,
+                           size_t *n)
+{
+    char path[] = "/tmp/json-parallel-XXXXXX";
+    int fd = mkstemp(path);
+    char *out = NULL;
+    off_t size;
+
+    if (fd < 0)
+        return NULL;
+
+    unlink(path);
+
+    if (!json_parallel_write_fd(fd, val, depth, nthreads, flags)
+            && ((size = lseek(fd, 0, SEEK_END)) >= 0)
+            && (lseek(fd, 0, SEEK_SET) == 0)
+            && ((out = malloc(size + 1)) != NULL)) {
+        /* A regular file gives it all in one go */
+        if (read(fd, out, size) == size) {
+            out[size] = '\0';
+            *n = size;
+        } else {
+            free(out);
+            out = NULL;
+        }
+    }
+
+    close(fd);
+    return out;
+}
@@ -0,0 +1,172 @@
+#include <libutil/json.h>
+#include <libutil/json/cursor.h>
+#include <libutil/json/pointer.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"a\": {\"b\": [10, 20, {\"c\": \"x\"}]}, \"m~n\": 1, \"p/q\": 2,"
+    " \"\": 3, \"01\": 4, \"n\": [1.5, 2.5, 3.5]}";
+
+/* Whether ptr comes to the same value (or none) every way there is */
+static void test_pointer(const char *ptr, const char *expected);
+
+
+int main(void)
+{
+    struct json_pointer *ptrs[4];
+    struct json_pointer *ptr;
+    struct json_cursor root;
+    struct json_cursor out[4];
+    struct json_value *val;
+    struct json_value *copy;
+    struct json_value tmp;
+    const struct json_value *cval;
+    size_t i;
+
+    /* "" is the whole document, anything else has to start with a slash */
+    CHECK(((ptr = json_pointer_compile("")) != NULL) && (ptr->ntokens == 0));
+    json_pointer_free(ptr);
+
+    CHECK(json_pointer_compile("a") == NULL);
+    CHECK(json_pointer_compile("/~") == NULL);
+    CHECK(json_pointer_compile("/~2") == NULL);
+
+    /* ~1 is a slash and ~0 a tilde, in that order */
+    CHECK(((ptr = json_pointer_compile("/~01/~10")) != NULL)
+          && (ptr->ntokens == 2)
+          && !strcmp(ptr->tokens[0].key, "~1")
+          && !strcmp(ptr->tokens[1].key, "/0"));
+    json_pointer_free(ptr);
+
+    test_pointer("", doc);
+    test_pointer("/a/b/1", "20");
+    test_pointer("/a/b/2/c", "\"x\"");
+    test_pointer("/m~0n", "1");
+    test_pointer("/p~1q", "2");
+    test_pointer("/", "3");
+    test_pointer("/01", "4");
+    test_pointer("/n/2", "3.5");
+
+    /* Indexes are numbers as JSON has them, in range */
+    test_pointer("/a/b/01", NULL);
+    test_pointer("/a/b/3", NULL);
+    test_pointer("/a/b/-", NULL);
+    test_pointer("/a/b/c", NULL);
+    test_pointer("/a/x", NULL);
+    test_pointer("/a/b/0/0", NULL);
+
+    /* Resolving several at once */
+    ptrs[0] = json_pointer_compile("/n/0");
+    ptrs[1] = json_pointer_compile("/missing");
+    ptrs[2] = json_pointer_compile("/a/b/2/c");
+    ptrs[3] = json_pointer_compile("/a/b/0");
+
+    CHECK(!json_cursor_init(&root, doc, strlen(doc)));
+    CHECK(json_pointer_find_all(ptrs, 4, &root, out) == 3);
+
+    CHECK(out[1].input == NULL);
+    CHECK(json_cursor_string_equal(&out[2], "x"));
+
+    for (i = 0; i < 4; ++i) {
+        struct json_cursor one;
+
+        if (i != 1)
+            CHECK(!json_pointer_find(ptrs[i], &root, &one)
+                  && (one.input == out[i].input) && (one.pos == out[i].pos));
+
+        json_pointer_free(ptrs[i]);
+    }
+
+    /* Packed arrays are read as they are and unpacked to be modified */
+    val = json_parse_ex(doc, strlen(doc), JSON_PARSE_PACKED);
+    ptr = json_pointer_compile("/n/1");
+
+    CHECK((val != NULL) && (ptr != NULL));
+
+    if ((val != NULL) && (ptr != NULL)) {
+        const struct json_value *arr = json_object_lookup_const(val, "n");
+
+        CHECK(arr->flags & JSON_VALUE_PACKED);
+
+        CHECK(((cval = json_pointer_get_const(ptr, val, &tmp)) == &tmp)
+              && (json_get_number_value(cval) == 2.5));
+        CHECK(arr->flags & JSON_VALUE_PACKED);
+
+        /* Changes through a clone stay with the clone */
+        copy = json_clone(val);
+
+        CHECK(copy != NULL);
+
+        if (copy != NULL) {
+            double *d;
+
+            CHECK(((d = json_get_number(json_pointer_get(ptr, copy))) != NULL)
+                  && (*d == 2.5));
+
+            if (d != NULL)
+                *d = 7;
+
+            CHECK(!(json_object_lookup_const(copy, "n")->flags
+                    & JSON_VALUE_PACKED));
+
+            CHECK(((cval = json_pointer_get_const(ptr, copy, &tmp)) != NULL)
+                  && (json_get_number_value(cval) == 7));
+            CHECK(((cval = json_pointer_get_const(ptr, val, &tmp)) != NULL)
+                  && (json_get_number_value(cval) == 2.5));
+
+            json_free(copy);
+        }
+
+        /* Only numbers in packed arrays come back in tmp */
+        CHECK(json_pointer_get_const(ptr, val, &tmp) == &tmp);
+    }
+
+    if (val != NULL)
+        json_free(val);
+
+    json_pointer_free(ptr);
+    return TEST_RESULT();
+}
+
+static void test_pointer(const char *ptr, const char *expected)
+{
+    struct json_pointer *p = json_pointer_compile(ptr);
+    struct json_value *val = json_parse(doc);
+    struct json_value *want = NULL;
+    struct json_value *found = NULL;
+    struct json_cursor root;
+    struct json_cursor cur;
+    struct json_value tmp;
+
+    CHECK((p != NULL) && (val != NULL));
+
+    if ((p == NULL) || (val == NULL))
+        goto exit;
+
+    if (expected != NULL)
+        CHECK((want = json_parse(expected)) != NULL);
+
+    CHECK(test_equal(json_pointer_get_const(p, val, &tmp), want));
+    CHECK(test_equal(json_pointer_get(p, val), want));
+
+    CHECK(!json_cursor_init(&root, doc, strlen(doc)));
+
+    if (!json_pointer_find(p, &root, &cur))
+        found = json_cursor_value(&cur);
+
+    CHECK(test_equal(found, want));
+
+exit:
+    if (found != NULL)
+        json_free(found);
+
+    if (want != NULL)
+        json_free(want);
+
+    if (val != NULL)
+        json_free(val);
+
+    if (p != NULL)
+        json_pointer_free(p);
+}
@@ -0,0 +1,275 @@
+#include <libutil/json.h>
+#include <libutil/json/schema.h>
+
+#include <limits.h>
+
+#include "test.h"
+
+struct test_point
+{
+    double x;
+    float y;
+};
+
+struct test_record
+{
+    char *name;
+    int i;
+    long l;
+    bool ok;
+    struct test_point at;
+    struct json_schema_array tags;
+    struct json_schema_array points;
+    struct json_schema_array longs;
+};
+
+/* Refers to itself through kids */
+struct test_node
+{
+    long v;
+    struct json_schema_array kids;
+};
+
+static struct json_field point_fields[] = {
+    JSON_FIELD(struct test_point, x, JSON_FIELD_DOUBLE),
+    JSON_FIELD(struct test_point, y, JSON_FIELD_FLOAT),
+    JSON_FIELD_END
+};
+
+static struct json_schema point_schema =
+    JSON_SCHEMA(struct test_point, point_fields);
+
+static struct json_field record_fields[] = {
+    JSON_FIELD(struct test_record, name, JSON_FIELD_STRING),
+    JSON_FIELD(struct test_record, i, JSON_FIELD_INT),
+    JSON_FIELD(struct test_record, l, JSON_FIELD_LONG),
+    JSON_FIELD(struct test_record, ok, JSON_FIELD_BOOL),
+    JSON_FIELD_OBJECT(struct test_record, at, &point_schema),
+    JSON_FIELD_ARRAY(struct test_record, tags, JSON_FIELD_STRING, NULL),
+    JSON_FIELD_ARRAY(struct test_record, points, JSON_FIELD_OBJECT,
+                     &point_schema),
+    JSON_FIELD_ARRAY(struct test_record, longs, JSON_FIELD_LONG, NULL),
+    JSON_FIELD_END
+};
+
+static struct json_schema record_schema =
+    JSON_SCHEMA(struct test_record, record_fields);
+
+static struct json_schema node_schema;
+
+static struct json_field node_fields[] = {
+    JSON_FIELD(struct test_node, v, JSON_FIELD_LONG),
+    JSON_FIELD_ARRAY(struct test_node, kids, JSON_FIELD_OBJECT, &node_schema),
+    JSON_FIELD_END
+};
+
+static struct json_schema node_schema =
+    JSON_SCHEMA(struct test_node, node_fields);
+
+static const char doc[] =
+    "{\"name\": \"r\\u00e9c\", \"i\": -7, \"l\": 9007199254740993,"
+    " \"ok\": true, \"unknown\": [1, {\"x\": 2}], \"at\": {\"x\": 1.5,"
+    " \"y\": -2}, \"tags\": [\"a\", null, \"b\"], \"points\": [{\"x\": 1},"
+    " {\"y\": 2},], \"longs\": [-9223372036854775808, 1e2, 100.0],"
+    " \"\\u0069\": 8}";
+
+/* Each fails after something that has to be freed has been decoded */
+static const char *const bad[] = {
+    "{\"name\": \"x\", \"tags\": [\"a\", \"b\"], \"i\": 1.5}",
+    "{\"name\": \"x\", \"points\": [{\"x\": 1}, {\"x\": \"1\"}]}",
+    "{\"name\": \"x\", \"tags\": [\"a\"], \"l\": 1} 2",
+    "{\"name\": \"x\", \"tags\": [\"a\"]",
+    "{\"tags\": [\"a\"], \"i\": 2147483648}",
+    "{\"name\": \"x\", \"at\": []}"
+};
+
+static const char nested[] =
+    "{\"v\": 1, \"kids\": [{\"v\": 2, \"kids\": [{\"v\": 3}]}, {\"v\": 4}]}";
+
+/* Whether the long field of a node decodes from text, and to what */
+static bool test_long(const char *text, long expected);
+
+/* Whether input decodes into a node at all */
+static bool test_node(const char *input, size_t max_depth);
+
+
+int main(void)
+{
+    struct test_record rec;
+    struct test_record again;
+    struct test_node node;
+    struct test_node *kid;
+    struct json_value *val;
+    const char *input;
+    char *out;
+    char *deep;
+    size_t n;
+    size_t i;
+
+    CHECK(!json_schema_init(&record_schema));
+    CHECK(!json_schema_init(&node_schema));
+
+    /* Everything there is, straight into the struct */
+    memset(&rec, 0, sizeof(rec));
+
+    CHECK(!json_schema_decode(&record_schema, doc, strlen(doc), &rec));
+    CHECK((rec.name != NULL) && !strcmp(rec.name, "r\xc3\xa9" "c"));
+    CHECK((rec.i == 8) && (rec.l == 9007199254740993L) && rec.ok);
+    CHECK((rec.at.x == 1.5) && (rec.at.y == -2));
+
+    CHECK(rec.tags.count == 3);
+
+    if (rec.tags.count == 3) {
+        char **tags = rec.tags.items;
+
+        CHECK(!strcmp(tags[0], "a") && (tags[1] == NULL)
+              && !strcmp(tags[2], "b"));
+    }
+
+    CHECK(rec.points.count == 2);
+
+    if (rec.points.count == 2) {
+        struct test_point *points = rec.points.items;
+
+        CHECK((points[0].x == 1) && (points[0].y == 0));
+        CHECK((points[1].x == 0) && (points[1].y == 2));
+    }
+
+    CHECK(rec.longs.count == 3);
+
+    if (rec.longs.count == 3) {
+        long *longs = rec.longs.items;
+
+        CHECK((longs[0] == LONG_MIN) && (longs[1] == 100) && (longs[2] == 100));
+    }
+
+    /* And back, integers exactly, to the same struct */
+    CHECK((out = json_schema_encode(&record_schema, &rec, &n)) != NULL);
+
+    if (out != NULL) {
+        CHECK(strlen(out) == n);
+        CHECK(strstr(out, "\"l\":9007199254740993,") != NULL);
+        CHECK(strstr(out, "-9223372036854775808") != NULL);
+
+        CHECK((val = json_parse(out)) != NULL);
+
+        if (val != NULL)
+            json_free(val);
+
+        memset(&again, 0, sizeof(again));
+
+        CHECK(!json_schema_decode(&record_schema, out, n, &again));
+        CHECK((again.name != NULL) && !strcmp(again.name, rec.name));
+        CHECK((again.l == rec.l) && (again.i == rec.i) && again.ok);
+        CHECK((again.tags.count == 3) && (again.points.count == 2)
+              && (again.longs.count == 3));
+
+        json_schema_free(&record_schema, &again);
+        free(out);
+    }
+
+    /* Members not in the input are left alone, null clears strings */
+    input = "{\"name\": null, \"i\": null}";
+
+    CHECK(!json_schema_decode(&record_schema, input, strlen(input), &rec));
+    CHECK((rec.name == NULL) && (rec.i == 8) && (rec.tags.count == 3));
+
+    json_schema_free(&record_schema, &rec);
+    CHECK((rec.tags.items == NULL) && (rec.tags.count == 0));
+
+    /* Whatever was decoded before an error is freed */
+    for (i = 0; i < sizeof(bad) / sizeof(*bad); ++i) {
+        memset(&rec, 0, sizeof(rec));
+
+        CHECK(json_schema_decode(&record_schema, bad[i], strlen(bad[i]), &rec));
+        CHECK((rec.name == NULL) && (rec.tags.items == NULL)
+              && (rec.tags.count == 0) && (rec.points.items == NULL));
+    }
+
+    /* Integers are taken as written, whole and in range or not at all */
+    CHECK(test_long("9007199254740993", 9007199254740993L));
+    CHECK(test_long("-9007199254740993", -9007199254740993L));
+    CHECK(test_long("9223372036854775807", LONG_MAX));
+    CHECK(test_long("-9223372036854775808", LONG_MIN));
+    CHECK(test_long("-0", 0));
+    CHECK(test_long("1E+2", 100));
+    CHECK(!test_long("9223372036854775808", 0));
+    CHECK(!test_long("-9223372036854775809", 0));
+    CHECK(!test_long("100000000000000000000000", 0));
+    CHECK(!test_long("9.223372036854775807e18", 0));
+    CHECK(!test_long("0.5", 0));
+    CHECK(!test_long("\"1\"", 0));
+
+    /* Nested through itself */
+    memset(&node, 0, sizeof(node));
+
+    CHECK(!json_schema_decode(&node_schema, nested, strlen(nested), &node));
+    CHECK((node.v == 1) && (node.kids.count == 2));
+
+    if (node.kids.count == 2) {
+        kid = node.kids.items;
+
+        CHECK((kid[0].v == 2) && (kid[0].kids.count == 1)
+              && (((struct test_node *)kid[0].kids.items)->v == 3));
+        CHECK((kid[1].v == 4) && (kid[1].kids.count == 0));
+    }
+
+    CHECK((out = json_schema_encode(&node_schema, &node, NULL)) != NULL);
+    CHECK((out != NULL)
+          && !strcmp(out, "{\"v\":1,\"kids\":[{\"v\":2,\"kids\":[{\"v\":3,"
+                     "\"kids\":[]}]},{\"v\":4,\"kids\":[]}]}"));
+    free(out);
+
+    json_schema_free(&node_schema, &node);
+
+    /* But only as deep as the lexer allows, arrays and objects alike */
+    CHECK(test_node("{\"kids\": [{}]}", 3));
+    CHECK(!test_node("{\"kids\": [{\"kids\": []}]}", 3));
+    CHECK(test_node("{\"kids\": [{\"kids\": []}]}", 4));
+    CHECK(!test_node("{}", 0));
+
+    n = 200000;
+    deep = malloc(n * 9 + 1);
+
+    if (deep != NULL) {
+        for (i = 0; i < n; ++i)
+            memcpy(deep + i * 9, "{\"kids\":[", 9);
+
+        deep[n * 9] = '\0';
+
+        memset(&node, 0, sizeof(node));
+
+        CHECK(json_schema_decode(&node_schema, deep, n * 9, &node));
+        CHECK((node.kids.items == NULL) && (node.kids.count == 0));
+
+        free(deep);
+    }
+
+    return TEST_RESULT();
+}
+
+static bool test_long(const char *text, long expected)
+{
+    struct test_node node = { 0 };
+    char input[64];
+    int n = snprintf(input, sizeof(input), "{\"v\": %s}", text);
+    bool ok = !json_schema_decode(&node_schema, input, n, &node);
+
+    json_schema_free(&node_schema, &node);
+    return ok && (node.v == expected);
+}
+
+static bool test_node(const char *input, size_t max_depth)
+{
+    struct json_lexer_state lex;
+    struct test_node node = { 0 };
+    bool ok;
+
+    json_lexer_init(&lex, input, strlen(input));
+    lex.max_depth = max_depth;
+
+    ok = !json_schema_decode_lexer(&node_schema, &lex, &node);
+    json_schema_free(&node_schema, &node);
+
+    return ok;
+}
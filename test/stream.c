@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <libutil/json.h>
+#include <libutil/json/stream.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+
+/* A FIFO and what to write to it */
+struct test_fifo
+{
+    char path[64];
+    const char *input;
+};
+
+/* Feeds input split at every possible point, plus a byte at a time */
+static void test_splits(const char *input,
+                        enum json_parser_status status,
+                        size_t offset);
+
+static struct json_value *test_feed(const char *input,
+                                    size_t split,
+                                    enum json_parser_status *status,
+                                    size_t *offset);
+
+/*
+ * Whether json_parse_file() takes input from a regular file (mapped) and from
+ * a FIFO (fed to the push parser) alike, and whether it took it
+ */
+static bool test_file(const char *input, bool *parsed);
+
+static void *test_fifo_thread(void *fifo);
+
+
+int main(void)
+{
+    struct json_parser *p;
+    struct json_value *val;
+    enum json_parser_status status;
+    size_t offset;
+    size_t depth;
+    char *deep;
+    bool parsed;
+
+    /* Escapes, surrogate pairs and numbers cut anywhere must still come out */
+    test_splits("{\"a\\\"b\": [1, -2.5e3, true, false, null, "
+                "\"\\u00e9\\ud83d\\ude00\\n\"], \"c\": {\"d\": []}}",
+                JSON_PARSER_DONE, 80);
+
+    test_splits("\"\"", JSON_PARSER_DONE, 2);
+    test_splits("  [] \n\t", JSON_PARSER_DONE, 7);
+
+    /* Anything but whitespace after the value, whichever chunk it's in */
+    test_splits("{\"a\":1} xyz", JSON_PARSER_ERROR, 8);
+    test_splits("[1]]", JSON_PARSER_ERROR, 3);
+    test_splits("12x", JSON_PARSER_ERROR, 2);
+
+    test_splits("[1,}", JSON_PARSER_ERROR, 3);
+    test_splits("{\"a\" 1}", JSON_PARSER_ERROR, 5);
+    test_splits("\"\\ud800\"", JSON_PARSER_ERROR, 0);
+    test_splits("[1, -]", JSON_PARSER_ERROR, 4);
+
+    /* Trailing commas, like json_parse() takes them, but nothing else */
+    test_splits("[1, [2,], {\"a\": {},},]", JSON_PARSER_DONE, 22);
+    test_splits("[,]", JSON_PARSER_ERROR, 1);
+    test_splits("[1,,]", JSON_PARSER_ERROR, 3);
+    test_splits("{,}", JSON_PARSER_ERROR, 1);
+    test_splits("{\"a\": 1,,}", JSON_PARSER_ERROR, 8);
+
+    /* Nested as deep as json_parse() allows, and no deeper */
+    deep = malloc(JSON_PARSE_MAX_DEPTH * 2 + 3);
+
+    for (depth = JSON_PARSE_MAX_DEPTH; deep != NULL; ++depth) {
+        memset(deep, '[', depth);
+        memset(deep + depth, ']', depth);
+        deep[depth * 2] = '\0';
+
+        val = test_feed(deep, depth, &status, &offset);
+
+        if (depth == JSON_PARSE_MAX_DEPTH) {
+            CHECK((val != NULL) && (status == JSON_PARSER_DONE));
+        } else {
+            CHECK((val == NULL) && (status == JSON_PARSER_ERROR)
+                  && (offset == JSON_PARSE_MAX_DEPTH));
+        }
+
+        if (val != NULL)
+            json_free(val);
+
+        if (depth > JSON_PARSE_MAX_DEPTH)
+            break;
+    }
+
+    free(deep);
+
+    /* Incomplete input is no value */
+    p = json_parser_new();
+
+    CHECK(json_parser_feed(p, "[1,", 3) == JSON_PARSER_CONTINUE);
+    CHECK(json_parser_finish(p) == NULL);
+
+    /* A number may only be complete once the input ends */
+    json_parser_reset(p);
+
+    CHECK(json_parser_feed(p, "42", 2) == JSON_PARSER_CONTINUE);
+    CHECK(((val = json_parser_finish(p)) != NULL)
+          && (json_get_number_value(val) == 42));
+
+    if (val != NULL)
+        json_free(val);
+
+    json_parser_free(p);
+
+    /* Files are the same whether they're mapped or not */
+    CHECK(test_file("{\"a\": [1, 2,]} \n", &parsed) && parsed);
+    CHECK(test_file("{\"a\": 1} garbage", &parsed) && !parsed);
+    CHECK(test_file("{\"a\": 1}}", &parsed) && !parsed);
+    CHECK(test_file("{\"a\": 1", &parsed) && !parsed);
+
+    return TEST_RESULT();
+}
+
+static void test_splits(const char *input,
+                        enum json_parser_status status,
+                        size_t offset)
+{
+    struct json_value *expected = NULL;
+    size_t n = strlen(input);
+    size_t split;
+
+    if (status == JSON_PARSER_DONE)
+        CHECK((expected = json_parse(input)) != NULL);
+
+    /* Split n stands for a byte at a time */
+    for (split = 0; split <= n; ++split) {
+        enum json_parser_status got;
+        size_t at;
+        struct json_value *val = test_feed(input, split, &got, &at);
+
+        CHECK(got == status);
+        CHECK(at == offset);
+        CHECK(test_equal(val, expected));
+
+        if (val != NULL)
+            json_free(val);
+    }
+
+    if (expected != NULL)
+        json_free(expected);
+}
+
+static struct json_value *test_feed(const char *input,
+                                    size_t split,
+                                    enum json_parser_status *status,
+                                    size_t *offset)
+{
+    struct json_parser *p = json_parser_new();
+    struct json_value *val;
+    size_t n = strlen(input);
+    size_t i;
+
+    if (split < n) {
+        json_parser_feed(p, input, split);
+        json_parser_feed(p, input + split, n - split);
+    } else {
+        for (i = 0; i < n; ++i)
+            json_parser_feed(p, input + i, 1);
+    }
+
+    *status = p->status;
+    *offset = p->offset;
+
+    val = json_parser_finish(p);
+    json_parser_free(p);
+
+    return val;
+}
+
+static bool test_file(const char *input, bool *parsed)
+{
+    char dir[] = "/tmp/json-stream-XXXXXX";
+    struct test_fifo fifo;
+    struct json_value *mapped = NULL;
+    struct json_value *piped = NULL;
+    pthread_t thread;
+    bool same = false;
+    int fd;
+
+    if (mkdtemp(dir) == NULL)
+        return false;
+
+    fifo.input = input;
+    snprintf(fifo.path, sizeof(fifo.path), "%s/file", dir);
+
+    if ((fd = open(fifo.path, O_WRONLY | O_CREAT, 0600)) >= 0) {
+        same = (write(fd, input, strlen(input)) == (ssize_t)strlen(input));
+        close(fd);
+
+        mapped = json_parse_file(fifo.path);
+        unlink(fifo.path);
+    }
+
+    snprintf(fifo.path, sizeof(fifo.path), "%s/fifo", dir);
+
+    if (same && !mkfifo(fifo.path, 0600)) {
+        /* Opening either end waits for the other one */
+        if (!pthread_create(&thread, NULL, test_fifo_thread, &fifo)) {
+            piped = json_parse_file(fifo.path);
+            pthread_join(thread, NULL);
+        } else {
+            same = false;
+        }
+
+        unlink(fifo.path);
+    } else {
+        same = false;
+    }
+
+    rmdir(dir);
+
+    *parsed = (mapped != NULL);
+    same = same && test_equal(mapped, piped);
+
+    if (mapped != NULL)
+        json_free(mapped);
+
+    if (piped != NULL)
+        json_free(piped);
+
+    return same;
+}
+
+static void *test_fifo_thread(void *fifo)
+{
+    const struct test_fifo *f = fifo;
+    int fd = open(f->path, O_WRONLY);
+
+    /* Less than PIPE_BUF, so written in one go before the reader is done */
+    if (fd >= 0) {
+        if (write(fd, f->input, strlen(f->input)) < 0)
+            perror("write");
+
+        close(fd);
+    }
+
+    return NULL;
+}
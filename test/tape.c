@@ -0,0 +1,219 @@
+#include <libutil/json.h>
+#include <libutil/json/tape.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"records\": [{\"id\": 1, \"name\": \"one\"},"
+    " {\"id\": 2, \"name\": \"\"}, {\"id\": -0.5, \"name\": \"\\u00e9\\n\"}],"
+    " \"b\": true, \"f\": false, \"z\": null, \"empty\": [], \"none\": {},"
+    " \"ab\": 1, \"a\": 2, \"\": 3}";
+
+/*
+ * Set up a tape of header, the given records (starting at offset 16) and a
+ * trailer with the root at offset root, in words (which must hold n + 4)
+ */
+static int test_craft(struct json_tape *tape,
+                      uint64_t *words,
+                      size_t n,
+                      uint64_t root);
+
+
+int main(void)
+{
+    struct json_value *val = json_parse(doc);
+    struct json_value *copy = NULL;
+    struct json_tape tape;
+    struct json_tape_node root;
+    struct json_tape_node node;
+    struct json_tape_node key;
+    const char *str;
+    const char *prev = NULL;
+    size_t prevn = 0;
+    char *buf = NULL;
+    size_t size;
+    size_t n;
+    size_t i;
+
+    CHECK(val != NULL);
+
+    if (val == NULL)
+        return TEST_RESULT();
+
+    CHECK((buf = json_tape_encode(val, &size)) != NULL);
+    CHECK((buf != NULL) && !json_tape_init(&tape, buf, size));
+
+    if (buf == NULL)
+        goto exit;
+
+    /* What goes in comes out */
+    root = json_tape_root(&tape);
+
+    CHECK(json_tape_type(&root) == JSON_OBJECT);
+    CHECK(((copy = json_tape_value(&root)) != NULL) && test_equal(copy, val));
+
+    CHECK(!json_tape_lookup(&root, "records", &node)
+          && (json_tape_length(&node) == 3)
+          && !json_tape_index(&node, 2, &node)
+          && !json_tape_lookup(&node, "name", &node)
+          && ((str = json_tape_get_string(&node, &n)) != NULL)
+          && (n == 3) && !strcmp(str, "\xc3\xa9\n"));
+
+    /* Keys that repeat are stored once */
+    if (!json_tape_lookup(&root, "records", &node)) {
+        struct json_tape_node rec;
+        struct json_tape_node other;
+
+        CHECK(!json_tape_index(&node, 0, &rec)
+              && !json_tape_member(&rec, 0, &key, NULL)
+              && !json_tape_index(&node, 1, &rec)
+              && !json_tape_member(&rec, 0, &other, NULL)
+              && (key.pos == other.pos));
+    }
+
+    CHECK(!json_tape_lookup(&root, "b", &node)
+          && json_tape_get_bool(&node) && *json_tape_get_bool(&node));
+    CHECK(json_tape_get_number(&node) == NULL);
+    CHECK(json_tape_get_string(&node, NULL) == NULL);
+
+    CHECK(!json_tape_lookup(&root, "z", &node) && json_tape_is_null(&node));
+    CHECK(!json_tape_lookup(&root, "", &node)
+          && json_tape_get_number(&node)
+          && (*json_tape_get_number(&node) == 3));
+
+    CHECK(!json_tape_lookup(&root, "empty", &node)
+          && (json_tape_length(&node) == 0)
+          && json_tape_index(&node, 0, &node));
+
+    CHECK(json_tape_lookup(&root, "missing", &node));
+    CHECK(json_tape_lookup(&root, "record", &node));
+    CHECK(json_tape_index(&root, 0, &node));
+
+    /* Members come in order of their keys, all of every key */
+    CHECK(json_tape_length(&root) == 9);
+
+    for (i = 0; !json_tape_member(&root, i, &key, NULL); ++i) {
+        CHECK((str = json_tape_get_string(&key, &n)) != NULL);
+
+        if (str == NULL)
+            break;
+
+        if (prev != NULL)
+            CHECK((memcmp(prev, str, (prevn < n) ? prevn : n) < 0)
+                  || ((memcmp(prev, str, (prevn < n) ? prevn : n) == 0)
+                      && (prevn < n)));
+
+        prev = str;
+        prevn = n;
+    }
+
+    CHECK(i == 9);
+    CHECK(!json_tape_member(&root, 2, &key, &node)
+          && json_tape_get_string(&key, &n) && (n == 2)
+          && json_tape_get_number(&node)
+          && (*json_tape_get_number(&node) == 1));
+
+    /* Anything that's not a whole tape is rejected */
+    CHECK(json_tape_init(&tape, buf, 0));
+    CHECK(json_tape_init(&tape, buf, size - 8));
+    CHECK(json_tape_init(&tape, buf + 8, size - 8));
+    CHECK(json_tape_init(&tape, buf + 1, size - 1));
+
+    buf[0] ^= 1;
+    CHECK(json_tape_init(&tape, buf, size));
+
+    /* Children have to come before their parents, so there are no cycles */
+    {
+        uint64_t words[9];
+        struct json_tape_node val;
+        struct json_value *obj;
+
+        /* [<itself>] */
+        words[2] = JSON_ARRAY | (1 << 8);
+        words[3] = 16;
+
+        CHECK(!test_craft(&tape, words, 2, 16));
+        root = json_tape_root(&tape);
+
+        CHECK((json_tape_type(&root) == JSON_ARRAY)
+              && (json_tape_length(&root) == 1));
+        CHECK(json_tape_index(&root, 0, &node));
+        CHECK(json_tape_value(&root) == NULL);
+
+        /* [<the trailer>] */
+        words[3] = 32;
+
+        CHECK(!test_craft(&tape, words, 2, 16));
+        root = json_tape_root(&tape);
+
+        CHECK(json_tape_index(&root, 0, &node));
+        CHECK(json_tape_value(&root) == NULL);
+
+        /* {"": <itself>} and {<itself>: null} */
+        words[2] = JSON_STRING;
+        words[3] = 0;
+        words[4] = JSON_OBJECT | (1 << 8);
+        words[5] = 16;
+        words[6] = 32;
+
+        CHECK(!test_craft(&tape, words, 5, 32));
+        root = json_tape_root(&tape);
+
+        CHECK(!json_tape_member(&root, 0, &key, NULL));
+        CHECK(json_tape_member(&root, 0, &key, &val));
+        CHECK(json_tape_lookup(&root, "", &val));
+        CHECK(json_tape_value(&root) == NULL);
+
+        words[5] = 32;
+        words[6] = 16;
+
+        CHECK(!test_craft(&tape, words, 5, 32));
+        root = json_tape_root(&tape);
+
+        CHECK(json_tape_member(&root, 0, &key, NULL));
+        CHECK(json_tape_lookup(&root, "", &val));
+        CHECK(json_tape_value(&root) == NULL);
+
+        /* Whereas the right way around is fine: {"": ""} */
+        words[5] = 16;
+
+        CHECK(!test_craft(&tape, words, 5, 32));
+        root = json_tape_root(&tape);
+
+        CHECK(!json_tape_lookup(&root, "", &val)
+              && json_tape_get_string(&val, &n) && (n == 0));
+        CHECK((obj = json_tape_value(&root)) != NULL);
+
+        if (obj != NULL) {
+            CHECK(json_object_size(obj) == 1);
+            json_free(obj);
+        }
+    }
+
+exit:
+    if (copy != NULL)
+        json_free(copy);
+
+    free(buf);
+    json_free(val);
+
+    return TEST_RESULT();
+}
+
+static int test_craft(struct json_tape *tape,
+                      uint64_t *words,
+                      size_t n,
+                      uint64_t root)
+{
+    uint32_t version = JSON_TAPE_VERSION;
+    uint32_t byteorder = 0x01020304;
+
+    memcpy(&words[0], "JSONTAPE", 8);
+    memcpy((char *)&words[1], &version, 4);
+    memcpy((char *)&words[1] + 4, &byteorder, 4);
+
+    words[n + 2] = root;
+    memcpy(&words[n + 3], "JSONTAPE", 8);
+
+    return json_tape_init(tape, (const char *)words, (n + 4) * 8);
+}
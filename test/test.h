@@ -0,0 +1,127 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <libutil/json.h>
+#include <libutil/json/writer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * What the test programs share. CHECK() reports a failed condition along
+ * with where it is and counts it, TEST_RESULT() is what main() returns: 0
+ * if everything passed, 1 otherwise.
+ */
+
+static unsigned test_failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            test_failures++;                                                \
+        }                                                                   \
+    } while (0)
+
+#define TEST_RESULT() (test_failures != 0)
+
+/* Whether a and b are the same JSON, whatever they look like inside */
+static inline bool test_equal(const struct json_value *a,
+                              const struct json_value *b)
+{
+    if ((a == NULL) || (b == NULL))
+        return a == b;
+
+    if (a->flags & JSON_VALUE_SHARED)
+        a = a->value.jshared;
+
+    if (b->flags & JSON_VALUE_SHARED)
+        b = b->value.jshared;
+
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type) {
+    case JSON_STRING: {
+        size_t na;
+        size_t nb;
+        const char *sa = json_get_string_n(a, &na);
+        const char *sb = json_get_string_n(b, &nb);
+
+        return (na == nb) && !memcmp(sa, sb, na);
+    }
+    case JSON_NUMBER:
+        return json_get_number_value(a) == json_get_number_value(b);
+
+    case JSON_BOOLEAN:
+        return a->value.jbool == b->value.jbool;
+
+    case JSON_NULL:
+        return true;
+
+    case JSON_ARRAY: {
+        struct json_array_iterator ia;
+        struct json_array_iterator ib;
+        struct json_value *va;
+        struct json_value *vb;
+
+        if (json_array_size(a) != json_array_size(b))
+            return false;
+
+        json_array_iterator_init(&ia, a);
+        json_array_iterator_init(&ib, b);
+
+        while (json_array_iterator_next(&ia, &va)
+                && json_array_iterator_next(&ib, &vb))
+            if (!test_equal(va, vb))
+                return false;
+
+        return true;
+    }
+    case JSON_OBJECT: {
+        struct json_object_iterator iter;
+        struct json_value *val;
+        const char *key;
+        size_t n;
+
+        if (json_object_size(a) != json_object_size(b))
+            return false;
+
+        json_object_iterator_init(&iter, a);
+
+        while (json_object_iterator_next(&iter, &key, &n, &val)) {
+            char *copy = strndup(key, n);
+            bool same = test_equal(val, json_object_lookup_const(b, copy));
+
+            free(copy);
+
+            if (!same) {
+                json_object_iterator_free(&iter);
+                return false;
+            }
+        }
+
+        return true;
+    }
+    }
+
+    return false;
+}
+
+/* val written out compactly into a new string */
+static inline char *test_dump(const struct json_value *val)
+{
+    struct json_writer w;
+    char *out;
+
+    json_writer_init_buffer(&w);
+    json_writer_value(&w, val);
+
+    out = json_writer_detach(&w, NULL);
+    json_writer_free(&w);
+
+    return out;
+}
+
+#endif /* defined TEST_H */
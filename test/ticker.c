@@ -1,5 +1,5 @@
-#include <libutil/dstring.h>
 #include <libutil/json.h>
+#include <libutil/json/stream.h>
 #include <libutil/container/hashtable.h>
 #include <libutil/container/list.h>
 
@@ -13,25 +13,25 @@ int main(int argc, char **argv) {
     FILE *f = NULL;
 
     if ((f = fopen("ticker.json", "r")) != NULL) {
-        char buffer[BUFSIZ] = {0};
-        char *file = NULL;
-
-        while (fread(buffer, 1, sizeof(buffer) - 1, f) > 0) {
-            file = dstrcati(file, buffer);
-
-            memset(buffer, 0, sizeof(buffer));
-        }
+        char buffer[BUFSIZ];
+        size_t n;
 
+        struct json_parser *p = json_parser_new();
         struct json_value *v = NULL;
 
-        if ((v = json_parse(file)) != NULL) {
+        /* No need to have the whole file in memory, feed it as it comes */
+        while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+            if (json_parser_feed(p, buffer, n) == JSON_PARSER_ERROR)
+                break;
+
+        if ((v = json_parser_finish(p)) != NULL) {
             print_bitcoin_ticker(v);
             json_free(v);
         } else {
             printf("Bad JSON!\n");
         }
 
-        free(file);
+        json_parser_free(p);
         fclose(f);
     } else {
         perror("fopen()");
@@ -0,0 +1,119 @@
+#include <libutil/json.h>
+
+#include "test.h"
+
+/* Input and where it goes wrong, if it does */
+struct test_case
+{
+    const char *input;
+    bool valid;
+    size_t pos;
+};
+
+static const struct test_case cases[] = {
+    { "0", true, 0 },
+    { "-0", true, 0 },
+    { "1.5e-3", true, 0 },
+    { " [ 1 , { \"a\" : null } ] ", true, 0 },
+    { "{\"a\":[{}]}", true, 0 },
+    { "\"\\u00e9\\ud83d\\ude00\\n\\/\"", true, 0 },
+    { "\"\xc3\xa9\xf0\x9f\x98\x80\"", true, 0 },
+
+    /* Numbers exactly as RFC 8259 has them */
+    { "01", false, 0 },
+    { "+1", false, 0 },
+    { ".5", false, 0 },
+    { "1.", false, 0 },
+    { "1.e1", false, 0 },
+    { "1e", false, 0 },
+    { "1e+", false, 0 },
+    { "-", false, 0 },
+    { "[1, 01]", false, 4 },
+
+    /* Strings: escapes, control characters, UTF-8 */
+    { "\"\\u12\"", false, 1 },
+    { "\"\\x\"", false, 1 },
+    { "\"\\ud800\"", false, 1 },
+    { "\"\\udc00\\ud800\"", false, 1 },
+    { "\"a\tb\"", false, 2 },
+    { "\"\xc3\"", false, 1 },
+    { "\"\xc0\xaf\"", false, 1 },
+    { "\"\xed\xa0\x80\"", false, 1 },
+    { "\"\xf4\x90\x80\x80\"", false, 1 },
+    { "\"abc", false, 4 },
+
+    /* Structure */
+    { "", false, 0 },
+    { "  ", false, 2 },
+    { "[", false, 1 },
+    { "[1,]", false, 3 },
+    { "[1 2]", false, 3 },
+    { "{\"a\":1,}", false, 7 },
+    { "{\"a\" 1}", false, 5 },
+    { "{1:2}", false, 1 },
+    { "[}", false, 1 },
+    { "tru", false, 0 },
+    { "nul", false, 0 },
+
+    /* Nothing but whitespace after the value */
+    { "[]]", false, 2 },
+    { "true x", false, 5 },
+    { "1 2", false, 2 },
+};
+
+
+int main(void)
+{
+    struct json_error err;
+    char *deep;
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+        const struct test_case *c = &cases[i];
+        int result;
+
+        err.pos = 0;
+        err.message = NULL;
+
+        result = json_validate(c->input, strlen(c->input), &err);
+
+        if (c->valid) {
+            CHECK(result == 0);
+        } else {
+            CHECK(result == 1);
+            CHECK(err.pos == c->pos);
+            CHECK(err.message != NULL);
+        }
+
+        /* Whatever the parser makes of it, it takes anything valid */
+        if (c->valid) {
+            struct json_value *val = json_parse(c->input);
+
+            CHECK(val != NULL);
+
+            if (val != NULL)
+                json_free(val);
+        }
+    }
+
+    /* Nothing past n is looked at, err is optional */
+    CHECK(!json_validate("[1]]", 3, NULL));
+    CHECK(json_validate("[1]", 2, NULL));
+    CHECK(!json_validate("\"a\"\0", 3, &err));
+
+    /* As deep as the parser goes, and no deeper */
+    deep = malloc(2 * JSON_PARSE_MAX_DEPTH + 2);
+
+    if (deep != NULL) {
+        memset(deep, '[', JSON_PARSE_MAX_DEPTH + 1);
+        memset(deep + JSON_PARSE_MAX_DEPTH + 1, ']', JSON_PARSE_MAX_DEPTH + 1);
+
+        CHECK(!json_validate(deep + 1, 2 * JSON_PARSE_MAX_DEPTH, NULL));
+        CHECK(json_validate(deep, 2 * JSON_PARSE_MAX_DEPTH + 2, &err)
+              && (err.pos == JSON_PARSE_MAX_DEPTH));
+
+        free(deep);
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,74 @@
+#include <libutil/json.h>
+
+#include "test.h"
+
+static const char doc[] =
+    "{\"a\\\"b\": 1, \"c\\\\d\": 2, \"\\u00e9\": 3, \"\\u0065\": 4,"
+    " \"plain\": 5, \"a\": {\"\\\"\": 6}}";
+
+/* Whether key in obj is the number n */
+static bool test_member(const struct json_value *obj,
+                        const char *key,
+                        double n);
+
+
+int main(void)
+{
+    struct json_value *val;
+    struct json_value *plain;
+    char *buf;
+
+    /* Views point into the input, which needn't even be terminated */
+    buf = malloc(sizeof(doc) - 1);
+
+    if (buf == NULL)
+        return 1;
+
+    memcpy(buf, doc, sizeof(doc) - 1);
+
+    val = json_parse_ex(buf, sizeof(doc) - 1, JSON_PARSE_VIEW);
+    plain = json_parse(doc);
+
+    CHECK((val != NULL) && (val->flags & JSON_VALUE_VIEW));
+    CHECK(test_equal(val, plain));
+
+    if (val != NULL) {
+        /* Keys are looked up as they are decoded, escapes and all */
+        CHECK(test_member(val, "a\"b", 1));
+        CHECK(test_member(val, "c\\d", 2));
+        CHECK(test_member(val, "\xc3\xa9", 3));
+        CHECK(test_member(val, "e", 4));
+        CHECK(test_member(val, "plain", 5));
+        CHECK(test_member(json_object_lookup_const(val, "a"), "\"", 6));
+
+        CHECK(json_object_lookup_const(val, "a\\\"b") == NULL);
+        CHECK(json_object_lookup_const(val, "a\"") == NULL);
+        CHECK(json_object_lookup_const(val, "a\"bc") == NULL);
+        CHECK(json_object_lookup_const(val, "\\u0065") == NULL);
+        CHECK(json_object_lookup_const(val, "") == NULL);
+
+        /* Converting the keys changes nothing about them */
+        CHECK(json_get_object(val) != NULL);
+        CHECK(!(val->flags & JSON_VALUE_VIEW));
+        CHECK(test_member(val, "a\"b", 1));
+        CHECK(test_equal(val, plain));
+
+        json_free(val);
+    }
+
+    if (plain != NULL)
+        json_free(plain);
+
+    free(buf);
+    return TEST_RESULT();
+}
+
+static bool test_member(const struct json_value *obj,
+                        const char *key,
+                        double n)
+{
+    const struct json_value *val = json_object_lookup_const(obj, key);
+
+    return (val != NULL) && (val->type == JSON_NUMBER)
+        && (json_get_number_value(val) == n);
+}